@@ -15,16 +15,40 @@
 using namespace std;
 
 extern HANDLE DeviceHandle;
+extern FILE *g_SyscallTraceFile;
+extern SRWLOCK g_SyscallTraceFileLock;
+extern HANDLE g_SyscallTraceThread;
+extern FILE *g_MsrSamplerFile;
+extern SRWLOCK g_MsrSamplerFileLock;
+extern UINT64 g_MsrSamplerSessionId;
+extern FILE *g_PmlDirtyPagesFile;
+extern SRWLOCK g_PmlDirtyPagesFileLock;
 
 int ReadCpuDetails();
 std::string ReadVendorString();
 void ShowMessages(const char* Fmt, ...);
 int CommandLm(vector<string> SplittedCommand);
+void CommandMsrSamplerWriteRecords(PMSR_SAMPLE_RECORDS_HEADER Header);
+void CommandEptAccessDirtyWritePmlRecord(PPML_DIRTY_PAGES_RECORD Record);
 
 void HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_MEMORY_STYLE Style, UINT64 Address,
     DEBUGGER_READ_MEMORY_TYPE MemoryType,
     DEBUGGER_READ_READING_TYPE ReadingType, UINT32 Pid,
     UINT Size);
+BOOLEAN HyperDbgReadMemoryScatter(UINT32 Pid, DEBUGGER_READ_MEMORY_TYPE MemoryType,
+    PDEBUGGER_READ_MEMORY_RANGE Ranges, UINT32 NumberOfRanges,
+    unsigned char* Buffer);
+BOOLEAN HyperDbgReadMemoryCached(UINT32 Pid, DEBUGGER_READ_MEMORY_TYPE MemoryType,
+    PDEBUGGER_READ_MEMORY_RANGE Ranges, UINT32 NumberOfRanges,
+    unsigned char* Buffer);
+void HyperDbgInvalidateMemoryCache();
+void CommandCache(vector<string> SplittedCommand);
+BOOLEAN ConvertStringToUInt64(string TextToConvert, PUINT64 Result);
+BOOLEAN HyperDbgReadOrWriteMsrBatch(DEBUGGER_MSR_ACTION_TYPE ActionType,
+    vector<UINT32> Msrs, PUINT64 CoreMask, UINT64 Value,
+    vector<UINT64>& Results);
+BOOLEAN HyperDbgParseValueList(string Text, vector<UINT64>& Values,
+    UINT64 MaximumNumberOfValues);
 string SeparateTo64BitValue(UINT64 Value);
 
 int HyperDbgDisassembler(unsigned char* BufferToDisassemble, UINT64 BaseAddress, UINT64 Size);
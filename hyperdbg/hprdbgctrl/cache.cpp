@@ -0,0 +1,387 @@
+/**
+ * @file cache.cpp
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Page cache of the memory that is read from the driver
+ * @details The pages are kept in an LRU list keyed by (pid, page, memory
+ * type), the guest is not halted so a page is read again after it expires
+ * @version 0.1
+ * @date 2020-05-10
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include "pch.h"
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#define MEMORY_CACHE_PAGE_SIZE 0x1000
+#define MEMORY_CACHE_DEFAULT_CAPACITY 0x100 // Pages
+#define MEMORY_CACHE_DEFAULT_TTL 500        // Milliseconds
+#define MEMORY_CACHE_READ_AHEAD_PAGES 1     // Pages after each missed page
+
+struct MEMORY_CACHE_KEY {
+  UINT32 Pid;
+  DEBUGGER_READ_MEMORY_TYPE MemoryType;
+  UINT64 Page;
+
+  bool operator==(const MEMORY_CACHE_KEY &Other) const {
+    return Pid == Other.Pid && MemoryType == Other.MemoryType &&
+           Page == Other.Page;
+  }
+};
+
+struct MEMORY_CACHE_KEY_HASH {
+  size_t operator()(const MEMORY_CACHE_KEY &Key) const {
+    return std::hash<UINT64>()(Key.Page ^ ((UINT64)Key.Pid << 52) ^
+                               Key.MemoryType);
+  }
+};
+
+typedef struct _MEMORY_CACHE_PAGE {
+  MEMORY_CACHE_KEY Key;
+  ULONGLONG ReadTime; // Tick count when the page is read
+  UINT32 ValidBytes;  // The page is read until the first byte that is not
+                      // present
+  unsigned char Data[MEMORY_CACHE_PAGE_SIZE];
+
+} MEMORY_CACHE_PAGE, *PMEMORY_CACHE_PAGE;
+
+typedef list<shared_ptr<MEMORY_CACHE_PAGE>> MEMORY_CACHE_LRU;
+
+//
+// The front of the list is the most recently used page
+//
+MEMORY_CACHE_LRU g_MemoryCacheLru;
+unordered_map<MEMORY_CACHE_KEY, MEMORY_CACHE_LRU::iterator,
+              MEMORY_CACHE_KEY_HASH>
+    g_MemoryCacheIndex;
+
+BOOLEAN g_MemoryCacheEnabled = TRUE;
+UINT64 g_MemoryCacheCapacity = MEMORY_CACHE_DEFAULT_CAPACITY;
+UINT64 g_MemoryCacheTtl = MEMORY_CACHE_DEFAULT_TTL;
+
+UINT64 g_MemoryCacheHits;
+UINT64 g_MemoryCacheMisses;
+UINT64 g_MemoryCacheReadAheadPages;
+UINT64 g_MemoryCacheEvictions;
+UINT64 g_MemoryCacheRequests;
+
+shared_ptr<MEMORY_CACHE_PAGE> MemoryCacheLookup(MEMORY_CACHE_KEY Key) {
+
+  auto Item = g_MemoryCacheIndex.find(Key);
+
+  if (Item == g_MemoryCacheIndex.end()) {
+    return nullptr;
+  }
+
+  //
+  // The guest is running, so an old page might be changed
+  //
+  if (GetTickCount64() - (*Item->second)->ReadTime > g_MemoryCacheTtl) {
+    g_MemoryCacheLru.erase(Item->second);
+    g_MemoryCacheIndex.erase(Item);
+    return nullptr;
+  }
+
+  g_MemoryCacheLru.splice(g_MemoryCacheLru.begin(), g_MemoryCacheLru,
+                          Item->second);
+
+  return *Item->second;
+}
+
+void MemoryCacheInsert(shared_ptr<MEMORY_CACHE_PAGE> Page) {
+
+  auto Item = g_MemoryCacheIndex.find(Page->Key);
+
+  if (Item != g_MemoryCacheIndex.end()) {
+    g_MemoryCacheLru.erase(Item->second);
+    g_MemoryCacheIndex.erase(Item);
+  }
+
+  g_MemoryCacheLru.push_front(Page);
+  g_MemoryCacheIndex[Page->Key] = g_MemoryCacheLru.begin();
+
+  while (g_MemoryCacheLru.size() > g_MemoryCacheCapacity) {
+    g_MemoryCacheIndex.erase(g_MemoryCacheLru.back()->Key);
+    g_MemoryCacheLru.pop_back();
+    g_MemoryCacheEvictions++;
+  }
+}
+
+/**
+ * @brief Remove all of the cached pages
+ * @details Called after the commands that change the state of the guest
+ * (wrmsr and !hiddenhook), other changes of the guest are seen after the
+ * pages expire
+ *
+ */
+void HyperDbgInvalidateMemoryCache() {
+  g_MemoryCacheLru.clear();
+  g_MemoryCacheIndex.clear();
+}
+
+/**
+ * @brief Read a list of ranges through the page cache
+ * @details The missed pages and the pages after them (read-ahead) are read
+ * from the driver in a single scatter-gather request
+ *
+ * @param Pid Read from the memory of what process
+ * @param MemoryType Virtual or physical ranges
+ * @param Ranges The ranges, the result of each of them is filled
+ * @param NumberOfRanges Number of the ranges
+ * @param Buffer The data of the ranges one after another
+ * @return BOOLEAN Returns false if the request is failed
+ */
+BOOLEAN HyperDbgReadMemoryCached(UINT32 Pid,
+                                 DEBUGGER_READ_MEMORY_TYPE MemoryType,
+                                 PDEBUGGER_READ_MEMORY_RANGE Ranges,
+                                 UINT32 NumberOfRanges, unsigned char *Buffer) {
+
+  MEMORY_CACHE_KEY Key = {Pid, MemoryType, 0};
+  unordered_map<UINT64, shared_ptr<MEMORY_CACHE_PAGE>> Pages;
+  unordered_set<UINT64> MissedPages;
+  vector<UINT64> PagesToRead;
+  vector<DEBUGGER_READ_MEMORY_RANGE> PageRanges;
+  vector<unsigned char> PageData;
+  UINT64 Address;
+  UINT64 LastAddress;
+  UINT64 Copied;
+  UINT64 Offset;
+  UINT64 SizeOfChunk;
+  UINT64 AvailableBytes;
+  unsigned char *Destination = Buffer;
+
+  if (!g_MemoryCacheEnabled) {
+    return HyperDbgReadMemoryScatter(Pid, MemoryType, Ranges, NumberOfRanges,
+                                     Buffer);
+  }
+
+  //
+  // Find the pages that are not cached
+  //
+  for (UINT32 i = 0; i < NumberOfRanges; i++) {
+
+    if (Ranges[i].Size == 0) {
+      continue;
+    }
+
+    //
+    // A range that passes the end of the address space is read until the end
+    //
+    LastAddress = Ranges[i].Size - 1 > ~0ull - Ranges[i].Address
+                      ? ~0ull
+                      : Ranges[i].Address + Ranges[i].Size - 1;
+
+    for (UINT64 Page =
+             Ranges[i].Address & ~((UINT64)MEMORY_CACHE_PAGE_SIZE - 1);
+         Page <= LastAddress; Page += MEMORY_CACHE_PAGE_SIZE) {
+
+      if (Pages.count(Page) || MissedPages.count(Page)) {
+        continue;
+      }
+
+      Key.Page = Page;
+      auto CachedPage = MemoryCacheLookup(Key);
+
+      if (CachedPage != nullptr) {
+        Pages[Page] = CachedPage;
+        g_MemoryCacheHits++;
+      } else {
+        MissedPages.insert(Page);
+        PagesToRead.push_back(Page);
+        g_MemoryCacheMisses++;
+      }
+
+      //
+      // The last page of the address space
+      //
+      if (Page + MEMORY_CACHE_PAGE_SIZE == 0) {
+        break;
+      }
+    }
+  }
+
+  //
+  // Read the pages after the missed pages too, the memory views are
+  // mostly scrolled forward
+  //
+  for (size_t i = 0, Count = PagesToRead.size(); i < Count; i++) {
+    for (UINT64 j = 1; j <= MEMORY_CACHE_READ_AHEAD_PAGES; j++) {
+
+      Key.Page = PagesToRead[i] + (j * MEMORY_CACHE_PAGE_SIZE);
+
+      if (Key.Page < PagesToRead[i]) {
+        break;
+      }
+
+      if (MissedPages.count(Key.Page) || Pages.count(Key.Page) ||
+          g_MemoryCacheIndex.count(Key)) {
+        continue;
+      }
+
+      MissedPages.insert(Key.Page);
+      PagesToRead.push_back(Key.Page);
+      g_MemoryCacheReadAheadPages++;
+    }
+  }
+
+  //
+  // Read the missed pages, each request holds a limited number of ranges
+  //
+  for (size_t First = 0; First < PagesToRead.size();
+       First += DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES) {
+
+    size_t Count = min(PagesToRead.size() - First,
+                       (size_t)DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES);
+
+    PageRanges.assign(Count, DEBUGGER_READ_MEMORY_RANGE{0});
+    PageData.resize(Count * MEMORY_CACHE_PAGE_SIZE);
+
+    for (size_t i = 0; i < Count; i++) {
+      PageRanges[i].Address = PagesToRead[First + i];
+      PageRanges[i].Size = MEMORY_CACHE_PAGE_SIZE;
+    }
+
+    g_MemoryCacheRequests++;
+
+    if (!HyperDbgReadMemoryScatter(Pid, MemoryType, PageRanges.data(),
+                                   (UINT32)Count, PageData.data())) {
+      return FALSE;
+    }
+
+    for (size_t i = 0; i < Count; i++) {
+
+      auto Page = make_shared<MEMORY_CACHE_PAGE>();
+
+      Page->Key = {Pid, MemoryType, PageRanges[i].Address};
+      Page->ReadTime = GetTickCount64();
+      Page->ValidBytes = PageRanges[i].ReadBytes;
+      memcpy(Page->Data, &PageData[i * MEMORY_CACHE_PAGE_SIZE],
+             MEMORY_CACHE_PAGE_SIZE);
+
+      MemoryCacheInsert(Page);
+      Pages[PageRanges[i].Address] = Page;
+    }
+  }
+
+  //
+  // Copy the ranges from the pages, each range is valid until the first
+  // byte that is not present
+  //
+  for (UINT32 i = 0; i < NumberOfRanges; i++) {
+
+    ZeroMemory(Destination, Ranges[i].Size);
+    Ranges[i].ReadBytes = 0;
+
+    for (Copied = 0; Copied < Ranges[i].Size; Copied += SizeOfChunk) {
+
+      Address = Ranges[i].Address + Copied;
+
+      //
+      // The range is wrapped at the end of the address space
+      //
+      if (Copied != 0 && Address == 0) {
+        break;
+      }
+
+      auto Page =
+          Pages[Address & ~((UINT64)MEMORY_CACHE_PAGE_SIZE - 1)];
+
+      Offset = Address & (MEMORY_CACHE_PAGE_SIZE - 1);
+      SizeOfChunk =
+          min(MEMORY_CACHE_PAGE_SIZE - Offset, Ranges[i].Size - Copied);
+      AvailableBytes =
+          Page->ValidBytes > Offset ? Page->ValidBytes - Offset : 0;
+
+      memcpy(Destination + Copied, &Page->Data[Offset],
+             min(SizeOfChunk, AvailableBytes));
+      Ranges[i].ReadBytes += (UINT32)min(SizeOfChunk, AvailableBytes);
+
+      if (AvailableBytes < SizeOfChunk) {
+        break;
+      }
+    }
+
+    Ranges[i].Status =
+        Ranges[i].ReadBytes == Ranges[i].Size ? 0 : 0x8000000D; // STATUS_PARTIAL_COPY
+    Destination += Ranges[i].Size;
+  }
+
+  return TRUE;
+}
+
+/* ==============================================================================================
+ */
+
+void CommandCacheHelp() {
+  ShowMessages(".cache : shows or configures the page cache of the memory "
+               "views and the disassembler.\n\n");
+  ShowMessages("syntax : \t.cache\n");
+  ShowMessages("syntax : \t.cache [on|off|flush]\n");
+  ShowMessages("syntax : \t.cache size [number of pages (hex value)]\n");
+  ShowMessages("syntax : \t.cache ttl [milliseconds (hex value)]\n");
+  ShowMessages("\t\te.g : .cache\n");
+  ShowMessages("\t\te.g : .cache size 400\n");
+  ShowMessages("\t\te.g : .cache ttl 1f4\n");
+  ShowMessages("Note : The guest is not halted, the changes of its memory are "
+               "seen after the pages expire (ttl), all of the pages are "
+               "removed after wrmsr and !hiddenhook\n");
+}
+
+void CommandCache(vector<string> SplittedCommand) {
+
+  UINT64 Value;
+  UINT64 Accesses = g_MemoryCacheHits + g_MemoryCacheMisses;
+
+  if (SplittedCommand.size() == 1) {
+    ShowMessages("cache is %s, 0x%llx of 0x%llx pages, ttl : 0x%llx ms\n",
+                 g_MemoryCacheEnabled ? "on" : "off",
+                 (UINT64)g_MemoryCacheLru.size(), g_MemoryCacheCapacity,
+                 g_MemoryCacheTtl);
+    ShowMessages("hits : 0x%llx, misses : 0x%llx, hit rate : %.2f%%\n",
+                 g_MemoryCacheHits, g_MemoryCacheMisses,
+                 Accesses ? (g_MemoryCacheHits * 100.0) / Accesses : 0.0);
+    ShowMessages("read-ahead pages : 0x%llx, evictions : 0x%llx, requests : "
+                 "0x%llx\n",
+                 g_MemoryCacheReadAheadPages, g_MemoryCacheEvictions,
+                 g_MemoryCacheRequests);
+    return;
+  }
+
+  if (SplittedCommand.size() == 2) {
+    if (!SplittedCommand.at(1).compare("on")) {
+      g_MemoryCacheEnabled = TRUE;
+      return;
+    } else if (!SplittedCommand.at(1).compare("off")) {
+      g_MemoryCacheEnabled = FALSE;
+      HyperDbgInvalidateMemoryCache();
+      return;
+    } else if (!SplittedCommand.at(1).compare("flush")) {
+      HyperDbgInvalidateMemoryCache();
+      g_MemoryCacheHits = 0;
+      g_MemoryCacheMisses = 0;
+      g_MemoryCacheReadAheadPages = 0;
+      g_MemoryCacheEvictions = 0;
+      g_MemoryCacheRequests = 0;
+      return;
+    }
+  }
+
+  if (SplittedCommand.size() == 3 &&
+      ConvertStringToUInt64(SplittedCommand.at(2), &Value)) {
+    if (!SplittedCommand.at(1).compare("size") && Value != 0) {
+      g_MemoryCacheCapacity = Value;
+      HyperDbgInvalidateMemoryCache();
+      return;
+    } else if (!SplittedCommand.at(1).compare("ttl")) {
+      g_MemoryCacheTtl = Value;
+      HyperDbgInvalidateMemoryCache();
+      return;
+    }
+  }
+
+  ShowMessages("incorrect use of '.cache'\n\n");
+  CommandCacheHelp();
+}
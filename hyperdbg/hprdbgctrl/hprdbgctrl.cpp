@@ -16,6 +16,14 @@
 // Global Variables
 //
 HANDLE DeviceHandle;
+FILE *g_SyscallTraceFile; // The file that syscall trace records are written to
+SRWLOCK g_SyscallTraceFileLock = SRWLOCK_INIT;
+HANDLE g_SyscallTraceThread; // The thread that reads syscall trace records
+FILE *g_MsrSamplerFile; // The file that MSR samples are written to
+SRWLOCK g_MsrSamplerFileLock = SRWLOCK_INIT;
+UINT64 g_MsrSamplerSessionId; // The samples of other sessions are not written
+FILE *g_PmlDirtyPagesFile; // The file that the dirty pages of PML are written to
+SRWLOCK g_PmlDirtyPagesFileLock = SRWLOCK_INIT;
 using namespace std;
 BOOLEAN IsVmxOffProcessStart; // Show whether the vmxoff process start or not
 Callback Handler = 0;
@@ -153,6 +161,7 @@ void ReadIrpBasedBuffer() {
   // allocate buffer for transfering messages
   //
   char *OutputBuffer = (char *)malloc(UsermodeBufferSize);
+  BOOLEAN IsRecordsBacklog = FALSE;
 
   try {
 
@@ -160,7 +169,13 @@ void ReadIrpBasedBuffer() {
       if (!IsVmxOffProcessStart) {
         ZeroMemory(OutputBuffer, UsermodeBufferSize);
 
-        Sleep(200); // we're not trying to eat all of the CPU ;)
+        //
+        // MSR samples and dirty pages packets are usually followed by more
+        // packets, so they're read without waiting
+        //
+        if (!IsRecordsBacklog) {
+          Sleep(200); // we're not trying to eat all of the CPU ;)
+        }
 
         Status = DeviceIoControl(
             Handle,               // Handle to device
@@ -179,12 +194,32 @@ void ReadIrpBasedBuffer() {
           ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
           break;
         }
-        ShowMessages("========================= Kernel Mode (Buffer) "
-                     "=========================\n");
 
         OperationCode = 0;
         memcpy(&OperationCode, OutputBuffer, sizeof(UINT32));
 
+        //
+        // The records of MSR samples and dirty pages are decoded into their
+        // files without showing any message
+        //
+        IsRecordsBacklog = OperationCode == OPERATION_LOG_MSR_SAMPLES ||
+                           OperationCode == OPERATION_LOG_PML_DIRTY_PAGES;
+
+        if (OperationCode == OPERATION_LOG_MSR_SAMPLES) {
+          CommandMsrSamplerWriteRecords(
+              (PMSR_SAMPLE_RECORDS_HEADER)(OutputBuffer + sizeof(UINT32)));
+          continue;
+        }
+
+        if (OperationCode == OPERATION_LOG_PML_DIRTY_PAGES) {
+          CommandEptAccessDirtyWritePmlRecord(
+              (PPML_DIRTY_PAGES_RECORD)(OutputBuffer + sizeof(UINT32)));
+          continue;
+        }
+
+        ShowMessages("========================= Kernel Mode (Buffer) "
+                     "=========================\n");
+
         ShowMessages("Returned Length : 0x%x \n", ReturnedLength);
         ShowMessages("Operation Code : 0x%x \n", OperationCode);
 
@@ -206,7 +241,6 @@ void ReadIrpBasedBuffer() {
           ShowMessages("Warning log (OPERATION_LOG_WARNING_MESSAGE) :\n");
           ShowMessages("%s\n", OutputBuffer + sizeof(UINT32));
           break;
-
         default:
           break;
         }
@@ -11,6 +11,7 @@
  */
 
 #include "pch.h"
+#include "snapshot.h"
 #include <algorithm>
 #include <iomanip>
 #include <iterator>
@@ -51,54 +52,98 @@ void PrintBits(size_t const size, void const *const ptr) {
   }
 }
 /**
- * @brief Read memory and disassembler
+ * @brief Read a list of ranges in a single request
  *
+ * @param Pid Read from the memory of what process
+ * @param MemoryType Virtual or physical ranges
+ * @param Ranges The ranges, the driver fills the result of each of them
+ * @param NumberOfRanges Number of the ranges
+ * @param Buffer The data of the ranges one after another
+ * @return BOOLEAN Returns false if the request is failed
  */
-void HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_MEMORY_STYLE Style,
-                                      UINT64 Address,
-                                      DEBUGGER_READ_MEMORY_TYPE MemoryType,
-                                      DEBUGGER_READ_READING_TYPE ReadingType,
-                                      UINT32 Pid, UINT Size) {
+BOOLEAN HyperDbgReadMemoryScatter(UINT32 Pid,
+                                  DEBUGGER_READ_MEMORY_TYPE MemoryType,
+                                  PDEBUGGER_READ_MEMORY_RANGE Ranges,
+                                  UINT32 NumberOfRanges, unsigned char *Buffer) {
 
   BOOL Status;
   ULONG ReturnedLength;
-  DEBUGGER_READ_MEMORY ReadMem;
-  UINT32 OperationCode;
-  CHAR Character;
+  UINT32 RequestSize;
+  UINT32 DataSize = 0;
+  PDEBUGGER_READ_MEMORY_SCATTER_REQUEST Request;
+  PDEBUGGER_READ_MEMORY_RANGE RequestRanges;
 
   if (!DeviceHandle) {
     ShowMessages("Handle not found, probably the driver is not loaded.\n");
-    return;
+    return FALSE;
   }
 
-  ReadMem.Address = Address;
-  ReadMem.Pid = Pid;
-  ReadMem.Size = Size;
-  ReadMem.MemoryType = MemoryType;
-  ReadMem.ReadingType = ReadingType;
+  if (NumberOfRanges == 0 ||
+      NumberOfRanges > DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES) {
+    return FALSE;
+  }
 
-  //
-  // allocate buffer for transfering messages
-  //
-  unsigned char *OutputBuffer = (unsigned char *)malloc(Size);
+  for (UINT32 i = 0; i < NumberOfRanges; i++) {
+    DataSize += Ranges[i].Size;
+  }
 
-  ZeroMemory(OutputBuffer, Size);
+  RequestSize = SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST +
+                (NumberOfRanges * sizeof(DEBUGGER_READ_MEMORY_RANGE));
 
-  Status = DeviceIoControl(DeviceHandle,               // Handle to device
-                           IOCTL_DEBUGGER_READ_MEMORY, // IO Control code
-                           &ReadMem, // Input Buffer to driver.
-                           SIZEOF_DEBUGGER_READ_MEMORY, // Input buffer length
-                           OutputBuffer,    // Output Buffer from driver.
-                           Size,            // Length of output buffer in bytes.
-                           &ReturnedLength, // Bytes placed in buffer.
-                           NULL             // synchronous call
+  Request = (PDEBUGGER_READ_MEMORY_SCATTER_REQUEST)malloc(RequestSize +
+                                                          DataSize);
+  ZeroMemory(Request, RequestSize + DataSize);
+
+  Request->Pid = Pid;
+  Request->MemoryType = MemoryType;
+  Request->NumberOfRanges = NumberOfRanges;
+
+  RequestRanges = (PDEBUGGER_READ_MEMORY_RANGE)(
+      (UINT64)Request + SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST);
+  memcpy(RequestRanges, Ranges,
+         NumberOfRanges * sizeof(DEBUGGER_READ_MEMORY_RANGE));
+
+  Status = DeviceIoControl(
+      DeviceHandle,                       // Handle to device
+      IOCTL_DEBUGGER_READ_MEMORY_SCATTER, // IO Control code
+      Request,                            // Input Buffer to driver.
+      RequestSize,                        // Input buffer length
+      Request,                            // Output Buffer from driver.
+      RequestSize + DataSize,             // Length of output buffer in bytes.
+      &ReturnedLength,                    // Bytes placed in buffer.
+      NULL                                // synchronous call
   );
 
   if (!Status) {
     ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
-    return;
+    free(Request);
+    return FALSE;
   }
 
+  //
+  // Copy the results and the data of the ranges
+  //
+  memcpy(Ranges, RequestRanges,
+         NumberOfRanges * sizeof(DEBUGGER_READ_MEMORY_RANGE));
+  memcpy(Buffer, (unsigned char *)Request + RequestSize, DataSize);
+
+  free(Request);
+
+  return TRUE;
+}
+
+/**
+ * @brief Show the memory that is read or disassemble it
+ *
+ */
+void HyperDbgShowMemoryOrDisassemble(DEBUGGER_SHOW_MEMORY_STYLE Style,
+                                     UINT64 Address,
+                                     DEBUGGER_READ_MEMORY_TYPE MemoryType,
+                                     unsigned char *OutputBuffer, UINT Size,
+                                     ULONG ReturnedLength) {
+
+  CHAR Character;
+
   if (Style == DEBUGGER_SHOW_COMMAND_DB) {
     for (int i = 0; i < Size; i += 16) {
 
@@ -229,6 +274,70 @@ void HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_MEMORY_STYLE Style,
   ShowMessages("\n");
 }
 
+/**
+ * @brief Read memory and disassembler
+ *
+ */
+void HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_MEMORY_STYLE Style,
+                                      UINT64 Address,
+                                      DEBUGGER_READ_MEMORY_TYPE MemoryType,
+                                      DEBUGGER_READ_READING_TYPE ReadingType,
+                                      UINT32 Pid, UINT Size) {
+
+  DEBUGGER_READ_MEMORY_RANGE Range = {0};
+
+  Range.Address = Address;
+  Range.Size = Size;
+
+  //
+  // allocate buffer for transfering messages
+  //
+  unsigned char *OutputBuffer = (unsigned char *)malloc(Size);
+
+  //
+  // The pages are read through the cache, the driver doesn't use the
+  // reading type
+  //
+  if (HyperDbgReadMemoryCached(Pid, MemoryType, &Range, 1, OutputBuffer)) {
+    HyperDbgShowMemoryOrDisassemble(Style, Address, MemoryType, OutputBuffer,
+                                    Size, Range.ReadBytes);
+  }
+
+  free(OutputBuffer);
+}
+
+/**
+ * @brief Read memory of several addresses in a single request and show
+ * them or disassemble them
+ *
+ */
+void HyperDbgReadMemoryAndDisassembleAddresses(
+    DEBUGGER_SHOW_MEMORY_STYLE Style, vector<UINT64> Addresses,
+    DEBUGGER_READ_MEMORY_TYPE MemoryType, UINT32 Pid, UINT Size) {
+
+  vector<DEBUGGER_READ_MEMORY_RANGE> Ranges(Addresses.size());
+  unsigned char *OutputBuffer;
+
+  for (size_t i = 0; i < Addresses.size(); i++) {
+    ZeroMemory(&Ranges[i], sizeof(DEBUGGER_READ_MEMORY_RANGE));
+    Ranges[i].Address = Addresses[i];
+    Ranges[i].Size = Size;
+  }
+
+  OutputBuffer = (unsigned char *)malloc(Size * Addresses.size());
+
+  if (HyperDbgReadMemoryCached(Pid, MemoryType, Ranges.data(),
+                               (UINT32)Ranges.size(), OutputBuffer)) {
+    for (size_t i = 0; i < Ranges.size(); i++) {
+      HyperDbgShowMemoryOrDisassemble(Style, Ranges[i].Address, MemoryType,
+                                      OutputBuffer + (i * Size), Size,
+                                      Ranges[i].ReadBytes);
+    }
+  }
+
+  free(OutputBuffer);
+}
+
 const vector<string> Split(const string &s, const char &c) {
   string buff{""};
   vector<string> v;
@@ -342,38 +451,144 @@ void CommandClearScreen() { system("cls"); }
 /* ==============================================================================================
  */
 
+void CommandHiddenHookHelp() {
+  ShowMessages("!hiddenhook : Puts a hidden hook (EPT) on an address, the "
+               "hook is visible to all the cores, only to a single core "
+               "(the core gets a private EPT view) or only to a single "
+               "process (the process gets an EPT view).\n");
+  ShowMessages("Note : You can use \"bh\" and \"!hiddenhook\" in a same way, "
+               "the execute hooks trigger the hidden hook (detour) events\n\n");
+  ShowMessages("syntax : \t!hiddenhook [all | core [core id (hex value)] | "
+               "process [process id (hex value)]] [access (r, w, x, rw, rx, "
+               "rwx)] [address (hex value)]\n");
+  ShowMessages("syntax : \t!hiddenhook unhook [address (hex value)]\n");
+  ShowMessages("syntax : \t!hiddenhook unhook core [core id (hex value)]\n");
+  ShowMessages(
+      "syntax : \t!hiddenhook unhook process [process id (hex value)]\n");
+  ShowMessages("\t\te.g : !hiddenhook all x fffff801deadbeef\n");
+  ShowMessages("\t\te.g : bh core 2 rw fffff801deadbeef\n");
+  ShowMessages("\t\te.g : bh process 1a4c x 7ff8deadbeef\n");
+  ShowMessages("\t\te.g : !hiddenhook unhook fffff801deadbeef\n");
+  ShowMessages("\t\te.g : !hiddenhook unhook core 2\n");
+  ShowMessages("\t\te.g : !hiddenhook unhook process 1a4c\n");
+  ShowMessages("Note : The view of a process (and its hooks) is removed when "
+               "the process exits\n");
+}
 void CommandHiddenHook(vector<string> SplittedCommand) {
 
-  //
-  // Note : You can use "bh" and "!hiddenhook" in a same way
-  // * means optional
-  // !hiddenhook
-  //				 [Type:(all/process)]
-  //				 [Address:(hex) - Address to hook]
-  //				*[Pid:(hex number) - only if you choose
-  //'process' as the Type] [Action:(break/code/log)]
-  //				*[Condition:({ asm in hex })]
-  //				*[Code:({asm in hex}) - only if you choose
-  //'code' as the Action]
-  //				*[Log:(gp regs, pseudo-regs, static address,
-  // dereference regs +- value) - only if you choose 'log' as the Action]
-  //
-  //
-  //		e.g :
-  //				-	bh all break fffff801deadbeef
-  //						Description : Breaks to the
-  // debugger in all accesses to the selected address
-  //
-  //				-	!hiddenhook process 8e34
-  // fffff801deadbeef 						Description :
-  // Breaks to the debugger in accesses from the selected process by pid to the
-  // selected address
-  //
+  BOOL Status;
+  ULONG ReturnedLength;
+  UINT64 Address;
+  UINT64 CoreId;
+  UINT64 ProcessId;
+  string Access;
+  DEBUGGER_HIDDEN_HOOK_REQUEST Request = {0};
+
+  Request.CoreId = DEBUGGER_EVENT_APPLY_TO_ALL_CORES;
+
+  if (SplittedCommand.size() >= 3 &&
+      !SplittedCommand.at(1).compare("unhook")) {
+
+    Request.Action = DEBUGGER_HIDDEN_HOOK_REMOVE;
+
+    if (SplittedCommand.size() == 3 &&
+        ConvertStringToUInt64(SplittedCommand.at(2), &Address)) {
+      Request.Address = Address;
+    } else if (SplittedCommand.size() == 4 &&
+               !SplittedCommand.at(2).compare("core") &&
+               ConvertStringToUInt64(SplittedCommand.at(3), &CoreId) &&
+               CoreId < DEBUGGER_EVENT_APPLY_TO_ALL_CORES) {
+      Request.CoreId = (UINT32)CoreId;
+    } else if (SplittedCommand.size() == 4 &&
+               !SplittedCommand.at(2).compare("process") &&
+               ConvertStringToUInt64(SplittedCommand.at(3), &ProcessId) &&
+               ProcessId != 0 && ProcessId <= MAXUINT32) {
+      Request.ProcessId = (UINT32)ProcessId;
+    } else {
+      ShowMessages("incorrect use of '!hiddenhook'\n\n");
+      CommandHiddenHookHelp();
+      return;
+    }
 
-  for (auto Section : SplittedCommand) {
-    ShowMessages("%s", Section.c_str());
-    ShowMessages("\n");
+  } else if ((SplittedCommand.size() == 4 &&
+              !SplittedCommand.at(1).compare("all")) ||
+             (SplittedCommand.size() == 5 &&
+              (!SplittedCommand.at(1).compare("core") ||
+               !SplittedCommand.at(1).compare("process")))) {
+
+    Request.Action = DEBUGGER_HIDDEN_HOOK_APPLY;
+
+    if (SplittedCommand.size() == 5 &&
+        !SplittedCommand.at(1).compare("process")) {
+      if (!ConvertStringToUInt64(SplittedCommand.at(2), &ProcessId) ||
+          ProcessId == 0 || ProcessId > MAXUINT32) {
+        ShowMessages("please specify a correct process id\n\n");
+        CommandHiddenHookHelp();
+        return;
+      }
+      Request.ProcessId = (UINT32)ProcessId;
+    } else if (SplittedCommand.size() == 5) {
+      if (!ConvertStringToUInt64(SplittedCommand.at(2), &CoreId) ||
+          CoreId >= DEBUGGER_EVENT_APPLY_TO_ALL_CORES) {
+        ShowMessages("please specify a correct core id\n\n");
+        CommandHiddenHookHelp();
+        return;
+      }
+      Request.CoreId = (UINT32)CoreId;
+    }
+
+    Access = SplittedCommand.at(SplittedCommand.size() - 2);
+
+    if (Access.empty() ||
+        Access.find_first_not_of("rwx") != string::npos) {
+      ShowMessages("please specify a correct access (r, w, x)\n\n");
+      CommandHiddenHookHelp();
+      return;
+    }
+
+    Request.SetHookForRead = Access.find('r') != string::npos;
+    Request.SetHookForWrite = Access.find('w') != string::npos;
+    Request.SetHookForExec = Access.find('x') != string::npos;
+
+    if (!ConvertStringToUInt64(SplittedCommand.back(), &Address)) {
+      ShowMessages("please specify a correct hex address\n\n");
+      CommandHiddenHookHelp();
+      return;
+    }
+
+    Request.Address = Address;
+
+  } else {
+    ShowMessages("incorrect use of '!hiddenhook'\n\n");
+    CommandHiddenHookHelp();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  Status = DeviceIoControl(
+      DeviceHandle,                        // Handle to device
+      IOCTL_DEBUGGER_HIDDEN_HOOK,          // IO Control code
+      &Request,                            // Input Buffer to driver.
+      SIZEOF_DEBUGGER_HIDDEN_HOOK_REQUEST, // Input buffer length
+      NULL,                                // Output Buffer from driver.
+      0,                                   // Length of output buffer.
+      &ReturnedLength,                     // Bytes placed in buffer.
+      NULL                                 // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+    return;
   }
+
+  //
+  // The hooks change the pages (and the views) that the guest sees
+  //
+  HyperDbgInvalidateMemoryCache();
 }
 
 /* ==============================================================================================
@@ -390,12 +605,14 @@ void CommandReadMemoryHelp() {
   ShowMessages("\n If you want to read physical memory then add '!' at the "
                "start of the command\n");
   ShowMessages("You can also disassemble physical memory using '!u'\n");
+  ShowMessages("Several addresses are read in a single request\n");
 
-  ShowMessages("syntax : \t[!]d[b|c|d|q] [address] l [length (hex)] pid "
-               "[process id (hex)]\n");
+  ShowMessages("syntax : \t[!]d[b|c|d|q] [address] [address (optional)...] l "
+               "[length (hex)] pid [process id (hex)]\n");
   ShowMessages("\t\te.g : db fffff8077356f010 \n");
   ShowMessages("\t\te.g : !dq 100000\n");
   ShowMessages("\t\te.g : u fffff8077356f010\n");
+  ShowMessages("\t\te.g : dq fffff8077356f010 fffff8077356f890 l 20\n");
 }
 void CommandReadMemoryAndDisassembler(vector<string> SplittedCommand) {
 
@@ -404,6 +621,9 @@ void CommandReadMemoryAndDisassembler(vector<string> SplittedCommand) {
   UINT32 Pid = 0;
   UINT32 Length = 0;
   UINT64 TargetAddress = 0;
+  vector<UINT64> Addresses;
+  DEBUGGER_SHOW_MEMORY_STYLE Style;
+  DEBUGGER_READ_MEMORY_TYPE MemoryType;
   bool IsNextProcessId = false;
   bool IsFirstCommand = true;
 
@@ -456,28 +676,24 @@ void CommandReadMemoryAndDisassembler(vector<string> SplittedCommand) {
     //
     // Probably it's address
     //
-    if (TargetAddress == 0) {
-
-      string TempAddress = Section;
-      TempAddress.erase(remove(TempAddress.begin(), TempAddress.end(), '`'),
-                        TempAddress.end());
+    string TempAddress = Section;
+    TempAddress.erase(remove(TempAddress.begin(), TempAddress.end(), '`'),
+                      TempAddress.end());
 
-      if (!ConvertStringToUInt64(TempAddress, &TargetAddress)) {
-        ShowMessages("Err, you should enter a valid address\n\n");
-        return;
-      }
-    } else {
-      //
-      // User inserts two address
-      //
-      ShowMessages("Err, incorrect use of '%s' command\n\n",
-                   FirstCommand.c_str());
-      CommandReadMemoryHelp();
+    if (!ConvertStringToUInt64(TempAddress, &TargetAddress) ||
+        !TargetAddress) {
+      ShowMessages("Err, you should enter a valid address\n\n");
+      return;
+    }
 
+    if (Addresses.size() == DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES) {
+      ShowMessages("Err, too many addresses\n\n");
       return;
     }
+
+    Addresses.push_back(TargetAddress);
   }
-  if (!TargetAddress) {
+  if (Addresses.empty()) {
     //
     // User inserts two address
     //
@@ -507,51 +723,40 @@ void CommandReadMemoryAndDisassembler(vector<string> SplittedCommand) {
     Pid = GetCurrentProcessId();
   }
 
-  if (!FirstCommand.compare("db")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DB, TargetAddress,
-                                     DEBUGGER_READ_VIRTUAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-
-  } else if (!FirstCommand.compare("dc")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DC, TargetAddress,
-                                     DEBUGGER_READ_VIRTUAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("dd")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DD, TargetAddress,
-                                     DEBUGGER_READ_VIRTUAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("dq")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DQ, TargetAddress,
-                                     DEBUGGER_READ_VIRTUAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("!db")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DB, TargetAddress,
-                                     DEBUGGER_READ_PHYSICAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("!dc")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DC, TargetAddress,
-                                     DEBUGGER_READ_PHYSICAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("!dd")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DD, TargetAddress,
-                                     DEBUGGER_READ_PHYSICAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("!dq")) {
-    HyperDbgReadMemoryAndDisassemble(DEBUGGER_SHOW_COMMAND_DQ, TargetAddress,
-                                     DEBUGGER_READ_PHYSICAL_ADDRESS,
-                                     READ_FROM_KERNEL, Pid, Length);
-  }
   //
-  // Disassembler (!u or u)
+  // '!' at the start of the command means physical memory, and the last
+  // character shows the style
   //
-  else if (!FirstCommand.compare("u")) {
-    HyperDbgReadMemoryAndDisassemble(
-        DEBUGGER_SHOW_COMMAND_DISASSEMBLE, TargetAddress,
-        DEBUGGER_READ_VIRTUAL_ADDRESS, READ_FROM_KERNEL, Pid, Length);
-  } else if (!FirstCommand.compare("!u")) {
-    HyperDbgReadMemoryAndDisassemble(
-        DEBUGGER_SHOW_COMMAND_DISASSEMBLE, TargetAddress,
-        DEBUGGER_READ_PHYSICAL_ADDRESS, READ_FROM_KERNEL, Pid, Length);
+  MemoryType = FirstCommand.front() == '!' ? DEBUGGER_READ_PHYSICAL_ADDRESS
+                                           : DEBUGGER_READ_VIRTUAL_ADDRESS;
+
+  switch (FirstCommand.back()) {
+  case 'b':
+    Style = DEBUGGER_SHOW_COMMAND_DB;
+    break;
+  case 'c':
+    Style = DEBUGGER_SHOW_COMMAND_DC;
+    break;
+  case 'd':
+    Style = DEBUGGER_SHOW_COMMAND_DD;
+    break;
+  case 'q':
+    Style = DEBUGGER_SHOW_COMMAND_DQ;
+    break;
+  default:
+    Style = DEBUGGER_SHOW_COMMAND_DISASSEMBLE;
+    break;
+  }
+
+  if (Addresses.size() == 1) {
+    HyperDbgReadMemoryAndDisassemble(Style, Addresses.front(), MemoryType,
+                                     READ_FROM_KERNEL, Pid, Length);
+  } else {
+    //
+    // All of the addresses are read in a single request
+    //
+    HyperDbgReadMemoryAndDisassembleAddresses(Style, Addresses, MemoryType,
+                                              Pid, Length);
   }
 }
 
@@ -833,42 +1038,160 @@ void CommandFormats(vector<string> SplittedCommand) {
   ShowMessages("Double :     %.*e\n", DECIMAL_DIG, u64Value);
 }
 
+/* ==============================================================================================
+ */
+
+/**
+ * @brief Parse a list of hex values and ranges (e.g. c0000080,c0000100-c0000102)
+ *
+ */
+BOOLEAN HyperDbgParseValueList(string Text, vector<UINT64> &Values,
+                               UINT64 MaximumNumberOfValues) {
+
+  UINT64 First;
+  UINT64 Last;
+  size_t Separator;
+
+  for (auto Item : Split(Text, ',')) {
+
+    Separator = Item.find('-');
+
+    if (Separator == string::npos) {
+      if (!ConvertStringToUInt64(Item, &First)) {
+        return FALSE;
+      }
+      Last = First;
+    } else if (!ConvertStringToUInt64(Item.substr(0, Separator), &First) ||
+               !ConvertStringToUInt64(Item.substr(Separator + 1), &Last) ||
+               Last < First) {
+      return FALSE;
+    }
+
+    if (Last - First >= MaximumNumberOfValues ||
+        Values.size() + (Last - First + 1) > MaximumNumberOfValues) {
+      return FALSE;
+    }
+
+    for (UINT64 Value = First; Value <= Last; Value++) {
+      Values.push_back(Value);
+    }
+  }
+
+  return !Values.empty();
+}
+
+/**
+ * @brief Read or write a list of msrs on a set of cores in a single request
+ *
+ * @param ActionType rdmsr or wrmsr
+ * @param Msrs The msrs
+ * @param CoreMask The selected cores, it's changed to the cores that are
+ * present
+ * @param Value The value to write (wrmsr)
+ * @param Results A row of the values of the msrs for each of the selected
+ * cores
+ * @return BOOLEAN Returns false if the request is failed
+ */
+BOOLEAN HyperDbgReadOrWriteMsrBatch(DEBUGGER_MSR_ACTION_TYPE ActionType,
+                                    vector<UINT32> Msrs, PUINT64 CoreMask,
+                                    UINT64 Value, vector<UINT64> &Results) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  UINT32 RequestSize;
+  UINT32 BufferSize;
+  UINT32 NumberOfCores = 0;
+  PDEBUGGER_MSR_BATCH_REQUEST Request;
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return FALSE;
+  }
+
+  if (Msrs.empty() || Msrs.size() > DEBUGGER_MSR_BATCH_MAX_MSRS) {
+    return FALSE;
+  }
+
+  for (UINT64 Mask = *CoreMask; Mask != 0; Mask &= Mask - 1) {
+    NumberOfCores++;
+  }
+
+  RequestSize = SIZEOF_DEBUGGER_MSR_BATCH_REQUEST +
+                ((UINT32)Msrs.size() * sizeof(UINT32));
+  BufferSize = DEBUGGER_MSR_BATCH_RESULTS_OFFSET(Msrs.size()) +
+               (NumberOfCores * (UINT32)Msrs.size() * sizeof(UINT64));
+
+  Request = (PDEBUGGER_MSR_BATCH_REQUEST)malloc(BufferSize);
+  ZeroMemory(Request, BufferSize);
+
+  Request->ActionType = ActionType;
+  Request->CoreMask = *CoreMask;
+  Request->Value = Value;
+  Request->NumberOfMsrs = (UINT32)Msrs.size();
+
+  memcpy((unsigned char *)Request + SIZEOF_DEBUGGER_MSR_BATCH_REQUEST,
+         Msrs.data(), Msrs.size() * sizeof(UINT32));
+
+  Status = DeviceIoControl(DeviceHandle,             // Handle to device
+                           IOCTL_DEBUGGER_MSR_BATCH, // IO Control code
+                           Request,                  // Input Buffer to driver.
+                           RequestSize,              // Input buffer length
+                           Request,         // Output Buffer from driver.
+                           BufferSize,      // Length of output buffer in bytes.
+                           &ReturnedLength, // Bytes placed in buffer.
+                           NULL             // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+    free(Request);
+    return FALSE;
+  }
+
+  //
+  // The driver removes the cores that are not present
+  //
+  *CoreMask = Request->CoreMask;
+
+  PUINT64 RequestResults = (PUINT64)((unsigned char *)Request +
+                                     DEBUGGER_MSR_BATCH_RESULTS_OFFSET(
+                                         Msrs.size()));
+  Results.assign(RequestResults,
+                 RequestResults + (Request->NumberOfCores * Msrs.size()));
+
+  free(Request);
+
+  return TRUE;
+}
+
 /* ==============================================================================================
  */
 
 void CommandRdmsrHelp() {
-  ShowMessages("rdmsr : Reads a model-specific register (MSR).\n\n");
-  ShowMessages("syntax : \trdmsr [rcx (hex value)] core [core index (hex value "
-               "- optional)]\n");
+  ShowMessages("rdmsr : Reads model-specific registers (MSRs).\n\n");
+  ShowMessages("syntax : \trdmsr [rcx (hex value, list or range)] core [core "
+               "index (hex value, list or range - optional)]\n");
   ShowMessages("\t\te.g : rdmsr c0000082\n");
   ShowMessages("\t\te.g : rdmsr c0000082 core 2\n");
+  ShowMessages("\t\te.g : rdmsr c0000080-c0000084 174,175,176 core 0-3\n");
 }
 void CommandRdmsr(vector<string> SplittedCommand) {
 
-  BOOL Status;
   BOOL IsNextCoreId = FALSE;
-  BOOL SetMsr = FALSE;
-  DEBUGGER_READ_AND_WRITE_ON_MSR MsrReadRequest;
-  ULONG ReturnedLength;
-  UINT64 Msr;
-  UINT32 CoreNumer = DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES;
-  SYSTEM_INFO SysInfo;
-  DWORD NumCPU;
-
-  if (SplittedCommand.size() >= 5) {
-    ShowMessages("incorrect use of 'rdmsr'\n\n");
-    CommandRdmsrHelp();
-    return;
-  }
+  vector<UINT64> Values;
+  vector<UINT64> Cores;
+  vector<UINT32> Msrs;
+  vector<UINT64> Results;
+  UINT64 CoreMask = DEBUGGER_MSR_BATCH_APPLY_ALL_CORES;
+  UINT32 Row = 0;
 
-  for (auto Section : SplittedCommand) {
+  for (size_t i = 1; i < SplittedCommand.size(); i++) {
 
-    if (!Section.compare(SplittedCommand.at(0))) {
-      continue;
-    }
+    string Section = SplittedCommand.at(i);
 
     if (IsNextCoreId) {
-      if (!ConvertStringToUInt32(Section, &CoreNumer)) {
+      if (!HyperDbgParseValueList(Section, Cores, 64) ||
+          *max_element(Cores.begin(), Cores.end()) >= 64) {
         ShowMessages("please specify a correct hex value for core id\n\n");
         CommandRdmsrHelp();
         return;
@@ -877,22 +1200,23 @@ void CommandRdmsr(vector<string> SplittedCommand) {
       continue;
     }
 
-    if (!Section.compare("core")) {
+    if (!Section.compare("core") && Cores.empty()) {
       IsNextCoreId = TRUE;
       continue;
     }
 
-    if (SetMsr || !ConvertStringToUInt64(Section, &Msr)) {
-      ShowMessages("please specify a correct hex value to be read\n\n");
+    if (!HyperDbgParseValueList(Section, Values, DEBUGGER_MSR_BATCH_MAX_MSRS)) {
+      ShowMessages("please specify a correct hex value to be read (at most "
+                   "0x%x msrs)\n\n",
+                   DEBUGGER_MSR_BATCH_MAX_MSRS);
       CommandRdmsrHelp();
       return;
     }
-    SetMsr = TRUE;
   }
   //
   // Check if msr is set or not
   //
-  if (!SetMsr) {
+  if (Values.empty()) {
     ShowMessages("please specify a correct hex value to be read\n\n");
     CommandRdmsrHelp();
     return;
@@ -903,63 +1227,37 @@ void CommandRdmsr(vector<string> SplittedCommand) {
     return;
   }
 
-  if (!DeviceHandle) {
-    ShowMessages("Handle not found, probably the driver is not loaded.\n");
-    return;
+  for (auto Value : Values) {
+    Msrs.push_back((UINT32)Value);
   }
 
-  MsrReadRequest.ActionType = DEBUGGER_MSR_READ;
-  MsrReadRequest.Msr = Msr;
-  MsrReadRequest.CoreNumber = CoreNumer;
-
-  //
-  // Find logical cores count
-  //
-  GetSystemInfo(&SysInfo);
-  NumCPU = SysInfo.dwNumberOfProcessors;
-
-  //
-  // allocate buffer for transfering messages
-  //
-
-  UINT64 *OutputBuffer = (UINT64 *)malloc(sizeof(UINT64) * NumCPU);
-
-  ZeroMemory(OutputBuffer, sizeof(UINT64) * NumCPU);
-
-  Status = DeviceIoControl(
-      DeviceHandle,                     // Handle to device
-      IOCTL_DEBUGGER_READ_OR_WRITE_MSR, // IO Control code
-      &MsrReadRequest,                  // Input Buffer to driver.
-      SIZEOF_READ_AND_WRITE_ON_MSR,     // Input buffer length
-      OutputBuffer,                     // Output Buffer from driver.
-      sizeof(UINT64) * NumCPU,          // Length of output buffer in bytes.
-      &ReturnedLength,                  // Bytes placed in buffer.
-      NULL                              // synchronous call
-  );
+  if (!Cores.empty()) {
+    CoreMask = 0;
+    for (auto Core : Cores) {
+      CoreMask |= 1ull << Core;
+    }
+  }
 
-  if (!Status) {
-    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+  if (!HyperDbgReadOrWriteMsrBatch(DEBUGGER_MSR_READ, Msrs, &CoreMask, 0,
+                                   Results)) {
     return;
   }
 
   //
   // btw, %x is enough, no need to %llx
   //
-  if (CoreNumer == DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES) {
-    //
-    // Show all cores
-    //
-    for (size_t i = 0; i < NumCPU; i++) {
+  for (UINT32 Core = 0; Core < 64; Core++) {
+
+    if (!(CoreMask & (1ull << Core))) {
+      continue;
+    }
 
-      ShowMessages("core : 0x%x - msr[%llx] = %s\n", i, Msr,
-                   SeparateTo64BitValue((OutputBuffer[i])).c_str());
+    for (size_t i = 0; i < Msrs.size(); i++) {
+      ShowMessages("core : 0x%x - msr[%x] = %s\n", Core, Msrs[i],
+                   SeparateTo64BitValue(Results[(Row * Msrs.size()) + i])
+                       .c_str());
     }
-  } else {
-    //
-    // Show for a single-core
-    //
-    ShowMessages("core : 0x%x - msr[%llx] = %s\n", CoreNumer, Msr,
-                 SeparateTo64BitValue((OutputBuffer[0])).c_str());
+    Row++;
   }
 }
 
@@ -967,37 +1265,32 @@ void CommandRdmsr(vector<string> SplittedCommand) {
  */
 
 void CommandWrmsrHelp() {
-  ShowMessages("wrmsr : Writes on a model-specific register (MSR).\n\n");
-  ShowMessages("syntax : \twrmsr [ecx (hex value)] [value to write - EDX:EAX "
-               "(hex value)] core [core index (hex value - optional)]\n");
+  ShowMessages("wrmsr : Writes on model-specific registers (MSRs).\n\n");
+  ShowMessages("syntax : \twrmsr [ecx (hex value, list or range)] [value to "
+               "write - EDX:EAX (hex value)] core [core index (hex value, "
+               "list or range - optional)]\n");
   ShowMessages("\t\te.g : wrmsr c0000082 fffff8077356f010\n");
   ShowMessages("\t\te.g : wrmsr c0000082 fffff8077356f010 core 2\n");
+  ShowMessages("\t\te.g : wrmsr c1-c4 0 core 0,2\n");
 }
 void CommandWrmsr(vector<string> SplittedCommand) {
 
-  BOOL Status;
   BOOL IsNextCoreId = FALSE;
-  BOOL SetMsr = FALSE;
-  BOOL SetValue = FALSE;
-  DEBUGGER_READ_AND_WRITE_ON_MSR MsrWriteRequest;
-  UINT64 Msr;
+  vector<string> Sections;
+  vector<UINT64> Values;
+  vector<UINT64> Cores;
+  vector<UINT32> Msrs;
+  vector<UINT64> Results;
   UINT64 Value = 0;
-  UINT32 CoreNumer = DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES;
-
-  if (SplittedCommand.size() >= 6) {
-    ShowMessages("incorrect use of 'wrmsr'\n\n");
-    CommandWrmsrHelp();
-    return;
-  }
+  UINT64 CoreMask = DEBUGGER_MSR_BATCH_APPLY_ALL_CORES;
 
-  for (auto Section : SplittedCommand) {
+  for (size_t i = 1; i < SplittedCommand.size(); i++) {
 
-    if (!Section.compare(SplittedCommand.at(0))) {
-      continue;
-    }
+    string Section = SplittedCommand.at(i);
 
     if (IsNextCoreId) {
-      if (!ConvertStringToUInt32(Section, &CoreNumer)) {
+      if (!HyperDbgParseValueList(Section, Cores, 64) ||
+          *max_element(Cores.begin(), Cores.end()) >= 64) {
         ShowMessages("please specify a correct hex value for core id\n\n");
         CommandWrmsrHelp();
         return;
@@ -1006,48 +1299,24 @@ void CommandWrmsr(vector<string> SplittedCommand) {
       continue;
     }
 
-    if (!Section.compare("core")) {
+    if (!Section.compare("core") && Cores.empty()) {
       IsNextCoreId = TRUE;
       continue;
     }
 
-    if (!SetMsr) {
-      if (!ConvertStringToUInt64(Section, &Msr)) {
-        ShowMessages("please specify a correct hex value to be read\n\n");
-        CommandWrmsrHelp();
-        return;
-      } else {
-        //
-        // Means that the MSR is set, next we should read value
-        //
-        SetMsr = TRUE;
-        continue;
-      }
-    }
-
-    if (SetMsr) {
-      if (!ConvertStringToUInt64(Section, &Value)) {
-        ShowMessages(
-            "please specify a correct hex value to put on the msr\n\n");
-        CommandWrmsrHelp();
-        return;
-      } else {
-
-        SetValue = TRUE;
-        continue;
-      }
-    }
+    Sections.push_back(Section);
   }
+
   //
-  // Check if msr is set or not
+  // The last value is the value to write and the others are the msrs
   //
-  if (!SetMsr) {
+  if (Sections.size() < 2) {
     ShowMessages("please specify a correct hex value to write\n\n");
     CommandWrmsrHelp();
     return;
   }
-  if (!SetValue) {
-    ShowMessages("please specify a correct hex value to put on msr\n\n");
+  if (!ConvertStringToUInt64(Sections.back(), &Value)) {
+    ShowMessages("please specify a correct hex value to put on the msr\n\n");
     CommandWrmsrHelp();
     return;
   }
@@ -1057,24 +1326,144 @@ void CommandWrmsr(vector<string> SplittedCommand) {
     return;
   }
 
+  Sections.pop_back();
+
+  for (auto Section : Sections) {
+    if (!HyperDbgParseValueList(Section, Values, DEBUGGER_MSR_BATCH_MAX_MSRS)) {
+      ShowMessages("please specify a correct hex value for the msr (at most "
+                   "0x%x msrs)\n\n",
+                   DEBUGGER_MSR_BATCH_MAX_MSRS);
+      CommandWrmsrHelp();
+      return;
+    }
+  }
+
+  for (auto Msr : Values) {
+    Msrs.push_back((UINT32)Msr);
+  }
+
+  if (!Cores.empty()) {
+    CoreMask = 0;
+    for (auto Core : Cores) {
+      CoreMask |= 1ull << Core;
+    }
+  }
+
+  if (!HyperDbgReadOrWriteMsrBatch(DEBUGGER_MSR_WRITE, Msrs, &CoreMask, Value,
+                                   Results)) {
+    return;
+  }
+
+  //
+  // The msrs might change the memory that the guest sees (e.g. PAT)
+  //
+  HyperDbgInvalidateMemoryCache();
+
+  ShowMessages("\n");
+}
+
+/* ==============================================================================================
+ */
+
+void CommandEptInfoHelp() {
+  ShowMessages("!eptinfo : Shows the memory that is used by EPT tables and "
+               "hooks.\n\n");
+  ShowMessages("syntax : \t!eptinfo\n");
+}
+void CommandEptInfo(vector<string> SplittedCommand) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  DEBUGGER_EPT_MEMORY_FOOTPRINT Footprint = {0};
+
+  if (SplittedCommand.size() != 1) {
+    ShowMessages("incorrect use of '!eptinfo'\n\n");
+    CommandEptInfoHelp();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  Status = DeviceIoControl(
+      DeviceHandle,                              // Handle to device
+      IOCTL_DEBUGGER_QUERY_EPT_MEMORY_FOOTPRINT, // IO Control code
+      NULL,                                      // Input Buffer to driver.
+      0,                                         // Input buffer length
+      &Footprint,                                // Output Buffer from driver.
+      SIZEOF_DEBUGGER_EPT_MEMORY_FOOTPRINT,      // Length of output buffer.
+      &ReturnedLength,                           // Bytes placed in buffer.
+      NULL                                       // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+    return;
+  }
+
+  ShowMessages("shared identity table : 0x%llx bytes (%lld split pages)\n",
+               Footprint.SharedTableSize, Footprint.SharedTableSplitPages);
+  ShowMessages("private tables       : 0x%llx bytes (%lld cores)\n",
+               Footprint.PrivateTablesSize, Footprint.NumberOfPrivateTables);
+  ShowMessages("hooked pages         : 0x%llx bytes (%lld pages)\n",
+               Footprint.HookedPagesSize, Footprint.NumberOfHookedPages);
+  ShowMessages("total                : 0x%llx bytes\n", Footprint.TotalSize);
+  ShowMessages("invept               : %lld issued, %lld coalesced\n",
+               Footprint.InveptIssued,
+               Footprint.InveptRequested - Footprint.InveptIssued);
+  ShowMessages("invept broadcasts    : %lld issued, %lld coalesced\n",
+               Footprint.InvalidationBroadcastsIssued,
+               Footprint.InvalidationBroadcastsRequested -
+                   Footprint.InvalidationBroadcastsIssued);
+}
+
+/* ==============================================================================================
+ */
+
+void CommandSpinlocksHelp() {
+  ShowMessages("!spinlocks : Shows the contention counters of the spinlocks of "
+               "the hypervisor.\n\n");
+  ShowMessages("syntax : \t!spinlocks [reset (optional)]\n");
+  ShowMessages("\t\te.g : !spinlocks\n");
+  ShowMessages("\t\te.g : !spinlocks reset\n");
+  ShowMessages("\nthe counters are only collected if the driver is built with "
+               "'CollectSpinlockContentionStatistics', 'reset' clears them "
+               "after they're shown.\n");
+}
+void CommandSpinlocks(vector<string> SplittedCommand) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  DEBUGGER_SPINLOCK_STATISTICS Statistics = {0};
+  const char *LockNames[DEBUGGER_SPINLOCK_COUNT] = {
+      "vmx-root logging", "vmx-root logging (non-immediate)", "reading pool",
+      "ept core views", "hidden hooks detours", "ept hooked pages"};
+
+  if (SplittedCommand.size() > 2 ||
+      (SplittedCommand.size() == 2 && SplittedCommand.at(1).compare("reset"))) {
+    ShowMessages("incorrect use of '!spinlocks'\n\n");
+    CommandSpinlocksHelp();
+    return;
+  }
+
   if (!DeviceHandle) {
     ShowMessages("Handle not found, probably the driver is not loaded.\n");
     return;
   }
 
-  MsrWriteRequest.ActionType = DEBUGGER_MSR_WRITE;
-  MsrWriteRequest.Msr = Msr;
-  MsrWriteRequest.CoreNumber = CoreNumer;
-  MsrWriteRequest.Value = Value;
+  Statistics.Reset = SplittedCommand.size() == 2;
 
-  Status = DeviceIoControl(DeviceHandle,                     // Handle to device
-                           IOCTL_DEBUGGER_READ_OR_WRITE_MSR, // IO Control code
-                           &MsrWriteRequest, // Input Buffer to driver.
-                           SIZEOF_READ_AND_WRITE_ON_MSR, // Input buffer length
-                           NULL, // Output Buffer from driver.
-                           NULL, // Length of output buffer in bytes.
-                           NULL, // Bytes placed in buffer.
-                           NULL  // synchronous call
+  Status = DeviceIoControl(
+      DeviceHandle,                             // Handle to device
+      IOCTL_DEBUGGER_QUERY_SPINLOCK_STATISTICS, // IO Control code
+      &Statistics,                              // Input Buffer to driver.
+      SIZEOF_DEBUGGER_SPINLOCK_STATISTICS,      // Input buffer length
+      &Statistics,                              // Output Buffer from driver.
+      SIZEOF_DEBUGGER_SPINLOCK_STATISTICS,      // Length of output buffer.
+      &ReturnedLength,                          // Bytes placed in buffer.
+      NULL                                      // synchronous call
   );
 
   if (!Status) {
@@ -1082,7 +1471,1280 @@ void CommandWrmsr(vector<string> SplittedCommand) {
     return;
   }
 
-  ShowMessages("\n");
+  if (!Statistics.IsCollected) {
+    ShowMessages("the driver is not built with "
+                 "'CollectSpinlockContentionStatistics'\n");
+    return;
+  }
+
+  ShowMessages("%-34s %16s %16s %16s %16s\n", "lock", "acquisitions",
+               "contentions", "spins", "max wait (tsc)");
+
+  for (UINT32 i = 0; i < DEBUGGER_SPINLOCK_COUNT; i++) {
+    ShowMessages("%-34s %16lld %16lld %16lld %16lld\n", LockNames[i],
+                 Statistics.Locks[i].Acquisitions,
+                 Statistics.Locks[i].Contentions, Statistics.Locks[i].Spins,
+                 Statistics.Locks[i].MaxWait);
+  }
+}
+
+/* ==============================================================================================
+ */
+
+void CommandEptAccessDirtyHelp() {
+  ShowMessages("!eptad : Tracks the accessed (working-set) or dirty physical "
+               "pages by using the accessed and dirty flags of EPT.\n\n");
+  ShowMessages("syntax : \t!eptad [enable | disable]\n");
+  ShowMessages("syntax : \t!eptad pml enable [file path]\n");
+  ShowMessages("syntax : \t!eptad pml [disable | close]\n");
+  ShowMessages("syntax : \t!eptad [access | dirty] [physical address (hex "
+               "value)] [number of pages (hex value)] [interval in "
+               "milliseconds (hex value - optional)]\n");
+  ShowMessages("\t\te.g : !eptad enable\n");
+  ShowMessages("\t\te.g : !eptad pml enable c:\\dirty.csv\n");
+  ShowMessages("\t\te.g : !eptad dirty 0 1000\n");
+  ShowMessages("\t\te.g : !eptad access 100000 8000 3e8\n");
+  ShowMessages("\nthe pages that are logged by Page Modification Logging are "
+               "written to the file (core and physical address of each page) "
+               "until it's closed by 'pml close' or by the next 'pml "
+               "enable'.\n");
+  ShowMessages("\nPML clears the dirty flags when it logs the pages, so the "
+               "flags are only harvested after '!eptad enable' and 'pml "
+               "enable' fails until they're disabled by '!eptad disable'.\n");
+  ShowMessages("a page is reported if its flag is set in the shared EPT table "
+               "or in any of the private views of the cores and the process "
+               "views.\n");
+}
+void CommandEptAccessDirtyWritePmlRecord(PPML_DIRTY_PAGES_RECORD Record) {
+
+  UINT32 *PageFrameNumbers =
+      (UINT32 *)((UINT64)Record + sizeof(PML_DIRTY_PAGES_RECORD));
+
+  if (Record->DroppedPages != 0) {
+    ShowMessages("0x%x dirty pages of core 0x%x are dropped (the ring of the "
+                 "core was full)\n",
+                 Record->DroppedPages, Record->CoreIndex);
+  }
+
+  AcquireSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+
+  if (g_PmlDirtyPagesFile == NULL) {
+    ReleaseSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+    return;
+  }
+
+  for (UINT32 i = 0; i < Record->NumberOfPages; i++) {
+    fprintf(g_PmlDirtyPagesFile, "%u,%llx\n", Record->CoreIndex,
+            (UINT64)PageFrameNumbers[i] * 0x1000);
+  }
+
+  ReleaseSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+}
+void CommandEptAccessDirtyClosePmlFile() {
+
+  AcquireSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+
+  if (g_PmlDirtyPagesFile != NULL) {
+    fclose(g_PmlDirtyPagesFile);
+    g_PmlDirtyPagesFile = NULL;
+  }
+
+  ReleaseSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+}
+BOOL CommandEptAccessDirtySendRequest(
+    PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST AccessDirtyRequest,
+    UINT32 BufferSize) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+
+  Status = DeviceIoControl(
+      DeviceHandle,                             // Handle to device
+      IOCTL_DEBUGGER_EPT_ACCESS_DIRTY_FLAGS,    // IO Control code
+      AccessDirtyRequest,                       // Input Buffer to driver.
+      SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST, // Input buffer length
+      AccessDirtyRequest,                       // Output Buffer from driver.
+      BufferSize,                               // Length of output buffer.
+      &ReturnedLength,                          // Bytes placed in buffer.
+      NULL                                      // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+  }
+
+  return Status;
+}
+void CommandEptAccessDirty(vector<string> SplittedCommand) {
+
+  DEBUGGER_EPT_ACCESS_DIRTY_REQUEST Request = {0};
+  PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST Result;
+  UINT64 PhysicalAddress;
+  UINT64 NumberOfPages;
+  UINT64 Interval = 0;
+  UINT64 CurrentPage;
+  UINT32 *Runs;
+  UINT32 BufferSize;
+  const UINT32 MaxRuns = 0x10000;
+
+  if (SplittedCommand.size() == 2 &&
+      (!SplittedCommand.at(1).compare("enable") ||
+       !SplittedCommand.at(1).compare("disable"))) {
+
+    if (!DeviceHandle) {
+      ShowMessages("Handle not found, probably the driver is not loaded.\n");
+      return;
+    }
+
+    Request.Action = !SplittedCommand.at(1).compare("enable")
+                         ? DEBUGGER_EPT_ACCESS_DIRTY_ENABLE
+                         : DEBUGGER_EPT_ACCESS_DIRTY_DISABLE;
+
+    CommandEptAccessDirtySendRequest(&Request,
+                                     SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST);
+    return;
+  }
+
+  //
+  // The pages that are logged by Page Modification Logging are delivered
+  // as OPERATION_LOG_PML_DIRTY_PAGES messages and written to a file
+  //
+  if (SplittedCommand.size() == 3 && !SplittedCommand.at(1).compare("pml") &&
+      !SplittedCommand.at(2).compare("close")) {
+    CommandEptAccessDirtyClosePmlFile();
+    return;
+  }
+
+  if (SplittedCommand.size() == 3 && !SplittedCommand.at(1).compare("pml") &&
+      !SplittedCommand.at(2).compare("disable")) {
+
+    if (!DeviceHandle) {
+      ShowMessages("Handle not found, probably the driver is not loaded.\n");
+      return;
+    }
+
+    Request.Action = DEBUGGER_EPT_ACCESS_DIRTY_DISABLE_PML;
+
+    CommandEptAccessDirtySendRequest(&Request,
+                                     SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST);
+    return;
+  }
+
+  if (SplittedCommand.size() == 4 && !SplittedCommand.at(1).compare("pml") &&
+      !SplittedCommand.at(2).compare("enable")) {
+
+    FILE *DirtyPagesFile;
+
+    if (!DeviceHandle) {
+      ShowMessages("Handle not found, probably the driver is not loaded.\n");
+      return;
+    }
+
+    DirtyPagesFile = fopen(SplittedCommand.at(3).c_str(), "w");
+
+    if (DirtyPagesFile == NULL) {
+      ShowMessages("could not create '%s'\n", SplittedCommand.at(3).c_str());
+      return;
+    }
+
+    //
+    // Write the names of the columns
+    //
+    fprintf(DirtyPagesFile, "core,address\n");
+
+    CommandEptAccessDirtyClosePmlFile();
+
+    AcquireSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+    g_PmlDirtyPagesFile = DirtyPagesFile;
+    ReleaseSRWLockExclusive(&g_PmlDirtyPagesFileLock);
+
+    Request.Action = DEBUGGER_EPT_ACCESS_DIRTY_ENABLE_PML;
+
+    if (!CommandEptAccessDirtySendRequest(
+            &Request, SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST)) {
+      CommandEptAccessDirtyClosePmlFile();
+    }
+    return;
+  }
+
+  if (SplittedCommand.size() != 4 && SplittedCommand.size() != 5) {
+    ShowMessages("incorrect use of '!eptad'\n\n");
+    CommandEptAccessDirtyHelp();
+    return;
+  }
+
+  if (SplittedCommand.at(1).compare("access") &&
+      SplittedCommand.at(1).compare("dirty")) {
+    ShowMessages("please specify 'access' or 'dirty'\n\n");
+    CommandEptAccessDirtyHelp();
+    return;
+  }
+
+  if (!ConvertStringToUInt64(SplittedCommand.at(2), &PhysicalAddress) ||
+      !ConvertStringToUInt64(SplittedCommand.at(3), &NumberOfPages) ||
+      (SplittedCommand.size() == 5 &&
+       !ConvertStringToUInt64(SplittedCommand.at(4), &Interval))) {
+    ShowMessages("please specify a correct hex value\n\n");
+    CommandEptAccessDirtyHelp();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  //
+  // allocate buffer for the request and the run-lengths
+  //
+  BufferSize =
+      SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST + MaxRuns * sizeof(UINT32);
+  Result = (PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST)malloc(BufferSize);
+
+  if (Result == NULL) {
+    ShowMessages("insufficient memory\n");
+    return;
+  }
+
+  Request.Action = DEBUGGER_EPT_ACCESS_DIRTY_HARVEST;
+  Request.HarvestDirtyFlags = !SplittedCommand.at(1).compare("dirty");
+  Request.ClearAfterHarvest = TRUE;
+  Request.PhysicalAddress = PhysicalAddress & ~0xfffull;
+  Request.NumberOfPages = NumberOfPages;
+
+  //
+  // If there is an interval, the flags are cleared first, then we sample
+  // the pages that are touched during the interval
+  //
+  if (Interval != 0) {
+
+    memcpy(Result, &Request, SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST);
+
+    if (!CommandEptAccessDirtySendRequest(Result, BufferSize)) {
+      free(Result);
+      return;
+    }
+
+    Sleep((DWORD)Interval);
+  }
+
+  memcpy(Result, &Request, SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST);
+
+  if (!CommandEptAccessDirtySendRequest(Result, BufferSize)) {
+    free(Result);
+    return;
+  }
+
+  ShowMessages("%s pages : 0x%llx of 0x%llx harvested pages\n",
+               Request.HarvestDirtyFlags ? "dirty" : "accessed",
+               Result->NumberOfSetPages, Result->NumberOfHarvestedPages);
+
+  //
+  // Decode the runs, even runs are clear and odd runs are set
+  //
+  Runs = (UINT32 *)((UINT64)Result + SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST);
+  CurrentPage = Request.PhysicalAddress / 0x1000;
+
+  for (UINT32 i = 0; i < Result->NumberOfRuns; i++) {
+
+    if (i % 2 == 1) {
+      ShowMessages("%016llx - %016llx\n", CurrentPage * 0x1000,
+                   (CurrentPage + Runs[i]) * 0x1000 - 1);
+    }
+
+    CurrentPage += Runs[i];
+  }
+
+  free(Result);
+}
+
+/* ==============================================================================================
+ */
+
+void CommandSyscallFilterHelp() {
+  ShowMessages("!syscallfilter : Chooses the syscalls and the processes that "
+               "are logged and trigger the events of the EFER syscall hook, "
+               "other syscalls are emulated silently.\n\n");
+  ShowMessages("syntax : \t!syscallfilter [watch | ignore] [first syscall "
+               "number (hex value)] [last syscall number (hex value - "
+               "optional)]\n");
+  ShowMessages("syntax : \t!syscallfilter process [watch | ignore] [process "
+               "id (hex value)]\n");
+  ShowMessages("syntax : \t!syscallfilter clear\n");
+  ShowMessages("\t\te.g : !syscallfilter watch 55\n");
+  ShowMessages("\t\te.g : !syscallfilter ignore 1000 1fff\n");
+  ShowMessages("\t\te.g : !syscallfilter process watch 1d4\n");
+  ShowMessages("\t\te.g : !syscallfilter process ignore 4\n");
+  ShowMessages("\t\te.g : !syscallfilter clear\n");
+  ShowMessages("\nif no process is watched then all of the processes except "
+               "the ignored processes are watched.\n");
+}
+void CommandSyscallFilter(vector<string> SplittedCommand) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  UINT64 FirstSyscallNumber;
+  UINT64 LastSyscallNumber;
+  UINT64 ProcessId;
+  DEBUGGER_SYSCALL_FILTER_REQUEST Request = {0};
+
+  if (SplittedCommand.size() == 2 && !SplittedCommand.at(1).compare("clear")) {
+
+    Request.Action = DEBUGGER_SYSCALL_FILTER_CLEAR;
+
+  } else if ((SplittedCommand.size() == 3 || SplittedCommand.size() == 4) &&
+             (!SplittedCommand.at(1).compare("watch") ||
+              !SplittedCommand.at(1).compare("ignore"))) {
+
+    if (!ConvertStringToUInt64(SplittedCommand.at(2), &FirstSyscallNumber) ||
+        (SplittedCommand.size() == 4 &&
+         !ConvertStringToUInt64(SplittedCommand.at(3), &LastSyscallNumber))) {
+      ShowMessages("please specify a correct hex value\n\n");
+      CommandSyscallFilterHelp();
+      return;
+    }
+
+    if (SplittedCommand.size() == 3) {
+      LastSyscallNumber = FirstSyscallNumber;
+    }
+
+    if (FirstSyscallNumber > LastSyscallNumber ||
+        LastSyscallNumber >= DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER) {
+      ShowMessages("syscall numbers should be an ascending range below "
+                   "0x%x\n",
+                   DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER);
+      return;
+    }
+
+    Request.Action = !SplittedCommand.at(1).compare("watch")
+                         ? DEBUGGER_SYSCALL_FILTER_WATCH_SYSCALLS
+                         : DEBUGGER_SYSCALL_FILTER_IGNORE_SYSCALLS;
+    Request.FirstSyscallNumber = (UINT32)FirstSyscallNumber;
+    Request.LastSyscallNumber = (UINT32)LastSyscallNumber;
+
+  } else if (SplittedCommand.size() == 4 &&
+             !SplittedCommand.at(1).compare("process") &&
+             (!SplittedCommand.at(2).compare("watch") ||
+              !SplittedCommand.at(2).compare("ignore"))) {
+
+    if (!ConvertStringToUInt64(SplittedCommand.at(3), &ProcessId) ||
+        ProcessId == 0 || ProcessId > MAXUINT32) {
+      ShowMessages("please specify a correct process id\n\n");
+      CommandSyscallFilterHelp();
+      return;
+    }
+
+    Request.Action = !SplittedCommand.at(2).compare("watch")
+                         ? DEBUGGER_SYSCALL_FILTER_WATCH_PROCESS
+                         : DEBUGGER_SYSCALL_FILTER_IGNORE_PROCESS;
+    Request.ProcessId = (UINT32)ProcessId;
+
+  } else {
+    ShowMessages("incorrect use of '!syscallfilter'\n\n");
+    CommandSyscallFilterHelp();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  Status = DeviceIoControl(
+      DeviceHandle,                           // Handle to device
+      IOCTL_DEBUGGER_SYSCALL_FILTER,          // IO Control code
+      &Request,                               // Input Buffer to driver.
+      SIZEOF_DEBUGGER_SYSCALL_FILTER_REQUEST, // Input buffer length
+      NULL,                                   // Output Buffer from driver.
+      0,                                      // Length of output buffer.
+      &ReturnedLength,                        // Bytes placed in buffer.
+      NULL                                    // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+  }
+}
+
+/* ==============================================================================================
+ */
+
+void CommandSyscallTraceHelp() {
+  ShowMessages("!syscalltrace : Traces the watched syscalls of the EFER "
+               "syscall hook as binary records and decodes them into a "
+               "comma-separated file (one column for each field).\n\n");
+  ShowMessages("syntax : \t!syscalltrace enable [file path] [number of stack "
+               "arguments (hex value - optional)]\n");
+  ShowMessages("syntax : \t!syscalltrace disable\n");
+  ShowMessages("syntax : \t!syscalltrace close\n");
+  ShowMessages("\t\te.g : !syscalltrace enable c:\\trace.csv\n");
+  ShowMessages("\t\te.g : !syscalltrace enable c:\\trace.csv 4\n");
+  ShowMessages("\t\te.g : !syscalltrace disable\n");
+  ShowMessages("\nthe events of the syscall hook are not triggered for "
+               "the traced syscalls, the records that are still in the "
+               "driver after 'disable' are written to the file until it's "
+               "closed by 'close' or by the next 'enable'.\n");
+}
+
+BOOLEAN CommandSyscallTraceWriteRecords(char *Buffer, UINT32 BufferSize) {
+
+  PSYSCALL_TRACE_RECORDS_HEADER Header;
+  PSYSCALL_TRACE_RECORD Record;
+  UINT64 *StackArguments;
+  UINT32 Offset = 0;
+
+  AcquireSRWLockExclusive(&g_SyscallTraceFileLock);
+
+  if (g_SyscallTraceFile == NULL) {
+    ReleaseSRWLockExclusive(&g_SyscallTraceFileLock);
+    return FALSE;
+  }
+
+  //
+  // The buffer is a sequence of the records of the cores
+  //
+  while (Offset + sizeof(SYSCALL_TRACE_RECORDS_HEADER) <= BufferSize) {
+
+    Header = (PSYSCALL_TRACE_RECORDS_HEADER)(Buffer + Offset);
+    Record = (PSYSCALL_TRACE_RECORD)((UINT64)Header +
+                                     sizeof(SYSCALL_TRACE_RECORDS_HEADER));
+
+    if (Header->DroppedRecords != 0) {
+      ShowMessages("0x%x syscall trace records of core 0x%x are dropped (the "
+                   "ring of the core was full)\n",
+                   Header->DroppedRecords, Header->CoreIndex);
+    }
+
+    for (UINT32 i = 0; i < Header->NumberOfRecords; i++) {
+
+      fprintf(g_SyscallTraceFile,
+              "%llu,%u,%u,%u,%llx,%llx,%llx,%llx,%llx,%llx",
+              Record->TimeStampCounter, Header->CoreIndex, Record->ProcessId,
+              Record->ThreadId, Record->Cr3, Record->ServiceNumber,
+              Record->Arguments[0], Record->Arguments[1],
+              Record->Arguments[2], Record->Arguments[3]);
+
+      StackArguments =
+          (UINT64 *)((UINT64)Record + sizeof(SYSCALL_TRACE_RECORD));
+
+      for (UINT32 j = 0; j < Header->NumberOfStackArguments; j++) {
+        fprintf(g_SyscallTraceFile, ",%llx", StackArguments[j]);
+      }
+
+      fprintf(g_SyscallTraceFile, "\n");
+
+      Record = (PSYSCALL_TRACE_RECORD)((UINT64)Record +
+                                       SYSCALL_TRACE_RECORD_SIZE(
+                                           Header->NumberOfStackArguments));
+    }
+
+    Offset += sizeof(SYSCALL_TRACE_RECORDS_HEADER) +
+              Header->NumberOfRecords *
+                  SYSCALL_TRACE_RECORD_SIZE(Header->NumberOfStackArguments);
+  }
+
+  ReleaseSRWLockExclusive(&g_SyscallTraceFileLock);
+
+  return TRUE;
+}
+DWORD WINAPI CommandSyscallTraceReadThread(void *Data) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  HANDLE Handle;
+  char *Buffer;
+
+  //
+  // The read IOCTL waits for the records, so it has its own handle to not
+  // block the other IOCTLs of the debugger
+  //
+  Handle = CreateFileA("\\\\.\\HyperdbgHypervisorDevice",
+                       GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (Handle == INVALID_HANDLE_VALUE) {
+    ShowMessages("CreateFile failed with error: 0x%x\n", GetLastError());
+    return 1;
+  }
+
+  Buffer = (char *)malloc(SYSCALL_TRACE_READ_BUFFER_SIZE);
+
+  if (Buffer == NULL) {
+    CloseHandle(Handle);
+    return 1;
+  }
+
+  //
+  // Read the records in bulk until the file is closed
+  //
+  do {
+
+    Status = DeviceIoControl(
+        Handle,                            // Handle to device
+        IOCTL_DEBUGGER_READ_SYSCALL_TRACE, // IO Control code
+        NULL,                              // Input Buffer to driver.
+        0,                                 // Input buffer length
+        Buffer,                            // Output Buffer from driver.
+        SYSCALL_TRACE_READ_BUFFER_SIZE,    // Length of output buffer.
+        &ReturnedLength,                   // Bytes placed in buffer.
+        NULL                               // synchronous call
+    );
+
+    if (!Status) {
+      ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+      break;
+    }
+
+  } while (CommandSyscallTraceWriteRecords(Buffer, ReturnedLength));
+
+  free(Buffer);
+  CloseHandle(Handle);
+
+  return 0;
+}
+BOOL CommandSyscallTraceSendRequest(BOOLEAN IsEnabled,
+                                    UINT32 NumberOfStackArguments) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  DEBUGGER_SYSCALL_TRACE_REQUEST Request = {0};
+
+  Request.IsEnabled = IsEnabled;
+  Request.NumberOfStackArguments = NumberOfStackArguments;
+
+  Status = DeviceIoControl(
+      DeviceHandle,                          // Handle to device
+      IOCTL_DEBUGGER_SYSCALL_TRACE,          // IO Control code
+      &Request,                              // Input Buffer to driver.
+      SIZEOF_DEBUGGER_SYSCALL_TRACE_REQUEST, // Input buffer length
+      NULL,                                  // Output Buffer from driver.
+      0,                                     // Length of output buffer.
+      &ReturnedLength,                       // Bytes placed in buffer.
+      NULL                                   // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+  }
+
+  return Status;
+}
+void CommandSyscallTraceCloseFile() {
+
+  AcquireSRWLockExclusive(&g_SyscallTraceFileLock);
+
+  if (g_SyscallTraceFile != NULL) {
+    fclose(g_SyscallTraceFile);
+    g_SyscallTraceFile = NULL;
+  }
+
+  ReleaseSRWLockExclusive(&g_SyscallTraceFileLock);
+
+  //
+  // The reader stops after its current read (it waits for a second at most)
+  //
+  if (g_SyscallTraceThread != NULL) {
+    WaitForSingleObject(g_SyscallTraceThread, INFINITE);
+    CloseHandle(g_SyscallTraceThread);
+    g_SyscallTraceThread = NULL;
+  }
+}
+void CommandSyscallTrace(vector<string> SplittedCommand) {
+
+  UINT64 NumberOfStackArguments = 0;
+  FILE *TraceFile;
+
+  if (SplittedCommand.size() == 2 &&
+      !SplittedCommand.at(1).compare("close")) {
+    CommandSyscallTraceCloseFile();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  if (SplittedCommand.size() == 2 &&
+      !SplittedCommand.at(1).compare("disable")) {
+    CommandSyscallTraceSendRequest(FALSE, 0);
+    return;
+  }
+
+  if ((SplittedCommand.size() != 3 && SplittedCommand.size() != 4) ||
+      SplittedCommand.at(1).compare("enable")) {
+    ShowMessages("incorrect use of '!syscalltrace'\n\n");
+    CommandSyscallTraceHelp();
+    return;
+  }
+
+  if (SplittedCommand.size() == 4 &&
+      (!ConvertStringToUInt64(SplittedCommand.at(3), &NumberOfStackArguments) ||
+       NumberOfStackArguments > SYSCALL_TRACE_MAX_STACK_ARGUMENTS)) {
+    ShowMessages("the number of stack arguments should be a hex value below "
+                 "0x%x\n",
+                 SYSCALL_TRACE_MAX_STACK_ARGUMENTS + 1);
+    return;
+  }
+
+  TraceFile = fopen(SplittedCommand.at(2).c_str(), "w");
+
+  if (TraceFile == NULL) {
+    ShowMessages("could not create '%s'\n", SplittedCommand.at(2).c_str());
+    return;
+  }
+
+  //
+  // Write the names of the columns
+  //
+  fprintf(TraceFile, "tsc,core,pid,tid,cr3,service,arg1,arg2,arg3,arg4");
+
+  for (UINT32 i = 0; i < NumberOfStackArguments; i++) {
+    fprintf(TraceFile, ",arg%u", i + 5);
+  }
+
+  fprintf(TraceFile, "\n");
+
+  CommandSyscallTraceCloseFile();
+
+  AcquireSRWLockExclusive(&g_SyscallTraceFileLock);
+  g_SyscallTraceFile = TraceFile;
+  ReleaseSRWLockExclusive(&g_SyscallTraceFileLock);
+
+  if (!CommandSyscallTraceSendRequest(TRUE, (UINT32)NumberOfStackArguments)) {
+    CommandSyscallTraceCloseFile();
+    return;
+  }
+
+  g_SyscallTraceThread =
+      CreateThread(NULL, 0, CommandSyscallTraceReadThread, NULL, 0, NULL);
+}
+
+/* ==============================================================================================
+ */
+
+void CommandMsrSamplerHelp() {
+  ShowMessages("!msrsampler : Reads a set of model-specific registers (MSRs) "
+               "on each core periodically and writes the samples into a "
+               "comma-separated file (one column for each msr).\n\n");
+  ShowMessages("syntax : \t!msrsampler start [ecx (hex value, list or range)] "
+               "interval [milliseconds (hex value)] file [file path] core "
+               "[core index (hex value, list or range - optional)]\n");
+  ShowMessages("syntax : \t!msrsampler stop\n");
+  ShowMessages("syntax : \t!msrsampler close\n");
+  ShowMessages("\t\te.g : !msrsampler start e7,e8 309-30b interval a file "
+               "c:\\samples.csv\n");
+  ShowMessages("\t\te.g : !msrsampler start 38e interval 64 file "
+               "c:\\status.csv core 0-3\n");
+  ShowMessages("\t\te.g : !msrsampler stop\n");
+  ShowMessages("\nthe samples that are still in the log buffer after 'stop' "
+               "are written to the file until it's closed by 'close' or by "
+               "the next 'start', the samples of a previous 'start' are not "
+               "written to the file of the next one.\n");
+}
+
+void CommandMsrSamplerWriteRecords(PMSR_SAMPLE_RECORDS_HEADER Header) {
+
+  UINT64 *Record;
+
+  AcquireSRWLockExclusive(&g_MsrSamplerFileLock);
+
+  //
+  // The packets of a previous session might be still in the log buffer,
+  // their msrs are not the columns of the current file
+  //
+  if (g_MsrSamplerFile == NULL ||
+      Header->SessionId != g_MsrSamplerSessionId) {
+    ReleaseSRWLockExclusive(&g_MsrSamplerFileLock);
+    return;
+  }
+
+  Record = (UINT64 *)((UINT64)Header + sizeof(MSR_SAMPLE_RECORDS_HEADER));
+
+  for (UINT32 i = 0; i < Header->NumberOfRecords; i++) {
+
+    fprintf(g_MsrSamplerFile, "%llu,%u", Record[0], Header->CoreIndex);
+
+    for (UINT32 j = 0; j < Header->NumberOfMsrs; j++) {
+      fprintf(g_MsrSamplerFile, ",%llx", Record[j + 1]);
+    }
+
+    fprintf(g_MsrSamplerFile, "\n");
+
+    Record = (UINT64 *)((UINT64)Record +
+                        MSR_SAMPLE_RECORD_SIZE(Header->NumberOfMsrs));
+  }
+
+  ReleaseSRWLockExclusive(&g_MsrSamplerFileLock);
+}
+BOOL CommandMsrSamplerSendRequest(PDEBUGGER_MSR_SAMPLER_REQUEST Request) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+
+  Status = DeviceIoControl(
+      DeviceHandle,                        // Handle to device
+      IOCTL_DEBUGGER_MSR_SAMPLER,          // IO Control code
+      Request,                             // Input Buffer to driver.
+      SIZEOF_DEBUGGER_MSR_SAMPLER_REQUEST, // Input buffer length
+      NULL,                                // Output Buffer from driver.
+      0,                                   // Length of output buffer.
+      &ReturnedLength,                     // Bytes placed in buffer.
+      NULL                                 // synchronous call
+  );
+
+  if (!Status) {
+    ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+  }
+
+  return Status;
+}
+void CommandMsrSamplerCloseFile() {
+
+  AcquireSRWLockExclusive(&g_MsrSamplerFileLock);
+
+  if (g_MsrSamplerFile != NULL) {
+    fclose(g_MsrSamplerFile);
+    g_MsrSamplerFile = NULL;
+  }
+
+  ReleaseSRWLockExclusive(&g_MsrSamplerFileLock);
+}
+void CommandMsrSampler(vector<string> SplittedCommand) {
+
+  DEBUGGER_MSR_SAMPLER_REQUEST Request = {0};
+  vector<UINT64> Msrs;
+  vector<UINT64> Cores;
+  string FilePath;
+  string NextArgument;
+  UINT64 Interval = 0;
+  FILE *SamplesFile;
+
+  if (SplittedCommand.size() == 2 &&
+      !SplittedCommand.at(1).compare("close")) {
+    CommandMsrSamplerCloseFile();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  if (SplittedCommand.size() == 2 && !SplittedCommand.at(1).compare("stop")) {
+    CommandMsrSamplerSendRequest(&Request);
+    return;
+  }
+
+  if (SplittedCommand.size() < 3 || SplittedCommand.at(1).compare("start")) {
+    ShowMessages("incorrect use of '!msrsampler'\n\n");
+    CommandMsrSamplerHelp();
+    return;
+  }
+
+  for (size_t i = 2; i < SplittedCommand.size(); i++) {
+
+    string Section = SplittedCommand.at(i);
+
+    if (!NextArgument.compare("interval")) {
+      if (!ConvertStringToUInt64(Section, &Interval) || Interval == 0 ||
+          Interval > MAXUINT32) {
+        ShowMessages("please specify a correct hex value for the interval\n");
+        return;
+      }
+    } else if (!NextArgument.compare("file")) {
+      FilePath = Section;
+    } else if (!NextArgument.compare("core")) {
+      if (!HyperDbgParseValueList(Section, Cores, 64) ||
+          *max_element(Cores.begin(), Cores.end()) >= 64) {
+        ShowMessages("please specify a correct hex value for core id\n");
+        return;
+      }
+    } else if (!Section.compare("interval") || !Section.compare("file") ||
+               !Section.compare("core")) {
+      NextArgument = Section;
+      continue;
+    } else if (!HyperDbgParseValueList(Section, Msrs,
+                                       DEBUGGER_MSR_SAMPLER_MAX_MSRS)) {
+      ShowMessages("please specify a correct hex value for the msr (at most "
+                   "0x%x msrs)\n",
+                   DEBUGGER_MSR_SAMPLER_MAX_MSRS);
+      return;
+    }
+
+    NextArgument.clear();
+  }
+
+  if (Msrs.empty() || Interval == 0 || FilePath.empty() ||
+      !NextArgument.empty()) {
+    ShowMessages("incorrect use of '!msrsampler'\n\n");
+    CommandMsrSamplerHelp();
+    return;
+  }
+
+  Request.IsEnabled = TRUE;
+  Request.Interval = (UINT32)Interval;
+  Request.CoreMask = Cores.empty() ? DEBUGGER_MSR_BATCH_APPLY_ALL_CORES : 0;
+  Request.NumberOfMsrs = (UINT32)Msrs.size();
+
+  for (auto Core : Cores) {
+    Request.CoreMask |= 1ull << Core;
+  }
+
+  for (size_t i = 0; i < Msrs.size(); i++) {
+    Request.Msrs[i] = (UINT32)Msrs[i];
+  }
+
+  SamplesFile = fopen(FilePath.c_str(), "w");
+
+  if (SamplesFile == NULL) {
+    ShowMessages("could not create '%s'\n", FilePath.c_str());
+    return;
+  }
+
+  //
+  // Write the names of the columns
+  //
+  fprintf(SamplesFile, "tsc,core");
+
+  for (auto Msr : Msrs) {
+    fprintf(SamplesFile, ",msr_%llx", Msr);
+  }
+
+  fprintf(SamplesFile, "\n");
+
+  CommandMsrSamplerCloseFile();
+
+  //
+  // Each start is a new session, so only its own samples are written
+  //
+  AcquireSRWLockExclusive(&g_MsrSamplerFileLock);
+  g_MsrSamplerFile = SamplesFile;
+  g_MsrSamplerSessionId = max(GetTickCount64(), g_MsrSamplerSessionId + 1);
+  Request.SessionId = g_MsrSamplerSessionId;
+  ReleaseSRWLockExclusive(&g_MsrSamplerFileLock);
+
+  if (!CommandMsrSamplerSendRequest(&Request)) {
+    CommandMsrSamplerCloseFile();
+  }
+}
+
+/* ==============================================================================================
+ */
+
+#define SEARCH_MEMORY_RESULTS_PER_REQUEST 0x200
+
+void CommandSearchMemoryHelp() {
+  ShowMessages("s : searches the virtual memory of a process for a byte "
+               "pattern, '?' is a wildcard for a nibble and '??' for a "
+               "byte.\n\n");
+  ShowMessages("syntax : \ts [address] l [length (hex)] [pattern (hex bytes)] "
+               "pid [process id (hex - optional)]\n");
+  ShowMessages("\t\te.g : s fffff8077356f010 l 100000 48 8b ?? 24 ?8\n");
+  ShowMessages("\t\te.g : s 7ff6a1230000 l 5000 e8 ?? ?? ?? ?? 90 pid 1c0\n");
+}
+BOOLEAN CommandSearchMemoryParseByte(string Text, PUCHAR Byte, PUCHAR Mask) {
+
+  *Byte = 0;
+  *Mask = 0;
+
+  if (Text.size() == 1) {
+    //
+    // A single character is the low nibble
+    //
+    Text.insert(0, "0");
+  }
+
+  if (Text.size() != 2) {
+    return FALSE;
+  }
+
+  for (auto Character : Text) {
+    *Byte <<= 4;
+    *Mask <<= 4;
+
+    if (Character == '?') {
+      continue;
+    }
+    if (!isxdigit(Character)) {
+      return FALSE;
+    }
+
+    *Byte |= (UCHAR)stoi(string(1, Character), nullptr, 16);
+    *Mask |= 0xf;
+  }
+
+  return TRUE;
+}
+void CommandSearchMemory(vector<string> SplittedCommand) {
+
+  BOOL Status;
+  ULONG ReturnedLength;
+  UINT32 Pid = 0;
+  UINT64 Address = 0;
+  UINT64 Length = 0;
+  UINT64 EndAddress;
+  UINT32 NumberOfMatches = 0;
+  bool IsNextProcessId = false;
+  bool IsNextLength = false;
+  bool IsFirstCommand = true;
+  PDEBUGGER_SEARCH_MEMORY_REQUEST Request;
+  PUINT64 Results;
+  UINT32 BufferSize = SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST +
+                      (SEARCH_MEMORY_RESULTS_PER_REQUEST * sizeof(UINT64));
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  Request = (PDEBUGGER_SEARCH_MEMORY_REQUEST)malloc(BufferSize);
+  ZeroMemory(Request, BufferSize);
+
+  for (auto Section : SplittedCommand) {
+    if (IsFirstCommand) {
+      IsFirstCommand = false;
+      continue;
+    }
+    if (IsNextProcessId) {
+      if (!ConvertStringToUInt32(Section, &Pid)) {
+        ShowMessages("Err, you should enter a valid proc id\n\n");
+        free(Request);
+        return;
+      }
+      IsNextProcessId = false;
+      continue;
+    }
+    if (IsNextLength) {
+      if (!ConvertStringToUInt64(Section, &Length)) {
+        ShowMessages("Err, you should enter a valid length\n\n");
+        free(Request);
+        return;
+      }
+      IsNextLength = false;
+      continue;
+    }
+    if (!Section.compare("l")) {
+      IsNextLength = true;
+      continue;
+    }
+    if (!Section.compare("pid")) {
+      IsNextProcessId = true;
+      continue;
+    }
+
+    //
+    // The first value is the address and the others are the pattern
+    //
+    if (Address == 0) {
+      string TempAddress = Section;
+      TempAddress.erase(remove(TempAddress.begin(), TempAddress.end(), '`'),
+                        TempAddress.end());
+
+      if (!ConvertStringToUInt64(TempAddress, &Address)) {
+        ShowMessages("Err, you should enter a valid address\n\n");
+        free(Request);
+        return;
+      }
+      continue;
+    }
+
+    if (Request->PatternLength == DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH ||
+        !CommandSearchMemoryParseByte(
+            Section, &Request->Pattern[Request->PatternLength],
+            &Request->Mask[Request->PatternLength])) {
+      ShowMessages("Err, invalid byte '%s' in the pattern (at most 0x%x "
+                   "bytes)\n\n",
+                   Section.c_str(), DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH);
+      free(Request);
+      return;
+    }
+    Request->PatternLength++;
+  }
+
+  if (Address == 0 || Length == 0 || Request->PatternLength == 0 ||
+      IsNextLength || IsNextProcessId) {
+    ShowMessages("incorrect use of 's'\n\n");
+    CommandSearchMemoryHelp();
+    free(Request);
+    return;
+  }
+
+  if (Pid == 0) {
+    //
+    // Default process we search the current process
+    //
+    Pid = GetCurrentProcessId();
+  }
+
+  Request->Pid = Pid;
+  EndAddress = Address + Length;
+  Results = (PUINT64)((UINT64)Request + SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST);
+
+  //
+  // Each request scans a limited part of the range and returns a limited
+  // number of matches, so continue the search until the whole range is
+  // searched
+  //
+  do {
+    Request->Address = Address;
+    Request->Length = EndAddress - Address;
+
+    Status = DeviceIoControl(
+        DeviceHandle,                          // Handle to device
+        IOCTL_DEBUGGER_SEARCH_MEMORY,          // IO Control code
+        Request,                               // Input Buffer to driver.
+        SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST, // Input buffer length
+        Request,                               // Output Buffer from driver.
+        BufferSize,      // Length of output buffer in bytes.
+        &ReturnedLength, // Bytes placed in buffer.
+        NULL             // synchronous call
+    );
+
+    if (!Status) {
+      ShowMessages("Ioctl failed with code 0x%x\n", GetLastError());
+      break;
+    }
+
+    for (UINT32 i = 0; i < Request->NumberOfResults; i++) {
+      ShowMessages("%s\n", SeparateTo64BitValue(Results[i]).c_str());
+    }
+
+    NumberOfMatches += Request->NumberOfResults;
+    Address = Request->NextAddress;
+
+  } while (Address != 0);
+
+  ShowMessages("found 0x%x match(es)\n", NumberOfMatches);
+
+  free(Request);
+}
+
+/* ==============================================================================================
+ */
+
+#define SNAPSHOT_MAX_SHOWN_RUNS 0x100
+
+void CommandSnapshotHelp() {
+  ShowMessages(".snapshot : takes snapshots of the virtual memory of a process "
+               "and shows the differences of two snapshots.\n\n");
+  ShowMessages("syntax : \t.snapshot take [name] [address] l [length (hex)] "
+               "... pid [process id (hex - optional)]\n");
+  ShowMessages("syntax : \t.snapshot diff [first name] [second name]\n");
+  ShowMessages("syntax : \t.snapshot delete [name | all]\n");
+  ShowMessages("syntax : \t.snapshot list\n");
+  ShowMessages("\t\te.g : .snapshot take before 7ff6a1230000 l 5000 "
+               "7ff6a1300000 l 1000 pid 1c0\n");
+  ShowMessages("\t\te.g : .snapshot diff before after\n");
+}
+bool CommandSnapshotReadPages(void *Context, uint32_t Pid,
+                              const uint64_t *Pages, uint32_t NumberOfPages,
+                              uint8_t *Buffer, uint32_t *ValidBytes) {
+
+  vector<DEBUGGER_READ_MEMORY_RANGE> Ranges(NumberOfPages);
+
+  for (UINT32 i = 0; i < NumberOfPages; i++) {
+    ZeroMemory(&Ranges[i], sizeof(DEBUGGER_READ_MEMORY_RANGE));
+    Ranges[i].Address = Pages[i];
+    Ranges[i].Size = SNAPSHOT_PAGE_SIZE;
+  }
+
+  //
+  // Snapshots are not read through the page cache as they should be
+  // the current content of the memory
+  //
+  if (!HyperDbgReadMemoryScatter(Pid, DEBUGGER_READ_VIRTUAL_ADDRESS,
+                                 Ranges.data(), NumberOfPages, Buffer)) {
+    return false;
+  }
+
+  for (UINT32 i = 0; i < NumberOfPages; i++) {
+    ValidBytes[i] = Ranges[i].ReadBytes;
+  }
+
+  return true;
+}
+void CommandSnapshotShowDiff(string First, string Second) {
+
+  SNAPSHOT_DIFF Diff;
+  UCHAR OldValue;
+  UCHAR NewValue;
+  uint8_t FirstPage[SNAPSHOT_PAGE_SIZE];
+  uint8_t SecondPage[SNAPSHOT_PAGE_SIZE];
+  UINT64 LoadedPage = MAXUINT64;
+
+  if (!SnapshotDiff(First, Second, &Diff)) {
+    ShowMessages("err, snapshot not found\n");
+    return;
+  }
+
+  for (size_t i = 0; i < Diff.Runs.size() && i < SNAPSHOT_MAX_SHOWN_RUNS;
+       i++) {
+
+    ShowMessages("%s l %llx :",
+                 SeparateTo64BitValue(Diff.Runs[i].Address).c_str(),
+                 Diff.Runs[i].Length);
+
+    //
+    // Show the bytes of the short runs
+    //
+    for (UINT64 j = 0; j < Diff.Runs[i].Length && j < 8; j++) {
+
+      UINT64 Address = Diff.Runs[i].Address + j;
+      UINT64 Page = Address & ~((UINT64)SNAPSHOT_PAGE_SIZE - 1);
+
+      if (Page != LoadedPage) {
+        SnapshotReadPage(First, Page, FirstPage);
+        SnapshotReadPage(Second, Page, SecondPage);
+        LoadedPage = Page;
+      }
+
+      OldValue = FirstPage[Address - Page];
+      NewValue = SecondPage[Address - Page];
+      ShowMessages(" %02x->%02x", OldValue, NewValue);
+    }
+
+    ShowMessages("%s\n", Diff.Runs[i].Length > 8 ? " ..." : "");
+  }
+
+  if (Diff.Runs.size() > SNAPSHOT_MAX_SHOWN_RUNS) {
+    ShowMessages("... 0x%llx more changed range(s)\n",
+                 (UINT64)(Diff.Runs.size() - SNAPSHOT_MAX_SHOWN_RUNS));
+  }
+
+  for (auto Page : Diff.RemovedPages) {
+    ShowMessages("%s : page is not readable anymore\n",
+                 SeparateTo64BitValue(Page).c_str());
+  }
+
+  for (auto Page : Diff.AddedPages) {
+    ShowMessages("%s : page is readable now\n",
+                 SeparateTo64BitValue(Page).c_str());
+  }
+
+  ShowMessages("identical pages : 0x%llx, changed pages : 0x%llx, changed "
+               "bytes : 0x%llx\n",
+               Diff.IdenticalPages, Diff.ChangedPages, Diff.ChangedBytes);
+}
+void CommandSnapshot(vector<string> SplittedCommand) {
+
+  UINT32 Pid = 0;
+  UINT64 Value;
+  SNAPSHOT_RANGE Range = {0};
+  vector<SNAPSHOT_RANGE> Ranges;
+  SNAPSHOT_STORE_STATISTICS Statistics;
+  bool IsNextProcessId = false;
+  bool IsNextLength = false;
+  bool HasAddress = false;
+
+  if (SplittedCommand.size() == 2 && !SplittedCommand.at(1).compare("list")) {
+
+    for (auto &Snapshot : SnapshotList()) {
+      ShowMessages("%s : pid 0x%x, 0x%llx page(s)\n", Snapshot.Name.c_str(),
+                   Snapshot.Pid, Snapshot.NumberOfPages);
+    }
+
+    SnapshotGetStoreStatistics(&Statistics);
+    ShowMessages("0x%llx page(s) are stored in 0x%llx unique page(s) "
+                 "(0x%llx bytes)\n",
+                 Statistics.NumberOfPages, Statistics.NumberOfUniquePages,
+                 Statistics.StoredBytes);
+    return;
+  }
+
+  if (SplittedCommand.size() == 3 &&
+      !SplittedCommand.at(1).compare("delete")) {
+
+    if (!SplittedCommand.at(2).compare("all")) {
+      SnapshotDeleteAll();
+    } else if (!SnapshotDelete(SplittedCommand.at(2))) {
+      ShowMessages("err, snapshot not found\n");
+    }
+    return;
+  }
+
+  if (SplittedCommand.size() == 4 && !SplittedCommand.at(1).compare("diff")) {
+    CommandSnapshotShowDiff(SplittedCommand.at(2), SplittedCommand.at(3));
+    return;
+  }
+
+  if (SplittedCommand.size() < 6 || SplittedCommand.at(1).compare("take")) {
+    ShowMessages("incorrect use of '.snapshot'\n\n");
+    CommandSnapshotHelp();
+    return;
+  }
+
+  for (size_t i = 3; i < SplittedCommand.size(); i++) {
+
+    string Section = SplittedCommand.at(i);
+
+    if (IsNextProcessId) {
+      if (!ConvertStringToUInt32(Section, &Pid)) {
+        ShowMessages("Err, you should enter a valid proc id\n\n");
+        return;
+      }
+      IsNextProcessId = false;
+      continue;
+    }
+    if (IsNextLength) {
+      if (!ConvertStringToUInt64(Section, &Value) || Value == 0) {
+        ShowMessages("Err, you should enter a valid length\n\n");
+        return;
+      }
+      Range.Size = Value;
+      Ranges.push_back(Range);
+      IsNextLength = false;
+      HasAddress = false;
+      continue;
+    }
+    if (!Section.compare("pid")) {
+      IsNextProcessId = true;
+      continue;
+    }
+    if (!Section.compare("l") && HasAddress) {
+      IsNextLength = true;
+      continue;
+    }
+
+    Section.erase(remove(Section.begin(), Section.end(), '`'), Section.end());
+
+    if (HasAddress || !ConvertStringToUInt64(Section, &Range.Address)) {
+      ShowMessages("Err, you should enter a valid address\n\n");
+      return;
+    }
+    HasAddress = true;
+  }
+
+  if (Ranges.empty() || IsNextLength || IsNextProcessId || HasAddress) {
+    ShowMessages("incorrect use of '.snapshot'\n\n");
+    CommandSnapshotHelp();
+    return;
+  }
+
+  if (!DeviceHandle) {
+    ShowMessages("Handle not found, probably the driver is not loaded.\n");
+    return;
+  }
+
+  if (Pid == 0) {
+    //
+    // Default process we read the current process
+    //
+    Pid = GetCurrentProcessId();
+  }
+
+  if (!SnapshotTake(SplittedCommand.at(2), Pid, Ranges,
+                    CommandSnapshotReadPages, NULL)) {
+    ShowMessages("err, unable to take the snapshot\n");
+    return;
+  }
+
+  SnapshotGetStoreStatistics(&Statistics);
+  ShowMessages("snapshot '%s' is taken, 0x%llx unique page(s) are stored "
+               "(0x%llx bytes)\n",
+               SplittedCommand.at(2).c_str(), Statistics.NumberOfUniquePages,
+               Statistics.StoredBytes);
 }
 
 /* ==============================================================================================
@@ -1144,6 +2806,10 @@ int _cdecl HyperdbgInterpreter(const char *Command) {
     CommandRdmsr(SplittedCommand);
   } else if (!FirstCommand.compare(".formats")) {
     CommandFormats(SplittedCommand);
+  } else if (!FirstCommand.compare(".cache")) {
+    CommandCache(SplittedCommand);
+  } else if (!FirstCommand.compare(".snapshot")) {
+    CommandSnapshot(SplittedCommand);
   } else if (!FirstCommand.compare("lm")) {
     CommandLm(SplittedCommand);
   } else if (!FirstCommand.compare("db") || !FirstCommand.compare("dc") ||
@@ -1152,9 +2818,23 @@ int _cdecl HyperdbgInterpreter(const char *Command) {
              !FirstCommand.compare("!dd") || !FirstCommand.compare("!dq") ||
              !FirstCommand.compare("!u") || !FirstCommand.compare("u")) {
     CommandReadMemoryAndDisassembler(SplittedCommand);
+  } else if (!FirstCommand.compare("s")) {
+    CommandSearchMemory(SplittedCommand);
   } else if (!FirstCommand.compare("!hiddenhook") ||
              !FirstCommand.compare("bh")) {
     CommandHiddenHook(SplittedCommand);
+  } else if (!FirstCommand.compare("!eptinfo")) {
+    CommandEptInfo(SplittedCommand);
+  } else if (!FirstCommand.compare("!spinlocks")) {
+    CommandSpinlocks(SplittedCommand);
+  } else if (!FirstCommand.compare("!eptad")) {
+    CommandEptAccessDirty(SplittedCommand);
+  } else if (!FirstCommand.compare("!syscallfilter")) {
+    CommandSyscallFilter(SplittedCommand);
+  } else if (!FirstCommand.compare("!syscalltrace")) {
+    CommandSyscallTrace(SplittedCommand);
+  } else if (!FirstCommand.compare("!msrsampler")) {
+    CommandMsrSampler(SplittedCommand);
   } else {
     ShowMessages("Couldn't resolve error at '%s'", FirstCommand.c_str());
     ShowMessages("\n");
@@ -0,0 +1,505 @@
+/**
+ * @file snapshot.cpp
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Memory snapshots and their diff engine
+ * @details The pages of all of the snapshots are kept in a single store,
+ * each page is compressed and kept once no matter how many snapshots
+ * (or addresses) contain it
+ * @version 0.1
+ * @date 2020-05-10
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include "snapshot.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SNAPSHOT_COMPARE_SSE2
+#endif
+
+//
+// The compressed stream is a list of blocks, a control byte less than
+// 0x80 is followed by (control + 1) literal bytes and otherwise the next
+// byte is repeated (control - 0x80 + SNAPSHOT_MIN_REPEAT) times
+//
+#define SNAPSHOT_MAX_LITERAL 0x80
+#define SNAPSHOT_MIN_REPEAT 3
+#define SNAPSHOT_MAX_REPEAT (0x7f + SNAPSHOT_MIN_REPEAT)
+
+typedef struct _SNAPSHOT_STORED_PAGE {
+  uint64_t Hash;
+  bool Compressed; // Otherwise the page is kept as it is
+  std::vector<uint8_t> Data;
+
+} SNAPSHOT_STORED_PAGE, *PSNAPSHOT_STORED_PAGE;
+
+typedef std::shared_ptr<SNAPSHOT_STORED_PAGE> SNAPSHOT_PAGE_REFERENCE;
+
+typedef struct _SNAPSHOT {
+  uint32_t Pid;
+  std::map<uint64_t, SNAPSHOT_PAGE_REFERENCE> Pages; // Sorted by address
+
+} SNAPSHOT, *PSNAPSHOT;
+
+std::map<std::string, SNAPSHOT> g_Snapshots;
+
+//
+// Pages are found by the hash of their content
+//
+std::unordered_map<uint64_t, std::vector<SNAPSHOT_PAGE_REFERENCE>>
+    g_SnapshotPageStore;
+
+uint64_t SnapshotHashPage(const uint8_t *Page) {
+
+  uint64_t Hash = 0x9e3779b97f4a7c15;
+  uint64_t Word;
+
+  for (size_t i = 0; i < SNAPSHOT_PAGE_SIZE; i += sizeof(uint64_t)) {
+    memcpy(&Word, Page + i, sizeof(uint64_t));
+    Hash = (Hash ^ Word) * 0xff51afd7ed558ccd;
+    Hash ^= Hash >> 32;
+  }
+
+  return Hash;
+}
+
+/**
+ * @brief Compress a page
+ *
+ * @param Page The page (SNAPSHOT_PAGE_SIZE bytes)
+ * @param Output Buffer of SNAPSHOT_PAGE_SIZE bytes
+ * @return size_t Size of the compressed page, or zero if the page
+ * is not compressible
+ */
+size_t SnapshotCompress(const uint8_t *Page, uint8_t *Output) {
+
+  size_t Index = 0;
+  size_t OutputSize = 0;
+  size_t Start;
+  size_t Repeat;
+
+  while (Index < SNAPSHOT_PAGE_SIZE) {
+
+    //
+    // Find the repeats of the current byte
+    //
+    Repeat = 1;
+    while (Index + Repeat < SNAPSHOT_PAGE_SIZE && Repeat < SNAPSHOT_MAX_REPEAT &&
+           Page[Index + Repeat] == Page[Index]) {
+      Repeat++;
+    }
+
+    if (Repeat >= SNAPSHOT_MIN_REPEAT) {
+
+      if (OutputSize + 2 >= SNAPSHOT_PAGE_SIZE) {
+        return 0;
+      }
+
+      Output[OutputSize++] =
+          (uint8_t)(SNAPSHOT_MAX_LITERAL + Repeat - SNAPSHOT_MIN_REPEAT);
+      Output[OutputSize++] = Page[Index];
+      Index += Repeat;
+      continue;
+    }
+
+    //
+    // Copy the bytes until the next repeat
+    //
+    Start = Index;
+    while (Index < SNAPSHOT_PAGE_SIZE && Index - Start < SNAPSHOT_MAX_LITERAL) {
+      if (Index + 2 < SNAPSHOT_PAGE_SIZE && Page[Index] == Page[Index + 1] &&
+          Page[Index] == Page[Index + 2]) {
+        break;
+      }
+      Index++;
+    }
+
+    if (OutputSize + 1 + (Index - Start) >= SNAPSHOT_PAGE_SIZE) {
+      return 0;
+    }
+
+    Output[OutputSize++] = (uint8_t)(Index - Start - 1);
+    memcpy(&Output[OutputSize], &Page[Start], Index - Start);
+    OutputSize += Index - Start;
+  }
+
+  return OutputSize;
+}
+
+/**
+ * @brief Decompress a page
+ *
+ * @param Input The compressed page
+ * @param Size Size of the compressed page
+ * @param Page Buffer of SNAPSHOT_PAGE_SIZE bytes
+ * @return bool Returns false if the compressed page is corrupted
+ */
+bool SnapshotDecompress(const uint8_t *Input, size_t Size, uint8_t *Page) {
+
+  size_t Index = 0;
+  size_t PageIndex = 0;
+  size_t Count;
+
+  while (Index < Size) {
+
+    if (Input[Index] < SNAPSHOT_MAX_LITERAL) {
+
+      Count = Input[Index] + 1;
+
+      if (Index + 1 + Count > Size || PageIndex + Count > SNAPSHOT_PAGE_SIZE) {
+        return false;
+      }
+
+      memcpy(&Page[PageIndex], &Input[Index + 1], Count);
+      Index += 1 + Count;
+
+    } else {
+
+      Count = Input[Index] - SNAPSHOT_MAX_LITERAL + SNAPSHOT_MIN_REPEAT;
+
+      if (Index + 2 > Size || PageIndex + Count > SNAPSHOT_PAGE_SIZE) {
+        return false;
+      }
+
+      memset(&Page[PageIndex], Input[Index + 1], Count);
+      Index += 2;
+    }
+
+    PageIndex += Count;
+  }
+
+  return PageIndex == SNAPSHOT_PAGE_SIZE;
+}
+
+bool SnapshotLoadPage(const SNAPSHOT_PAGE_REFERENCE &StoredPage,
+                      uint8_t *Page) {
+
+  if (!StoredPage->Compressed) {
+    memcpy(Page, StoredPage->Data.data(), SNAPSHOT_PAGE_SIZE);
+    return true;
+  }
+
+  return SnapshotDecompress(StoredPage->Data.data(), StoredPage->Data.size(),
+                            Page);
+}
+
+/**
+ * @brief Find a page in the store or add it to the store
+ *
+ */
+SNAPSHOT_PAGE_REFERENCE SnapshotStorePage(const uint8_t *Page) {
+
+  uint8_t Compressed[SNAPSHOT_PAGE_SIZE];
+  size_t CompressedSize = SnapshotCompress(Page, Compressed);
+  uint64_t Hash = SnapshotHashPage(Page);
+  auto &Bucket = g_SnapshotPageStore[Hash];
+  auto StoredPage = std::make_shared<SNAPSHOT_STORED_PAGE>();
+
+  StoredPage->Hash = Hash;
+  StoredPage->Compressed = CompressedSize != 0;
+
+  if (StoredPage->Compressed) {
+    StoredPage->Data.assign(Compressed, Compressed + CompressedSize);
+  } else {
+    StoredPage->Data.assign(Page, Page + SNAPSHOT_PAGE_SIZE);
+  }
+
+  //
+  // The compression is deterministic, so the same pages have the same data
+  //
+  for (auto &Item : Bucket) {
+    if (Item->Compressed == StoredPage->Compressed &&
+        Item->Data == StoredPage->Data) {
+      return Item;
+    }
+  }
+
+  Bucket.push_back(StoredPage);
+
+  return StoredPage;
+}
+
+/**
+ * @brief Remove the pages that are not used by any snapshot
+ *
+ */
+void SnapshotCollectPages() {
+
+  for (auto Item = g_SnapshotPageStore.begin();
+       Item != g_SnapshotPageStore.end();) {
+
+    auto &Bucket = Item->second;
+
+    Bucket.erase(std::remove_if(Bucket.begin(), Bucket.end(),
+                                [](const SNAPSHOT_PAGE_REFERENCE &Page) {
+                                  return Page.use_count() == 1;
+                                }),
+                 Bucket.end());
+
+    if (Bucket.empty()) {
+      Item = g_SnapshotPageStore.erase(Item);
+    } else {
+      Item++;
+    }
+  }
+}
+
+/**
+ * @brief Take a snapshot of the ranges of a process
+ * @details The pages that are not readable are not kept, if there is
+ * a snapshot with the same name then it's replaced
+ *
+ * @param Name Name of the snapshot
+ * @param Pid Process id
+ * @param Ranges The ranges to capture
+ * @param ReadPages Callback that reads the pages
+ * @param Context Passed to the callback
+ * @return bool Returns false if the callback fails
+ */
+bool SnapshotTake(const std::string &Name, uint32_t Pid,
+                  const std::vector<SNAPSHOT_RANGE> &Ranges,
+                  SNAPSHOT_READ_PAGES ReadPages, void *Context) {
+
+  SNAPSHOT Snapshot;
+  std::vector<uint64_t> Pages;
+  std::vector<uint8_t> Buffer(SNAPSHOT_READ_PAGES_PER_REQUEST *
+                              SNAPSHOT_PAGE_SIZE);
+  std::vector<uint32_t> ValidBytes(SNAPSHOT_READ_PAGES_PER_REQUEST);
+  uint32_t Count;
+
+  for (auto &Range : Ranges) {
+
+    if (Range.Size == 0) {
+      continue;
+    }
+
+    for (uint64_t Page = Range.Address & ~((uint64_t)SNAPSHOT_PAGE_SIZE - 1);
+         Page <= Range.Address + Range.Size - 1; Page += SNAPSHOT_PAGE_SIZE) {
+      Pages.push_back(Page);
+
+      if (Page + SNAPSHOT_PAGE_SIZE == 0) {
+        break;
+      }
+    }
+  }
+
+  std::sort(Pages.begin(), Pages.end());
+  Pages.erase(std::unique(Pages.begin(), Pages.end()), Pages.end());
+
+  Snapshot.Pid = Pid;
+
+  for (size_t First = 0; First < Pages.size();
+       First += SNAPSHOT_READ_PAGES_PER_REQUEST) {
+
+    Count = (uint32_t)std::min<size_t>(Pages.size() - First,
+                                       SNAPSHOT_READ_PAGES_PER_REQUEST);
+
+    memset(Buffer.data(), 0, Buffer.size());
+    memset(ValidBytes.data(), 0, ValidBytes.size() * sizeof(uint32_t));
+
+    if (!ReadPages(Context, Pid, &Pages[First], Count, Buffer.data(),
+                   ValidBytes.data())) {
+      Snapshot.Pages.clear();
+      SnapshotCollectPages();
+      return false;
+    }
+
+    for (uint32_t i = 0; i < Count; i++) {
+      if (ValidBytes[i] != 0) {
+        Snapshot.Pages[Pages[First + i]] =
+            SnapshotStorePage(&Buffer[i * SNAPSHOT_PAGE_SIZE]);
+      }
+    }
+  }
+
+  g_Snapshots[Name] = std::move(Snapshot);
+
+  //
+  // The pages of the replaced snapshot might not be used anymore
+  //
+  SnapshotCollectPages();
+
+  return true;
+}
+
+bool SnapshotDelete(const std::string &Name) {
+
+  if (!g_Snapshots.erase(Name)) {
+    return false;
+  }
+
+  SnapshotCollectPages();
+
+  return true;
+}
+
+void SnapshotDeleteAll() {
+  g_Snapshots.clear();
+  g_SnapshotPageStore.clear();
+}
+
+void SnapshotAddChangedByte(uint64_t Address, PSNAPSHOT_DIFF Diff) {
+
+  Diff->ChangedBytes++;
+
+  if (!Diff->Runs.empty() &&
+      Diff->Runs.back().Address + Diff->Runs.back().Length == Address) {
+    Diff->Runs.back().Length++;
+  } else {
+    Diff->Runs.push_back({Address, 1});
+  }
+}
+
+/**
+ * @brief Add the changed bytes of two pages to the diff
+ * @details The adjacent changed bytes (even on the adjacent pages) are
+ * merged into a single run
+ *
+ */
+void SnapshotComparePages(uint64_t Address, const uint8_t *First,
+                          const uint8_t *Second, PSNAPSHOT_DIFF Diff) {
+
+  uint32_t Mask;
+
+  for (size_t Offset = 0; Offset < SNAPSHOT_PAGE_SIZE; Offset += 16) {
+
+#ifdef SNAPSHOT_COMPARE_SSE2
+    __m128i FirstBlock =
+        _mm_loadu_si128((const __m128i *)(First + Offset));
+    __m128i SecondBlock =
+        _mm_loadu_si128((const __m128i *)(Second + Offset));
+
+    Mask = ~(uint32_t)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(FirstBlock, SecondBlock)) &
+           0xffff;
+#else
+    Mask = 0;
+
+    if (memcmp(First + Offset, Second + Offset, 16)) {
+      for (uint32_t i = 0; i < 16; i++) {
+        if (First[Offset + i] != Second[Offset + i]) {
+          Mask |= 1u << i;
+        }
+      }
+    }
+#endif
+
+    for (uint32_t i = 0; Mask != 0; i++, Mask >>= 1) {
+      if (Mask & 1) {
+        SnapshotAddChangedByte(Address + Offset + i, Diff);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Find the differences of two snapshots
+ * @details The pages are compared by their stored page first, so the
+ * identical pages are not decompressed
+ *
+ * @param First Name of the older snapshot
+ * @param Second Name of the newer snapshot
+ * @param Diff The result
+ * @return bool Returns false if one of the snapshots is not found
+ */
+bool SnapshotDiff(const std::string &First, const std::string &Second,
+                  PSNAPSHOT_DIFF Diff) {
+
+  uint8_t FirstPage[SNAPSHOT_PAGE_SIZE];
+  uint8_t SecondPage[SNAPSHOT_PAGE_SIZE];
+  auto FirstSnapshot = g_Snapshots.find(First);
+  auto SecondSnapshot = g_Snapshots.find(Second);
+
+  if (FirstSnapshot == g_Snapshots.end() ||
+      SecondSnapshot == g_Snapshots.end()) {
+    return false;
+  }
+
+  *Diff = SNAPSHOT_DIFF{};
+
+  auto FirstItem = FirstSnapshot->second.Pages.begin();
+  auto SecondItem = SecondSnapshot->second.Pages.begin();
+  auto FirstEnd = FirstSnapshot->second.Pages.end();
+  auto SecondEnd = SecondSnapshot->second.Pages.end();
+
+  while (FirstItem != FirstEnd || SecondItem != SecondEnd) {
+
+    if (SecondItem == SecondEnd ||
+        (FirstItem != FirstEnd && FirstItem->first < SecondItem->first)) {
+      Diff->RemovedPages.push_back(FirstItem->first);
+      FirstItem++;
+      continue;
+    }
+
+    if (FirstItem == FirstEnd || SecondItem->first < FirstItem->first) {
+      Diff->AddedPages.push_back(SecondItem->first);
+      SecondItem++;
+      continue;
+    }
+
+    if (FirstItem->second == SecondItem->second) {
+      Diff->IdenticalPages++;
+    } else if (SnapshotLoadPage(FirstItem->second, FirstPage) &&
+               SnapshotLoadPage(SecondItem->second, SecondPage)) {
+      Diff->ChangedPages++;
+      SnapshotComparePages(FirstItem->first, FirstPage, SecondPage, Diff);
+    }
+
+    FirstItem++;
+    SecondItem++;
+  }
+
+  return true;
+}
+
+bool SnapshotReadPage(const std::string &Name, uint64_t Page,
+                      uint8_t *Buffer) {
+
+  auto Snapshot = g_Snapshots.find(Name);
+
+  if (Snapshot == g_Snapshots.end()) {
+    return false;
+  }
+
+  auto Item = Snapshot->second.Pages.find(Page);
+
+  if (Item == Snapshot->second.Pages.end()) {
+    return false;
+  }
+
+  return SnapshotLoadPage(Item->second, Buffer);
+}
+
+std::vector<SNAPSHOT_INFORMATION> SnapshotList() {
+
+  std::vector<SNAPSHOT_INFORMATION> Result;
+
+  for (auto &Item : g_Snapshots) {
+    Result.push_back(
+        {Item.first, Item.second.Pid, (uint64_t)Item.second.Pages.size()});
+  }
+
+  return Result;
+}
+
+void SnapshotGetStoreStatistics(PSNAPSHOT_STORE_STATISTICS Statistics) {
+
+  *Statistics = SNAPSHOT_STORE_STATISTICS{};
+
+  for (auto &Item : g_Snapshots) {
+    Statistics->NumberOfPages += Item.second.Pages.size();
+  }
+
+  for (auto &Bucket : g_SnapshotPageStore) {
+    for (auto &Page : Bucket.second) {
+      Statistics->NumberOfUniquePages++;
+      Statistics->StoredBytes += Page->Data.size();
+    }
+  }
+}
@@ -0,0 +1,92 @@
+/**
+ * @file snapshot.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the memory snapshots and their diff engine
+ * @details This engine doesn't depend on the driver or on Windows, the
+ * pages are read with a callback
+ * @version 0.1
+ * @date 2020-05-10
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SNAPSHOT_PAGE_SIZE 0x1000
+
+//
+// Number of the pages that are requested from the read callback at once
+//
+#define SNAPSHOT_READ_PAGES_PER_REQUEST 0x400
+
+/**
+ * @brief Read a list of pages of the target process
+ * @details The page n is read to Buffer + (n * SNAPSHOT_PAGE_SIZE) and the
+ * number of its bytes that are read is set in ValidBytes[n], if a page
+ * is partially read then the rest of it is zero
+ *
+ */
+typedef bool (*SNAPSHOT_READ_PAGES)(void *Context, uint32_t Pid,
+                                    const uint64_t *Pages,
+                                    uint32_t NumberOfPages, uint8_t *Buffer,
+                                    uint32_t *ValidBytes);
+
+typedef struct _SNAPSHOT_RANGE {
+  uint64_t Address;
+  uint64_t Size;
+
+} SNAPSHOT_RANGE, *PSNAPSHOT_RANGE;
+
+/**
+ * @brief A range of the bytes that are changed between two snapshots
+ *
+ */
+typedef struct _SNAPSHOT_DIFF_RUN {
+  uint64_t Address;
+  uint64_t Length;
+
+} SNAPSHOT_DIFF_RUN, *PSNAPSHOT_DIFF_RUN;
+
+typedef struct _SNAPSHOT_DIFF {
+  uint64_t IdenticalPages;
+  uint64_t ChangedPages;
+  uint64_t ChangedBytes;
+  std::vector<SNAPSHOT_DIFF_RUN> Runs;
+  std::vector<uint64_t> AddedPages;   // Only readable in the second snapshot
+  std::vector<uint64_t> RemovedPages; // Only readable in the first snapshot
+
+} SNAPSHOT_DIFF, *PSNAPSHOT_DIFF;
+
+typedef struct _SNAPSHOT_INFORMATION {
+  std::string Name;
+  uint32_t Pid;
+  uint64_t NumberOfPages; // Readable pages
+
+} SNAPSHOT_INFORMATION, *PSNAPSHOT_INFORMATION;
+
+typedef struct _SNAPSHOT_STORE_STATISTICS {
+  uint64_t NumberOfPages;       // Pages of all of the snapshots
+  uint64_t NumberOfUniquePages; // Pages that are actually stored
+  uint64_t StoredBytes;         // Size of the compressed unique pages
+
+} SNAPSHOT_STORE_STATISTICS, *PSNAPSHOT_STORE_STATISTICS;
+
+bool SnapshotTake(const std::string &Name, uint32_t Pid,
+                  const std::vector<SNAPSHOT_RANGE> &Ranges,
+                  SNAPSHOT_READ_PAGES ReadPages, void *Context);
+bool SnapshotDelete(const std::string &Name);
+void SnapshotDeleteAll();
+bool SnapshotDiff(const std::string &First, const std::string &Second,
+                  PSNAPSHOT_DIFF Diff);
+bool SnapshotReadPage(const std::string &Name, uint64_t Page,
+                      uint8_t *Buffer);
+std::vector<SNAPSHOT_INFORMATION> SnapshotList();
+void SnapshotGetStoreStatistics(PSNAPSHOT_STORE_STATISTICS Statistics);
+
+size_t SnapshotCompress(const uint8_t *Page, uint8_t *Output);
+bool SnapshotDecompress(const uint8_t *Input, size_t Size, uint8_t *Page);
+void SnapshotComparePages(uint64_t Address, const uint8_t *First,
+                          const uint8_t *Second, PSNAPSHOT_DIFF Diff);
@@ -28,7 +28,7 @@ SaveTheRegisters:
 
 	mov rcx, rsp		    ; Fast call argument to PGUEST_REGS
     mov rdx, [rsp +080h]    ; Fast call argument (second) - CalledFrom
-    sub rdx, 5              ; as we used (call $ + 5) so we subtract it by 5 
+    sub rdx, 5              ; as the detour site is a 5 bytes call (to here, to a stub or call $ + 5) so we subtract it by 5 
 	sub	rsp, 28h		; Free some space for Shadow Section
 
 	call	ExtensionCommandHiddenHookGeneralDetourEventHandler
@@ -15,19 +15,343 @@
 #include "DebuggerCommands.h"
 #include "GlobalVariables.h"
 #include "InlineAsm.h"
+#include "DpcRoutines.h"
+#include "Common.h"
+#include "Broadcast.h"
 
 /**
- * @brief Broadcast syscall hook to all cores
+ * @brief Count the cores that are selected by a core mask
  * 
+ * @param CoreMask The selected cores or BROADCAST_ALL_CORES
+ * @return UINT32 
+ */
+UINT32
+BroadcastWorkQueueCountCores(UINT64 CoreMask)
+{
+    UINT32 ProcessorCount = KeQueryActiveProcessorCount(0);
+
+    if (CoreMask == BROADCAST_ALL_CORES)
+    {
+        return ProcessorCount;
+    }
+
+    //
+    // Remove the cores that are not present, the mask covers the first 64 cores
+    //
+    if (ProcessorCount < 64)
+    {
+        CoreMask &= (1ull << ProcessorCount) - 1;
+    }
+
+    return (UINT32)__popcnt64(CoreMask);
+}
+
+/**
+ * @brief Allocate a work request for a number of cores
+ * 
+ * @param NumberOfCores Number of the selected cores
+ * @param Operations The operations (non-paged)
+ * @param NumberOfOperations Number of the operations
+ * @param Results Receives the results of all the cores (non-paged, optional)
+ * @return PBROADCAST_WORK_REQUEST The request or NULL if there is no memory
+ */
+PBROADCAST_WORK_REQUEST
+BroadcastWorkQueueAllocate(UINT32 NumberOfCores, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results)
+{
+    PBROADCAST_WORK_REQUEST WorkRequest;
+
+    WorkRequest = ExAllocatePoolWithTag(NonPagedPool, sizeof(BROADCAST_WORK_REQUEST) + (NumberOfCores - 1) * sizeof(KDPC), POOLTAG);
+
+    if (!WorkRequest)
+    {
+        return NULL;
+    }
+
+    WorkRequest->Operations         = Operations;
+    WorkRequest->NumberOfOperations = NumberOfOperations;
+    WorkRequest->Results            = Results;
+    WorkRequest->PendingCores       = NumberOfCores;
+
+    KeInitializeEvent(&WorkRequest->CompletionEvent, NotificationEvent, FALSE);
+
+    return WorkRequest;
+}
+
+/**
+ * @brief Queue the DPC of a row of a work request to a core
+ * @details If the DPC can't be targeted, the results of the row are zero
+ * 
+ * @param WorkRequest The request
+ * @param Row The row of the results of the core
+ * @param CoreIndex The core (a core of processor group 0)
+ * @return VOID
+ */
+VOID
+BroadcastWorkQueueInsertDpc(PBROADCAST_WORK_REQUEST WorkRequest, UINT64 Row, UINT32 CoreIndex)
+{
+    PROCESSOR_NUMBER ProcessorNumber;
+
+    KeInitializeDpc(&WorkRequest->Dpcs[Row], BroadcastDpcPerformWorkQueue, WorkRequest);
+
+    //
+    // The system-wide indexes start with the cores of group 0, so the index of
+    // a core of group 0 is its number in the group
+    //
+    if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(CoreIndex, &ProcessorNumber)) ||
+        !NT_SUCCESS(KeSetTargetProcessorDpcEx(&WorkRequest->Dpcs[Row], &ProcessorNumber)))
+    {
+        if (WorkRequest->Results != NULL)
+        {
+            RtlZeroMemory(&WorkRequest->Results[Row * WorkRequest->NumberOfOperations], WorkRequest->NumberOfOperations * sizeof(UINT64));
+        }
+
+        if (InterlockedDecrement(&WorkRequest->PendingCores) == 0)
+        {
+            KeSetEvent(&WorkRequest->CompletionEvent, IO_NO_INCREMENT, FALSE);
+        }
+
+        return;
+    }
+
+    //
+    // The row of the core is passed to its DPC
+    //
+    KeSetImportanceDpc(&WorkRequest->Dpcs[Row], HighImportance);
+    KeInsertQueueDpc(&WorkRequest->Dpcs[Row], (PVOID)Row, NULL);
+}
+
+/**
+ * @brief Wait for all the cores of a work request and free it
+ * 
+ * @param WorkRequest The request
+ * @return VOID
+ */
+VOID
+BroadcastWorkQueueWait(PBROADCAST_WORK_REQUEST WorkRequest)
+{
+    //
+    // The DPC of the current core (if it's selected) runs as soon as
+    // this thread waits, so there is no deadlock here
+    //
+    KeWaitForSingleObject(&WorkRequest->CompletionEvent, Executive, KernelMode, FALSE, NULL);
+
+    ExFreePoolWithTag(WorkRequest, POOLTAG);
+}
+
+/**
+ * @brief Perform a batch of operations on a set of cores
+ * @details A DPC is queued to each of the selected cores and the whole batch
+ * is performed in that DPC, the results of each core are in a row of
+ * NumberOfOperations results in the order of the selected cores. Nothing is
+ * shared between the requests so they don't serialize each other. The cores
+ * are the cores of processor group 0 that are counted by
+ * KeQueryActiveProcessorCount(0), the same numbering as g_GuestState, should
+ * be called at IRQL <= APC_LEVEL
+ * 
+ * @param CoreMask The selected cores (the first 64 cores) or BROADCAST_ALL_CORES
+ * @param Operations The operations (non-paged)
+ * @param NumberOfOperations Number of the operations
+ * @param Results Receives the results of all the cores (non-paged, optional)
+ * @return NTSTATUS 
+ */
+NTSTATUS
+BroadcastWorkQueueSubmit(UINT64 CoreMask, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results)
+{
+    PBROADCAST_WORK_REQUEST WorkRequest;
+    UINT32                  ProcessorCount = KeQueryActiveProcessorCount(0);
+    UINT32                  NumberOfCores  = BroadcastWorkQueueCountCores(CoreMask);
+    UINT64                  Row            = 0;
+
+    if (NumberOfCores == 0 || NumberOfOperations == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WorkRequest = BroadcastWorkQueueAllocate(NumberOfCores, Operations, NumberOfOperations, Results);
+
+    if (!WorkRequest)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (UINT32 i = 0; i < ProcessorCount; i++)
+    {
+        if (CoreMask != BROADCAST_ALL_CORES && (i >= 64 || !(CoreMask & (1ull << i))))
+        {
+            continue;
+        }
+
+        BroadcastWorkQueueInsertDpc(WorkRequest, Row, i);
+
+        Row++;
+    }
+
+    BroadcastWorkQueueWait(WorkRequest);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Perform a batch of operations on a single core
+ * @details The same as BroadcastWorkQueueSubmit, but the core is selected by
+ * its index so all the cores (not only the first 64 cores) can be selected,
+ * should be called at IRQL <= APC_LEVEL
+ * 
+ * @param CoreIndex The core
+ * @param Operations The operations (non-paged)
+ * @param NumberOfOperations Number of the operations
+ * @param Results Receives the results of the core (non-paged, optional)
+ * @return NTSTATUS 
+ */
+NTSTATUS
+BroadcastWorkQueueSubmitToCore(UINT32 CoreIndex, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results)
+{
+    PBROADCAST_WORK_REQUEST WorkRequest;
+
+    if (CoreIndex >= KeQueryActiveProcessorCount(0) || NumberOfOperations == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WorkRequest = BroadcastWorkQueueAllocate(1, Operations, NumberOfOperations, Results);
+
+    if (!WorkRequest)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    BroadcastWorkQueueInsertDpc(WorkRequest, 0, CoreIndex);
+
+    BroadcastWorkQueueWait(WorkRequest);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Perform the batch of a work request on the current core
+ * 
+ * @param DeferredContext The request (PBROADCAST_WORK_REQUEST)
+ * @param SystemArgument1 The row of the results of this core
  * @return VOID 
  */
 VOID
-BroadcastDpcEnableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+BroadcastDpcPerformWorkQueue(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
 {
+    PBROADCAST_WORK_REQUEST WorkRequest = (PBROADCAST_WORK_REQUEST)DeferredContext;
+    ULONG                   CoreIndex   = KeGetCurrentProcessorNumber();
+    PBROADCAST_OPERATION    Operation;
+    UINT64                  Result;
+
+    for (UINT32 i = 0; i < WorkRequest->NumberOfOperations; i++)
+    {
+        Operation = &WorkRequest->Operations[i];
+
+        switch (Operation->Type)
+        {
+        case BROADCAST_OPERATION_READ_MSR:
+        {
+            Result = __readmsr((ULONG)Operation->Target);
+            break;
+        }
+        case BROADCAST_OPERATION_WRITE_MSR:
+        {
+            __writemsr((ULONG)Operation->Target, Operation->Parameters[0]);
+            Result = Operation->Parameters[0];
+            break;
+        }
+        case BROADCAST_OPERATION_VMCALL:
+        {
+            Result = (UINT64)AsmVmxVmcall(Operation->Target, Operation->Parameters[0], Operation->Parameters[1], Operation->Parameters[2]);
+            break;
+        }
+        case BROADCAST_OPERATION_ROUTINE:
+        {
+            Result = ((BROADCAST_ROUTINE)Operation->Target)(CoreIndex, (PVOID)Operation->Parameters[0]);
+            break;
+        }
+        default:
+        {
+            Result = 0;
+            break;
+        }
+        }
+
+        if (WorkRequest->Results != NULL)
+        {
+            WorkRequest->Results[(UINT64)SystemArgument1 * WorkRequest->NumberOfOperations + i] = Result;
+        }
+    }
+
     //
-    // Enable Syscall hook from vmx-root
+    // The request is freed after the event is signaled, nothing
+    // should be accessed after it
     //
-    AsmVmxVmcall(VMCALL_ENABLE_SYSCALL_HOOK_EFER, 0, 0, 0);
+    if (InterlockedDecrement(&WorkRequest->PendingCores) == 0)
+    {
+        KeSetEvent(&WorkRequest->CompletionEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
+/**
+ * @brief Broadcast to start or stop the periodic MSR sampler on all cores
+ * @details The timer of each core is stopped and its samples are sent
+ * first, then it's started again if the core is selected
+ * 
+ * @param DeferredContext The configuration (PDEBUGGER_MSR_SAMPLER_REQUEST)
+ * @return VOID 
+ */
+VOID
+BroadcastDpcConfigureMsrSampler(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    PDEBUGGER_MSR_SAMPLER_REQUEST    MsrSamplerRequest = (PDEBUGGER_MSR_SAMPLER_REQUEST)DeferredContext;
+    ULONG                            CoreIndex         = KeGetCurrentProcessorNumber();
+    PPROCESSOR_DEBUGGING_MSR_SAMPLER MsrSampler        = &g_GuestState[CoreIndex].DebuggingState.MsrSampler;
+    PMSR_SAMPLE_RECORDS_HEADER       Header            = (PMSR_SAMPLE_RECORDS_HEADER)MsrSampler->Packet;
+    UINT32                           MaximumRecords;
+    LARGE_INTEGER                    DueTime;
+    PROCESSOR_NUMBER                 ProcessorNumber;
+
+    if (MsrSampler->IsEnabled)
+    {
+        KeCancelTimer(&MsrSampler->Timer);
+        MsrSampler->IsEnabled = FALSE;
+        DpcRoutineFlushMsrSamples(CoreIndex);
+    }
+
+    if (MsrSamplerRequest->IsEnabled && CoreIndex < 64 && (MsrSamplerRequest->CoreMask & (1ull << CoreIndex)))
+    {
+        Header->CoreIndex         = CoreIndex;
+        Header->NumberOfRecords   = 0;
+        Header->NumberOfMsrs      = (UINT16)MsrSamplerRequest->NumberOfMsrs;
+        Header->SessionId         = MsrSamplerRequest->SessionId;
+        MsrSampler->SizeOfRecords = 0;
+
+        //
+        // The samples are sent at least every 100 milliseconds
+        //
+        MaximumRecords               = (sizeof(MsrSampler->Packet) - sizeof(MSR_SAMPLE_RECORDS_HEADER)) / MSR_SAMPLE_RECORD_SIZE(Header->NumberOfMsrs);
+        MsrSampler->RecordsPerPacket = (UINT16)max(1, min(MaximumRecords, 100 / MsrSamplerRequest->Interval));
+
+        KeInitializeTimer(&MsrSampler->Timer);
+        KeInitializeDpc(&MsrSampler->Dpc, DpcRoutineSampleMsrs, NULL);
+
+        //
+        // The DPC of the timer runs on this core, a CCHAR target (KeSetTargetProcessorDpc)
+        // can't address all the cores
+        //
+        if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(CoreIndex, &ProcessorNumber)) ||
+            !NT_SUCCESS(KeSetTargetProcessorDpcEx(&MsrSampler->Dpc, &ProcessorNumber)))
+        {
+            LogError("The MSR sampler can't target core : 0x%x", CoreIndex);
+        }
+        else
+        {
+            MsrSampler->IsEnabled = TRUE;
+
+            DueTime.QuadPart = -((LONGLONG)MsrSamplerRequest->Interval * 10000);
+            KeSetTimerEx(&MsrSampler->Timer, DueTime, MsrSamplerRequest->Interval, &MsrSampler->Dpc);
+        }
+    }
 
     //
     // Wait for all DPCs to synchronize at this point
@@ -41,17 +365,17 @@ BroadcastDpcEnableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID Sys
 }
 
 /**
- * @brief Broadcast syscall unhook to all cores
+ * @brief Broadcast the changes of the EPT views of processes to all cores
  * 
  * @return VOID 
  */
 VOID
-BroadcastDpcDisableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+BroadcastDpcUpdateEptProcessViews(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
 {
     //
-    // Disable Syscall hook from vmx-root
+    // Update cr3 vm-exits and the current EPTP from vmx-root
     //
-    AsmVmxVmcall(VMCALL_DISABLE_SYSCALL_HOOK_EFER, 0, 0, 0);
+    AsmVmxVmcall(VMCALL_UPDATE_PROCESS_VIEWS, 0, 0, 0);
 
     //
     // Wait for all DPCs to synchronize at this point
@@ -65,21 +389,17 @@ BroadcastDpcDisableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID Sy
 }
 
 /**
- * @brief Broadcast msr write
+ * @brief Broadcast to enable Page Modification Logging on all cores
  * 
  * @return VOID 
  */
 VOID
-BroadcastDpcWriteMsrToAllCores(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+BroadcastDpcEnablePml(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
 {
-    ULONG CurrentProcessorIndex = 0;
-
-    CurrentProcessorIndex = KeGetCurrentProcessorNumber();
-
     //
-    // write on MSR
+    // Set the PML address and the PML control from vmx-root
     //
-    __writemsr(g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Msr, g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Value);
+    AsmVmxVmcall(VMCALL_ENABLE_PML, 0, 0, 0);
 
     //
     // Wait for all DPCs to synchronize at this point
@@ -93,21 +413,44 @@ BroadcastDpcWriteMsrToAllCores(KDPC * Dpc, PVOID DeferredContext, PVOID SystemAr
 }
 
 /**
- * @brief Broadcast msr read
+ * @brief Broadcast to enable or disable the binary syscall trace on all cores
  * 
+ * @param DeferredContext The request (PDEBUGGER_SYSCALL_TRACE_REQUEST)
  * @return VOID 
  */
 VOID
-BroadcastDpcReadMsrToAllCores(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+BroadcastDpcConfigureSyscallTrace(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
 {
-    ULONG CurrentProcessorIndex = 0;
+    PDEBUGGER_SYSCALL_TRACE_REQUEST SyscallTraceRequest = (PDEBUGGER_SYSCALL_TRACE_REQUEST)DeferredContext;
+
+    //
+    // Change the trace from vmx-root
+    //
+    AsmVmxVmcall(VMCALL_CONFIGURE_SYSCALL_TRACE, SyscallTraceRequest->IsEnabled, SyscallTraceRequest->NumberOfStackArguments, 0);
+
+    //
+    // Wait for all DPCs to synchronize at this point
+    //
+    KeSignalCallDpcSynchronize(SystemArgument2);
 
-    CurrentProcessorIndex = KeGetCurrentProcessorNumber();
+    //
+    // Mark the DPC as being complete
+    //
+    KeSignalCallDpcDone(SystemArgument1);
+}
 
+/**
+ * @brief Broadcast to drain and disable Page Modification Logging on all cores
+ * 
+ * @return VOID 
+ */
+VOID
+BroadcastDpcDisablePml(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
     //
-    // read on MSR
+    // Drain the logged pages and unset the PML control from vmx-root
     //
-    g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Value = __readmsr(g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Msr);
+    AsmVmxVmcall(VMCALL_DISABLE_PML, 0, 0, 0);
 
     //
     // Wait for all DPCs to synchronize at this point
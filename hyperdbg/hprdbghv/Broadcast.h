@@ -12,16 +12,92 @@
 #pragma once
 #include <ntddk.h>
 
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Apply the operations on all of the cores (even after the 64th core)
+ * 
+ */
+#define BROADCAST_ALL_CORES 0xffffffffffffffff
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Types of the operations that are performed on the cores
+ * 
+ */
+typedef enum _BROADCAST_OPERATION_TYPE
+{
+    BROADCAST_OPERATION_READ_MSR,  // Result is the value of the msr
+    BROADCAST_OPERATION_WRITE_MSR, // Result is the written value
+    BROADCAST_OPERATION_VMCALL,    // Result is the status of the vmcall
+    BROADCAST_OPERATION_ROUTINE,   // Result is the return value of the routine
+
+} BROADCAST_OPERATION_TYPE;
+
+/**
+ * @brief The routine of BROADCAST_OPERATION_ROUTINE, it's called at DISPATCH_LEVEL
+ * 
+ */
+typedef UINT64 (*BROADCAST_ROUTINE)(UINT32 CoreIndex, PVOID Context);
+
+/**
+ * @brief An operation that is performed on each of the selected cores
+ * 
+ */
+typedef struct _BROADCAST_OPERATION
+{
+    BROADCAST_OPERATION_TYPE Type;
+    UINT64                   Target;        // Msr (ecx), vmcall number or the routine (BROADCAST_ROUTINE)
+    UINT64                   Parameters[3]; // The value to write, parameters of the vmcall or the context of the routine
+
+} BROADCAST_OPERATION, *PBROADCAST_OPERATION;
+
+/**
+ * @brief A batch of operations that is queued to the selected cores, each core
+ * runs the whole batch in a single DPC and the last core signals the event
+ * 
+ */
+typedef struct _BROADCAST_WORK_REQUEST
+{
+    PBROADCAST_OPERATION Operations;
+    UINT32               NumberOfOperations;
+    PUINT64              Results;         // NumberOfOperations results for each core (optional)
+    volatile LONG        PendingCores;    // Cores that have not finished the batch yet
+    KEVENT               CompletionEvent; // Signaled when all of the cores are finished
+    KDPC                 Dpcs[1];         // One DPC for each of the selected cores
+
+} BROADCAST_WORK_REQUEST, *PBROADCAST_WORK_REQUEST;
 
 //////////////////////////////////////////////////
 //					Functions					//
 //////////////////////////////////////////////////
 
+UINT32
+BroadcastWorkQueueCountCores(UINT64 CoreMask);
+PBROADCAST_WORK_REQUEST
+BroadcastWorkQueueAllocate(UINT32 NumberOfCores, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results);
+VOID
+BroadcastWorkQueueInsertDpc(PBROADCAST_WORK_REQUEST WorkRequest, UINT64 Row, UINT32 CoreIndex);
+VOID
+BroadcastWorkQueueWait(PBROADCAST_WORK_REQUEST WorkRequest);
+NTSTATUS
+BroadcastWorkQueueSubmit(UINT64 CoreMask, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results);
+NTSTATUS
+BroadcastWorkQueueSubmitToCore(UINT32 CoreIndex, PBROADCAST_OPERATION Operations, UINT32 NumberOfOperations, PUINT64 Results);
+VOID
+BroadcastDpcPerformWorkQueue(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+VOID
+BroadcastDpcConfigureMsrSampler(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
 VOID
-BroadcastDpcEnableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+BroadcastDpcUpdateEptProcessViews(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
 VOID
-BroadcastDpcDisableEferSyscallEvents(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+BroadcastDpcEnablePml(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
 VOID
-BroadcastDpcWriteMsrToAllCores(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+BroadcastDpcDisablePml(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
 VOID
-BroadcastDpcReadMsrToAllCores(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
\ No newline at end of file
+BroadcastDpcConfigureSyscallTrace(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
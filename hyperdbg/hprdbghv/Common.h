@@ -13,6 +13,7 @@
 #pragma once
 #include "Ept.h"
 #include "Configuration.h"
+#include "Spinlock.h"
 #include "Trace.h"
 
 //////////////////////////////////////////////////
@@ -35,16 +36,6 @@ typedef enum _SEGMENT_REGISTERS
     TR
 };
 
-//////////////////////////////////////////////////
-//				 Spinlock Funtions				//
-//////////////////////////////////////////////////
-inline BOOLEAN
-SpinlockTryLock(volatile LONG * Lock);
-inline void
-SpinlockLock(volatile LONG * Lock);
-inline void
-SpinlockUnlock(volatile LONG * Lock);
-
 //////////////////////////////////////////////////
 //					Constants					//
 //////////////////////////////////////////////////
@@ -273,6 +264,15 @@ typedef struct _NT_KPROCESS
     UCHAR             Data[1];
 } NT_KPROCESS, *PNT_KPROCESS;
 
+/**
+ * @brief Offset of UserDirectoryTableBase in KPROCESS
+ * @details It's the cr3 of user-mode when KVA shadowing is enabled, the offset
+ * is valid from Windows 10 1803 (build 17134)
+ * 
+ */
+#define NT_KPROCESS_USER_DIRECTORY_TABLE_BASE_OFFSET    0x280
+#define NT_KPROCESS_USER_DIRECTORY_TABLE_BASE_MIN_BUILD 17134
+
 //////////////////////////////////////////////////
 //				 Function Types					//
 //////////////////////////////////////////////////
@@ -431,12 +431,51 @@ SyscallHookTest();
 /* Enable or Disable Syscall Hook for EFER MSR */
 VOID
 SyscallHookConfigureEFER(BOOLEAN EnableEFERSyscallHook);
+/* Find the sysret of the system call handler (PASSIVE_LEVEL) */
+UINT64
+SyscallHookFindSysretAddress();
+/* Check whether an address is one of the verified sysrets */
+BOOLEAN
+SyscallHookIsVerifiedSysret(UINT64 Address);
+/* Add a sysret to the verified sysrets */
+VOID
+SyscallHookAddVerifiedSysret(UINT64 Address);
 /* Manage #UD Exceptions for EFER Syscall */
 BOOLEAN
 SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex);
 /* SYSRET instruction emulation routine */
 BOOLEAN
-SyscallHookEmulateSYSRET(PGUEST_REGS Regs);
+SyscallHookEmulateSYSRET(PGUEST_REGS Regs, UINT32 CoreIndex);
 /* SYSCALL instruction emulation routine */
 BOOLEAN
-SyscallHookEmulateSYSCALL(PGUEST_REGS Regs);
+SyscallHookEmulateSYSCALL(PGUEST_REGS Regs, UINT32 CoreIndex);
+/* Log a syscall and trigger the events of the syscall hook */
+VOID
+SyscallHookTraceSYSCALL(PGUEST_REGS Regs, UINT32 CoreIndex, UINT64 SyscallAddress);
+/* Initialize the lock and the flush timer of the binary syscall trace (vmx non-root) */
+VOID
+SyscallHookInitializeTrace();
+/* Add the record of a syscall to the binary trace ring of the core (vmx-root) */
+VOID
+SyscallHookAppendTraceRecord(PGUEST_REGS Regs, UINT32 CoreIndex);
+/* Enable or disable the binary trace of the core (vmx-root) */
+VOID
+SyscallHookConfigureTrace(UINT32 CoreIndex, BOOLEAN Enable, UINT32 NumberOfStackArguments);
+/* Copy the records of the binary trace rings of all the cores to a buffer (vmx non-root) */
+UINT32
+SyscallHookReadTrace(PVOID Buffer, UINT32 BufferSize);
+/* Reset the binary trace rings of all the cores (vmx non-root) */
+VOID
+SyscallHookResetTrace();
+/* Free the binary trace rings of all the cores (vmx non-root) */
+VOID
+SyscallHookFreeTrace();
+/* The DPC of the flush timer of the binary syscall trace */
+VOID
+SyscallHookTraceFlushDpcRoutine(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+/* Handle EPT Violation */
+BOOLEAN
+EptHandleEptViolation(PGUEST_REGS Regs, ULONG ExitQualification, UINT64 GuestPhysicalAddr);
+/* Handle hooked pages in Vmx-root mode */
+BOOLEAN
+EptHandleHookedPage(PGUEST_REGS Regs, EPT_HOOKED_PAGE_DETAIL * HookedEntryDetails, PEPT_PML1_ENTRY EntryAddress, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, SIZE_T PhysicalAddress);
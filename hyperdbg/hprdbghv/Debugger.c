@@ -128,9 +128,21 @@ DebuggerInitialize()
     }
 
     //
-    // Initialize the list of hidden hooks headers
+    // Initialize the table of hidden hooks detours
     //
-    InitializeListHead(&g_HiddenHooksDetourListHead);
+    RtlZeroMemory((PVOID)g_HiddenHooksDetourTable, sizeof(g_HiddenHooksDetourTable));
+    RtlZeroMemory(&g_HiddenHooksDetourTableLock, sizeof(SPINLOCK_TICKET));
+    g_HiddenHooksDetourTableCount = 0;
+
+    //
+    // Initialize the lock of the MSR sampler configuration
+    //
+    ExInitializeFastMutex(&g_MsrSamplerMutex);
+
+    //
+    // Initialize the lock of the EFER syscall hook filter
+    //
+    ExInitializeFastMutex(&g_SyscallFilterMutex);
 
     //
     // Enabled Debugger Events
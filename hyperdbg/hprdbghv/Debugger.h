@@ -14,6 +14,7 @@
 #include <ntddk.h>
 #include "Common.h"
 #include "Logging.h"
+#include "PatternMatcher.h"
 
 //////////////////////////////////////////////////
 //				Memory Manager		    		//
@@ -22,20 +23,117 @@
 NTSTATUS
 MemoryManagerReadProcessMemoryNormal(HANDLE PID, PVOID Address, DEBUGGER_READ_MEMORY_TYPE MemType, PVOID UserBuffer, SIZE_T Size, PSIZE_T ReturnSize);
 
+NTSTATUS
+MemoryManagerReadProcessMemoryScatter(HANDLE PID, DEBUGGER_READ_MEMORY_TYPE MemType, PDEBUGGER_READ_MEMORY_RANGE Ranges, UINT32 NumberOfRanges, PVOID RequestBuffer);
+
+NTSTATUS
+MemoryManagerSearchProcessMemory(HANDLE PID, UINT64 Address, UINT64 Length, PPATTERN_MATCHER Matcher, PUINT64 Results, UINT32 MaxResults, PUINT32 NumberOfResults, PUINT64 NextAddress);
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Number of the records in the binary syscall trace ring of each core
+ * 
+ */
+#define SYSCALL_TRACE_RING_ENTRY_COUNT 0x2000
+
+/**
+ * @brief Interval of the timer that wakes up the reader of the binary syscall trace (in milliseconds)
+ * 
+ */
+#define SYSCALL_TRACE_FLUSH_INTERVAL 50
+
+/**
+ * @brief The longest time that the read IOCTL of the binary syscall trace waits for records (in milliseconds)
+ * 
+ */
+#define SYSCALL_TRACE_READ_TIMEOUT 1000
+
 //////////////////////////////////////////////////
 //					Structures					//
 //////////////////////////////////////////////////
 
 /**
- * @brief Use to modify Msrs or read MSR values
+ * @brief The filter of the EFER syscall hook
+ * @details A filter is not changed after it's published in g_SyscallFilter, a
+ * new filter is built and swapped with it, so the #UD handlers of all the cores
+ * only read it
+ * 
+ */
+typedef struct _DEBUGGER_SYSCALL_FILTER
+{
+    BOOLEAN IsSyscallFilterEnabled;                                        // Whether the bitmap is checked or not
+    UINT32  NumberOfProcesses;                                             // Number of the processes in the process filter
+    LONG    ProcessIds[DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES];             // Watched processes (zero means a free slot)
+    UINT32  NumberOfExcludedProcesses;                                     // Number of the ignored processes
+    LONG    ExcludedProcessIds[DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES];     // Ignored processes (zero means a free slot)
+    UINT64  SyscallBitmap[DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER / 64]; // Watched syscalls indexed by RAX
+
+} DEBUGGER_SYSCALL_FILTER, *PDEBUGGER_SYSCALL_FILTER;
+
+/**
+ * @brief The MSRs that SYSCALL and SYSRET use
+ * @details They're cached when the EFER syscall hook is enabled
+ * so the emulation doesn't execute RDMSR
+ * 
+ */
+typedef struct _PROCESSOR_DEBUGGING_SYSCALL_MSRS
+{
+    UINT64 Lstar; // Target of SYSCALL
+    UINT64 Star;  // Selectors of SYSCALL and SYSRET
+    UINT64 Fmask; // The RFLAGS bits that SYSCALL clears
+
+} PROCESSOR_DEBUGGING_SYSCALL_MSRS, *PPROCESSOR_DEBUGGING_SYSCALL_MSRS;
+
+/**
+ * @brief The ring of the binary syscall trace of a core
+ * @details The core writes the records to its ring from vmx-root without
+ * acquiring any lock (it's the only producer), the read IOCTL is the only
+ * consumer and copies the records of all of the cores in bulk
+ * 
+ */
+typedef struct _SYSCALL_TRACE_RING
+{
+    volatile LONG64 Head;                    // Number of the records that are written by the core (vmx-root)
+    volatile LONG64 DroppedRecords;          // Number of the records that are dropped as the ring was full (vmx-root)
+    volatile LONG64 Tail;                    // Number of the records that are read by the client
+    LONG64          ReportedDroppedRecords;  // Number of the dropped records that are reported to the client
+    UCHAR           Records[SYSCALL_TRACE_RING_ENTRY_COUNT][SYSCALL_TRACE_RECORD_SIZE(SYSCALL_TRACE_MAX_STACK_ARGUMENTS)];
+
+} SYSCALL_TRACE_RING, *PSYSCALL_TRACE_RING;
+
+/**
+ * @brief The binary trace of the EFER syscall hook on each core
+ * @details The records are written to the ring of the core, so the
+ * lock of the log buffer is never acquired for the traced syscalls
+ * 
+ */
+typedef struct _PROCESSOR_DEBUGGING_SYSCALL_TRACE
+{
+    BOOLEAN             IsBinaryTraceEnabled;   // Whether the watched syscalls are traced as binary records
+    UINT32              NumberOfStackArguments; // Number of the stack arguments of each record
+    PSYSCALL_TRACE_RING Ring;                   // Records of the core (allocated in vmx non-root)
+
+} PROCESSOR_DEBUGGING_SYSCALL_TRACE, *PPROCESSOR_DEBUGGING_SYSCALL_TRACE;
+
+/**
+ * @brief The periodic MSR sampler on each core
+ * @details The timer DPC is targeted to the core itself, so the samples
+ * of a core are read and batched without any lock
  * 
  */
-typedef struct _PROCESSOR_DEBUGGING_MSR_READ_OR_WRITE
+typedef struct _PROCESSOR_DEBUGGING_MSR_SAMPLER
 {
-    UINT64 Msr;   // Msr (ecx)
-    UINT64 Value; // the value to write on msr
+    KTIMER  Timer;                       // Periodic timer of the sampler
+    KDPC    Dpc;                         // Reads the MSRs when the timer expires
+    BOOLEAN IsEnabled;                   // Whether the core is sampled or not
+    UINT16  RecordsPerPacket;            // The packet is sent after this number of records
+    UINT32  SizeOfRecords;               // Used bytes of the packet after the header
+    UCHAR   Packet[PacketChunkSize - 1]; // MSR_SAMPLE_RECORDS_HEADER and the records
 
-} PROCESSOR_DEBUGGING_MSR_READ_OR_WRITE, PPROCESSOR_DEBUGGING_MSR_READ_OR_WRITE;
+} PROCESSOR_DEBUGGING_MSR_SAMPLER, *PPROCESSOR_DEBUGGING_MSR_SAMPLER;
 
 /**
  * @brief Saves the debugger state
@@ -45,9 +143,11 @@ typedef struct _PROCESSOR_DEBUGGING_MSR_READ_OR_WRITE
  */
 typedef struct _PROCESSOR_DEBUGGING_STATE
 {
-    UINT64                                UndefinedInstructionAddress; // #UD Location of instruction (used by EFER Syscall)
-    UINT64                                SysretAddress;               // Address of sysret
-    PROCESSOR_DEBUGGING_MSR_READ_OR_WRITE MsrState;
+    UINT64                            UndefinedInstructionAddress; // #UD Location of instruction (used by EFER Syscall)
+    GUEST_REGS                        SyscallRegs;                 // Registers before the SYSCALL that is executed by MTF (used by EFER Syscall)
+    PROCESSOR_DEBUGGING_SYSCALL_MSRS  SyscallMsrs;                 // Cached MSRs of the EFER syscall hook
+    PROCESSOR_DEBUGGING_SYSCALL_TRACE SyscallTrace;                // Binary trace of the EFER syscall hook
+    PROCESSOR_DEBUGGING_MSR_SAMPLER   MsrSampler;                  // Periodic MSR sampler
 
 } PROCESSOR_DEBUGGING_STATE, PPROCESSOR_DEBUGGING_STATE;
 
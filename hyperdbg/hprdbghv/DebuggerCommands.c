@@ -16,6 +16,9 @@
 #include "DpcRoutines.h"
 #include "Common.h"
 #include "GlobalVariables.h"
+#include "HypervisorRoutines.h"
+#include "Pml.h"
+#include "InlineAsm.h"
 
 NTSTATUS
 DebuggerCommandReadMemory(PDEBUGGER_READ_MEMORY ReadMemRequest, PVOID UserBuffer, PSIZE_T ReturnSize)
@@ -43,8 +46,10 @@ DebuggerCommandReadMemory(PDEBUGGER_READ_MEMORY ReadMemRequest, PVOID UserBuffer
 NTSTATUS
 DebuggerReadOrWriteMsr(PDEBUGGER_READ_AND_WRITE_ON_MSR ReadOrWriteMsrRequest, UINT64 * UserBuffer, PSIZE_T ReturnSize)
 {
-    NTSTATUS Status;
-    UINT32   ProcessorCount = KeQueryActiveProcessorCount(0);
+    NTSTATUS            Status;
+    BROADCAST_OPERATION Operation = {0};
+
+    *ReturnSize = 0;
 
     //
     // We don't check whether the MSR is in valid range of hardware or not
@@ -53,137 +58,1082 @@ DebuggerReadOrWriteMsr(PDEBUGGER_READ_AND_WRITE_ON_MSR ReadOrWriteMsrRequest, UI
     //
 
     if (ReadOrWriteMsrRequest->ActionType == DEBUGGER_MSR_WRITE)
+    {
+        Operation.Type          = BROADCAST_OPERATION_WRITE_MSR;
+        Operation.Parameters[0] = ReadOrWriteMsrRequest->Value;
+    }
+    else if (ReadOrWriteMsrRequest->ActionType == DEBUGGER_MSR_READ)
+    {
+        Operation.Type = BROADCAST_OPERATION_READ_MSR;
+    }
+    else
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    Operation.Target = ReadOrWriteMsrRequest->Msr;
+
+    //
+    // The request and the user buffer are at the same place, but the operation
+    // is already copied, rdmsr returns a value for each of the cores and wrmsr
+    // has nothing to return
+    //
+    if (ReadOrWriteMsrRequest->CoreNumber == DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES)
+    {
+        Status = BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES,
+                                          &Operation,
+                                          1,
+                                          Operation.Type == BROADCAST_OPERATION_READ_MSR ? UserBuffer : NULL);
+
+        if (NT_SUCCESS(Status) && Operation.Type == BROADCAST_OPERATION_READ_MSR)
+        {
+            *ReturnSize = sizeof(UINT64) * KeQueryActiveProcessorCount(0);
+        }
+    }
+    else
     {
         //
-        // Set Msr to be applied on the target cores
+        // A single core is selected by its index (not by a core mask), so it
+        // might be any of the cores, the invalid cores are rejected
         //
-        if (ReadOrWriteMsrRequest->CoreNumber == DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES)
+        Status = BroadcastWorkQueueSubmitToCore(ReadOrWriteMsrRequest->CoreNumber,
+                                                &Operation,
+                                                1,
+                                                Operation.Type == BROADCAST_OPERATION_READ_MSR ? UserBuffer : NULL);
+
+        if (NT_SUCCESS(Status) && Operation.Type == BROADCAST_OPERATION_READ_MSR)
         {
-            //
-            // Means that we should apply it on all cores
-            //
-            for (size_t i = 0; i < ProcessorCount; i++)
-            {
-                g_GuestState[i].DebuggingState.MsrState.Msr   = ReadOrWriteMsrRequest->Msr;
-                g_GuestState[i].DebuggingState.MsrState.Value = ReadOrWriteMsrRequest->Value;
-            }
-            //
-            // Broadcast to all cores to change their Msrs
-            //
-            KeGenericCallDpc(BroadcastDpcWriteMsrToAllCores, 0x0);
+            *ReturnSize = sizeof(UINT64);
         }
-        else
+    }
+
+    return Status;
+}
+
+/**
+ * @brief Read or write a list of msrs on a set of cores
+ * @details All of the cores are broadcasted once, no matter how many
+ * msrs or cores are selected
+ * 
+ * @param MsrBatchRequest The request, the results are placed after the msrs
+ * @param InputBufferLength Size of the request and the msrs
+ * @param OutputBufferLength Size of the buffer that receives the results
+ * @param ReturnSize Size of the request and the results
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerReadOrWriteMsrBatch(PDEBUGGER_MSR_BATCH_REQUEST MsrBatchRequest, ULONG InputBufferLength, ULONG OutputBufferLength, PSIZE_T ReturnSize)
+{
+    NTSTATUS             Status;
+    UINT32               ProcessorCount = KeQueryActiveProcessorCount(0);
+    UINT64               ResultsSize;
+    PUINT32              Msrs;
+    PBROADCAST_OPERATION Operations;
+
+    *ReturnSize = 0;
+
+    if (MsrBatchRequest->NumberOfMsrs == 0 || MsrBatchRequest->NumberOfMsrs > DEBUGGER_MSR_BATCH_MAX_MSRS ||
+        InputBufferLength < SIZEOF_DEBUGGER_MSR_BATCH_REQUEST + MsrBatchRequest->NumberOfMsrs * sizeof(UINT32) ||
+        (MsrBatchRequest->ActionType != DEBUGGER_MSR_READ && MsrBatchRequest->ActionType != DEBUGGER_MSR_WRITE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Remove the cores that are not present, the mask covers the first 64 cores
+    //
+    if (ProcessorCount < 64)
+    {
+        MsrBatchRequest->CoreMask &= (1ull << ProcessorCount) - 1;
+    }
+
+    if (MsrBatchRequest->CoreMask == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    MsrBatchRequest->NumberOfCores = BroadcastWorkQueueCountCores(MsrBatchRequest->CoreMask);
+    ResultsSize                    = MsrBatchRequest->NumberOfCores * MsrBatchRequest->NumberOfMsrs * sizeof(UINT64);
+
+    if (OutputBufferLength < DEBUGGER_MSR_BATCH_RESULTS_OFFSET(MsrBatchRequest->NumberOfMsrs) + ResultsSize)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Operations = ExAllocatePoolWithTag(NonPagedPool, MsrBatchRequest->NumberOfMsrs * sizeof(BROADCAST_OPERATION), POOLTAG);
+
+    if (!Operations)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // We don't check whether the MSRs are valid, the same as a single
+    // rdmsr or wrmsr
+    //
+    Msrs = (PUINT32)((UINT64)MsrBatchRequest + SIZEOF_DEBUGGER_MSR_BATCH_REQUEST);
+
+    for (UINT32 i = 0; i < MsrBatchRequest->NumberOfMsrs; i++)
+    {
+        Operations[i].Type          = MsrBatchRequest->ActionType == DEBUGGER_MSR_WRITE ? BROADCAST_OPERATION_WRITE_MSR : BROADCAST_OPERATION_READ_MSR;
+        Operations[i].Target        = Msrs[i];
+        Operations[i].Parameters[0] = MsrBatchRequest->Value;
+    }
+
+    //
+    // The rows of the results are in the order of the selected cores
+    //
+    Status = BroadcastWorkQueueSubmit(MsrBatchRequest->CoreMask,
+                                      Operations,
+                                      MsrBatchRequest->NumberOfMsrs,
+                                      (PUINT64)((UINT64)MsrBatchRequest + DEBUGGER_MSR_BATCH_RESULTS_OFFSET(MsrBatchRequest->NumberOfMsrs)));
+
+    ExFreePoolWithTag(Operations, POOLTAG);
+
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    *ReturnSize = DEBUGGER_MSR_BATCH_RESULTS_OFFSET(MsrBatchRequest->NumberOfMsrs) + ResultsSize;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Stop the timers of the MSR sampler on all cores
+ * @details Should be called at PASSIVE_LEVEL while g_MsrSamplerMutex is held
+ * 
+ * @return VOID 
+ */
+static VOID
+DebuggerDisableMsrSampler()
+{
+    DEBUGGER_MSR_SAMPLER_REQUEST MsrSamplerRequest = {0};
+
+    if (!g_MsrSamplerConfiguration.IsEnabled)
+    {
+        return;
+    }
+
+    KeGenericCallDpc(BroadcastDpcConfigureMsrSampler, &MsrSamplerRequest);
+
+    //
+    // Wait for the sampling DPCs that are queued before canceling the timers
+    //
+    KeFlushQueuedDpcs();
+
+    g_MsrSamplerConfiguration.IsEnabled = FALSE;
+}
+
+/**
+ * @brief Stop the periodic MSR sampler on all cores
+ * @details The pending samples are sent to the log buffer, should be
+ * called at PASSIVE_LEVEL
+ * 
+ * @return VOID 
+ */
+VOID
+DebuggerStopMsrSampler()
+{
+    ExAcquireFastMutex(&g_MsrSamplerMutex);
+
+    DebuggerDisableMsrSampler();
+
+    ExReleaseFastMutex(&g_MsrSamplerMutex);
+}
+
+/**
+ * @brief Start or stop the periodic MSR sampler
+ * 
+ * @param MsrSamplerRequest The MSRs, the cores and the interval
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerConfigureMsrSampler(PDEBUGGER_MSR_SAMPLER_REQUEST MsrSamplerRequest)
+{
+    UINT32 ProcessorCount = KeQueryActiveProcessorCount(0);
+
+    if (MsrSamplerRequest->IsEnabled)
+    {
+        if (ProcessorCount < 64)
         {
-            //
-            // We have to change a single core's msr
+            MsrSamplerRequest->CoreMask &= (1ull << ProcessorCount) - 1;
+        }
 
-            //
-            // Check if the core number is not invalid
-            //
-            if (ReadOrWriteMsrRequest->CoreNumber >= ProcessorCount)
-            {
-                return STATUS_INVALID_PARAMETER;
-            }
-            //
-            // Otherwise it's valid
-            //
-            g_GuestState[ReadOrWriteMsrRequest->CoreNumber].DebuggingState.MsrState.Msr   = ReadOrWriteMsrRequest->Msr;
-            g_GuestState[ReadOrWriteMsrRequest->CoreNumber].DebuggingState.MsrState.Value = ReadOrWriteMsrRequest->Value;
+        if (MsrSamplerRequest->NumberOfMsrs == 0 || MsrSamplerRequest->NumberOfMsrs > DEBUGGER_MSR_SAMPLER_MAX_MSRS ||
+            MsrSamplerRequest->Interval == 0 || MsrSamplerRequest->CoreMask == 0)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
 
-            //
-            // Execute it on a single core
-            //
-            Status = DpcRoutineRunTaskOnSingleCore(ReadOrWriteMsrRequest->CoreNumber, DpcRoutinePerformWriteMsr, NULL);
+    //
+    // The configuration is not changed while the timers are running, and
+    // the concurrent requests don't change it at the same time
+    //
+    ExAcquireFastMutex(&g_MsrSamplerMutex);
+
+    DebuggerDisableMsrSampler();
+
+    if (MsrSamplerRequest->IsEnabled)
+    {
+        g_MsrSamplerConfiguration = *MsrSamplerRequest;
+
+        KeGenericCallDpc(BroadcastDpcConfigureMsrSampler, &g_MsrSamplerConfiguration);
+    }
+
+    ExReleaseFastMutex(&g_MsrSamplerMutex);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Compute the memory that is used by EPT tables and hooks
+ * 
+ * @param UserBuffer The structure to fill
+ * @param ReturnSize Size of the filled structure
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerQueryEptMemoryFootprint(PDEBUGGER_EPT_MEMORY_FOOTPRINT UserBuffer, PSIZE_T ReturnSize)
+{
+    ULONG       ProcessorsCount;
+    ULONG       CoreIndex;
+    UINT64      NumberOfSplits;
+    PLIST_ENTRY TempList = 0;
+    KIRQL       OldIrql;
+
+    //
+    // Check if the hypervisor is initialized
+    //
+    if (g_EptState == NULL || g_EptState->EptPageTable == NULL)
+    {
+        *ReturnSize = 0;
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    RtlZeroMemory(UserBuffer, SIZEOF_DEBUGGER_EPT_MEMORY_FOOTPRINT);
+
+    //
+    // The shared identity table
+    //
+    UserBuffer->SharedTableSize       = EptGetPageTableSize(g_EptState->EptPageTable, &NumberOfSplits);
+    UserBuffer->SharedTableSplitPages = NumberOfSplits;
 
-            *ReturnSize = 0;
-            return Status;
+    //
+    // The private tables of the cores
+    //
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    SpinlockLockShared(&EptCoreViewLock);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        if (g_GuestState[CoreIndex].EptView.PageTable != g_EptState->EptPageTable)
+        {
+            UserBuffer->NumberOfPrivateTables++;
+            UserBuffer->PrivateTablesSize += EptGetPageTableSize(g_GuestState[CoreIndex].EptView.PageTable, &NumberOfSplits);
         }
 
         //
-        // It's an wrmsr, nothing to return
+        // The invalidations that are coalesced in the vm-exits of this core
         //
-        *ReturnSize = 0;
-        return STATUS_SUCCESS;
+        UserBuffer->InveptRequested += g_GuestState[CoreIndex].PendingInvalidations.RequestedCount;
+        UserBuffer->InveptIssued += g_GuestState[CoreIndex].PendingInvalidations.IssuedCount;
     }
-    else if (ReadOrWriteMsrRequest->ActionType == DEBUGGER_MSR_READ)
+
+    SpinlockUnlockShared(&EptCoreViewLock);
+
+    UserBuffer->InvalidationBroadcastsRequested = g_EptState->InvalidationBroadcastRequests;
+    UserBuffer->InvalidationBroadcastsIssued    = g_EptState->InvalidationBroadcastsIssued;
+
+    //
+    // The hooked pages
+    //
+    OldIrql = EptLockHookedPages();
+
+    TempList = &g_EptState->HookedPagesList;
+    while (&g_EptState->HookedPagesList != TempList->Flink)
     {
+        TempList                            = TempList->Flink;
+        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+
+        UserBuffer->NumberOfHookedPages++;
+        UserBuffer->HookedPagesSize += sizeof(EPT_HOOKED_PAGE_DETAIL);
+
         //
-        // Set Msr to be applied on the target cores
+        // The detours of a page share one trampoline block
         //
-        if (ReadOrWriteMsrRequest->CoreNumber == DEBUGGER_READ_AND_WRITE_ON_MSR_APPLY_ALL_CORES)
+        if (HookedEntry->TrampolineBlock != NULL)
         {
-            //
-            // Means that we should apply it on all cores
-            //
-            for (size_t i = 0; i < ProcessorCount; i++)
-            {
-                g_GuestState[i].DebuggingState.MsrState.Msr = ReadOrWriteMsrRequest->Msr;
-            }
+            UserBuffer->HookedPagesSize += EPT_HOOK_TRAMPOLINE_BLOCK_SIZE;
+        }
+    }
 
-            //
-            // Broadcast to all cores to read their Msrs
-            //
-            KeGenericCallDpc(BroadcastDpcReadMsrToAllCores, 0x0);
+    EptUnlockHookedPages(OldIrql);
 
-            //
-            // When we reach here, all processor read their shits
-            // so we have to fill that fucking buffer for usermode
-            //
-            for (size_t i = 0; i < ProcessorCount; i++)
-            {
-                UserBuffer[i] = g_GuestState[i].DebuggingState.MsrState.Value;
-            }
+    UserBuffer->TotalSize = UserBuffer->SharedTableSize + UserBuffer->PrivateTablesSize + UserBuffer->HookedPagesSize;
 
-            //
-            // It's an rdmsr we have to return a value for all cores
-            //
+    *ReturnSize = SIZEOF_DEBUGGER_EPT_MEMORY_FOOTPRINT;
+    return STATUS_SUCCESS;
+}
 
-            *ReturnSize = sizeof(UINT64) * ProcessorCount;
-            return STATUS_SUCCESS;
-        }
-        else
-        {
-            //
-            // Apply to one core
-            //
+/**
+ * @brief Copy the contention counters of the spinlocks of the hypervisor
+ * @details The counters are updated by the owners of the locks without
+ * interlocked operations, so they're approximate while the locks are in use
+ * 
+ * @param StatisticsRequest The request (reset or not) and the structure to fill
+ * @param ReturnSize Size of the filled structure
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerQuerySpinlockStatistics(PDEBUGGER_SPINLOCK_STATISTICS StatisticsRequest, PSIZE_T ReturnSize)
+{
+    BOOLEAN Reset = StatisticsRequest->Reset;
 
-            //
-            // Check if the core number is not invalid
-            //
-            if (ReadOrWriteMsrRequest->CoreNumber >= ProcessorCount)
-            {
-                *ReturnSize = 0;
-                return STATUS_INVALID_PARAMETER;
-            }
-            //
-            // Otherwise it's valid
-            //
-            g_GuestState[ReadOrWriteMsrRequest->CoreNumber].DebuggingState.MsrState.Msr = ReadOrWriteMsrRequest->Msr;
+    RtlZeroMemory(StatisticsRequest, SIZEOF_DEBUGGER_SPINLOCK_STATISTICS);
+    StatisticsRequest->Reset = Reset;
 
-            //
-            // Execute it on a single core
-            //
-            Status = DpcRoutineRunTaskOnSingleCore(ReadOrWriteMsrRequest->CoreNumber, DpcRoutinePerformReadMsr, NULL);
+#if CollectSpinlockContentionStatistics
 
-            if (Status != STATUS_SUCCESS)
-            {
-                *ReturnSize = 0;
-                return Status;
-            }
-            //
-            // Restore the result to the usermode
-            //
-            UserBuffer[0] = g_GuestState[ReadOrWriteMsrRequest->CoreNumber].DebuggingState.MsrState.Value;
+    PSPINLOCK_STATISTICS Statistics[DEBUGGER_SPINLOCK_COUNT];
 
-            *ReturnSize = sizeof(UINT64);
-            return STATUS_SUCCESS;
+    Statistics[DEBUGGER_SPINLOCK_VMX_ROOT_LOGGING]               = &VmxRootLoggingLock.Statistics;
+    Statistics[DEBUGGER_SPINLOCK_VMX_ROOT_LOGGING_NON_IMMEDIATE] = &VmxRootLoggingLockForNonImmBuffers.Statistics;
+    Statistics[DEBUGGER_SPINLOCK_READING_POOL]                   = &LockForReadingPool.Statistics;
+    Statistics[DEBUGGER_SPINLOCK_EPT_CORE_VIEW]                  = &EptCoreViewLock.Writer.Statistics;
+    Statistics[DEBUGGER_SPINLOCK_HIDDEN_HOOKS_DETOUR_TABLE]      = &g_HiddenHooksDetourTableLock.Statistics;
+    Statistics[DEBUGGER_SPINLOCK_EPT_HOOKED_PAGES]               = &EptHookedPagesLock.Statistics;
+
+    StatisticsRequest->IsCollected = TRUE;
+
+    for (UINT32 i = 0; i < DEBUGGER_SPINLOCK_COUNT; i++)
+    {
+        StatisticsRequest->Locks[i].Acquisitions = Statistics[i]->Acquisitions;
+        StatisticsRequest->Locks[i].Contentions  = Statistics[i]->Contentions;
+        StatisticsRequest->Locks[i].Spins        = Statistics[i]->Spins;
+        StatisticsRequest->Locks[i].MaxWait      = Statistics[i]->MaxWait;
+
+        if (Reset)
+        {
+            RtlZeroMemory(Statistics[i], sizeof(SPINLOCK_STATISTICS));
         }
     }
-    else
+
+#endif
+
+    *ReturnSize = SIZEOF_DEBUGGER_SPINLOCK_STATISTICS;
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Enable, disable or harvest the accessed and dirty flags of EPT, or
+ * enable and disable Page Modification Logging
+ * @details The run-lengths of the harvested bitmap are written after the request
+ * 
+ * @param AccessDirtyRequest The request (also used as the output buffer)
+ * @param OutputBufferLength Size of the output buffer
+ * @param ReturnSize Size of the filled buffer
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerEptAccessDirtyFlags(PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST AccessDirtyRequest, ULONG OutputBufferLength, PSIZE_T ReturnSize)
+{
+    UINT32 MaxRuns;
+
+    *ReturnSize = 0;
+
+    //
+    // Check if the hypervisor is initialized
+    //
+    if (g_EptState == NULL || g_EptState->EptPageTable == NULL)
     {
-        *ReturnSize = 0;
         return STATUS_UNSUCCESSFUL;
     }
 
-    return STATUS_UNSUCCESSFUL;
+    switch (AccessDirtyRequest->Action)
+    {
+    case DEBUGGER_EPT_ACCESS_DIRTY_ENABLE:
+    case DEBUGGER_EPT_ACCESS_DIRTY_DISABLE:
+
+        //
+        // Page Modification Logging doesn't work without the dirty flags
+        //
+        if (AccessDirtyRequest->Action == DEBUGGER_EPT_ACCESS_DIRTY_DISABLE)
+        {
+            PmlDisable();
+        }
+
+        ExAcquireFastMutex(&PmlMutex);
+
+        //
+        // The drains of PML clear the dirty flags, so the flags can't be harvested meanwhile
+        //
+        if (AccessDirtyRequest->Action == DEBUGGER_EPT_ACCESS_DIRTY_ENABLE && g_EptState->IsPmlEnabled)
+        {
+            ExReleaseFastMutex(&PmlMutex);
+            return STATUS_INVALID_DEVICE_STATE;
+        }
+
+        if (!EptSetAccessDirtyFlags(AccessDirtyRequest->Action == DEBUGGER_EPT_ACCESS_DIRTY_ENABLE))
+        {
+            ExReleaseFastMutex(&PmlMutex);
+            return STATUS_NOT_SUPPORTED;
+        }
+
+        g_EptState->IsAccessDirtyHarvestActive = AccessDirtyRequest->Action == DEBUGGER_EPT_ACCESS_DIRTY_ENABLE;
+
+        ExReleaseFastMutex(&PmlMutex);
+
+        return STATUS_SUCCESS;
+
+    case DEBUGGER_EPT_ACCESS_DIRTY_HARVEST:
+
+        if (OutputBufferLength < SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST + sizeof(UINT32))
+        {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        //
+        // The flags are harvested only if they're enabled by '!eptad enable', PML can't
+        // be enabled and clear the dirty flags until the harvest is finished
+        //
+        ExAcquireFastMutex(&PmlMutex);
+
+        if (!g_EptState->IsAccessDirtyHarvestActive)
+        {
+            ExReleaseFastMutex(&PmlMutex);
+            return STATUS_INVALID_DEVICE_STATE;
+        }
+
+        MaxRuns = (OutputBufferLength - SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST) / sizeof(UINT32);
+
+        AccessDirtyRequest->NumberOfHarvestedPages = EptHarvestAccessDirtyFlags(AccessDirtyRequest->PhysicalAddress,
+                                                                                AccessDirtyRequest->NumberOfPages,
+                                                                                AccessDirtyRequest->HarvestDirtyFlags,
+                                                                                AccessDirtyRequest->ClearAfterHarvest,
+                                                                                (UINT32 *)((UINT64)AccessDirtyRequest + SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST),
+                                                                                MaxRuns,
+                                                                                &AccessDirtyRequest->NumberOfRuns,
+                                                                                &AccessDirtyRequest->NumberOfSetPages);
+
+        //
+        // The cleared flags are not set again by the cached translations
+        //
+        if (AccessDirtyRequest->ClearAfterHarvest)
+        {
+            HvNotifyAllToInvalidateEpt();
+        }
+
+        ExReleaseFastMutex(&PmlMutex);
+
+        *ReturnSize = SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST + (AccessDirtyRequest->NumberOfRuns * sizeof(UINT32));
+
+        return STATUS_SUCCESS;
+
+    case DEBUGGER_EPT_ACCESS_DIRTY_ENABLE_PML:
+
+        if (!PmlEnable())
+        {
+            return STATUS_NOT_SUPPORTED;
+        }
+
+        return STATUS_SUCCESS;
+
+    case DEBUGGER_EPT_ACCESS_DIRTY_DISABLE_PML:
+
+        PmlDisable();
+
+        return STATUS_SUCCESS;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+}
+
+/**
+ * @brief Add a process to a process set of the EFER syscall hook filter
+ * 
+ * @param ProcessIds The watched or the ignored processes
+ * @param NumberOfProcesses Number of the processes in the set
+ * @param ProcessId The process id
+ * @return BOOLEAN FALSE if it's not in the set and there is no free slot
+ */
+BOOLEAN
+DebuggerSyscallFilterAddProcess(PLONG ProcessIds, PUINT32 NumberOfProcesses, LONG ProcessId)
+{
+    UINT32 Index;
+
+    for (Index = 0; Index < DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES; Index++)
+    {
+        if (ProcessIds[Index] == ProcessId)
+        {
+            return TRUE;
+        }
+    }
+
+    for (Index = 0; Index < DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES; Index++)
+    {
+        if (ProcessIds[Index] == 0)
+        {
+            ProcessIds[Index] = ProcessId;
+            (*NumberOfProcesses)++;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Remove a process from a process set of the EFER syscall hook filter
+ * 
+ * @param ProcessIds The watched or the ignored processes
+ * @param NumberOfProcesses Number of the processes in the set
+ * @param ProcessId The process id
+ * @return BOOLEAN TRUE if it was in the set
+ */
+BOOLEAN
+DebuggerSyscallFilterRemoveProcess(PLONG ProcessIds, PUINT32 NumberOfProcesses, LONG ProcessId)
+{
+    for (UINT32 Index = 0; Index < DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES; Index++)
+    {
+        if (ProcessIds[Index] == ProcessId)
+        {
+            ProcessIds[Index] = 0;
+            (*NumberOfProcesses)--;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief The routine that is broadcasted after a filter is replaced
+ * @details The #UD handler reads the filter in vmx-root mode, so when this DPC
+ * runs on a core, that core has left the vm-exits that might still read the old
+ * filter
+ * 
+ * @param CoreIndex The index of the core
+ * @param Context Not used
+ * @return UINT64 
+ */
+UINT64
+DebuggerSyscallFilterWaitForReaders(UINT32 CoreIndex, PVOID Context)
+{
+    UNREFERENCED_PARAMETER(CoreIndex);
+    UNREFERENCED_PARAMETER(Context);
+
+    return 0;
+}
+
+/**
+ * @brief Replace the filter of the EFER syscall hook and free the old filter
+ * @details g_SyscallFilterMutex should be held
+ * 
+ * @param Filter The new filter (non-paged) or NULL to watch everything
+ * @return VOID 
+ */
+VOID
+DebuggerPublishSyscallFilter(PDEBUGGER_SYSCALL_FILTER Filter)
+{
+    BROADCAST_OPERATION      Operation = {0};
+    PDEBUGGER_SYSCALL_FILTER OldFilter;
+
+    OldFilter = InterlockedExchangePointer((PVOID volatile *)&g_SyscallFilter, Filter);
+
+    if (OldFilter == NULL)
+    {
+        return;
+    }
+
+    //
+    // No core can find the old filter anymore, but a core might still
+    // be in a vm-exit that has read it
+    //
+    Operation.Type   = BROADCAST_OPERATION_ROUTINE;
+    Operation.Target = (UINT64)DebuggerSyscallFilterWaitForReaders;
+
+    BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES, &Operation, 1, NULL);
+
+    ExFreePoolWithTag(OldFilter, POOLTAG);
+}
+
+/**
+ * @brief Change the filter of the EFER syscall hook
+ * @details The requests are serialized by g_SyscallFilterMutex, a copy of the
+ * current filter is changed and published as a whole, so the #UD handlers never
+ * see a partial change and a failed request doesn't change anything
+ * 
+ * @param SyscallFilterRequest The request
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerConfigureSyscallFilter(PDEBUGGER_SYSCALL_FILTER_REQUEST SyscallFilterRequest)
+{
+    PDEBUGGER_SYSCALL_FILTER Filter;
+    UINT32                   Index;
+    LONG                     ProcessId;
+    BOOLEAN                  IsWatch;
+
+    switch (SyscallFilterRequest->Action)
+    {
+    case DEBUGGER_SYSCALL_FILTER_WATCH_SYSCALLS:
+    case DEBUGGER_SYSCALL_FILTER_IGNORE_SYSCALLS:
+
+        if (SyscallFilterRequest->FirstSyscallNumber > SyscallFilterRequest->LastSyscallNumber ||
+            SyscallFilterRequest->LastSyscallNumber >= DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        break;
+
+    case DEBUGGER_SYSCALL_FILTER_WATCH_PROCESS:
+    case DEBUGGER_SYSCALL_FILTER_IGNORE_PROCESS:
+
+        if (SyscallFilterRequest->ProcessId == 0)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        break;
+
+    case DEBUGGER_SYSCALL_FILTER_CLEAR:
+
+        DebuggerClearSyscallFilter();
+
+        return STATUS_SUCCESS;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Filter = ExAllocatePoolWithTag(NonPagedPool, sizeof(DEBUGGER_SYSCALL_FILTER), POOLTAG);
+
+    if (!Filter)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ExAcquireFastMutex(&g_SyscallFilterMutex);
+
+    if (g_SyscallFilter != NULL)
+    {
+        RtlCopyMemory(Filter, g_SyscallFilter, sizeof(DEBUGGER_SYSCALL_FILTER));
+    }
+    else
+    {
+        RtlZeroMemory(Filter, sizeof(DEBUGGER_SYSCALL_FILTER));
+    }
+
+    if (SyscallFilterRequest->Action == DEBUGGER_SYSCALL_FILTER_WATCH_SYSCALLS ||
+        SyscallFilterRequest->Action == DEBUGGER_SYSCALL_FILTER_IGNORE_SYSCALLS)
+    {
+        IsWatch = SyscallFilterRequest->Action == DEBUGGER_SYSCALL_FILTER_WATCH_SYSCALLS;
+
+        //
+        // The first watched range starts from an empty bitmap and the first
+        // ignored range starts from a full bitmap (as everything was watched)
+        //
+        if (!Filter->IsSyscallFilterEnabled)
+        {
+            RtlFillMemory(Filter->SyscallBitmap, sizeof(Filter->SyscallBitmap), IsWatch ? 0 : 0xff);
+        }
+
+        for (Index = SyscallFilterRequest->FirstSyscallNumber; Index <= SyscallFilterRequest->LastSyscallNumber; Index++)
+        {
+            if (IsWatch)
+            {
+                Filter->SyscallBitmap[Index / 64] |= 1ull << (Index % 64);
+            }
+            else
+            {
+                Filter->SyscallBitmap[Index / 64] &= ~(1ull << (Index % 64));
+            }
+        }
+
+        Filter->IsSyscallFilterEnabled = TRUE;
+    }
+    else
+    {
+        IsWatch   = SyscallFilterRequest->Action == DEBUGGER_SYSCALL_FILTER_WATCH_PROCESS;
+        ProcessId = (LONG)SyscallFilterRequest->ProcessId;
+
+        //
+        // A watched process is removed from the ignored processes and an ignored
+        // process is removed from the watched processes, so ignoring a process
+        // without any watched process means all of the processes except it
+        //
+        DebuggerSyscallFilterRemoveProcess(IsWatch ? Filter->ExcludedProcessIds : Filter->ProcessIds,
+                                           IsWatch ? &Filter->NumberOfExcludedProcesses : &Filter->NumberOfProcesses,
+                                           ProcessId);
+
+        if (!DebuggerSyscallFilterAddProcess(IsWatch ? Filter->ProcessIds : Filter->ExcludedProcessIds,
+                                             IsWatch ? &Filter->NumberOfProcesses : &Filter->NumberOfExcludedProcesses,
+                                             ProcessId))
+        {
+            //
+            // There is no free slot, the published filter is not changed
+            //
+            ExReleaseFastMutex(&g_SyscallFilterMutex);
+            ExFreePoolWithTag(Filter, POOLTAG);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    DebuggerPublishSyscallFilter(Filter);
+
+    ExReleaseFastMutex(&g_SyscallFilterMutex);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Remove the filter of the EFER syscall hook so everything is watched
+ * @details Should be called at PASSIVE_LEVEL, it's also called before terminating
+ * VMX to free the filter
+ * 
+ * @return VOID 
+ */
+VOID
+DebuggerClearSyscallFilter()
+{
+    ExAcquireFastMutex(&g_SyscallFilterMutex);
+
+    DebuggerPublishSyscallFilter(NULL);
+
+    ExReleaseFastMutex(&g_SyscallFilterMutex);
+}
+
+/**
+ * @brief Enable or disable the binary trace of the EFER syscall hook on all cores
+ * 
+ * @param SyscallTraceRequest The request
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerConfigureSyscallTrace(PDEBUGGER_SYSCALL_TRACE_REQUEST SyscallTraceRequest)
+{
+    DEBUGGER_SYSCALL_TRACE_REQUEST DisableRequest = {0};
+    PSYSCALL_TRACE_RING            Ring;
+    LARGE_INTEGER                  DueTime;
+    UINT32                         ProcessorCount;
+
+    if (SyscallTraceRequest->NumberOfStackArguments > SYSCALL_TRACE_MAX_STACK_ARGUMENTS)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ProcessorCount = KeQueryActiveProcessorCount(0);
+
+    ExAcquireFastMutex(&g_SyscallTraceMutex);
+
+    //
+    // No core writes records after this broadcast
+    //
+    KeGenericCallDpc(BroadcastDpcConfigureSyscallTrace, &DisableRequest);
+
+    if (!SyscallTraceRequest->IsEnabled)
+    {
+        //
+        // The records that are still in the rings are read by the client
+        // until the next trace, so the reader is woken up once more
+        //
+        KeCancelTimer(&g_SyscallTraceFlushTimer);
+        KeSetEvent(&g_SyscallTraceEvent, 0, FALSE);
+
+        ExReleaseFastMutex(&g_SyscallTraceMutex);
+        return STATUS_SUCCESS;
+    }
+
+    for (size_t i = 0; i < ProcessorCount; i++)
+    {
+        if (g_GuestState[i].DebuggingState.SyscallTrace.Ring != NULL)
+        {
+            continue;
+        }
+
+        Ring = ExAllocatePoolWithTag(NonPagedPool, sizeof(SYSCALL_TRACE_RING), POOLTAG);
+
+        if (Ring == NULL)
+        {
+            LogError("Insufficient memory in allocating the syscall trace ring");
+            ExReleaseFastMutex(&g_SyscallTraceMutex);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        g_GuestState[i].DebuggingState.SyscallTrace.Ring = Ring;
+    }
+
+    //
+    // The records of the previous trace have another number of stack
+    // arguments and belong to the previous file of the client
+    //
+    SyscallHookResetTrace();
+
+    KeGenericCallDpc(BroadcastDpcConfigureSyscallTrace, SyscallTraceRequest);
+
+    //
+    // Wake up the reader periodically while there are records
+    //
+    DueTime.QuadPart = -(SYSCALL_TRACE_FLUSH_INTERVAL * 10000LL);
+    KeSetTimerEx(&g_SyscallTraceFlushTimer, DueTime, SYSCALL_TRACE_FLUSH_INTERVAL, &g_SyscallTraceFlushDpc);
+
+    ExReleaseFastMutex(&g_SyscallTraceMutex);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Stop the binary trace of the EFER syscall hook and free its rings
+ * @details Should be called at PASSIVE_LEVEL before terminating VMX
+ * 
+ * @return VOID 
+ */
+VOID
+DebuggerStopSyscallTrace()
+{
+    DEBUGGER_SYSCALL_TRACE_REQUEST DisableRequest = {0};
+
+    ExAcquireFastMutex(&g_SyscallTraceMutex);
+
+    KeGenericCallDpc(BroadcastDpcConfigureSyscallTrace, &DisableRequest);
+
+    //
+    // Wait for the flush DPC that might be running before freeing the rings
+    //
+    KeCancelTimer(&g_SyscallTraceFlushTimer);
+    KeFlushQueuedDpcs();
+
+    SyscallHookFreeTrace();
+
+    ExReleaseFastMutex(&g_SyscallTraceMutex);
+}
+
+/**
+ * @brief Read the records of the binary trace of the EFER syscall hook
+ * @details The records of all the cores are copied in bulk, if there is no
+ * record then it waits until the flush timer finds records or the timeout
+ * 
+ * @param UserBuffer The buffer of the records
+ * @param OutputBufferLength Size of the buffer
+ * @param ReturnSize Size of the records and their headers
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerReadSyscallTrace(PVOID UserBuffer, ULONG OutputBufferLength, PSIZE_T ReturnSize)
+{
+    LARGE_INTEGER Timeout;
+
+    if (OutputBufferLength < sizeof(SYSCALL_TRACE_RECORDS_HEADER) + SYSCALL_TRACE_RECORD_SIZE(SYSCALL_TRACE_MAX_STACK_ARGUMENTS))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Timeout.QuadPart = -(SYSCALL_TRACE_READ_TIMEOUT * 10000LL);
+    KeWaitForSingleObject(&g_SyscallTraceEvent, Executive, KernelMode, FALSE, &Timeout);
+
+    ExAcquireFastMutex(&g_SyscallTraceMutex);
+
+    *ReturnSize = SyscallHookReadTrace(UserBuffer, OutputBufferLength);
+
+    ExReleaseFastMutex(&g_SyscallTraceMutex);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Search the virtual memory of a process for a pattern
+ * @details The addresses of the matches are written after the request,
+ * if there is no room for all of them or the range is longer than the
+ * bytes that are scanned by a request, then the request shows where the
+ * search should continue
+ * 
+ * @param SearchRequest The request (both input and output)
+ * @param OutputBufferLength Size of the output buffer
+ * @param ReturnSize The size of the request and the addresses
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerCommandSearchMemory(PDEBUGGER_SEARCH_MEMORY_REQUEST SearchRequest, ULONG OutputBufferLength, PSIZE_T ReturnSize)
+{
+    PATTERN_MATCHER Matcher;
+    NTSTATUS        Status;
+    UINT32          MaxResults;
+
+    *ReturnSize = 0;
+
+    if (SearchRequest->PatternLength > DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH ||
+        !PatternMatcherInitialize(&Matcher, SearchRequest->Pattern, SearchRequest->Mask, SearchRequest->PatternLength))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (OutputBufferLength < SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST + sizeof(UINT64))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    MaxResults = (OutputBufferLength - SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST) / sizeof(UINT64);
+
+    Status = MemoryManagerSearchProcessMemory((HANDLE)SearchRequest->Pid,
+                                              SearchRequest->Address,
+                                              SearchRequest->Length,
+                                              &Matcher,
+                                              (PUINT64)((UINT64)SearchRequest + SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST),
+                                              MaxResults,
+                                              &SearchRequest->NumberOfResults,
+                                              &SearchRequest->NextAddress);
+
+    if (Status == STATUS_SUCCESS)
+    {
+        *ReturnSize = SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST + (SearchRequest->NumberOfResults * sizeof(UINT64));
+    }
+
+    return Status;
+}
+
+/**
+ * @brief Read a list of ranges in a single request
+ * @details The data of each range is placed after the ranges, the
+ * request is rejected if the output buffer can't hold all of them
+ * 
+ * @param ScatterRequest The request (both input and output)
+ * @param InputBufferLength Size of the input buffer
+ * @param OutputBufferLength Size of the output buffer
+ * @param ReturnSize The size of the request, the ranges and their data
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerCommandReadMemoryScatter(PDEBUGGER_READ_MEMORY_SCATTER_REQUEST ScatterRequest, ULONG InputBufferLength, ULONG OutputBufferLength, PSIZE_T ReturnSize)
+{
+    PDEBUGGER_READ_MEMORY_RANGE Ranges;
+    UINT64                      Offset;
+    NTSTATUS                    Status;
+
+    *ReturnSize = 0;
+
+    if (ScatterRequest->NumberOfRanges == 0 || ScatterRequest->NumberOfRanges > DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES ||
+        InputBufferLength < SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST + ScatterRequest->NumberOfRanges * sizeof(DEBUGGER_READ_MEMORY_RANGE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Ranges = (PDEBUGGER_READ_MEMORY_RANGE)((UINT64)ScatterRequest + SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST);
+
+    //
+    // Place the data of the ranges one after another
+    //
+    Offset = SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST + ScatterRequest->NumberOfRanges * sizeof(DEBUGGER_READ_MEMORY_RANGE);
+
+    for (UINT32 i = 0; i < ScatterRequest->NumberOfRanges; i++)
+    {
+        Ranges[i].Offset    = (UINT32)Offset;
+        Ranges[i].ReadBytes = 0;
+        Offset += Ranges[i].Size;
+
+        if (Offset > OutputBufferLength)
+        {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+    }
+
+    Status = MemoryManagerReadProcessMemoryScatter((HANDLE)ScatterRequest->Pid,
+                                                   ScatterRequest->MemoryType,
+                                                   Ranges,
+                                                   ScatterRequest->NumberOfRanges,
+                                                   ScatterRequest);
+
+    if (Status == STATUS_SUCCESS)
+    {
+        *ReturnSize = Offset;
+    }
+
+    return Status;
+}
+
+/**
+ * @brief Apply or remove a hidden hook on all the cores or a single core
+ * @details The execute hooks continue from the general detour, so they trigger
+ * the HIDDEN_HOOK_EXEC_DETOUR events, should be called from vmx non-root mode
+ * (PASSIVE_LEVEL)
+ * 
+ * @param HiddenHookRequest The request
+ * @return NTSTATUS 
+ */
+NTSTATUS
+DebuggerCommandHiddenHook(PDEBUGGER_HIDDEN_HOOK_REQUEST HiddenHookRequest)
+{
+    PVOID   OrigFunction = NULL;
+    PVOID   HookFunction;
+    BOOLEAN Result;
+
+    if (HiddenHookRequest->CoreId != DEBUGGER_EVENT_APPLY_TO_ALL_CORES &&
+        (HiddenHookRequest->CoreId >= KeQueryActiveProcessorCount(0) || HiddenHookRequest->ProcessId != 0))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    switch (HiddenHookRequest->Action)
+    {
+    case DEBUGGER_HIDDEN_HOOK_APPLY:
+
+        HookFunction = HiddenHookRequest->SetHookForExec ? (PVOID)AsmGeneralDetourHook : NULL;
+
+        if (HiddenHookRequest->ProcessId != 0)
+        {
+            Result = EptPageHookForProcess(HiddenHookRequest->ProcessId,
+                                           (PVOID)HiddenHookRequest->Address,
+                                           HookFunction,
+                                           &OrigFunction,
+                                           HiddenHookRequest->SetHookForRead,
+                                           HiddenHookRequest->SetHookForWrite,
+                                           HiddenHookRequest->SetHookForExec);
+        }
+        else if (HiddenHookRequest->CoreId == DEBUGGER_EVENT_APPLY_TO_ALL_CORES)
+        {
+            Result = EptPageHook((PVOID)HiddenHookRequest->Address,
+                                 HookFunction,
+                                 &OrigFunction,
+                                 HiddenHookRequest->SetHookForRead,
+                                 HiddenHookRequest->SetHookForWrite,
+                                 HiddenHookRequest->SetHookForExec);
+        }
+        else
+        {
+            Result = EptPageHookForCore(HiddenHookRequest->CoreId,
+                                        (PVOID)HiddenHookRequest->Address,
+                                        HookFunction,
+                                        &OrigFunction,
+                                        HiddenHookRequest->SetHookForRead,
+                                        HiddenHookRequest->SetHookForWrite,
+                                        HiddenHookRequest->SetHookForExec);
+        }
+
+        return Result ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+
+    case DEBUGGER_HIDDEN_HOOK_REMOVE:
+
+        if (HiddenHookRequest->ProcessId != 0)
+        {
+            Result = EptRemoveProcessView(HiddenHookRequest->ProcessId);
+        }
+        else if (HiddenHookRequest->CoreId == DEBUGGER_EVENT_APPLY_TO_ALL_CORES)
+        {
+            Result = HvPerformPageUnHookSinglePage(HiddenHookRequest->Address);
+        }
+        else
+        {
+            Result = EptPageUnHookForCore(HiddenHookRequest->CoreId);
+        }
+
+        return Result ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
 }
@@ -20,3 +20,57 @@ DebuggerCommandReadMemory(PDEBUGGER_READ_MEMORY ReadMemRequest, PVOID UserBuffer
 
 NTSTATUS
 DebuggerReadOrWriteMsr(PDEBUGGER_READ_AND_WRITE_ON_MSR ReadOrWriteMsrRequest, UINT64 * UserBuffer, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerReadOrWriteMsrBatch(PDEBUGGER_MSR_BATCH_REQUEST MsrBatchRequest, ULONG InputBufferLength, ULONG OutputBufferLength, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerConfigureMsrSampler(PDEBUGGER_MSR_SAMPLER_REQUEST MsrSamplerRequest);
+
+VOID
+DebuggerStopMsrSampler();
+
+NTSTATUS
+DebuggerQueryEptMemoryFootprint(PDEBUGGER_EPT_MEMORY_FOOTPRINT UserBuffer, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerQuerySpinlockStatistics(PDEBUGGER_SPINLOCK_STATISTICS StatisticsRequest, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerEptAccessDirtyFlags(PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST AccessDirtyRequest, ULONG OutputBufferLength, PSIZE_T ReturnSize);
+
+BOOLEAN
+DebuggerSyscallFilterAddProcess(PLONG ProcessIds, PUINT32 NumberOfProcesses, LONG ProcessId);
+
+BOOLEAN
+DebuggerSyscallFilterRemoveProcess(PLONG ProcessIds, PUINT32 NumberOfProcesses, LONG ProcessId);
+
+UINT64
+DebuggerSyscallFilterWaitForReaders(UINT32 CoreIndex, PVOID Context);
+
+VOID
+DebuggerPublishSyscallFilter(PDEBUGGER_SYSCALL_FILTER Filter);
+
+NTSTATUS
+DebuggerConfigureSyscallFilter(PDEBUGGER_SYSCALL_FILTER_REQUEST SyscallFilterRequest);
+
+VOID
+DebuggerClearSyscallFilter();
+
+NTSTATUS
+DebuggerConfigureSyscallTrace(PDEBUGGER_SYSCALL_TRACE_REQUEST SyscallTraceRequest);
+
+VOID
+DebuggerStopSyscallTrace();
+
+NTSTATUS
+DebuggerReadSyscallTrace(PVOID UserBuffer, ULONG OutputBufferLength, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerCommandReadMemoryScatter(PDEBUGGER_READ_MEMORY_SCATTER_REQUEST ScatterRequest, ULONG InputBufferLength, ULONG OutputBufferLength, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerCommandSearchMemory(PDEBUGGER_SEARCH_MEMORY_REQUEST SearchRequest, ULONG OutputBufferLength, PSIZE_T ReturnSize);
+
+NTSTATUS
+DebuggerCommandHiddenHook(PDEBUGGER_HIDDEN_HOOK_REQUEST HiddenHookRequest);
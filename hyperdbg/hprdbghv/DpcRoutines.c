@@ -12,147 +12,71 @@
  */
 #include "Common.h";
 #include "GlobalVariables.h";
-
-/* lock for one core execution */
-volatile LONG OneCoreLock;
+#include "InlineAsm.h"
+#include "Vmcall.h"
 
 /**
- * @brief This function synchronize the function execution for a single core
- * You should only used it for one core, not in multiple threads simultaneously
- * The function that needs to use this featue (Routine parameter function) should 
- * have the when it ends :
- *  
- *              SpinlockUnlock(&OneCoreLock);
- *
+ * @brief Send the MSR samples of the core to the log buffer
+ * @details Should be called on the same core at DISPATCH_LEVEL
+ * 
+ * @param CoreIndex Logical core index
  * @return VOID 
  */
-NTSTATUS
-DpcRoutineRunTaskOnSingleCore(UINT32 CoreNumber, PVOID Routine, PVOID DeferredContext)
+VOID
+DpcRoutineFlushMsrSamples(UINT32 CoreIndex)
 {
-    PRKDPC Dpc;
-    UINT32 ProcessorCount;
-
-    ProcessorCount = KeQueryActiveProcessorCount(0);
-
-    //
-    // Check if the core number is not invalid
-    //
-    if (CoreNumber >= ProcessorCount)
-    {
-        return STATUS_INVALID_PARAMETER;
-    }
+    PPROCESSOR_DEBUGGING_MSR_SAMPLER MsrSampler = &g_GuestState[CoreIndex].DebuggingState.MsrSampler;
+    PMSR_SAMPLE_RECORDS_HEADER       Header     = (PMSR_SAMPLE_RECORDS_HEADER)MsrSampler->Packet;
 
-    //
-    // Allocate Memory for DPC
-    //
-    Dpc = ExAllocatePoolWithTag(NonPagedPool, sizeof(KDPC), POOLTAG);
-
-    if (!Dpc)
+    if (Header->NumberOfRecords != 0)
     {
-        return STATUS_INSUFFICIENT_RESOURCES;
+        LogSendBuffer(OPERATION_LOG_MSR_SAMPLES, MsrSampler->Packet, sizeof(MSR_SAMPLE_RECORDS_HEADER) + MsrSampler->SizeOfRecords);
     }
 
-    //
-    // Creating a DPC that will run on the target process
-    //
-    KeInitializeDpc(Dpc,            // Dpc
-                    Routine,        // DeferredRoutine
-                    DeferredContext // DeferredContext
-    );
-
-    //
-    // Set the target core
-    //
-    KeSetTargetProcessorDpc(Dpc, CoreNumber);
-
-    //
-    // it's sure will be executed, but we want to free the above
-    // pool, so we have to wait on a spinlock that will be release
-    // by the the DPC routine, actually Affinity Thread but that
-    // won't support more than 64 logical cores, I create a discussion
-    // here, and explained the problem, but no one answers
-    // link: https://community.osr.com/discussion/292064/putting-a-barrier-for-dpc-before-continuing-the-rest-of-code
-    // we also can't use the spinlock routine of Windows as this function
-    // raises the IRQL to DPC and we want to execute at DPC, means that
-    // If we're currently on the right core, we never find a chance to
-    // release the spinlock so a deadlock happens, all in all it's complicated :)
-    //
-
-    //
-    // Set the lock to be freed by the other DPC routine
-    //
-    if (!SpinlockTryLock(&OneCoreLock))
-    {
-        //
-        // We can't get the lock, probably sth goes wrong !
-        //
-        return STATUS_UNSUCCESSFUL;
-    }
-
-    //
-    // Fire the DPC
-    //
-    KeInsertQueueDpc(Dpc, NULL, NULL);
-
-    //
-    // spin on lock to be release, immediately after we get the lock, we'll
-    // release it for because there is no need to it anymore and DPC is finished
-    //
-    SpinlockLock(&OneCoreLock);
-    SpinlockUnlock(&OneCoreLock);
-
-    //
-    // Now it's safe to deallocate the bugger
-    //
-    ExFreePoolWithTag(Dpc, POOLTAG);
-
-    return STATUS_SUCCESS;
+    Header->NumberOfRecords   = 0;
+    MsrSampler->SizeOfRecords = 0;
 }
 
 /**
- * @brief Broadcast msr write
+ * @brief Read the sampled MSRs when the timer of the core expires
+ * @details The timer DPC is targeted to its own core
  * 
  * @return VOID 
  */
 VOID
-DpcRoutinePerformWriteMsr(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+DpcRoutineSampleMsrs(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
 {
-    ULONG CurrentProcessorIndex = 0;
-
-    CurrentProcessorIndex = KeGetCurrentProcessorNumber();
+    UINT32                           CoreIndex  = KeGetCurrentProcessorNumber();
+    PPROCESSOR_DEBUGGING_MSR_SAMPLER MsrSampler = &g_GuestState[CoreIndex].DebuggingState.MsrSampler;
+    PMSR_SAMPLE_RECORDS_HEADER       Header     = (PMSR_SAMPLE_RECORDS_HEADER)MsrSampler->Packet;
+    PUINT64                          Record;
 
     //
-    // write on MSR
+    // The timer might be expired right before it's canceled
     //
-    __writemsr(g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Msr, g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Value);
+    if (!MsrSampler->IsEnabled)
+    {
+        return;
+    }
 
-    //
-    // As this function is designed for a single,
-    // we have to release the synchronization lock here
-    //
-    SpinlockUnlock(&OneCoreLock);
-}
+    Record = (PUINT64)(MsrSampler->Packet + sizeof(MSR_SAMPLE_RECORDS_HEADER) + MsrSampler->SizeOfRecords);
 
-/**
- * @brief Broadcast msr read
- * 
- * @return VOID 
- */
-VOID
-DpcRoutinePerformReadMsr(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
-{
-    ULONG CurrentProcessorIndex = 0;
+    Record[0] = __rdtsc();
 
-    CurrentProcessorIndex = KeGetCurrentProcessorNumber();
+    for (UINT32 i = 0; i < g_MsrSamplerConfiguration.NumberOfMsrs; i++)
+    {
+        Record[i + 1] = __readmsr(g_MsrSamplerConfiguration.Msrs[i]);
+    }
 
-    //
-    // read on MSR
-    //
-    g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Value = __readmsr(g_GuestState[CurrentProcessorIndex].DebuggingState.MsrState.Msr);
+    Header->NumberOfRecords++;
+    MsrSampler->SizeOfRecords += MSR_SAMPLE_RECORD_SIZE(Header->NumberOfMsrs);
 
     //
-    // As this function is designed for a single,
-    // we have to release the synchronization lock here
+    // Send the packet if it's full or if it holds enough time
     //
-    SpinlockUnlock(&OneCoreLock);
+    if (Header->NumberOfRecords >= MsrSampler->RecordsPerPacket ||
+        sizeof(MSR_SAMPLE_RECORDS_HEADER) + MsrSampler->SizeOfRecords + MSR_SAMPLE_RECORD_SIZE(Header->NumberOfMsrs) > sizeof(MsrSampler->Packet))
+    {
+        DpcRoutineFlushMsrSamples(CoreIndex);
+    }
 }
@@ -366,15 +366,25 @@ DrvUnsupported(PDEVICE_OBJECT DeviceObject, PIRP Irp)
 NTSTATUS
 DrvDispatchIoControl(PDEVICE_OBJECT DeviceObject, PIRP Irp)
 {
-    PIO_STACK_LOCATION              IrpStack;
-    PREGISTER_NOTIFY_BUFFER         RegisterEventRequest;
-    PDEBUGGER_READ_MEMORY           DebuggerReadMemRequest;
-    PDEBUGGER_READ_AND_WRITE_ON_MSR DebuggerReadOrWriteMsrRequest;
-    NTSTATUS                        Status;
-    ULONG                           InBuffLength;  // Input buffer length
-    ULONG                           OutBuffLength; // Output buffer length
-    SIZE_T                          ReturnSize;
-    BOOLEAN                         DoNotChangeInformation = FALSE;
+    PIO_STACK_LOCATION                    IrpStack;
+    PREGISTER_NOTIFY_BUFFER               RegisterEventRequest;
+    PDEBUGGER_READ_MEMORY                 DebuggerReadMemRequest;
+    PDEBUGGER_READ_AND_WRITE_ON_MSR       DebuggerReadOrWriteMsrRequest;
+    PDEBUGGER_EPT_MEMORY_FOOTPRINT        DebuggerEptMemoryFootprintRequest;
+    PDEBUGGER_SPINLOCK_STATISTICS         DebuggerSpinlockStatisticsRequest;
+    PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST    DebuggerEptAccessDirtyRequest;
+    PDEBUGGER_SYSCALL_FILTER_REQUEST      DebuggerSyscallFilterRequest;
+    PDEBUGGER_SYSCALL_TRACE_REQUEST       DebuggerSyscallTraceRequest;
+    PDEBUGGER_SEARCH_MEMORY_REQUEST       DebuggerSearchMemoryRequest;
+    PDEBUGGER_READ_MEMORY_SCATTER_REQUEST DebuggerReadMemoryScatterRequest;
+    PDEBUGGER_MSR_BATCH_REQUEST           DebuggerMsrBatchRequest;
+    PDEBUGGER_MSR_SAMPLER_REQUEST         DebuggerMsrSamplerRequest;
+    PDEBUGGER_HIDDEN_HOOK_REQUEST         DebuggerHiddenHookRequest;
+    NTSTATUS                              Status;
+    ULONG                                 InBuffLength;  // Input buffer length
+    ULONG                                 OutBuffLength; // Output buffer length
+    SIZE_T                                ReturnSize;
+    BOOLEAN                               DoNotChangeInformation = FALSE;
 
     //
     // Here's the best place to see if there is any allocation pending
@@ -527,6 +537,301 @@ DrvDispatchIoControl(PDEVICE_OBJECT DeviceObject, PIRP Irp)
                 DoNotChangeInformation = TRUE;
             }
 
+            break;
+        case IOCTL_DEBUGGER_QUERY_EPT_MEMORY_FOOTPRINT:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.OutputBufferLength < SIZEOF_DEBUGGER_EPT_MEMORY_FOOTPRINT || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerEptMemoryFootprintRequest = (PDEBUGGER_EPT_MEMORY_FOOTPRINT)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerQueryEptMemoryFootprint(DebuggerEptMemoryFootprintRequest, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_QUERY_SPINLOCK_STATISTICS:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_SPINLOCK_STATISTICS ||
+                IrpStack->Parameters.DeviceIoControl.OutputBufferLength < SIZEOF_DEBUGGER_SPINLOCK_STATISTICS ||
+                Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerSpinlockStatisticsRequest = (PDEBUGGER_SPINLOCK_STATISTICS)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerQuerySpinlockStatistics(DebuggerSpinlockStatisticsRequest, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_EPT_ACCESS_DIRTY_FLAGS:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            OutBuffLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+            DebuggerEptAccessDirtyRequest = (PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            //
+            // Both usermode and to send to usermode and the comming buffer are
+            // at the same place
+            //
+            Status = DebuggerEptAccessDirtyFlags(DebuggerEptAccessDirtyRequest, OutBuffLength, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_SYSCALL_FILTER:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_SYSCALL_FILTER_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerSyscallFilterRequest = (PDEBUGGER_SYSCALL_FILTER_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerConfigureSyscallFilter(DebuggerSyscallFilterRequest);
+
+            break;
+        case IOCTL_DEBUGGER_SYSCALL_TRACE:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_SYSCALL_TRACE_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerSyscallTraceRequest = (PDEBUGGER_SYSCALL_TRACE_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerConfigureSyscallTrace(DebuggerSyscallTraceRequest);
+
+            break;
+        case IOCTL_DEBUGGER_READ_SYSCALL_TRACE:
+            //
+            // First validate the parameters.
+            //
+            if (Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            OutBuffLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+            Status = DebuggerReadSyscallTrace(Irp->AssociatedIrp.SystemBuffer, OutBuffLength, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_SEARCH_MEMORY:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            OutBuffLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+            DebuggerSearchMemoryRequest = (PDEBUGGER_SEARCH_MEMORY_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            //
+            // Both usermode and to send to usermode and the comming buffer are
+            // at the same place
+            //
+            Status = DebuggerCommandSearchMemory(DebuggerSearchMemoryRequest, OutBuffLength, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_READ_MEMORY_SCATTER:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            InBuffLength  = IrpStack->Parameters.DeviceIoControl.InputBufferLength;
+            OutBuffLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+            DebuggerReadMemoryScatterRequest = (PDEBUGGER_READ_MEMORY_SCATTER_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            //
+            // Both usermode and to send to usermode and the comming buffer are
+            // at the same place
+            //
+            Status = DebuggerCommandReadMemoryScatter(DebuggerReadMemoryScatterRequest, InBuffLength, OutBuffLength, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_MSR_BATCH:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_MSR_BATCH_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            InBuffLength  = IrpStack->Parameters.DeviceIoControl.InputBufferLength;
+            OutBuffLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+            DebuggerMsrBatchRequest = (PDEBUGGER_MSR_BATCH_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            //
+            // Both usermode and to send to usermode and the comming buffer are
+            // at the same place
+            //
+            Status = DebuggerReadOrWriteMsrBatch(DebuggerMsrBatchRequest, InBuffLength, OutBuffLength, &ReturnSize);
+
+            //
+            // Set the size
+            //
+            if (Status == STATUS_SUCCESS)
+            {
+                Irp->IoStatus.Information = ReturnSize;
+
+                //
+                // Avoid zeroing it
+                //
+                DoNotChangeInformation = TRUE;
+            }
+
+            break;
+        case IOCTL_DEBUGGER_MSR_SAMPLER:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_MSR_SAMPLER_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerMsrSamplerRequest = (PDEBUGGER_MSR_SAMPLER_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerConfigureMsrSampler(DebuggerMsrSamplerRequest);
+
+            break;
+        case IOCTL_DEBUGGER_HIDDEN_HOOK:
+            //
+            // First validate the parameters.
+            //
+            if (IrpStack->Parameters.DeviceIoControl.InputBufferLength < SIZEOF_DEBUGGER_HIDDEN_HOOK_REQUEST || Irp->AssociatedIrp.SystemBuffer == NULL)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                LogError("Invalid parameter to IOCTL Dispatcher.");
+                break;
+            }
+
+            DebuggerHiddenHookRequest = (PDEBUGGER_HIDDEN_HOOK_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+
+            Status = DebuggerCommandHiddenHook(DebuggerHiddenHookRequest);
+
             break;
         default:
             LogError("Unknow IOCTL");
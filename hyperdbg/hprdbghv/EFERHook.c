@@ -25,15 +25,10 @@
 #include "GlobalVariables.h"
 #include "Vmx.h"
 #include "Logging.h"
-
-/**
- * @brief As we have just on sysret in all the Windows,
- * we use the following variable to hold its address
- * this way, we're not force to check for the instruction
- * so we remove the memory access to check for sysret 
- * in this case.
- * 
- */
+#include "Debugger.h"
+#include "Emulation.h"
+#include "MemoryMapper.h"
+#include "LengthDisassemblerEngine.h"
 
 /* Check for instruction sysret and syscall */
 #define IS_SYSRET_INSTRUCTION(Code)   \
@@ -44,6 +39,15 @@
     (*((PUINT8)(Code) + 0) == 0x0F && \
      *((PUINT8)(Code) + 1) == 0x05)
 
+/* Length of syscall (0f 05), vm-exit instruction length is not valid for #UD */
+#define SYSCALL_INSTRUCTION_LENGTH 2
+
+/* Length of sysret (48 0f 07) */
+#define SYSRET_INSTRUCTION_LENGTH 3
+
+/* How far the sysret is searched after the target of syscall */
+#define SYSRET_SEARCH_LIMIT 0x4000
+
 /**
  * @brief Disables the Syscall Enable Bit (SCE) in GUEST_EFER
  * 
@@ -105,6 +109,7 @@ SyscallHookConfigureEFER(BOOLEAN EnableEFERSyscallHook)
     IA32_VMX_BASIC_MSR VmxBasicMsr     = {0};
     UINT32             VmEntryControls = 0;
     UINT32             VmExitControls  = 0;
+    UINT32             CoreIndex       = KeGetCurrentProcessorNumber();
 
     //
     // Reading IA32_VMX_BASIC_MSR
@@ -114,7 +119,7 @@ SyscallHookConfigureEFER(BOOLEAN EnableEFERSyscallHook)
     //
     // Set MSR Bitmap to avoid patch guard interception
     //
-    HvSetMsrBitmap(MSR_EFER, KeGetCurrentProcessorNumber(), TRUE, FALSE);
+    HvSetMsrBitmap(MSR_EFER, CoreIndex, TRUE, FALSE);
 
     //
     // Read previous VM-Entry and VM-Exit controls
@@ -128,6 +133,14 @@ SyscallHookConfigureEFER(BOOLEAN EnableEFERSyscallHook)
     {
         MsrValue.SyscallEnable = FALSE;
 
+        //
+        // Cache the MSRs of SYSCALL and SYSRET, they're read again
+        // each time that the hook is enabled
+        //
+        g_GuestState[CoreIndex].DebuggingState.SyscallMsrs.Lstar = __readmsr(MSR_LSTAR);
+        g_GuestState[CoreIndex].DebuggingState.SyscallMsrs.Star  = __readmsr(MSR_STAR);
+        g_GuestState[CoreIndex].DebuggingState.SyscallMsrs.Fmask = __readmsr(MSR_FMASK);
+
         //
         // Set VM-Entry controls to load EFER
         //
@@ -197,29 +210,26 @@ SetGuestSs(PSEGMENT_SELECTOR Ss)
 
 /**
  * @brief This function emulates the SYSCALL execution 
+ * @details The MSRs are read from the cache of the core
  * 
  * @param Regs Guest registers
+ * @param CoreIndex Logical core index
  * @return BOOLEAN
  */
 BOOLEAN
-SyscallHookEmulateSYSCALL(PGUEST_REGS Regs)
+SyscallHookEmulateSYSCALL(PGUEST_REGS Regs, UINT32 CoreIndex)
 {
-    SEGMENT_SELECTOR Cs, Ss;
-    UINT32           InstructionLength;
-    UINT64           MsrValue;
-    ULONG64          GuestRip;
-    ULONG64          GuestRflags;
+    SEGMENT_SELECTOR                  Cs, Ss;
+    UINT64                            MsrValue;
+    ULONG64                           GuestRip;
+    ULONG64                           GuestRflags;
+    PPROCESSOR_DEBUGGING_SYSCALL_MSRS SyscallMsrs = &g_GuestState[CoreIndex].DebuggingState.SyscallMsrs;
 
     //
     // Reading guest's RIP
     //
     __vmx_vmread(GUEST_RIP, &GuestRip);
 
-    //
-    // Reading instruction length
-    //
-    __vmx_vmread(VM_EXIT_INSTRUCTION_LEN, &InstructionLength);
-
     //
     // Reading guest's Rflags
     //
@@ -229,23 +239,21 @@ SyscallHookEmulateSYSCALL(PGUEST_REGS Regs)
     // Save the address of the instruction following SYSCALL into RCX and then
     // load RIP from MSR_LSTAR.
     //
-    MsrValue  = __readmsr(MSR_LSTAR);
-    Regs->rcx = GuestRip + InstructionLength;
-    GuestRip  = MsrValue;
+    Regs->rcx = GuestRip + SYSCALL_INSTRUCTION_LENGTH;
+    GuestRip  = SyscallMsrs->Lstar;
     __vmx_vmwrite(GUEST_RIP, GuestRip);
 
     //
     // Save RFLAGS into R11 and then mask RFLAGS using MSR_FMASK
     //
-    MsrValue  = __readmsr(MSR_FMASK);
     Regs->r11 = GuestRflags;
-    GuestRflags &= ~(MsrValue | X86_FLAGS_RF);
+    GuestRflags &= ~(SyscallMsrs->Fmask | X86_FLAGS_RF);
     __vmx_vmwrite(GUEST_RFLAGS, GuestRflags);
 
     //
     // Load the CS and SS selectors with values derived from bits 47:32 of MSR_STAR
     //
-    MsrValue             = __readmsr(MSR_STAR);
+    MsrValue             = SyscallMsrs->Star;
     Cs.SEL               = (UINT16)((MsrValue >> 32) & ~3); // STAR[47:32] & ~RPL3
     Cs.BASE              = 0;                               // flat segment
     Cs.LIMIT             = (UINT32)~0;                      // 4GB limit
@@ -265,10 +273,11 @@ SyscallHookEmulateSYSCALL(PGUEST_REGS Regs)
  * @brief This function emulates the SYSRET execution 
  * 
  * @param Regs Guest registers
+ * @param CoreIndex Logical core index
  * @return BOOLEAN
  */
 BOOLEAN
-SyscallHookEmulateSYSRET(PGUEST_REGS Regs)
+SyscallHookEmulateSYSRET(PGUEST_REGS Regs, UINT32 CoreIndex)
 {
     SEGMENT_SELECTOR Cs, Ss;
     UINT64           MsrValue;
@@ -290,7 +299,7 @@ SyscallHookEmulateSYSRET(PGUEST_REGS Regs)
     //
     // SYSRET loads the CS and SS selectors with values derived from bits 63:48 of MSR_STAR
     //
-    MsrValue             = __readmsr(MSR_STAR);
+    MsrValue             = g_GuestState[CoreIndex].DebuggingState.SyscallMsrs.Star;
     Cs.SEL               = (UINT16)(((MsrValue >> 48) + 16) | 3); // (STAR[63:48]+16) | 3 (* RPL forced to 3 *)
     Cs.BASE              = 0;                                     // Flat segment
     Cs.LIMIT             = (UINT32)~0;                            // 4GB limit
@@ -307,53 +316,540 @@ SyscallHookEmulateSYSRET(PGUEST_REGS Regs)
 }
 
 /**
- * @brief Detect whether the #UD was because of Syscall or Sysret or not
+ * @brief Check whether a syscall passes the syscall and the process filters
+ * @details Syscalls that are out of the range of the bitmap are always watched
  * 
- * @param Regs Guest register
- * @param CoreIndex Logical core index
- * @return BOOLEAN Shows whther the caller should inject #UD on the guest or not
+ * @param SyscallNumber The service number (RAX)
+ * @return BOOLEAN Shows whether the syscall should be logged and trigger the events or not
  */
 BOOLEAN
-SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex)
+SyscallHookIsSyscallWatched(UINT32 SyscallNumber)
 {
-    UINT64  GuestCr3;
-    UINT64  OriginalCr3;
-    UINT64  Rip;
-    BOOLEAN Result;
+    //
+    // The published filter is not changed, it's read once as it might be replaced meanwhile
+    //
+    PDEBUGGER_SYSCALL_FILTER Filter = g_SyscallFilter;
+    UINT32                   ProcessId;
+
+    if (Filter == NULL)
+    {
+        return TRUE;
+    }
+
+    if (Filter->IsSyscallFilterEnabled && SyscallNumber < DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER &&
+        !(Filter->SyscallBitmap[SyscallNumber / 64] & (1ull << (SyscallNumber % 64))))
+    {
+        return FALSE;
+    }
+
+    if (Filter->NumberOfProcesses == 0 && Filter->NumberOfExcludedProcesses == 0)
+    {
+        return TRUE;
+    }
+
+    ProcessId = (UINT32)PsGetCurrentProcessId();
 
     //
-    // Reading guest's RIP
-    __vmx_vmread(GUEST_RIP, &Rip);
+    // The ignored processes are never watched
+    //
+    if (Filter->NumberOfExcludedProcesses != 0)
+    {
+        for (size_t i = 0; i < DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES; i++)
+        {
+            if (Filter->ExcludedProcessIds[i] == ProcessId)
+            {
+                return FALSE;
+            }
+        }
+    }
+
+    //
+    // An empty process filter means that all of the other processes are watched
+    //
+    if (Filter->NumberOfProcesses == 0)
+    {
+        return TRUE;
+    }
 
+    for (size_t i = 0; i < DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES; i++)
+    {
+        if (Filter->ProcessIds[i] == ProcessId)
+        {
+            return TRUE;
+        }
+    }
 
+    return FALSE;
+}
 
-    if (g_GuestState[CoreIndex].DebuggingState.SysretAddress == NULL && Rip & 0xff00000000000000)
+/**
+ * @brief Initialize the lock and the flush timer of the binary syscall trace
+ * @details Should be called once from vmx non-root mode before enabling the trace
+ * 
+ * @return VOID 
+ */
+VOID
+SyscallHookInitializeTrace()
+{
+    ExInitializeFastMutex(&g_SyscallTraceMutex);
+    KeInitializeEvent(&g_SyscallTraceEvent, SynchronizationEvent, FALSE);
+    KeInitializeTimer(&g_SyscallTraceFlushTimer);
+    KeInitializeDpc(&g_SyscallTraceFlushDpc, SyscallHookTraceFlushDpcRoutine, NULL);
+}
+
+/**
+ * @brief Enable or disable the binary trace of the core
+ * @details Should be called from vmx-root mode on the same core, the ring
+ * of the core is allocated and reset before the trace is enabled
+ * 
+ * @param CoreIndex Logical core index
+ * @param Enable Enable or disable the binary trace
+ * @param NumberOfStackArguments Number of the captured stack arguments
+ * @return VOID 
+ */
+VOID
+SyscallHookConfigureTrace(UINT32 CoreIndex, BOOLEAN Enable, UINT32 NumberOfStackArguments)
+{
+    PPROCESSOR_DEBUGGING_SYSCALL_TRACE SyscallTrace = &g_GuestState[CoreIndex].DebuggingState.SyscallTrace;
+
+    //
+    // The records that are still in the ring after disabling keep their size
+    //
+    if (Enable)
+    {
+        SyscallTrace->NumberOfStackArguments = NumberOfStackArguments;
+    }
+
+    SyscallTrace->IsBinaryTraceEnabled = Enable && SyscallTrace->Ring != NULL;
+}
+
+/**
+ * @brief Add the record of a syscall to the ring of the core
+ * @details Should be called from vmx-root mode on the same core, no lock is
+ * acquired as the current core is the only writer of its ring, if the reader
+ * is behind then the record is dropped and counted
+ * 
+ * @param Regs Guest registers
+ * @param CoreIndex Logical core index
+ * @return VOID 
+ */
+VOID
+SyscallHookAppendTraceRecord(PGUEST_REGS Regs, UINT32 CoreIndex)
+{
+    PPROCESSOR_DEBUGGING_SYSCALL_TRACE SyscallTrace = &g_GuestState[CoreIndex].DebuggingState.SyscallTrace;
+    PSYSCALL_TRACE_RING                Ring         = SyscallTrace->Ring;
+    PSYSCALL_TRACE_RECORD              Record;
+    LONG64                             Head;
+    UINT64                             GuestCr3;
+    UINT64                             GuestRsp;
+
+    Head = Ring->Head;
+
+    if (Head - InterlockedCompareExchange64(&Ring->Tail, 0, 0) >= SYSCALL_TRACE_RING_ENTRY_COUNT)
+    {
+        InterlockedIncrement64(&Ring->DroppedRecords);
+        return;
+    }
+
+    __vmx_vmread(GUEST_CR3, &GuestCr3);
+
+    Record = (PSYSCALL_TRACE_RECORD)Ring->Records[Head & (SYSCALL_TRACE_RING_ENTRY_COUNT - 1)];
+
+    Record->TimeStampCounter = __rdtsc();
+    Record->Cr3              = GuestCr3;
+    Record->ServiceNumber    = Regs->rax;
+    Record->Arguments[0]     = Regs->r10;
+    Record->Arguments[1]     = Regs->rdx;
+    Record->Arguments[2]     = Regs->r8;
+    Record->Arguments[3]     = Regs->r9;
+    Record->ProcessId        = (UINT32)PsGetCurrentProcessId();
+    Record->ThreadId         = (UINT32)PsGetCurrentThreadId();
+
+    if (SyscallTrace->NumberOfStackArguments != 0)
     {
         //
-        // Find the address of sysret
-        //
-        // Due to KVA Shadowing, we need to switch to a different directory table base
-        // if the PCID indicates this is a user mode directory table base
+        // The fifth argument is after the return address and the home
+        // space of the four register arguments, the stack is not switched
+        // yet, if it's not present then the arguments are zero
         //
-        __vmx_vmread(GUEST_CR3, &GuestCr3);
+        __vmx_vmread(GUEST_RSP, &GuestRsp);
 
-        OriginalCr3                  = __readcr3();
-        NT_KPROCESS * CurrentProcess = (NT_KPROCESS *)(PsGetCurrentProcess());
-        __writecr3(CurrentProcess->DirectoryTableBase);
+        if (!MemoryMapperReadGuestMemory(CoreIndex,
+                                         GuestCr3,
+                                         GuestRsp + 0x28,
+                                         (PVOID)((UINT64)Record + sizeof(SYSCALL_TRACE_RECORD)),
+                                         SyscallTrace->NumberOfStackArguments * sizeof(UINT64)))
+        {
+            RtlZeroMemory((PVOID)((UINT64)Record + sizeof(SYSCALL_TRACE_RECORD)), SyscallTrace->NumberOfStackArguments * sizeof(UINT64));
+        }
+    }
+
+    //
+    // Publish the record after its fields are written
+    //
+    InterlockedExchange64(&Ring->Head, Head + 1);
+}
+
+/**
+ * @brief Copy the records of the rings of all the cores to a buffer
+ * @details Should be called from vmx non-root mode while holding
+ * g_SyscallTraceMutex, the records of each core are placed after a
+ * SYSCALL_TRACE_RECORDS_HEADER and the copied records are given back
+ * to the cores
+ * 
+ * @param Buffer The buffer
+ * @param BufferSize Size of the buffer
+ * @return UINT32 Number of the bytes that are written to the buffer
+ */
+UINT32
+SyscallHookReadTrace(PVOID Buffer, UINT32 BufferSize)
+{
+    ULONG                              ProcessorsCount;
+    ULONG                              CoreIndex;
+    PPROCESSOR_DEBUGGING_SYSCALL_TRACE SyscallTrace;
+    PSYSCALL_TRACE_RING                Ring;
+    PSYSCALL_TRACE_RECORDS_HEADER      Header;
+    LONG64                             Head;
+    LONG64                             Tail;
+    LONG64                             DroppedRecords;
+    UINT32                             SizeOfRecord;
+    UINT32                             Index;
+    UINT32                             Offset = 0;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        SyscallTrace = &g_GuestState[CoreIndex].DebuggingState.SyscallTrace;
+        Ring         = SyscallTrace->Ring;
+
+        if (Ring == NULL)
+        {
+            continue;
+        }
+
+        //
+        // Read the head before the records that it publishes
+        //
+        Head           = InterlockedCompareExchange64(&Ring->Head, 0, 0);
+        Tail           = Ring->Tail;
+        DroppedRecords = Ring->DroppedRecords;
+        SizeOfRecord   = SYSCALL_TRACE_RECORD_SIZE(SyscallTrace->NumberOfStackArguments);
 
-        if (IS_SYSRET_INSTRUCTION(Rip))
+        if (Head == Tail && DroppedRecords == Ring->ReportedDroppedRecords)
         {
-            __writecr3(OriginalCr3);
+            continue;
+        }
 
+        if (Offset + sizeof(SYSCALL_TRACE_RECORDS_HEADER) + SizeOfRecord > BufferSize)
+        {
             //
-            // Save the address of Sysret, it won't change
+            // The rest of the records are read by the next read without waiting
             //
-            g_GuestState[CoreIndex].DebuggingState.SysretAddress = Rip;
+            KeSetEvent(&g_SyscallTraceEvent, 0, FALSE);
+            break;
+        }
+
+        Header                         = (PSYSCALL_TRACE_RECORDS_HEADER)((UINT64)Buffer + Offset);
+        Header->CoreIndex              = CoreIndex;
+        Header->NumberOfStackArguments = SyscallTrace->NumberOfStackArguments;
+        Header->NumberOfRecords        = (UINT32)min(Head - Tail, (LONG64)((BufferSize - Offset - sizeof(SYSCALL_TRACE_RECORDS_HEADER)) / SizeOfRecord));
+        Header->DroppedRecords         = (UINT32)min(DroppedRecords - Ring->ReportedDroppedRecords, (LONG64)MAXUINT32);
+
+        Offset += sizeof(SYSCALL_TRACE_RECORDS_HEADER);
+
+        for (Index = 0; Index < Header->NumberOfRecords; Index++)
+        {
+            RtlCopyMemory((PVOID)((UINT64)Buffer + Offset), Ring->Records[(Tail + Index) & (SYSCALL_TRACE_RING_ENTRY_COUNT - 1)], SizeOfRecord);
+            Offset += SizeOfRecord;
+        }
+
+        Ring->ReportedDroppedRecords = DroppedRecords;
+
+        //
+        // Give the records back to the core
+        //
+        InterlockedExchange64(&Ring->Tail, Tail + Header->NumberOfRecords);
+
+        if (Tail + Header->NumberOfRecords != Head)
+        {
+            KeSetEvent(&g_SyscallTraceEvent, 0, FALSE);
+            break;
         }
-        __writecr3(OriginalCr3);
     }
 
-    if (Rip == g_GuestState[CoreIndex].DebuggingState.SysretAddress)
+    return Offset;
+}
+
+/**
+ * @brief Reset the rings of all the cores
+ * @details Should be called from vmx non-root mode while holding
+ * g_SyscallTraceMutex and while the trace is disabled on all the cores,
+ * the records of the previous trace are dropped
+ * 
+ * @return VOID 
+ */
+VOID
+SyscallHookResetTrace()
+{
+    ULONG               ProcessorsCount;
+    ULONG               CoreIndex;
+    PSYSCALL_TRACE_RING Ring;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        Ring = g_GuestState[CoreIndex].DebuggingState.SyscallTrace.Ring;
+
+        if (Ring != NULL)
+        {
+            Ring->Head                   = 0;
+            Ring->Tail                   = 0;
+            Ring->DroppedRecords         = 0;
+            Ring->ReportedDroppedRecords = 0;
+        }
+    }
+}
+
+/**
+ * @brief Free the rings of all the cores
+ * @details Should be called from vmx non-root mode while holding
+ * g_SyscallTraceMutex, the trace should be disabled on all the cores
+ * and the flush timer should be stopped
+ * 
+ * @return VOID 
+ */
+VOID
+SyscallHookFreeTrace()
+{
+    ULONG ProcessorsCount;
+    ULONG CoreIndex;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        if (g_GuestState[CoreIndex].DebuggingState.SyscallTrace.Ring != NULL)
+        {
+            ExFreePoolWithTag(g_GuestState[CoreIndex].DebuggingState.SyscallTrace.Ring, POOLTAG);
+            g_GuestState[CoreIndex].DebuggingState.SyscallTrace.Ring = NULL;
+        }
+    }
+}
+
+/**
+ * @brief The DPC of the flush timer of the binary syscall trace
+ * @details The reader is woken up if there is any record, so the records
+ * are not held by the rings for longer than the interval of the timer
+ * 
+ * @param Dpc
+ * @param DeferredContext
+ * @param SystemArgument1
+ * @param SystemArgument2
+ * @return VOID 
+ */
+VOID
+SyscallHookTraceFlushDpcRoutine(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    ULONG               ProcessorsCount;
+    ULONG               CoreIndex;
+    PSYSCALL_TRACE_RING Ring;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        Ring = g_GuestState[CoreIndex].DebuggingState.SyscallTrace.Ring;
+
+        if (Ring != NULL && (Ring->Head != Ring->Tail || Ring->DroppedRecords != Ring->ReportedDroppedRecords))
+        {
+            KeSetEvent(&g_SyscallTraceEvent, 0, FALSE);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Log a syscall and trigger the events of the syscall hook
+ * @details The syscalls that nobody watches are ignored
+ * 
+ * @param Regs Guest registers
+ * @param CoreIndex Logical core index
+ * @param SyscallAddress Address of the syscall instruction
+ * @return VOID 
+ */
+VOID
+SyscallHookTraceSYSCALL(PGUEST_REGS Regs, UINT32 CoreIndex, UINT64 SyscallAddress)
+{
+    if (!SyscallHookIsSyscallWatched((UINT32)Regs->rax))
+    {
+        return;
+    }
+
+    //
+    // The binary trace is only recorded, the events are not triggered for
+    // the traced syscalls so the trace keeps up with the syscall rate
+    //
+    if (g_GuestState[CoreIndex].DebuggingState.SyscallTrace.IsBinaryTraceEnabled)
+    {
+        SyscallHookAppendTraceRecord(Regs, CoreIndex);
+        return;
+    }
+
+    LogInfo("SYSCALL instruction => 0x%llX , service number : 0x%x , process id : 0x%x",
+            SyscallAddress,
+            (UINT32)Regs->rax,
+            PsGetCurrentProcessId());
+
+    //
+    // Trigger the events of the syscall hook, the service number is the context
+    //
+    DebuggerTriggerEvents(SYSCALL_HOOK_EFER, Regs, (PVOID)Regs->rax);
+}
+
+/**
+ * @brief Find the sysret of the system call handler
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL), the target
+ * of syscall (MSR_LSTAR) is the start of KiSystemCall64 or with KVA Shadowing
+ * KiSystemCall64Shadow, so its instructions are disassembled from there and the
+ * first sysret on an instruction boundary is returned. It's only a hint for the
+ * #UD handler, which checks the bytes of any other sysret that causes #UD
+ * (e.g. KiKernelSysretExit with KVA Shadowing)
+ * 
+ * @return UINT64 Address of sysret or zero if it's not found
+ */
+UINT64
+SyscallHookFindSysretAddress()
+{
+    UINT64 SyscallTarget;
+    UINT64 KernelBase;
+    UINT64 EndAddress;
+    SIZE_T Length;
+    ULONG  KernelSize = 0;
+
+    SyscallTarget = __readmsr(MSR_LSTAR);
+    KernelBase    = (UINT64)SyscallHookGetKernelBase(&KernelSize);
+
+    if (KernelBase == 0 || SyscallTarget < KernelBase || SyscallTarget >= KernelBase + KernelSize)
+    {
+        LogError("The target of syscall is not in the kernel image");
+        return 0;
+    }
+
+    EndAddress = SyscallTarget + SYSRET_SEARCH_LIMIT;
+
+    if (EndAddress > KernelBase + KernelSize)
+    {
+        EndAddress = KernelBase + KernelSize;
+    }
+
+    if (!MmIsAddressValid((PVOID)SyscallTarget))
+    {
+        LogError("The target of syscall is not valid");
+        return 0;
+    }
+
+    for (UINT64 Address = SyscallTarget; Address + SYSRET_INSTRUCTION_LENGTH <= EndAddress; Address += Length)
+    {
+        //
+        // The code of the handlers is not paged, but the disassembler might
+        // read the next page at the end of the section
+        //
+        if (((Address + EMULATION_MAX_INSTRUCTION_LENGTH - 1) & (PAGE_SIZE - 1)) < EMULATION_MAX_INSTRUCTION_LENGTH - 1 &&
+            !MmIsAddressValid((PVOID)(Address + EMULATION_MAX_INSTRUCTION_LENGTH - 1)))
+        {
+            break;
+        }
+
+        if (IS_SYSRET_INSTRUCTION(Address))
+        {
+            return Address;
+        }
+
+        Length = ldisasm((PVOID)Address, TRUE);
+
+        if (Length == 0 || Length > EMULATION_MAX_INSTRUCTION_LENGTH)
+        {
+            break;
+        }
+    }
+
+    LogError("Sysret is not found after the target of syscall");
+    return 0;
+}
+
+/**
+ * @brief Check whether an address is one of the verified sysrets
+ * 
+ * @param Address The address of the instruction
+ * @return BOOLEAN 
+ */
+BOOLEAN
+SyscallHookIsVerifiedSysret(UINT64 Address)
+{
+    for (UINT32 i = 0; i < SYSCALL_HOOK_SYSRET_ADDRESSES; i++)
+    {
+        if (g_SyscallHookSysretAddresses[i] == Address)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Add a sysret to the verified sysrets
+ * @details If there is no free slot, then the sysret is checked on each #UD
+ * 
+ * @param Address The address of the sysret
+ * @return VOID 
+ */
+VOID
+SyscallHookAddVerifiedSysret(UINT64 Address)
+{
+    for (UINT32 i = 0; i < SYSCALL_HOOK_SYSRET_ADDRESSES; i++)
+    {
+        //
+        // Another core might add the same address at the same time
+        //
+        UINT64 Previous = InterlockedCompareExchange64((volatile LONG64 *)&g_SyscallHookSysretAddresses[i], Address, 0);
+
+        if (Previous == 0 || Previous == Address)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Detect whether the #UD was because of Syscall or Sysret or not
+ * 
+ * @param Regs Guest register
+ * @param CoreIndex Logical core index
+ * @return BOOLEAN Shows whther the caller should inject #UD on the guest or not
+ */
+BOOLEAN
+SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex)
+{
+    UINT64  GuestCr3;
+    UINT64  Rip;
+    UINT64  GuestCsAccessRights;
+    UCHAR   InstructionBytes[SYSRET_INSTRUCTION_LENGTH];
+    BOOLEAN Result;
+
+    //
+    // Reading guest's RIP
+    //
+    __vmx_vmread(GUEST_RIP, &Rip);
+
+    if (SyscallHookIsVerifiedSysret(Rip))
     {
         //
         // It's a sysret instruction, let's emulate it
@@ -362,6 +858,25 @@ SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex)
     }
     else if (Rip & 0xff00000000000000)
     {
+        //
+        // It's not one of the verified sysrets (or nothing is found when the
+        // hook is enabled), so the instruction is checked before the #UD
+        // is injected. It's checked without switching to another cr3, the
+        // code that executes sysret is mapped in the current cr3 even with
+        // KVA Shadowing (it's in the shadow of the kernel)
+        //
+        __vmx_vmread(GUEST_CR3, &GuestCr3);
+
+        if (MemoryMapperReadGuestMemory(CoreIndex, GuestCr3, Rip, InstructionBytes, SYSRET_INSTRUCTION_LENGTH) &&
+            IS_SYSRET_INSTRUCTION(InstructionBytes))
+        {
+            //
+            // The next sysrets of this address are not checked
+            //
+            SyscallHookAddVerifiedSysret(Rip);
+            goto EmulateSYSRET;
+        }
+
         //
         // It's a #UD in kernel, not relate to us
         // this way the caller injects a #UD
@@ -371,8 +886,33 @@ SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex)
     else
     {
         //
-        // It's sth in usermode, might be a syscall
+        // It's sth in usermode, might be a syscall, but syscall is
+        // not valid in compatibility mode
+        //
+        __vmx_vmread(GUEST_CS_AR_BYTES, &GuestCsAccessRights);
+
+        if (!(GuestCsAccessRights & EMULATION_CS_AR_BYTES_L_BIT))
+        {
+            return FALSE;
+        }
+
+        //
+        // Check the instruction without raising a page fault, if the code
+        // is paged out then the guest executes it again (with the SCE bit)
+        // so the page fault is delivered to the guest
         //
+        __vmx_vmread(GUEST_CR3, &GuestCr3);
+
+        if (!MemoryMapperReadGuestMemory(CoreIndex, GuestCr3, Rip, InstructionBytes, SYSCALL_INSTRUCTION_LENGTH))
+        {
+            goto ExecuteSYSCALLWithMtf;
+        }
+
+        if (!IS_SYSCALL_INSTRUCTION(InstructionBytes))
+        {
+            return FALSE;
+        }
+
         goto EmulateSYSCALL;
     }
 
@@ -380,8 +920,15 @@ SyscallHookHandleUD(PGUEST_REGS Regs, UINT32 CoreIndex)
     // Emulate SYSRET instruction
     //
 EmulateSYSRET:
-    LogInfo("SYSRET instruction => 0x%llX", Rip);
-    Result                               = SyscallHookEmulateSYSRET(Regs);
+    //
+    // The sysret doesn't have a service number, so it's only logged
+    // when there is no filter
+    //
+    if (g_SyscallFilter == NULL)
+    {
+        LogInfo("SYSRET instruction => 0x%llX", Rip);
+    }
+    Result                               = SyscallHookEmulateSYSRET(Regs, CoreIndex);
     g_GuestState[CoreIndex].IncrementRip = FALSE;
     return Result;
     //
@@ -389,16 +936,23 @@ EmulateSYSRET:
     //
 EmulateSYSCALL:
     //
-    // We don't emulate the syscalls anymore because
-    // The usermode code might be paged out
-    Result = SyscallHookEmulateSYSCALL(Regs);
-    LogInfo("SYSCALL instruction => 0x%llX , process id : 0x%x",
-            Rip,
-            PsGetCurrentProcessId());
+    // The emulation overwrites RCX and R11 like the processor does, so it's traced
+    // first and the events get the registers of the guest at the SYSCALL instruction
     //
-    //SyscallHookEnableSCE();
-    //HvSetMonitorTrapFlag(TRUE);
-    //g_GuestState[CoreIndex].DebuggingState.UndefinedInstructionAddress = Rip;
+    SyscallHookTraceSYSCALL(Regs, CoreIndex, Rip);
+
+    Result                               = SyscallHookEmulateSYSCALL(Regs, CoreIndex);
     g_GuestState[CoreIndex].IncrementRip = FALSE;
+
+    return Result;
+    //
+    // Execute SYSCALL in the guest and check the result in MTF vm-exit
+    //
+ExecuteSYSCALLWithMtf:
+    g_GuestState[CoreIndex].DebuggingState.SyscallRegs = *Regs;
+    SyscallHookEnableSCE();
+    HvSetMonitorTrapFlag(TRUE);
+    g_GuestState[CoreIndex].DebuggingState.UndefinedInstructionAddress = Rip;
+    g_GuestState[CoreIndex].IncrementRip                               = FALSE;
     return TRUE;
 }
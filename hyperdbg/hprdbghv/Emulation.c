@@ -0,0 +1,666 @@
+/**
+ * @file Emulation.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Emulation of the memory accesses to the hooked pages
+ * @details The common loads, stores and compares that access a read/write hooked
+ * page are performed in vmx-root mode on the original page, so the guest continues
+ * from the next instruction without restoring the entry and setting the Monitor
+ * Trap Flag, every other instruction falls back to the Monitor Trap Flag
+ * @version 0.1
+ * @date 2020-05-02
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "Vmx.h"
+#include "Common.h"
+#include "Emulation.h"
+#include "MemoryMapper.h"
+#include "GlobalVariables.h"
+
+/**
+ * @brief Decode the supported MOV, MOVZX and CMP instructions with a memory operand
+ * @details Supported instructions are MOV (88, 89, 8A, 8B, C6 /0, C7 /0), MOVZX (0F B6, 0F B7)
+ * and CMP (38, 39, 3A, 3B, 80 /7, 81 /7, 83 /7) with the operand-size, segment and REX prefixes,
+ * the base, index, scale and displacement of the memory operand are decoded so the caller can
+ * check the operand against the linear address of the vm-exit
+ * 
+ * @param Bytes The bytes of the instruction
+ * @param AvailableBytes Number of the bytes that can be read
+ * @param Instruction The decoded instruction
+ * @return BOOLEAN Returns false if the instruction is not supported
+ */
+BOOLEAN
+EmulationDecodeInstruction(PUCHAR Bytes, UINT32 AvailableBytes, PEMULATION_INSTRUCTION Instruction)
+{
+    UINT32  Index               = 0;
+    UINT32  DisplacementSize    = 0;
+    UINT32  ImmediateSize       = 0;
+    UINT32  OperandSize         = 4;
+    UINT32  OpcodeExtension     = 0;
+    BOOLEAN HasOpcodeExtension  = FALSE;
+    BOOLEAN OperandSizeOverride = FALSE;
+    UCHAR   Rex                 = 0;
+    UCHAR   Opcode;
+    UCHAR   ModRm;
+    UCHAR   Mod;
+    UCHAR   Rm;
+    UCHAR   Sib;
+
+    RtlZeroMemory(Instruction, sizeof(EMULATION_INSTRUCTION));
+
+    if (AvailableBytes > EMULATION_MAX_INSTRUCTION_LENGTH)
+    {
+        AvailableBytes = EMULATION_MAX_INSTRUCTION_LENGTH;
+    }
+
+    //
+    // Legacy prefixes, only FS and GS segments have a base in 64-bit mode,
+    // LOCK, REP and the address-size prefixes are not supported
+    //
+    while (Index < AvailableBytes)
+    {
+        if (Bytes[Index] == 0x66)
+        {
+            OperandSizeOverride = TRUE;
+        }
+        else if (Bytes[Index] == 0x64 || Bytes[Index] == 0x65)
+        {
+            Instruction->SegmentPrefix = Bytes[Index];
+        }
+        else if (Bytes[Index] != 0x2e && Bytes[Index] != 0x36 && Bytes[Index] != 0x3e && Bytes[Index] != 0x26)
+        {
+            break;
+        }
+        Index++;
+    }
+
+    //
+    // REX prefix
+    //
+    if (Index < AvailableBytes && (Bytes[Index] & 0xf0) == 0x40)
+    {
+        Rex                 = Bytes[Index];
+        Instruction->HasRex = TRUE;
+        Index++;
+    }
+
+    if (Index >= AvailableBytes)
+    {
+        return FALSE;
+    }
+
+    if (Rex & 0x8)
+    {
+        OperandSize = 8;
+    }
+    else if (OperandSizeOverride)
+    {
+        OperandSize = 2;
+    }
+
+    Opcode = Bytes[Index++];
+
+    switch (Opcode)
+    {
+    case 0x88:
+    case 0x89:
+        Instruction->Operation         = EMULATION_OPERATION_STORE;
+        Instruction->MemoryOperandSize = Opcode == 0x88 ? 1 : OperandSize;
+        break;
+
+    case 0x8a:
+    case 0x8b:
+        Instruction->Operation         = EMULATION_OPERATION_LOAD;
+        Instruction->MemoryOperandSize = Opcode == 0x8a ? 1 : OperandSize;
+        break;
+
+    case 0xc6:
+    case 0xc7:
+        Instruction->Operation         = EMULATION_OPERATION_STORE;
+        Instruction->MemoryOperandSize = Opcode == 0xc6 ? 1 : OperandSize;
+        Instruction->HasImmediate      = TRUE;
+        ImmediateSize                  = Instruction->MemoryOperandSize == 2 ? 2 : (Opcode == 0xc6 ? 1 : 4);
+        HasOpcodeExtension             = TRUE;
+        OpcodeExtension                = 0;
+        break;
+
+    case 0x38:
+    case 0x39:
+    case 0x3a:
+    case 0x3b:
+        Instruction->Operation            = EMULATION_OPERATION_COMPARE;
+        Instruction->MemoryOperandSize    = (Opcode == 0x38 || Opcode == 0x3a) ? 1 : OperandSize;
+        Instruction->IsMemoryFirstOperand = Opcode == 0x38 || Opcode == 0x39;
+        break;
+
+    case 0x80:
+    case 0x81:
+    case 0x83:
+        Instruction->Operation            = EMULATION_OPERATION_COMPARE;
+        Instruction->MemoryOperandSize    = Opcode == 0x80 ? 1 : OperandSize;
+        Instruction->IsMemoryFirstOperand = TRUE;
+        Instruction->HasImmediate         = TRUE;
+        ImmediateSize                     = Opcode == 0x81 ? (OperandSize == 2 ? 2 : 4) : 1;
+        HasOpcodeExtension                = TRUE;
+        OpcodeExtension                   = 7;
+        break;
+
+    case 0x0f:
+
+        if (Index >= AvailableBytes || (Bytes[Index] != 0xb6 && Bytes[Index] != 0xb7))
+        {
+            return FALSE;
+        }
+
+        //
+        // MOVZX, the register is wider than the memory operand
+        //
+        Instruction->Operation           = EMULATION_OPERATION_LOAD;
+        Instruction->MemoryOperandSize   = Bytes[Index] == 0xb6 ? 1 : 2;
+        Instruction->RegisterOperandSize = OperandSize;
+        Index++;
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    if (Instruction->RegisterOperandSize == 0)
+    {
+        Instruction->RegisterOperandSize = Instruction->MemoryOperandSize;
+    }
+
+    //
+    // ModR/M, only the memory forms are expected to access the hooked page
+    //
+    if (Index >= AvailableBytes)
+    {
+        return FALSE;
+    }
+
+    ModRm = Bytes[Index++];
+    Mod   = ModRm >> 6;
+    Rm    = ModRm & 0x7;
+
+    if (Mod == 3)
+    {
+        return FALSE;
+    }
+
+    if (HasOpcodeExtension)
+    {
+        if (((ModRm >> 3) & 0x7) != OpcodeExtension)
+        {
+            return FALSE;
+        }
+    }
+    else
+    {
+        Instruction->RegisterIndex = ((ModRm >> 3) & 0x7) | ((Rex & 0x4) ? 8 : 0);
+
+        if (Instruction->RegisterOperandSize == 1 && !Instruction->HasRex && Instruction->RegisterIndex >= 4)
+        {
+            //
+            // AH, CH, DH and BH are the second byte of RAX, RCX, RDX and RBX
+            //
+            Instruction->RegisterIndex -= 4;
+            Instruction->IsHighByteRegister = TRUE;
+        }
+        else if (Instruction->RegisterIndex == 4)
+        {
+            //
+            // RSP is not saved in the guest registers
+            //
+            return FALSE;
+        }
+    }
+
+    //
+    // SIB and displacement
+    //
+    if (Rm == 4)
+    {
+        if (Index >= AvailableBytes)
+        {
+            return FALSE;
+        }
+
+        Sib = Bytes[Index++];
+
+        Instruction->Scale         = 1 << (Sib >> 6);
+        Instruction->IndexRegister = ((Sib >> 3) & 0x7) | ((Rex & 0x2) ? 8 : 0);
+        Instruction->BaseRegister  = (Sib & 0x7) | ((Rex & 0x1) ? 8 : 0);
+
+        //
+        // Index 4 (without REX.X) means no index register
+        //
+        Instruction->HasIndexRegister = Instruction->IndexRegister != 4;
+
+        if (Mod == 0 && (Sib & 0x7) == 5)
+        {
+            DisplacementSize = 4;
+        }
+        else
+        {
+            Instruction->HasBaseRegister = TRUE;
+        }
+    }
+    else if (Mod == 0 && Rm == 5)
+    {
+        Instruction->IsRipRelative = TRUE;
+    }
+    else
+    {
+        Instruction->HasBaseRegister = TRUE;
+        Instruction->BaseRegister    = Rm | ((Rex & 0x1) ? 8 : 0);
+    }
+
+    if (Mod == 1)
+    {
+        DisplacementSize = 1;
+    }
+    else if (Mod == 2 || (Mod == 0 && Rm == 5))
+    {
+        DisplacementSize = 4;
+    }
+
+    if (Index + DisplacementSize > AvailableBytes)
+    {
+        return FALSE;
+    }
+
+    if (DisplacementSize == 1)
+    {
+        Instruction->Displacement = *(CHAR *)&Bytes[Index];
+    }
+    else if (DisplacementSize == 4)
+    {
+        Instruction->Displacement = *(LONG *)&Bytes[Index];
+    }
+
+    Index += DisplacementSize;
+
+    //
+    // Immediate, sign-extended to the operand size
+    //
+    if (Index + ImmediateSize > AvailableBytes)
+    {
+        return FALSE;
+    }
+
+    if (ImmediateSize == 1)
+    {
+        Instruction->Immediate = (UINT64)(INT64)(*(CHAR *)&Bytes[Index]);
+    }
+    else if (ImmediateSize == 2)
+    {
+        Instruction->Immediate = (UINT64)(INT64)(*(SHORT *)&Bytes[Index]);
+    }
+    else if (ImmediateSize == 4)
+    {
+        Instruction->Immediate = (UINT64)(INT64)(*(LONG *)&Bytes[Index]);
+    }
+
+    Index += ImmediateSize;
+
+    Instruction->Length = Index;
+
+    return TRUE;
+}
+
+/**
+ * @brief Read a value with the size of an operand
+ * 
+ * @param Address The address to read
+ * @param Size Size of the operand (1, 2, 4 or 8)
+ * @return UINT64 The zero-extended value
+ */
+UINT64
+EmulationReadOperand(PVOID Address, UINT32 Size)
+{
+    switch (Size)
+    {
+    case 1:
+        return *(volatile UCHAR *)Address;
+    case 2:
+        return *(volatile USHORT *)Address;
+    case 4:
+        return *(volatile UINT32 *)Address;
+    default:
+        return *(volatile UINT64 *)Address;
+    }
+}
+
+/**
+ * @brief Write a value with the size of an operand
+ * 
+ * @param Address The address to write
+ * @param Size Size of the operand (1, 2, 4 or 8)
+ * @param Value The value to write
+ * @return VOID
+ */
+VOID
+EmulationWriteOperand(PVOID Address, UINT32 Size, UINT64 Value)
+{
+    switch (Size)
+    {
+    case 1:
+        *(volatile UCHAR *)Address = (UCHAR)Value;
+        break;
+    case 2:
+        *(volatile USHORT *)Address = (USHORT)Value;
+        break;
+    case 4:
+        *(volatile UINT32 *)Address = (UINT32)Value;
+        break;
+    default:
+        *(volatile UINT64 *)Address = Value;
+        break;
+    }
+}
+
+/**
+ * @brief Compute the status flags of a CMP instruction
+ * 
+ * @param Destination The first operand
+ * @param Source The second operand
+ * @param Size Size of the operands (1, 2, 4 or 8)
+ * @return UINT64 The status flags of Destination - Source
+ */
+UINT64
+EmulationComputeCompareFlags(UINT64 Destination, UINT64 Source, UINT32 Size)
+{
+    UINT64 SignBit = 1ull << (Size * 8 - 1);
+    UINT64 Mask    = (SignBit << 1) - 1;
+    UINT64 Flags   = 0;
+    UINT64 Result;
+    UCHAR  Parity;
+
+    Destination &= Mask;
+    Source &= Mask;
+    Result = (Destination - Source) & Mask;
+
+    if (Destination < Source)
+    {
+        Flags |= X86_FLAGS_CF;
+    }
+    if (Result == 0)
+    {
+        Flags |= X86_FLAGS_ZF;
+    }
+    if (Result & SignBit)
+    {
+        Flags |= X86_FLAGS_SF;
+    }
+    if ((Destination ^ Source) & (Destination ^ Result) & SignBit)
+    {
+        Flags |= X86_FLAGS_OF;
+    }
+    if ((Destination ^ Source ^ Result) & 0x10)
+    {
+        Flags |= X86_FLAGS_AF;
+    }
+
+    //
+    // PF is set if the low byte of the result has an even number of set bits
+    //
+    Parity = (UCHAR)Result;
+    Parity ^= Parity >> 4;
+    Parity ^= Parity >> 2;
+    Parity ^= Parity >> 1;
+
+    if (!(Parity & 1))
+    {
+        Flags |= X86_FLAGS_PF;
+    }
+
+    return Flags;
+}
+
+/**
+ * @brief Compute the linear address of the memory operand of a decoded instruction
+ * @details This function should be called from vmx root-mode, RSP and the bases of
+ * FS and GS are read from the guest state
+ * 
+ * @param Regs The guest's general purpose registers
+ * @param GuestRip The address of the instruction
+ * @param Instruction The decoded instruction
+ * @return UINT64 The linear address of the memory operand
+ */
+UINT64
+EmulationComputeLinearAddress(PGUEST_REGS Regs, UINT64 GuestRip, PEMULATION_INSTRUCTION Instruction)
+{
+    UINT64 Address = (UINT64)Instruction->Displacement;
+    UINT64 RegisterValue;
+    UINT64 SegmentBase;
+
+    if (Instruction->IsRipRelative)
+    {
+        //
+        // RIP-relative addresses are based on the next instruction
+        //
+        Address += GuestRip + Instruction->Length;
+    }
+
+    if (Instruction->HasBaseRegister)
+    {
+        if (Instruction->BaseRegister == 4)
+        {
+            __vmx_vmread(GUEST_RSP, &RegisterValue);
+        }
+        else
+        {
+            RegisterValue = ((PUINT64)Regs)[Instruction->BaseRegister];
+        }
+        Address += RegisterValue;
+    }
+
+    if (Instruction->HasIndexRegister)
+    {
+        Address += ((PUINT64)Regs)[Instruction->IndexRegister] * Instruction->Scale;
+    }
+
+    if (Instruction->SegmentPrefix == 0x64)
+    {
+        __vmx_vmread(GUEST_FS_BASE, &SegmentBase);
+        Address += SegmentBase;
+    }
+    else if (Instruction->SegmentPrefix == 0x65)
+    {
+        __vmx_vmread(GUEST_GS_BASE, &SegmentBase);
+        Address += SegmentBase;
+    }
+
+    return Address;
+}
+
+/**
+ * @brief Emulate the memory access of the guest's current instruction to a hooked page
+ * @details This function should be called from vmx root-mode, the access is performed
+ * on the original page and the guest's RIP is moved to the next instruction, the
+ * caller should fall back to the Monitor Trap Flag if this function returns false
+ * 
+ * @param Regs The guest's general purpose registers
+ * @param GuestPhysicalAddr The guest physical address that caused the ept violation
+ * @param ViolationQualification The exit qualification of the ept violation
+ * @return BOOLEAN Returns true if the instruction was emulated
+ */
+BOOLEAN
+EmulationHandleHookedMemoryAccess(PGUEST_REGS Regs, UINT64 GuestPhysicalAddr, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification)
+{
+    UINT32                CoreIndex = KeGetCurrentProcessorNumber();
+    UINT64                GuestRip;
+    UINT64                GuestRflags;
+    UINT64                GuestCsAccessRights;
+    UINT64                GuestCr3;
+    UINT64                GuestLinearAddress;
+    UINT64                Interruptibility;
+    UINT64                MemoryAddress;
+    UINT64                MemoryValue;
+    UINT64                OtherValue;
+    UINT64                AccessedPage;
+    UINT64                InstructionPhysicalAddress;
+    UINT32                AvailableBytes;
+    PUCHAR                RegisterAddress;
+    UCHAR                 Bytes[EMULATION_MAX_INSTRUCTION_LENGTH];
+    EMULATION_INSTRUCTION Instruction;
+
+    //
+    // The linear address should be valid and the access should be to its
+    // translation, the accesses to the paging structures (page walks and
+    // the updates of the accessed and dirty bits) are not emulated
+    //
+    if (!ViolationQualification.ValidGuestLinearAddress || !ViolationQualification.CausedByTranslation)
+    {
+        return FALSE;
+    }
+
+    __vmx_vmread(GUEST_RIP, &GuestRip);
+    __vmx_vmread(GUEST_RFLAGS, &GuestRflags);
+    __vmx_vmread(GUEST_CS_AR_BYTES, &GuestCsAccessRights);
+
+    //
+    // Only the 64-bit kernel code is emulated, the single-steps should see the
+    // trap of the instruction itself
+    //
+    if (!(GuestCsAccessRights & EMULATION_CS_AR_BYTES_L_BIT) || (GuestRflags & X86_FLAGS_TF) || GuestRip < 0xffff800000000000)
+    {
+        return FALSE;
+    }
+
+    //
+    // The guest's code is read through the guest's paging structures, the host's
+    // address space might not map it (e.g. session addresses) and MmIsAddressValid
+    // is not safe in vmx-root
+    //
+    __vmx_vmread(GUEST_CR3, &GuestCr3);
+
+    AvailableBytes = PAGE_SIZE - (GuestRip & (PAGE_SIZE - 1));
+
+    //
+    // If the next page is not present, only the bytes before the page boundary
+    // are read as the instruction might still fit in them
+    //
+    if (MemoryMapperReadGuestMemory(CoreIndex, GuestCr3, GuestRip, Bytes, EMULATION_MAX_INSTRUCTION_LENGTH))
+    {
+        AvailableBytes = EMULATION_MAX_INSTRUCTION_LENGTH;
+    }
+    else if (AvailableBytes >= EMULATION_MAX_INSTRUCTION_LENGTH ||
+             !MemoryMapperReadGuestMemory(CoreIndex, GuestCr3, GuestRip, Bytes, AvailableBytes))
+    {
+        return FALSE;
+    }
+
+    if (!EmulationDecodeInstruction(Bytes, AvailableBytes, &Instruction))
+    {
+        return FALSE;
+    }
+
+    //
+    // The instruction should be the one that caused the violation, it's checked by
+    // the type of the access and the linear address of its memory operand
+    //
+    if ((BOOLEAN)ViolationQualification.WriteAccess != (Instruction.Operation == EMULATION_OPERATION_STORE))
+    {
+        return FALSE;
+    }
+
+    __vmx_vmread(GUEST_LINEAR_ADDRESS, &GuestLinearAddress);
+
+    if (EmulationComputeLinearAddress(Regs, GuestRip, &Instruction) != GuestLinearAddress ||
+        (GuestLinearAddress & (PAGE_SIZE - 1)) != (GuestPhysicalAddr & (PAGE_SIZE - 1)))
+    {
+        return FALSE;
+    }
+
+    //
+    // The instructions on the hooked page itself are not emulated as the guest
+    // might execute another copy of that page
+    //
+    AccessedPage = (UINT64)PAGE_ALIGN(GuestPhysicalAddr);
+
+    if (!MemoryMapperTranslateGuestVirtualAddress(CoreIndex, GuestCr3, GuestRip, &InstructionPhysicalAddress) ||
+        (UINT64)PAGE_ALIGN(InstructionPhysicalAddress) == AccessedPage ||
+        !MemoryMapperTranslateGuestVirtualAddress(CoreIndex, GuestCr3, GuestRip + Instruction.Length - 1, &InstructionPhysicalAddress) ||
+        (UINT64)PAGE_ALIGN(InstructionPhysicalAddress) == AccessedPage)
+    {
+        return FALSE;
+    }
+
+    //
+    // An access that crosses the page boundary needs the next page's entry too
+    //
+    if ((GuestPhysicalAddr & (PAGE_SIZE - 1)) + Instruction.MemoryOperandSize > PAGE_SIZE)
+    {
+        return FALSE;
+    }
+
+    MemoryAddress = PhysicalAddressToVirtualAddress(GuestPhysicalAddr);
+
+    if (MemoryAddress == 0)
+    {
+        return FALSE;
+    }
+
+    RegisterAddress = (PUCHAR)&((PUINT64)Regs)[Instruction.RegisterIndex];
+
+    if (Instruction.IsHighByteRegister)
+    {
+        RegisterAddress++;
+    }
+
+    switch (Instruction.Operation)
+    {
+    case EMULATION_OPERATION_LOAD:
+
+        MemoryValue = EmulationReadOperand((PVOID)MemoryAddress, Instruction.MemoryOperandSize);
+
+        //
+        // The 32-bit destinations are zero-extended to 64-bit
+        //
+        EmulationWriteOperand(RegisterAddress, Instruction.RegisterOperandSize == 4 ? 8 : Instruction.RegisterOperandSize, MemoryValue);
+        break;
+
+    case EMULATION_OPERATION_STORE:
+
+        OtherValue = Instruction.HasImmediate ? Instruction.Immediate : EmulationReadOperand(RegisterAddress, Instruction.RegisterOperandSize);
+
+        EmulationWriteOperand((PVOID)MemoryAddress, Instruction.MemoryOperandSize, OtherValue);
+        break;
+
+    case EMULATION_OPERATION_COMPARE:
+
+        MemoryValue = EmulationReadOperand((PVOID)MemoryAddress, Instruction.MemoryOperandSize);
+        OtherValue  = Instruction.HasImmediate ? Instruction.Immediate : EmulationReadOperand(RegisterAddress, Instruction.RegisterOperandSize);
+
+        GuestRflags &= ~EMULATION_RFLAGS_STATUS_MASK;
+
+        if (Instruction.IsMemoryFirstOperand)
+        {
+            GuestRflags |= EmulationComputeCompareFlags(MemoryValue, OtherValue, Instruction.MemoryOperandSize);
+        }
+        else
+        {
+            GuestRflags |= EmulationComputeCompareFlags(OtherValue, MemoryValue, Instruction.MemoryOperandSize);
+        }
+
+        __vmx_vmwrite(GUEST_RFLAGS, GuestRflags);
+        break;
+    }
+
+    //
+    // Move to the next instruction, the blocking by STI and MOV SS is ended
+    // after the instruction is executed
+    //
+    __vmx_vmwrite(GUEST_RIP, GuestRip + Instruction.Length);
+
+    __vmx_vmread(GUEST_INTERRUPTIBILITY_INFO, &Interruptibility);
+
+    if (Interruptibility & EMULATION_INTERRUPTIBILITY_BLOCKING_BY_STI_OR_MOV_SS)
+    {
+        __vmx_vmwrite(GUEST_INTERRUPTIBILITY_INFO, Interruptibility & ~EMULATION_INTERRUPTIBILITY_BLOCKING_BY_STI_OR_MOV_SS);
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file Emulation.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the emulation of memory accesses to the hooked pages
+ * @details
+ * @version 0.1
+ * @date 2020-05-02
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include <ntddk.h>
+#include "Common.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Maximum length of an x86 instruction
+ * 
+ */
+#define EMULATION_MAX_INSTRUCTION_LENGTH 15
+
+/**
+ * @brief The status flags that are changed by an emulated CMP
+ * 
+ */
+#define EMULATION_RFLAGS_STATUS_MASK (X86_FLAGS_CF | X86_FLAGS_PF | X86_FLAGS_AF | X86_FLAGS_ZF | X86_FLAGS_SF | X86_FLAGS_OF)
+
+/**
+ * @brief The L bit of the code segment's access rights (64-bit code)
+ * 
+ */
+#define EMULATION_CS_AR_BYTES_L_BIT (1 << 13)
+
+/**
+ * @brief Blocking by STI and blocking by MOV SS bits of the interruptibility state
+ * 
+ */
+#define EMULATION_INTERRUPTIBILITY_BLOCKING_BY_STI_OR_MOV_SS 0x3
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Type of the emulated operation
+ * 
+ */
+typedef enum _EMULATION_OPERATION
+{
+    EMULATION_OPERATION_LOAD,
+    EMULATION_OPERATION_STORE,
+    EMULATION_OPERATION_COMPARE
+
+} EMULATION_OPERATION;
+
+/**
+ * @brief The details of a decoded instruction
+ * 
+ */
+typedef struct _EMULATION_INSTRUCTION
+{
+    EMULATION_OPERATION Operation;
+    UINT32              Length;
+    UINT32              MemoryOperandSize;
+    UINT32              RegisterOperandSize;
+    UINT32              RegisterIndex;
+    BOOLEAN             HasRex;
+    BOOLEAN             IsHighByteRegister;
+    BOOLEAN             HasImmediate;
+    BOOLEAN             IsMemoryFirstOperand;
+    BOOLEAN             HasBaseRegister;
+    BOOLEAN             HasIndexRegister;
+    BOOLEAN             IsRipRelative;
+    UCHAR               SegmentPrefix;
+    UINT32              BaseRegister;
+    UINT32              IndexRegister;
+    UINT32              Scale;
+    INT64               Displacement;
+    UINT64              Immediate;
+
+} EMULATION_INSTRUCTION, *PEMULATION_INSTRUCTION;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Decode the supported MOV, MOVZX and CMP instructions with a memory operand */
+BOOLEAN
+EmulationDecodeInstruction(PUCHAR Bytes, UINT32 AvailableBytes, PEMULATION_INSTRUCTION Instruction);
+/* Read a value with the size of an operand */
+UINT64
+EmulationReadOperand(PVOID Address, UINT32 Size);
+/* Write a value with the size of an operand */
+VOID
+EmulationWriteOperand(PVOID Address, UINT32 Size, UINT64 Value);
+/* Compute the status flags of a CMP instruction */
+UINT64
+EmulationComputeCompareFlags(UINT64 Destination, UINT64 Source, UINT32 Size);
+/* Compute the linear address of the memory operand of a decoded instruction (vmx-root) */
+UINT64
+EmulationComputeLinearAddress(PGUEST_REGS Regs, UINT64 GuestRip, PEMULATION_INSTRUCTION Instruction);
+/* Emulate the memory access of the guest's current instruction to a hooked page (vmx-root) */
+BOOLEAN
+EmulationHandleHookedMemoryAccess(PGUEST_REGS Regs, UINT64 GuestPhysicalAddr, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification);
@@ -10,6 +10,7 @@
  * 
  */
 
+#include "Msr.h"
 #include "Vmx.h"
 #include "Ept.h"
 #include "Common.h"
@@ -21,6 +22,11 @@
 #include "PoolManager.h"
 #include "Hooks.h"
 #include "LengthDisassemblerEngine.h"
+#include "Dpc.h"
+#include "DpcRoutines.h"
+#include "Broadcast.h"
+#include "Emulation.h"
+#include "Trampoline.h"
 
 
 /**
@@ -57,6 +63,29 @@ EptCheckFeatures()
         g_ExecuteOnlySupport = TRUE;
     }
 
+    //
+    // Check whether the processor supports EPTP switching by VMFUNC, the allowed 1-settings
+    // of the secondary controls are in the upper 32 bits of the capability MSR
+    //
+    if (((__readmsr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32) & CPU_BASED_CTL2_ENABLE_VMFUNC) &&
+        (__readmsr(MSR_IA32_VMX_VMFUNC) & VM_FUNCTION_CONTROL_EPTP_SWITCHING))
+    {
+        g_EptState->IsVmfuncEptpSwitchingSupported = TRUE;
+    }
+    else
+    {
+        g_EptState->IsVmfuncEptpSwitchingSupported = FALSE;
+        LogWarning("The processor doesn't support EPTP switching by VMFUNC");
+    }
+
+    g_EptState->IsAccessDirtyFlagsSupported = VpidRegister.EptAccessedAndDirtyFlags ? TRUE : FALSE;
+
+    //
+    // Page Modification Logging needs the dirty flags of EPT
+    //
+    g_EptState->IsPmlSupported = g_EptState->IsAccessDirtyFlagsSupported &&
+                                 ((__readmsr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32) & CPU_BASED_CTL2_ENABLE_PML);
+
     if (!MTRRDefType.MtrrEnable)
     {
         LogError("Mtrr Dynamic Ranges not supported");
@@ -76,65 +105,57 @@ EptCheckFeatures()
 BOOLEAN
 EptBuildMtrrMap()
 {
-    IA32_MTRR_CAPABILITIES_REGISTER MTRRCap;
-    IA32_MTRR_PHYSBASE_REGISTER     CurrentPhysBase;
-    IA32_MTRR_PHYSMASK_REGISTER     CurrentPhysMask;
-    PMTRR_RANGE_DESCRIPTOR          Descriptor;
-    ULONG                           CurrentRegister;
-    ULONG                           NumberOfBitsInMask;
+    MTRR_REGISTERS_STATE Registers;
+    UINT32               NumberOfRanges;
+    ULONG                CurrentRegister;
 
-    MTRRCap.Flags = __readmsr(MSR_IA32_MTRR_CAPABILITIES);
+    RtlZeroMemory(&Registers, sizeof(MTRR_REGISTERS_STATE));
 
-    for (CurrentRegister = 0; CurrentRegister < MTRRCap.VariableRangeCount; CurrentRegister++)
+    //
+    // We only need to read these once because the ISA dictates that MTRRs are
+    // to be synchronized between all processors during BIOS initialization.
+    //
+    Registers.Capabilities.Flags = __readmsr(MSR_IA32_MTRR_CAPABILITIES);
+    Registers.DefaultType.Flags  = __readmsr(MSR_IA32_MTRR_DEF_TYPE);
+
+    for (CurrentRegister = 0; CurrentRegister < Registers.Capabilities.VariableRangeCount && CurrentRegister < MTRR_VARIABLE_RANGE_MAX_COUNT; CurrentRegister++)
     {
         //
         // For each dynamic register pair
         //
-        CurrentPhysBase.Flags = __readmsr(MSR_IA32_MTRR_PHYSBASE0 + (CurrentRegister * 2));
-        CurrentPhysMask.Flags = __readmsr(MSR_IA32_MTRR_PHYSMASK0 + (CurrentRegister * 2));
-
-        //
-        // Is the range enabled?
-        //
-        if (CurrentPhysMask.Valid)
-        {
-            //
-            // We only need to read these once because the ISA dictates that MTRRs are
-            // to be synchronized between all processors during BIOS initialization.
-            //
-            Descriptor = &g_EptState->MemoryRanges[g_EptState->NumberOfEnabledMemoryRanges++];
+        Registers.PhysBase[CurrentRegister].Flags = __readmsr(MSR_IA32_MTRR_PHYSBASE0 + (CurrentRegister * 2));
+        Registers.PhysMask[CurrentRegister].Flags = __readmsr(MSR_IA32_MTRR_PHYSMASK0 + (CurrentRegister * 2));
+    }
 
-            //
-            // Calculate the base address in bytes
-            //
-            Descriptor->PhysicalBaseAddress = CurrentPhysBase.PageFrameNumber * PAGE_SIZE;
+    if (Registers.Capabilities.FixedRangeSupported)
+    {
+        Registers.FixedRanges[0] = __readmsr(MSR_IA32_MTRR_FIX64K_00000);
+        Registers.FixedRanges[1] = __readmsr(MSR_IA32_MTRR_FIX16K_80000);
+        Registers.FixedRanges[2] = __readmsr(MSR_IA32_MTRR_FIX16K_A0000);
 
-            //
-            // Calculate the total size of the range
-            // The lowest bit of the mask that is set to 1 specifies the size of the range
-            //
-            _BitScanForward64(&NumberOfBitsInMask, CurrentPhysMask.PageFrameNumber * PAGE_SIZE);
+        for (CurrentRegister = 0; CurrentRegister < 8; CurrentRegister++)
+        {
+            Registers.FixedRanges[3 + CurrentRegister] = __readmsr(MSR_IA32_MTRR_FIX4K_C0000 + CurrentRegister);
+        }
+    }
 
-            //
-            // Size of the range in bytes + Base Address
-            //
-            Descriptor->PhysicalEndAddress = Descriptor->PhysicalBaseAddress + ((1ULL << NumberOfBitsInMask) - 1ULL);
+    //
+    // Build the sorted and merged map
+    //
+    if (!MtrrBuildMapFromRegisters(&Registers, EPT_IDENTITY_MAP_SIZE, g_EptState->MemoryRanges, MTRR_MAP_MAX_RANGES, &NumberOfRanges))
+    {
+        LogError("Too many MTRR ranges, the map is not large enough");
+        return FALSE;
+    }
 
-            //
-            // Memory Type (cacheability attributes)
-            //
-            Descriptor->MemoryType = (UCHAR)CurrentPhysBase.Type;
+    g_EptState->NumberOfEnabledMemoryRanges = NumberOfRanges;
 
-            if (Descriptor->MemoryType == MEMORY_TYPE_WRITE_BACK)
-            {
-                //
-                // This is already our default, so no need to store this range.
-                // Simply 'free' the range we just wrote.
-                //
-                g_EptState->NumberOfEnabledMemoryRanges--;
-            }
-            LogInfo("MTRR Range: Base=0x%llx End=0x%llx Type=0x%x", Descriptor->PhysicalBaseAddress, Descriptor->PhysicalEndAddress, Descriptor->MemoryType);
-        }
+    for (CurrentRegister = 0; CurrentRegister < NumberOfRanges; CurrentRegister++)
+    {
+        LogInfo("MTRR Range: Base=0x%llx End=0x%llx Type=0x%x",
+                g_EptState->MemoryRanges[CurrentRegister].PhysicalBaseAddress,
+                g_EptState->MemoryRanges[CurrentRegister].PhysicalEndAddress,
+                g_EptState->MemoryRanges[CurrentRegister].MemoryType);
     }
 
     LogInfo("Total MTRR Ranges Committed: %d", g_EptState->NumberOfEnabledMemoryRanges);
@@ -328,107 +349,261 @@ EptSplitLargePage(PVMM_EPT_PAGE_TABLE EptPageTable, PVOID PreAllocatedBuffer, SI
 }
 
 /**
- * @brief Set up PML2 Entries
+ * @brief Fill a range of PML2 entries of the identity page table
+ * @details Each entry is a pure function of its index, so for each run of
+ * entries with the same memory type, a template is made and the frame number
+ * is incremented, which results in straight (vectorizable) stores
  * 
- * @param NewEntry The PML2 Entry
- * @param PageFrameNumber PFN (Physical Address)
+ * @param PageTable The EPT Page Table
+ * @param FirstIndex Index of the first PML2 entry (in a flat view of PML2 entries)
+ * @param LastIndex Index of the last PML2 entry (inclusive)
  * @return VOID 
  */
 VOID
-EptSetupPML2Entry(PEPT_PML2_ENTRY NewEntry, SIZE_T PageFrameNumber)
+EptFillPML2Entries(PVMM_EPT_PAGE_TABLE PageTable, SIZE_T FirstIndex, SIZE_T LastIndex)
 {
-    SIZE_T AddressOfPage;
-    SIZE_T CurrentMtrrRange;
-    SIZE_T TargetMemoryType;
+    PEPT_PML2_ENTRY        Entries;
+    PMTRR_RANGE_DESCRIPTOR Range;
+    EPT_PML2_ENTRY         PML2EntryTemplate;
+    SIZE_T                 Index;
+    SIZE_T                 RunEnd;
+    UINT64                 EntryValue;
+    UINT32                 Cursor;
 
     //
-    // Each of the 512 collections of 512 PML2 entries is setup here
-    // This will, in total, identity map every physical address from 0x0
-    // to physical address 0x8000000000 (512GB of memory)
-    // ((EntryGroupIndex * VMM_EPT_PML2E_COUNT) + EntryIndex) * 2MB is
-    // the actual physical address we're mapping
+    // PML2 entries of all the 512 collections are contiguous
     //
-    NewEntry->PageFrameNumber = PageFrameNumber;
+    Entries = &PageTable->PML2[0][0];
+    Index   = FirstIndex;
+
+    for (Cursor = MtrrFindRangeIndex(g_EptState->MemoryRanges, g_EptState->NumberOfEnabledMemoryRanges, FirstIndex * SIZE_2_MB);
+         Cursor < g_EptState->NumberOfEnabledMemoryRanges && Index <= LastIndex;
+         Cursor++)
+    {
+        Range = &g_EptState->MemoryRanges[Cursor];
+
+        //
+        // The last 2MB page that starts within this range
+        //
+        RunEnd = Range->PhysicalEndAddress / SIZE_2_MB;
+
+        if (RunEnd > LastIndex)
+        {
+            RunEnd = LastIndex;
+        }
+
+        if (Index > RunEnd)
+        {
+            //
+            // This range doesn't contain the start of any 2MB page
+            //
+            continue;
+        }
+
+        //
+        // All PML2 entries will be RWX and 'present', we are using 2MB large pages,
+        // so we must mark LargePage as 1 here
+        //
+        PML2EntryTemplate.Flags         = 0;
+        PML2EntryTemplate.WriteAccess   = 1;
+        PML2EntryTemplate.ReadAccess    = 1;
+        PML2EntryTemplate.ExecuteAccess = 1;
+        PML2EntryTemplate.LargePage     = 1;
+        PML2EntryTemplate.MemoryType    = Range->MemoryType;
+
+        //
+        // PageFrameNumber starts from bit 21, so (Index * 2MB) is the frame number of
+        // the entry in its place
+        //
+        EntryValue = PML2EntryTemplate.Flags + (Index * SIZE_2_MB);
+
+        for (; Index <= RunEnd; Index++)
+        {
+            Entries[Index].Flags = EntryValue;
+            EntryValue += SIZE_2_MB;
+        }
+    }
+}
+
+/**
+ * @brief Broadcast filling the PML2 entries of the identity page table
+ * @details Each core fills an equal slice of PML2 entries
+ * 
+ * @param Dpc 
+ * @param DeferredContext The EPT Page Table
+ * @param SystemArgument1 
+ * @param SystemArgument2 
+ * @return VOID 
+ */
+VOID
+EptDpcBroadcastFillIdentityPageTable(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    SIZE_T ProcessorCount;
+    SIZE_T CurrentProcessorIndex;
+    SIZE_T EntriesPerCore;
+    SIZE_T FirstIndex;
+    SIZE_T LastIndex;
+
+    ProcessorCount        = KeQueryActiveProcessorCount(0);
+    CurrentProcessorIndex = KeGetCurrentProcessorNumber();
+    EntriesPerCore        = (VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT) / ProcessorCount;
+    FirstIndex            = CurrentProcessorIndex * EntriesPerCore;
 
     //
-    // Size of 2MB page * PageFrameNumber == AddressOfPage (physical memory)
+    // The last core fills the remaining entries
     //
-    AddressOfPage = PageFrameNumber * SIZE_2_MB;
+    if (CurrentProcessorIndex == ProcessorCount - 1)
+    {
+        LastIndex = (VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT) - 1;
+    }
+    else
+    {
+        LastIndex = FirstIndex + EntriesPerCore - 1;
+    }
+
+    EptFillPML2Entries((PVMM_EPT_PAGE_TABLE)DeferredContext, FirstIndex, LastIndex);
 
     //
-    // To be safe, we will map the first page as UC as to not bring up any
-    // kind of undefined behavior from the fixed MTRR section which we are
-    // not formally recognizing (typically there is MMIO memory in the first MB)
+    // Wait for all DPCs to synchronize at this point
     //
-    // I suggest reading up on the fixed MTRR section of the manual to see why the
-    // first entry is likely going to need to be UC.
+    KeSignalCallDpcSynchronize(SystemArgument2);
+
+    //
+    // Mark the DPC as being complete
     //
-    if (PageFrameNumber == 0)
+    KeSignalCallDpcDone(SystemArgument1);
+}
+
+/**
+ * @brief Split a 2MB page which contains more than one memory type
+ * @details The memory type of each 4KB page is set separately
+ * 
+ * @param PageTable The EPT Page Table
+ * @param PageFrameNumber PFN of the 2MB page
+ * @return BOOLEAN Returns false if the split was not successful
+ */
+BOOLEAN
+EptSplitMixedMemoryTypePage(PVMM_EPT_PAGE_TABLE PageTable, SIZE_T PageFrameNumber)
+{
+    SIZE_T                 AddressOfPage;
+    SIZE_T                 EntryIndex;
+    UINT32                 Cursor;
+    BOOLEAN                IsMixed;
+    PVMM_EPT_DYNAMIC_SPLIT Split;
+
+    AddressOfPage = PageFrameNumber * SIZE_2_MB;
+
+    Split = ExAllocatePoolWithTag(NonPagedPool, sizeof(VMM_EPT_DYNAMIC_SPLIT), POOLTAG);
+
+    if (!Split)
     {
-        NewEntry->MemoryType = MEMORY_TYPE_UNCACHEABLE;
-        return;
+        LogError("Insufficient memory for splitting the page at : 0x%llx", AddressOfPage);
+        return FALSE;
+    }
+
+    if (!EptSplitLargePage(PageTable, Split, AddressOfPage, 0))
+    {
+        ExFreePoolWithTag(Split, POOLTAG);
+        return FALSE;
     }
 
     //
-    // Default memory type is always WB for performance
+    // Keep track of it for later freeing
     //
-    TargetMemoryType = MEMORY_TYPE_WRITE_BACK;
+    InsertHeadList(&PageTable->DynamicSplitList, &(Split->DynamicSplitList));
 
     //
-    // For each MTRR range
+    // Set the memory type of each 4KB page by sweeping the map
     //
-    for (CurrentMtrrRange = 0; CurrentMtrrRange < g_EptState->NumberOfEnabledMemoryRanges; CurrentMtrrRange++)
+    Cursor = MtrrFindRangeIndex(g_EptState->MemoryRanges, g_EptState->NumberOfEnabledMemoryRanges, AddressOfPage);
+
+    for (EntryIndex = 0; EntryIndex < VMM_EPT_PML1E_COUNT; EntryIndex++)
     {
-        //
-        // If this page's address is below or equal to the max physical address of the range
-        //
-        if (AddressOfPage <= g_EptState->MemoryRanges[CurrentMtrrRange].PhysicalEndAddress)
+        Split->PML1[EntryIndex].MemoryType = MtrrSweepMemoryType(g_EptState->MemoryRanges, g_EptState->NumberOfEnabledMemoryRanges, &Cursor, AddressOfPage + (EntryIndex * PAGE_SIZE), PAGE_SIZE, &IsMixed);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Split all the 2MB pages that contain more than one memory type
+ * @details A 2MB page is mixed only if a boundary of the MTRR map is not 2MB aligned,
+ * so we just need to check the boundaries instead of all the pages
+ * 
+ * @param PageTable The EPT Page Table
+ * @return BOOLEAN Returns false if one of the splits was not successful
+ */
+BOOLEAN
+EptSplitMixedMemoryTypePages(PVMM_EPT_PAGE_TABLE PageTable)
+{
+    SIZE_T Boundary;
+    SIZE_T PageFrameNumber;
+    SIZE_T LastSplitPageFrameNumber = (SIZE_T)-1;
+    UINT32 CurrentRange;
+
+    for (CurrentRange = 0; CurrentRange + 1 < g_EptState->NumberOfEnabledMemoryRanges; CurrentRange++)
+    {
+        Boundary = g_EptState->MemoryRanges[CurrentRange].PhysicalEndAddress + 1;
+
+        if ((Boundary % SIZE_2_MB) == 0)
+        {
+            continue;
+        }
+
+        PageFrameNumber = Boundary / SIZE_2_MB;
+
+        if (PageFrameNumber == LastSplitPageFrameNumber)
         {
             //
-            // And this page's last address is above or equal to the base physical address of the range
+            // Already split because of the previous boundary
             //
-            if ((AddressOfPage + SIZE_2_MB - 1) >= g_EptState->MemoryRanges[CurrentMtrrRange].PhysicalBaseAddress)
-            {
-                //
-                // If we're here, this page fell within one of the ranges specified by the variable MTRRs
-                // Therefore, we must mark this page as the same cache type exposed by the MTRR
-                //
-                TargetMemoryType = g_EptState->MemoryRanges[CurrentMtrrRange].MemoryType;
-
-                // LogInfo("0x%X> Range=%llX -> %llX | Begin=%llX End=%llX", PageFrameNumber, AddressOfPage, AddressOfPage + SIZE_2_MB - 1, EptState->MemoryRanges[CurrentMtrrRange].PhysicalBaseAddress, EptState->MemoryRanges[CurrentMtrrRange].PhysicalEndAddress);
+            continue;
+        }
 
-                //
-                // 11.11.4.1 MTRR Precedences
-                //
-                if (TargetMemoryType == MEMORY_TYPE_UNCACHEABLE)
-                {
-                    //
-                    // If this is going to be marked uncacheable, then we stop the search as UC always
-                    // takes precedent
-                    //
-                    break;
-                }
-            }
+        if (!EptSplitMixedMemoryTypePage(PageTable, PageFrameNumber))
+        {
+            return FALSE;
         }
+
+        LastSplitPageFrameNumber = PageFrameNumber;
     }
-    //
-    // Finally, commit the memory type to the entry
-    //
-    NewEntry->MemoryType = TargetMemoryType;
+
+    return TRUE;
 }
 
 /**
- * @brief Allocates page maps and create identity page table
+ * @brief Free a page table and the split pages that are owned by the table
+ * @details Split pages that are allocated from the pool manager (hooks) are not
+ * owned by the table and are freed by the pool manager
+ * 
+ * @param PageTable The EPT Page Table
+ * @return VOID 
+ */
+VOID
+EptFreePageTable(PVMM_EPT_PAGE_TABLE PageTable)
+{
+    PVMM_EPT_DYNAMIC_SPLIT Split;
+
+    while (!IsListEmpty(&PageTable->DynamicSplitList))
+    {
+        Split = CONTAINING_RECORD(RemoveHeadList(&PageTable->DynamicSplitList), VMM_EPT_DYNAMIC_SPLIT, DynamicSplitList);
+        ExFreePoolWithTag(Split, POOLTAG);
+    }
+
+    MmFreeContiguousMemory(PageTable);
+}
+
+/**
+ * @brief Allocates page maps and set up PML4 and PML3 entries
+ * @details PML2 entries are not initialized and should be filled by the caller
  * 
  * @return PVMM_EPT_PAGE_TABLE 
  */
 PVMM_EPT_PAGE_TABLE
-EptAllocateAndCreateIdentityPageTable()
+EptAllocatePageTable()
 {
     PVMM_EPT_PAGE_TABLE PageTable;
     EPT_PML3_POINTER    RWXTemplate;
-    EPT_PML2_ENTRY      PML2EntryTemplate;
-    SIZE_T              EntryGroupIndex;
     SIZE_T              EntryIndex;
 
     //
@@ -451,9 +626,10 @@ EptAllocateAndCreateIdentityPageTable()
     }
 
     //
-    // Zero out all entries to ensure all unused entries are marked Not Present
+    // Zero out all PML4 and PML3 entries to ensure all unused entries are marked Not Present,
+    // PML2 entries are not zeroed as all of them will be filled later
     //
-    RtlZeroMemory(PageTable, sizeof(VMM_EPT_PAGE_TABLE));
+    RtlZeroMemory(PageTable, FIELD_OFFSET(VMM_EPT_PAGE_TABLE, PML2));
 
     //
     // Mark the first 512GB PML4 entry as present, which allows us to manage up
@@ -498,49 +674,99 @@ EptAllocateAndCreateIdentityPageTable()
         PageTable->PML3[EntryIndex].PageFrameNumber = (SIZE_T)VirtualAddressToPhysicalAddress(&PageTable->PML2[EntryIndex][0]) / PAGE_SIZE;
     }
 
-    PML2EntryTemplate.Flags = 0;
+    InitializeListHead(&PageTable->DynamicSplitList);
+
+    return PageTable;
+}
+
+/**
+ * @brief Allocates page maps and create identity page table
+ * 
+ * @return PVMM_EPT_PAGE_TABLE 
+ */
+PVMM_EPT_PAGE_TABLE
+EptAllocateAndCreateIdentityPageTable()
+{
+    PVMM_EPT_PAGE_TABLE PageTable;
+
+    PageTable = EptAllocatePageTable();
+
+    if (PageTable == NULL)
+    {
+        return NULL;
+    }
 
     //
-    // All PML2 entries will be RWX and 'present'
+    // Fill all the PML2 entries, each entry is marked as "Present" regardless of if the actual system
+    // has memory at this region or not. We will cause a fault in our EPT handler if the guest access
+    // a page outside a usable range, despite the EPT frame being present here.
     //
-    PML2EntryTemplate.WriteAccess   = 1;
-    PML2EntryTemplate.ReadAccess    = 1;
-    PML2EntryTemplate.ExecuteAccess = 1;
+#if BuildEptIdentityTableOnAllCores
 
     //
-    // We are using 2MB large pages, so we must mark this 1 here
+    // Each core fills a slice of entries
     //
-    PML2EntryTemplate.LargePage = 1;
+    KeGenericCallDpc(EptDpcBroadcastFillIdentityPageTable, PageTable);
+
+#else
 
-    /* For each collection of 512 PML2 entries (512 collections * 512 entries per collection), mark it RWX using the same template above.
-	   This marks the entries as "Present" regardless of if the actual system has memory at this region or not. We will cause a fault in our
-	   EPT handler if the guest access a page outside a usable range, despite the EPT frame being present here.
-	 */
-    __stosq((SIZE_T *)&PageTable->PML2[0], PML2EntryTemplate.Flags, VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT);
+    EptFillPML2Entries(PageTable, 0, (VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT) - 1);
+
+#endif
 
     //
-    // For each of the 512 collections of 512 2MB PML2 entries
+    // Split the pages that contain more than one memory type
     //
-    for (EntryGroupIndex = 0; EntryGroupIndex < VMM_EPT_PML3E_COUNT; EntryGroupIndex++)
+    if (!EptSplitMixedMemoryTypePages(PageTable))
     {
-        //
-        // For each 2MB PML2 entry in the collection
-        //
-        for (EntryIndex = 0; EntryIndex < VMM_EPT_PML2E_COUNT; EntryIndex++)
-        {
-            //
-            // Setup the memory type and frame number of the PML2 entry
-            //
-            EptSetupPML2Entry(&PageTable->PML2[EntryGroupIndex][EntryIndex], (EntryGroupIndex * VMM_EPT_PML2E_COUNT) + EntryIndex);
-        }
+        EptFreePageTable(PageTable);
+        return NULL;
     }
 
     return PageTable;
 }
 
+/**
+ * @brief Create an EPT Pointer for a page table
+ * 
+ * @param PageTable The EPT Page Table
+ * @return EPTP 
+ */
+EPTP
+EptCreateEptPointer(PVMM_EPT_PAGE_TABLE PageTable)
+{
+    EPTP EPTP;
+
+    EPTP.Flags = 0;
+
+    //
+    // For performance, we let the processor know it can cache the EPT
+    //
+    EPTP.MemoryType = MEMORY_TYPE_WRITE_BACK;
+
+    //
+    // The 'access' and 'dirty' flag features are only used when the page tracking is enabled
+    //
+    EPTP.EnableAccessAndDirtyFlags = g_EptState->IsAccessDirtyFlagsEnabled;
+
+    //
+    // Bits 5:3 (1 less than the EPT page-walk length) must be 3, indicating an EPT page-walk length of 4;
+    // see Section 28.2.2
+    //
+    EPTP.PageWalkLength = 3;
+
+    //
+    // The physical page number of the page table we will be using
+    //
+    EPTP.PageFrameNumber = (SIZE_T)VirtualAddressToPhysicalAddress(&PageTable->PML4) / PAGE_SIZE;
+
+    return EPTP;
+}
+
 /**
  * @brief Initialize EPT for an individual logical processor
- * @details Creates an identity mapped page table and sets up an EPTP to be applied to the VMCS later
+ * @details Creates an identity mapped page table which is shared between all the
+ * logical processors and sets up an EPTP to be applied to the VMCS later
  * 
  * @return BOOLEAN 
  */
@@ -548,7 +774,13 @@ BOOLEAN
 EptLogicalProcessorInitialize()
 {
     PVMM_EPT_PAGE_TABLE PageTable;
-    EPTP                EPTP;
+    ULONG               ProcessorsCount;
+    ULONG               CoreIndex;
+    LARGE_INTEGER       StartTime;
+    LARGE_INTEGER       EndTime;
+    LARGE_INTEGER       Frequency;
+
+    StartTime = KeQueryPerformanceCounter(&Frequency);
 
     //
     // Allocate the identity mapped page table
@@ -560,101 +792,468 @@ EptLogicalProcessorInitialize()
         return FALSE;
     }
 
-    //
-    // Virtual address to the page table to keep track of it for later freeing
-    //
-    g_EptState->EptPageTable = PageTable;
-
-    EPTP.Flags = 0;
+    EndTime = KeQueryPerformanceCounter(NULL);
 
     //
-    // For performance, we let the processor know it can cache the EPT
+    // Report the time it takes to build the table
     //
-    EPTP.MemoryType = MEMORY_TYPE_WRITE_BACK;
+    LogInfo("EPT identity page table built in %lld microseconds", ((EndTime.QuadPart - StartTime.QuadPart) * 1000000) / Frequency.QuadPart);
 
     //
-    // We are not utilizing the 'access' and 'dirty' flag features
+    // Virtual address to the page table to keep track of it for later freeing
     //
-    EPTP.EnableAccessAndDirtyFlags = FALSE;
+    g_EptState->EptPageTable = PageTable;
 
     //
-    // Bits 5:3 (1 less than the EPT page-walk length) must be 3, indicating an EPT page-walk length of 4;
-    // see Section 28.2.2
+    // We will write the EPTP to the VMCS later
     //
-    EPTP.PageWalkLength = 3;
+    g_EptState->EptPointer = EptCreateEptPointer(PageTable);
 
     //
-    // The physical page number of the page table we will be using
+    // All the cores start with the shared table
     //
-    EPTP.PageFrameNumber = (SIZE_T)VirtualAddressToPhysicalAddress(&PageTable->PML4) / PAGE_SIZE;
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        g_GuestState[CoreIndex].EptView.PageTable      = g_EptState->EptPageTable;
+        g_GuestState[CoreIndex].EptView.EptPointer     = g_EptState->EptPointer;
+        g_GuestState[CoreIndex].EptView.ReferenceCount = 0;
+    }
 
     //
-    // We will write the EPTP to the VMCS later
+    // The EPTP list of VMFUNC is not allocated, so EPTP switching stays disabled,
+    // VMFUNC doesn't cause vm-exits and any guest code that executes it could switch
+    // from a process view to the shared table (or to the view of another process) and
+    // bypass the hidden hooks, the views are only switched in the cr3 vm-exits
     //
-    g_EptState->EptPointer = EPTP;
+    g_EptState->EptpList = NULL;
 
     return TRUE;
 }
 
 /**
- * @brief Check if this exit is due to a violation caused by a currently hooked page
- * @details If the memory access attempt was RW and the page was marked executable, the page is swapped with
- * the original page.
- *
- * If the memory access attempt was execute and the page was marked not executable, the page is swapped with
- * the hooked page.
+ * @brief Create a private copy of the shared identity table
+ * @details The split pages of the shared table are duplicated and owned by the
+ * private table, the copy is a snapshot so later changes to the shared table (e.g.
+ * hooks) are not reflected in the private table
  * 
- * @param ViolationQualification The violation qualification in vm-exit
- * @param GuestPhysicalAddr The GUEST_PHYSICAL_ADDRESS that caused this EPT violation
- * @return BOOLEAN Returns true if it was successfull or false if the violation was not due to a page hook
+ * @return PVMM_EPT_PAGE_TABLE The private table or NULL if there was an error
  */
-BOOLEAN
-EptHandlePageHookExit(VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, UINT64 GuestPhysicalAddr)
+PVMM_EPT_PAGE_TABLE
+EptCreatePrivatePageTable()
 {
-    BOOLEAN     IsHandled = FALSE;
-    PLIST_ENTRY TempList  = 0;
+    PVMM_EPT_PAGE_TABLE    PageTable;
+    PEPT_PML2_ENTRY        TargetEntry;
+    PEPT_PML2_POINTER      TargetPointer;
+    PVMM_EPT_DYNAMIC_SPLIT Split;
+    SIZE_T                 EntryIndex;
 
-    TempList = &g_EptState->HookedPagesList;
-    while (&g_EptState->HookedPagesList != TempList->Flink)
+    PageTable = EptAllocatePageTable();
+
+    if (PageTable == NULL)
     {
-        TempList                            = TempList->Flink;
-        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
-        if (HookedEntry->PhysicalBaseAddress == PAGE_ALIGN(GuestPhysicalAddr))
-        {
-            //
-            // We found an address that match the details
-            //
-            // Returning true means that the caller should return to the ept state to
-            // the previous state when this instruction is executed
-            // by setting the Monitor Trap Flag. Return false means that nothing special
-            // for the caller to do
-            //
-            if (EptHandleHookedPage(HookedEntry, ViolationQualification, GuestPhysicalAddr))
-            {
-                //
-                // Next we have to save the current hooked entry to restore on the next instruction's vm-exit
-                //
-                g_GuestState[KeGetCurrentProcessorNumber()].MtfEptHookRestorePoint = HookedEntry;
+        return NULL;
+    }
 
-                //
-                // We have to set Monitor trap flag and give it the HookedEntry to work with
-                //
-                HvSetMonitorTrapFlag(TRUE);
-            }
+    //
+    // Copy the PML2 entries of the shared table, the large pages are ready to use
+    //
+    RtlCopyMemory(PageTable->PML2, g_EptState->EptPageTable->PML2, sizeof(PageTable->PML2));
+
+    //
+    // Duplicate the split pages, otherwise the private table points to the PML1 entries of the shared table
+    //
+    for (EntryIndex = 0; EntryIndex < VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT; EntryIndex++)
+    {
+        TargetEntry = &PageTable->PML2[0][0] + EntryIndex;
+
+        if (TargetEntry->LargePage)
+        {
+            continue;
+        }
+
+        Split = ExAllocatePoolWithTag(NonPagedPool, sizeof(VMM_EPT_DYNAMIC_SPLIT), POOLTAG);
+
+        if (!Split)
+        {
+            LogError("Insufficient memory for creating a private EPT table");
+            EptFreePageTable(PageTable);
+            return NULL;
+        }
+
+        TargetPointer = (PEPT_PML2_POINTER)TargetEntry;
+
+        RtlCopyMemory(&Split->PML1[0], (PVOID)PhysicalAddressToVirtualAddress(TargetPointer->PageFrameNumber * PAGE_SIZE), sizeof(Split->PML1));
+
+        Split->Pointer                 = TargetPointer;
+        TargetPointer->PageFrameNumber = (SIZE_T)VirtualAddressToPhysicalAddress(&Split->PML1[0]) / PAGE_SIZE;
+
+        InsertHeadList(&PageTable->DynamicSplitList, &(Split->DynamicSplitList));
+    }
+
+    return PageTable;
+}
+
+/**
+ * @brief Apply the EPT view of a core to the VMCS of that core
+ * @details If the core is not virtualized yet, then the view is applied
+ * when the VMCS is configured
+ * 
+ * @param CoreIndex The index of core
+ * @return BOOLEAN 
+ */
+BOOLEAN
+EptApplyCoreView(ULONG CoreIndex)
+{
+    BROADCAST_OPERATION Operation = {0};
+    UINT64              VmcallStatus;
+
+    if (!g_GuestState[CoreIndex].HasLaunched)
+    {
+        return TRUE;
+    }
+
+    //
+    // Ask the hypervisor to write the new EPTP to the VMCS of the core
+    //
+    Operation.Type          = BROADCAST_OPERATION_VMCALL;
+    Operation.Target        = VMCALL_CHANGE_EPT_POINTER;
+    Operation.Parameters[0] = g_GuestState[CoreIndex].EptView.EptPointer.Flags;
+
+    if (!NT_SUCCESS(BroadcastWorkQueueSubmitToCore(CoreIndex, &Operation, 1, &VmcallStatus)))
+    {
+        return FALSE;
+    }
+
+    return NT_SUCCESS((NTSTATUS)VmcallStatus);
+}
+
+/**
+ * @brief Create or reference a private EPT view for a core
+ * @details The first reference creates a private copy of the shared table and
+ * switches the core to it, other references just increase the reference count,
+ * should be called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param CoreIndex The index of core
+ * @return BOOLEAN Returns true if the core uses a private view
+ */
+BOOLEAN
+EptAcquireCorePrivateView(ULONG CoreIndex)
+{
+    PVMM_EPT_PAGE_TABLE PageTable;
+    PEPT_CORE_VIEW      View;
+    KIRQL               OldIrql;
+
+    if (CoreIndex >= KeQueryActiveProcessorCount(0))
+    {
+        return FALSE;
+    }
+
+    View = &g_GuestState[CoreIndex].EptView;
+
+    //
+    // The mutex serializes the allocation and the broadcast, the spinlock is
+    // only held while the fields of the view change
+    //
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
+
+    if (View->ReferenceCount != 0)
+    {
+        //
+        // The private view is already created
+        //
+        InterlockedIncrement(&View->ReferenceCount);
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return TRUE;
+    }
+
+    PageTable = EptCreatePrivatePageTable();
+
+    if (PageTable == NULL)
+    {
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return FALSE;
+    }
+
+    //
+    // The hooks are changed while holding the lock of the hooked pages, so the
+    // changes after the refresh are applied to the published view
+    //
+    SpinlockLockExclusive(&EptCoreViewLock);
+    OldIrql = EptLockHookedPages();
+
+    EptRefreshPrivatePageTable(PageTable);
+
+    View->PageTable  = PageTable;
+    View->EptPointer = EptCreateEptPointer(PageTable);
+
+    EptUnlockHookedPages(OldIrql);
+    SpinlockUnlockExclusive(&EptCoreViewLock);
+
+    if (!EptApplyCoreView(CoreIndex))
+    {
+        //
+        // The core still uses the shared table
+        //
+        SpinlockLockExclusive(&EptCoreViewLock);
+        OldIrql = EptLockHookedPages();
+
+        View->PageTable  = g_EptState->EptPageTable;
+        View->EptPointer = g_EptState->EptPointer;
+
+        EptUnlockHookedPages(OldIrql);
+        SpinlockUnlockExclusive(&EptCoreViewLock);
+
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+        EptFreePageTable(PageTable);
+        return FALSE;
+    }
+
+    InterlockedIncrement(&View->ReferenceCount);
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+    return TRUE;
+}
+
+/**
+ * @brief Release a reference to the private EPT view of a core
+ * @details When the last reference is released, the core switches back to the shared
+ * table, the hooks of the private table are removed and the table is freed, should be
+ * called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param CoreIndex The index of core
+ * @return VOID 
+ */
+VOID
+EptReleaseCorePrivateView(ULONG CoreIndex)
+{
+    PVMM_EPT_PAGE_TABLE PageTable;
+    PEPT_CORE_VIEW      View;
+    KIRQL               OldIrql;
+
+    if (CoreIndex >= KeQueryActiveProcessorCount(0))
+    {
+        return;
+    }
+
+    View = &g_GuestState[CoreIndex].EptView;
+
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
+
+    if (View->ReferenceCount == 0 || InterlockedDecrement(&View->ReferenceCount) != 0)
+    {
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return;
+    }
+
+    SpinlockLockExclusive(&EptCoreViewLock);
+    OldIrql = EptLockHookedPages();
+
+    PageTable        = View->PageTable;
+    View->PageTable  = g_EptState->EptPageTable;
+    View->EptPointer = g_EptState->EptPointer;
+
+    EptUnlockHookedPages(OldIrql);
+    SpinlockUnlockExclusive(&EptCoreViewLock);
+
+    if (!EptApplyCoreView(CoreIndex))
+    {
+        //
+        // The core might still use the private table, so it's not safe to free it
+        //
+        LogError("Unable to switch core %d to the shared EPT table", CoreIndex);
+
+        SpinlockLockExclusive(&EptCoreViewLock);
+        OldIrql = EptLockHookedPages();
+
+        //
+        // The changes of the shared hooks are not applied to the table while it's not published
+        //
+        EptRefreshPrivatePageTable(PageTable);
 
+        View->PageTable      = PageTable;
+        View->EptPointer     = EptCreateEptPointer(PageTable);
+        View->ReferenceCount = 1;
+
+        EptUnlockHookedPages(OldIrql);
+        SpinlockUnlockExclusive(&EptCoreViewLock);
+
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return;
+    }
+
+    //
+    // The hooks of this core are removed with its table
+    //
+    EptRemoveHooksOfPageTable(PageTable);
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+    //
+    // Invalidate the cached translations of the table before its memory is reused
+    //
+    HvNotifyAllToInvalidateEpt();
+
+    EptFreePageTable(PageTable);
+}
+
+/**
+ * @brief Free the shared identity table, the private tables and the process views
+ * @details Should be called after vmxoff
+ * 
+ * @return VOID 
+ */
+VOID
+EptFreeAllPageTables()
+{
+    ULONG ProcessorsCount;
+    ULONG CoreIndex;
+    ULONG ViewIndex;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        if (g_GuestState[CoreIndex].EptView.PageTable != g_EptState->EptPageTable)
+        {
+            EptFreePageTable(g_GuestState[CoreIndex].EptView.PageTable);
+        }
+
+        g_GuestState[CoreIndex].EptView.PageTable      = NULL;
+        g_GuestState[CoreIndex].EptView.ReferenceCount = 0;
+    }
+
+    for (ViewIndex = 0; ViewIndex < EPT_MAX_PROCESS_VIEWS; ViewIndex++)
+    {
+        if (g_EptState->ProcessViews[ViewIndex].PageTable != NULL)
+        {
+            EptFreePageTable(g_EptState->ProcessViews[ViewIndex].PageTable);
+            RtlZeroMemory(&g_EptState->ProcessViews[ViewIndex], sizeof(EPT_PROCESS_VIEW));
+        }
+    }
+
+    if (g_EptState->EptpList)
+    {
+        ExFreePoolWithTag(g_EptState->EptpList, POOLTAG);
+        g_EptState->EptpList = NULL;
+    }
+
+    EptFreePageTable(g_EptState->EptPageTable);
+}
+
+/**
+ * @brief Compute the size of a page table and its split pages
+ * 
+ * @param PageTable The EPT Page Table
+ * @param NumberOfSplits Number of 2MB pages that are split to 4KB pages
+ * @return UINT64 Size of the table in bytes
+ */
+UINT64
+EptGetPageTableSize(PVMM_EPT_PAGE_TABLE PageTable, UINT64 * NumberOfSplits)
+{
+    PEPT_PML2_ENTRY Entries;
+    SIZE_T          EntryIndex;
+    UINT64          Splits = 0;
+
+    Entries = &PageTable->PML2[0][0];
+
+    for (EntryIndex = 0; EntryIndex < VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT; EntryIndex++)
+    {
+        if (!Entries[EntryIndex].LargePage)
+        {
+            Splits++;
+        }
+    }
+
+    *NumberOfSplits = Splits;
+
+    return ((sizeof(VMM_EPT_PAGE_TABLE) / PAGE_SIZE) * PAGE_SIZE) + (Splits * sizeof(VMM_EPT_DYNAMIC_SPLIT));
+}
+
+/**
+ * @brief Check if this exit is due to a violation caused by a currently hooked page
+ * @details If the memory access attempt was RW and the page was marked executable, the page is swapped with
+ * the original page.
+ * 
+ * If the memory access attempt was execute and the page was marked not executable, the page is swapped with
+ * the hooked page.
+ * 
+ * @param Regs The guest's general purpose registers
+ * @param ViolationQualification The violation qualification in vm-exit
+ * @param GuestPhysicalAddr The GUEST_PHYSICAL_ADDRESS that caused this EPT violation
+ * @return BOOLEAN Returns true if it was successfull or false if the violation was not due to a page hook
+ */
+BOOLEAN
+EptHandlePageHookExit(PGUEST_REGS Regs, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, UINT64 GuestPhysicalAddr)
+{
+    BOOLEAN                 IsHandled = FALSE;
+    PEPT_HOOKED_PAGE_DETAIL HookedEntry;
+    PEPT_PML1_ENTRY         EntryAddress = NULL;
+    PVMM_EPT_PAGE_TABLE     CurrentPageTable;
+    KIRQL                   OldIrql;
+
+    CurrentPageTable = EptGetCurrentPageTable();
+
+    OldIrql = EptLockHookedPages();
+
+    //
+    // Find the hook of the table that caused the violation, the views are copies
+    // of the shared table so they might contain the hooks of the shared table,
+    // in that case the entry of the view is restored (not the shared entry)
+    //
+    HookedEntry = EptFindHookedPage(CurrentPageTable, PAGE_ALIGN(GuestPhysicalAddr));
+
+    if (HookedEntry != NULL)
+    {
+        EntryAddress = HookedEntry->EntryAddress;
+    }
+    else if (CurrentPageTable != g_EptState->EptPageTable)
+    {
+        HookedEntry = EptFindHookedPage(g_EptState->EptPageTable, PAGE_ALIGN(GuestPhysicalAddr));
+
+        if (HookedEntry != NULL)
+        {
+            EntryAddress = EptGetPml1Entry(CurrentPageTable, PAGE_ALIGN(GuestPhysicalAddr));
+        }
+    }
+
+    if (HookedEntry != NULL && EntryAddress != NULL)
+    {
+        //
+        // We found an address that match the details
+        //
+        // Returning true means that the caller should return to the ept state to
+        // the previous state when this instruction is executed
+        // by setting the Monitor Trap Flag. Return false means that nothing special
+        // for the caller to do (e.g., the instruction is emulated)
+        //
+        if (EptHandleHookedPage(Regs, HookedEntry, EntryAddress, ViolationQualification, GuestPhysicalAddr))
+        {
             //
-            // Indicate that we handled the ept violation
+            // Next we have to save the current hooked entry to restore on the next instruction's vm-exit
             //
-            IsHandled = TRUE;
+            g_GuestState[KeGetCurrentProcessorNumber()].MtfEptHookRestorePoint = HookedEntry;
+            g_GuestState[KeGetCurrentProcessorNumber()].MtfEptHookRestoreEntry = EntryAddress;
 
             //
-            // Get out of the loop
+            // We have to set Monitor trap flag and give it the HookedEntry to work with
             //
-            break;
+            HvSetMonitorTrapFlag(TRUE);
         }
+
+        //
+        // Indicate that we handled the ept violation
+        //
+        IsHandled = TRUE;
     }
+
+    EptUnlockHookedPages(OldIrql);
+
     //
-    // Redo the instruction
+    // Redo the instruction, or the emulated instruction has already moved the RIP
     //
     g_GuestState[KeGetCurrentProcessorNumber()].IncrementRip = FALSE;
     return IsHandled;
@@ -665,19 +1264,20 @@ EptHandlePageHookExit(VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualificatio
  * @details Violations are thrown whenever an operation is performed on an EPT entry 
  * that does not provide permissions to access that page
  * 
+ * @param Regs The guest's general purpose registers
  * @param ExitQualification 
  * @param GuestPhysicalAddr 
  * @return BOOLEAN Return true if the violation was handled by the page hook handler
  * and false if it was not handled
  */
 BOOLEAN
-EptHandleEptViolation(ULONG ExitQualification, UINT64 GuestPhysicalAddr)
+EptHandleEptViolation(PGUEST_REGS Regs, ULONG ExitQualification, UINT64 GuestPhysicalAddr)
 {
     VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification;
 
     ViolationQualification.Flags = ExitQualification;
 
-    if (EptHandlePageHookExit(ViolationQualification, GuestPhysicalAddr))
+    if (EptHandlePageHookExit(Regs, ViolationQualification, GuestPhysicalAddr))
     {
         //
         // Handled by page hook code
@@ -695,17 +1295,41 @@ EptHandleEptViolation(ULONG ExitQualification, UINT64 GuestPhysicalAddr)
 
 /**
  * @brief Handle vm-exits for Monitor Trap Flag to restore previous state
+ * @details If the hook is removed after the violation, then the entry is
+ * already restored and nothing is changed
  * 
- * @param HookedEntry 
+ * @param CoreIndex The index of the current core
  * @return VOID 
  */
 VOID
-EptHandleMonitorTrapFlag(PEPT_HOOKED_PAGE_DETAIL HookedEntry)
+EptHandleMonitorTrapFlag(ULONG CoreIndex)
 {
+    PEPT_HOOKED_PAGE_DETAIL HookedEntry;
+    PEPT_PML1_ENTRY         EntryAddress;
+    KIRQL                   OldIrql;
+
+    OldIrql = EptLockHookedPages();
+
+    HookedEntry  = g_GuestState[CoreIndex].MtfEptHookRestorePoint;
+    EntryAddress = g_GuestState[CoreIndex].MtfEptHookRestoreEntry;
+
+    g_GuestState[CoreIndex].MtfEptHookRestorePoint = NULL;
+    g_GuestState[CoreIndex].MtfEptHookRestoreEntry = NULL;
+
     //
-    // restore the hooked state
+    // The entry belongs to the current view unless the view is changed (and
+    // maybe freed) after the violation
     //
-    EptSetPML1AndInvalidateTLB(HookedEntry->EntryAddress, HookedEntry->ChangedEntry, INVEPT_SINGLE_CONTEXT);
+    if (HookedEntry != NULL &&
+        EptGetPml1Entry(EptGetCurrentPageTable(), HookedEntry->PhysicalBaseAddress) == EntryAddress)
+    {
+        //
+        // restore the hooked state
+        //
+        EptSetPML1AndInvalidateTLB(CurrentPageTable, EntryAddress, HookedEntry->ChangedEntry);
+    }
+
+    EptUnlockHookedPages(OldIrql);
 }
 
 /**
@@ -720,586 +1344,2137 @@ EptHandleMisconfiguration(UINT64 GuestAddress)
     LogInfo("EPT Misconfiguration!");
     LogError("A field in the EPT paging structure was invalid, Faulting guest address : 0x%llx", GuestAddress);
 
-    //
-    // We can't continue now.
-    // EPT misconfiguration is a fatal exception that will probably crash the OS if we don't get out now
-    //
-}
+    //
+    // We can't continue now.
+    // EPT misconfiguration is a fatal exception that will probably crash the OS if we don't get out now
+    //
+}
+
+/**
+ * @brief Check whether a range of instructions overlaps with the detours of a hooked page
+ * 
+ * @param Hook The details of hooked page
+ * @param Start The start of the range relative to the start of the page (might be negative)
+ * @param End The end of the range relative to the start of the page (might pass the end of the page)
+ * @return BOOLEAN Returns true if the range overlaps with the moved instructions of a detour
+ */
+BOOLEAN
+EptHookIsOverlappingDetour(PEPT_HOOKED_PAGE_DETAIL Hook, INT64 Start, INT64 End)
+{
+    PEPT_HOOK_DETOUR_SITE DetourSite;
+    UINT32                Index;
+
+    if (Hook == NULL)
+    {
+        return FALSE;
+    }
+
+    for (Index = 0; Index < Hook->NumberOfDetourSites; Index++)
+    {
+        DetourSite = &Hook->DetourSites[Index];
+
+        if (Start < (INT64)(DetourSite->OffsetIntoPage + DetourSite->SizeOfHookedInstructions) &&
+            (INT64)DetourSite->OffsetIntoPage < End)
+        {
+            LogError("The hook overlaps with the hook of 0x%llx", DetourSite->TargetAddress);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Find the hook of a virtual page on a table
+ * 
+ * @param EptPageTable The page table of the hook
+ * @param VirtualAddress The page aligned virtual address
+ * @return PEPT_HOOKED_PAGE_DETAIL The detail of the hooked page or NULL if the page is not hooked
+ */
+PEPT_HOOKED_PAGE_DETAIL
+EptHookFindHookedVirtualPage(PVMM_EPT_PAGE_TABLE EptPageTable, PVOID VirtualAddress)
+{
+    SIZE_T PhysicalAddress = (SIZE_T)VirtualAddressToPhysicalAddress(VirtualAddress);
+
+    if (!PhysicalAddress)
+    {
+        return NULL;
+    }
+
+    return EptFindHookedPage(EptPageTable, PhysicalAddress);
+}
+
+/**
+ * @brief Write the jump of a detour site to the fake pages
+ * @details If the fake page is already in use then the detour jump is written in a way that
+ * the first 8 bytes are changed atomically after the rest of the jump, the part of the jump
+ * that passes the end of the page is written to the start of the fake page of the next page
+ * before anything else
+ * 
+ * @param Hook The details of hooked page
+ * @param NextPage The details of the hooked next page if the jump passes the end of the page
+ * @param OffsetIntoPage Offset of the detour site in the page
+ * @param DetourJump The jump of the detour site
+ * @param SizeOfDetourJump The size of the jump
+ * @return VOID 
+ */
+VOID
+EptHookWriteDetourSite(PEPT_HOOKED_PAGE_DETAIL Hook, PEPT_HOOKED_PAGE_DETAIL NextPage, SIZE_T OffsetIntoPage, PCHAR DetourJump, SIZE_T SizeOfDetourJump)
+{
+    SIZE_T SizeOnPage = SizeOfDetourJump;
+    SIZE_T WindowOffset;
+    LONG64 Window;
+
+    if (OffsetIntoPage + SizeOfDetourJump > PAGE_SIZE)
+    {
+        SizeOnPage = PAGE_SIZE - OffsetIntoPage;
+
+        //
+        // The tail of the jump overwrites the moved instructions, so it's written before the
+        // head that makes it reachable
+        //
+        RtlCopyMemory(&NextPage->FakePageContents[0], &DetourJump[SizeOnPage], SizeOfDetourJump - SizeOnPage);
+    }
+
+    if (EptFindHookedPage(Hook->EptPageTable, Hook->PhysicalBaseAddress) != Hook)
+    {
+        //
+        // The fake page is not used yet
+        //
+        RtlCopyMemory(&Hook->FakePageContents[OffsetIntoPage], DetourJump, SizeOnPage);
+        return;
+    }
+
+    //
+    // Other cores might execute the fake page, so the start of the jump is written at last
+    // (by an 8 bytes window that contains the first byte of the jump)
+    //
+    WindowOffset = OffsetIntoPage + sizeof(LONG64) > PAGE_SIZE ? PAGE_SIZE - sizeof(LONG64) : OffsetIntoPage;
+
+    if (WindowOffset + sizeof(LONG64) < OffsetIntoPage + SizeOnPage)
+    {
+        RtlCopyMemory(&Hook->FakePageContents[WindowOffset + sizeof(LONG64)],
+                      &DetourJump[WindowOffset + sizeof(LONG64) - OffsetIntoPage],
+                      OffsetIntoPage + SizeOnPage - WindowOffset - sizeof(LONG64));
+    }
+
+    Window = *(LONG64 *)&Hook->FakePageContents[WindowOffset];
+    RtlCopyMemory((PCHAR)&Window + (OffsetIntoPage - WindowOffset),
+                  DetourJump,
+                  min(SizeOnPage, WindowOffset + sizeof(LONG64) - OffsetIntoPage));
+
+    InterlockedExchange64((LONG64 *)&Hook->FakePageContents[WindowOffset], Window);
+}
+
+/**
+ * @brief Hook instructions of a function by a detour on the fake page of the hooked page
+ * @details All the detours of a page share its fake page and its trampoline block, the
+ * overwritten instructions are relocated to the trampoline; if the detour jump passes the
+ * end of the page then the next page is hooked too and the two pages are unhooked together
+ * 
+ * @param Hook The details of hooked pages
+ * @param TargetFunction Target function that needs to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @return BOOLEAN Returns true if the hook was successfull or returns false if it was not successfull
+ */
+BOOLEAN
+EptHookInstructionMemory(PEPT_HOOKED_PAGE_DETAIL Hook, PVOID TargetFunction, PVOID HookFunction, PVOID * OrigFunction)
+{
+    PHIDDEN_HOOKS_DETOUR_DETAILS DetourHookDetails;
+    PEPT_HOOK_DETOUR_SITE        DetourSite;
+    PEPT_HOOKED_PAGE_DETAIL      NextPage         = NULL;
+    BOOLEAN                      IsNextPageHooked = FALSE;
+    PVOID                        NextVirtualPage;
+    SIZE_T                       SizeOfHookedInstructions;
+    SIZE_T                       SizeOfDetourJump;
+    SIZE_T                       SizeOfStub = 0;
+    SIZE_T                       SizeOfTrampoline;
+    SIZE_T                       OffsetIntoPage;
+    PCHAR                        Trampoline;
+    CHAR                         DetourJump[EPT_HOOK_DETOUR_JUMP_SIZE];
+
+    OffsetIntoPage  = ADDRMASK_EPT_PML1_OFFSET((SIZE_T)TargetFunction);
+    NextVirtualPage = (PCHAR)PAGE_ALIGN(TargetFunction) + PAGE_SIZE;
+    LogInfo("OffsetIntoPage: 0x%llx", OffsetIntoPage);
+
+    if (Hook->NumberOfDetourSites == EPT_MAX_DETOURS_PER_PAGE)
+    {
+        LogError("There are too many detours on this page");
+        return FALSE;
+    }
+
+    //
+    // Allocate some executable memory for the trampolines of this page, a block near the
+    // page lets the detours and the trampolines use the short jumps
+    //
+    if (!Hook->TrampolineBlock)
+    {
+        Hook->TrampolineBlock = PoolManagerRequestPoolNearAddress(EXEC_TRAMPOLINE, TRUE, EPT_HOOK_TRAMPOLINE_BLOCK_SIZE, (UINT64)PAGE_ALIGN(TargetFunction));
+
+        if (!Hook->TrampolineBlock)
+        {
+            LogError("Could not allocate trampoline function buffer.");
+            return FALSE;
+        }
+    }
+
+    //
+    // Create the jump to the hook function, the shortest form depends on the distance
+    // (a jump stub might be needed at the start of the free space of the block)
+    //
+    SizeOfDetourJump = TrampolineWriteDetourJump((PUCHAR)DetourJump,
+                                                 (UINT64)TargetFunction,
+                                                 (UINT64)HookFunction,
+                                                 (PUCHAR)&Hook->TrampolineBlock[Hook->TrampolineBlockUsedSize],
+                                                 EPT_HOOK_TRAMPOLINE_BLOCK_SIZE - Hook->TrampolineBlockUsedSize,
+                                                 &SizeOfStub);
+
+    //
+    // Determine the number of instructions necessary to overwrite using Length Disassembler Engine
+    //
+    SizeOfHookedInstructions = TrampolineGetSizeOfInstructions(TargetFunction, SizeOfDetourJump);
+
+    if (SizeOfHookedInstructions == 0)
+    {
+        LogError("Could not decode the instructions of 0x%llx", TargetFunction);
+        return FALSE;
+    }
+
+    LogInfo("Number of bytes of instruction mem: %d", SizeOfHookedInstructions);
+
+    //
+    // The moved instructions of the detours should not overlap, the detours of the previous
+    // page and the next page might also move instructions of this page
+    //
+    if (EptHookIsOverlappingDetour(Hook, OffsetIntoPage, OffsetIntoPage + SizeOfHookedInstructions) ||
+        EptHookIsOverlappingDetour(EptHookFindHookedVirtualPage(Hook->EptPageTable, (PCHAR)PAGE_ALIGN(TargetFunction) - PAGE_SIZE),
+                                   OffsetIntoPage + PAGE_SIZE,
+                                   OffsetIntoPage + PAGE_SIZE + SizeOfHookedInstructions))
+    {
+        return FALSE;
+    }
+
+    if (OffsetIntoPage + SizeOfHookedInstructions > PAGE_SIZE &&
+        EptHookIsOverlappingDetour(EptHookFindHookedVirtualPage(Hook->EptPageTable, NextVirtualPage),
+                                   (INT64)OffsetIntoPage - PAGE_SIZE,
+                                   (INT64)(OffsetIntoPage + SizeOfHookedInstructions) - PAGE_SIZE))
+    {
+        return FALSE;
+    }
+
+    //
+    // Build a trampoline (after the jump stub, if any)
+    //
+    Trampoline = &Hook->TrampolineBlock[Hook->TrampolineBlockUsedSize + SizeOfStub];
+
+    //
+    // Relocate the instructions and add the jump back to the original function
+    //
+    if (!TrampolineBuild(TargetFunction,
+                         SizeOfHookedInstructions,
+                         (PUCHAR)Trampoline,
+                         EPT_HOOK_TRAMPOLINE_BLOCK_SIZE - Hook->TrampolineBlockUsedSize - SizeOfStub,
+                         &SizeOfTrampoline))
+    {
+        LogError("Could not relocate the instructions of 0x%llx to the trampoline", TargetFunction);
+        return FALSE;
+    }
+
+    //
+    // The part of the detour jump that passes the end of the page is written to the
+    // fake page of the next page, so the next page is hooked too
+    //
+    if (OffsetIntoPage + SizeOfDetourJump > PAGE_SIZE)
+    {
+        NextPage = EptHookFindHookedVirtualPage(Hook->EptPageTable, NextVirtualPage);
+
+        if (NextPage == NULL)
+        {
+            if (!EptPerformPageHook(Hook->EptPageTable, NextVirtualPage, NULL, NULL, FALSE, FALSE, TRUE))
+            {
+                LogError("Could not hook the next page of 0x%llx", TargetFunction);
+                return FALSE;
+            }
+
+            NextPage         = EptHookFindHookedVirtualPage(Hook->EptPageTable, NextVirtualPage);
+            IsNextPageHooked = TRUE;
+        }
+
+        if (NextPage == NULL || !NextPage->IsExecutionHook)
+        {
+            LogError("The next page of 0x%llx is hooked by a different type of hook", TargetFunction);
+            return FALSE;
+        }
+    }
+
+    //
+    // Create the structure to return for the debugger, we do it here because it's the first
+    // function that changes the original function and if our structure is no ready after this
+    // fucntion then we probably see BSOD on other cores
+    //
+    DetourHookDetails = PoolManagerRequestPool(DETOUR_HOOK_DETAILS, TRUE, sizeof(HIDDEN_HOOKS_DETOUR_DETAILS));
+
+    if (!DetourHookDetails)
+    {
+        LogError("There is no pre-allocated pool for saving detour details");
+
+        if (IsNextPageHooked)
+        {
+            EptUnHookNewPage(NextPage);
+        }
+        return FALSE;
+    }
+
+    DetourHookDetails->HookedFunctionAddress = TargetFunction;
+    DetourHookDetails->ReturnAddress         = Trampoline;
+
+    //
+    // Publish it in the table of detours, the next page that is hooked for this
+    // detour is unhooked if the table is full
+    //
+    if (!HiddenHooksDetourInsert(DetourHookDetails))
+    {
+        LogError("There are too many detours");
+
+        PoolManagerFreePool((UINT64)DetourHookDetails);
+
+        if (IsNextPageHooked)
+        {
+            EptUnHookNewPage(NextPage);
+        }
+        return FALSE;
+    }
+
+    Hook->TrampolineBlockUsedSize += SizeOfStub + SizeOfTrampoline;
+
+    LogInfo("Trampoline: 0x%llx", Trampoline);
+    LogInfo("HookFunction: 0x%llx", HookFunction);
+
+    //
+    // Let the hook function call the original function
+    //
+    *OrigFunction = Trampoline;
+
+    //
+    // Write the jump to our shadow page memory to jump to our hook
+    //
+    EptHookWriteDetourSite(Hook, NextPage, OffsetIntoPage, DetourJump, SizeOfDetourJump);
+
+    //
+    // Save the detour site
+    //
+    DetourSite                           = &Hook->DetourSites[Hook->NumberOfDetourSites];
+    DetourSite->TargetAddress            = TargetFunction;
+    DetourSite->OffsetIntoPage           = OffsetIntoPage;
+    DetourSite->SizeOfHookedInstructions = SizeOfHookedInstructions;
+    DetourSite->Trampoline               = Trampoline;
+    DetourSite->SpannedPage              = NextPage;
+
+    Hook->NumberOfDetourSites++;
+
+    return TRUE;
+}
+
+/**
+ * @brief Handles page hooks
+ * @details The supported reads and writes are emulated on the original page, other
+ * accesses restore the original entry until the instruction is executed
+ * 
+ * @param Regs The guest's general purpose registers
+ * @param HookedEntryDetails The entry that describes the hooked page
+ * @param EntryAddress The entry of the current view (the view might inherit the hook of the shared table)
+ * @param ViolationQualification The exit qualification of vm-exit
+ * @param PhysicalAddress The physical address that cause this vm-exit
+ * @return BOOLEAN Returns TRUE if the entry should be restored after the instruction is
+ * executed or returns false if the instruction was emulated or there was an unexpected
+ * ept violation
+ */
+BOOLEAN
+EptHandleHookedPage(PGUEST_REGS Regs, EPT_HOOKED_PAGE_DETAIL * HookedEntryDetails, PEPT_PML1_ENTRY EntryAddress, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, SIZE_T PhysicalAddress)
+{
+    ULONG64 GuestRip;
+    ULONG64 ExactAccessedAddress;
+    ULONG64 AlignedVirtualAddress;
+    ULONG64 AlignedPhysicalAddress;
+
+    //
+    // Get alignment
+    //
+    AlignedVirtualAddress  = PAGE_ALIGN(HookedEntryDetails->VirtualAddress);
+    AlignedPhysicalAddress = PAGE_ALIGN(PhysicalAddress);
+
+    //
+    // Let's read the exact address that was accesses
+    //
+    ExactAccessedAddress = AlignedVirtualAddress + PhysicalAddress - AlignedPhysicalAddress;
+
+    //
+    // Reading guest's RIP
+    //
+    __vmx_vmread(GUEST_RIP, &GuestRip);
+
+    if (!ViolationQualification.EptExecutable && ViolationQualification.ExecuteAccess)
+    {
+        LogInfo("Guest RIP : 0x%llx tries to execute the page at : 0x%llx", GuestRip, ExactAccessedAddress);
+    }
+    else if (!ViolationQualification.EptWriteable && ViolationQualification.WriteAccess)
+    {
+        LogInfo("Guest RIP : 0x%llx tries to write on the page at :0x%llx", GuestRip, ExactAccessedAddress);
+    }
+    else if (!ViolationQualification.EptReadable && ViolationQualification.ReadAccess)
+    {
+        LogInfo("Guest RIP : 0x%llx tries to read the page at :0x%llx", GuestRip, ExactAccessedAddress);
+    }
+    else
+    {
+        //
+        // there was an unexpected ept violation
+        //
+        return FALSE;
+    }
+
+    //
+    // Emulate the common loads and stores without the Monitor Trap Flag round-trip
+    //
+    if (!ViolationQualification.ExecuteAccess &&
+        EmulationHandleHookedMemoryAccess(Regs, PhysicalAddress, ViolationQualification))
+    {
+        return FALSE;
+    }
+
+    EptSetPML1AndInvalidateTLB(EptGetCurrentPageTable(), EntryAddress, HookedEntryDetails->OriginalEntry);
+
+    //
+    // Means that restore the Entry to the previous state after current instruction executed in the guest
+    //
+    return TRUE;
+}
+
+/**
+ * @brief Acquire the lock of the hooked pages
+ * @details In vmx non-root, the owner runs at DISPATCH_LEVEL so it's not preempted
+ * while the vm-exits of the other cores wait for the lock
+ * 
+ * @return KIRQL The previous IRQL that should be passed to EptUnlockHookedPages
+ */
+KIRQL
+EptLockHookedPages()
+{
+    KIRQL OldIrql = PASSIVE_LEVEL;
+
+    //
+    // A vm-exit on this core might wait for the lock, so vmx non-root
+    // doesn't take a ticket
+    //
+    if (g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        SpinlockTicketLock(&EptHookedPagesLock);
+    }
+    else
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        SpinlockTicketLockPolling(&EptHookedPagesLock);
+    }
+
+    return OldIrql;
+}
+
+/**
+ * @brief Release the lock of the hooked pages
+ * 
+ * @param OldIrql The IRQL that is returned by EptLockHookedPages
+ * @return VOID 
+ */
+VOID
+EptUnlockHookedPages(KIRQL OldIrql)
+{
+    SpinlockTicketUnlock(&EptHookedPagesLock);
+
+    if (!g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        KeLowerIrql(OldIrql);
+    }
+}
+
+/**
+ * @brief Write an entry of a hooked page to a private table
+ * @details The large page of the table is split if the page is hooked on the
+ * shared table after the private table is created
+ * 
+ * @param PageTable The private table of a core or a process view
+ * @param PhysicalAddress The page aligned physical address
+ * @param EntryValue The new entry
+ * @return BOOLEAN Returns true if the entry was changed
+ */
+BOOLEAN
+EptSetPrivateEntryOfHookedPage(PVMM_EPT_PAGE_TABLE PageTable, SIZE_T PhysicalAddress, EPT_PML1_ENTRY EntryValue)
+{
+    PEPT_PML1_ENTRY TargetPage;
+    PVOID           TargetBuffer;
+
+    TargetPage = EptGetPml1Entry(PageTable, PhysicalAddress);
+
+    if (TargetPage == NULL)
+    {
+        //
+        // The large page is not split, so the page is not hooked on this table
+        //
+        if (EntryValue.ReadAccess && EntryValue.WriteAccess && EntryValue.ExecuteAccess)
+        {
+            return FALSE;
+        }
+
+        TargetBuffer = PoolManagerRequestPool(SPLIT_2MB_PAGING_TO_4KB_PAGE, TRUE, sizeof(VMM_EPT_DYNAMIC_SPLIT));
+
+        if (!TargetBuffer || !EptSplitLargePage(PageTable, TargetBuffer, PhysicalAddress, KeGetCurrentProcessorNumber()))
+        {
+            LogError("Could not split the page of a view for the address : 0x%llx", PhysicalAddress);
+            return FALSE;
+        }
+
+        TargetPage = EptGetPml1Entry(PageTable, PhysicalAddress);
+    }
+
+    if (TargetPage == NULL || TargetPage->Flags == EntryValue.Flags)
+    {
+        return FALSE;
+    }
+
+    InterlockedExchange64((LONG64 *)&TargetPage->Flags, EntryValue.Flags);
+
+    return TRUE;
+}
+
+/**
+ * @brief Copy the shared table and the hooked entries to a private table
+ * @details The private table is copied from the shared table without holding the lock of the
+ * hooked pages, so the copy might contain an entry that is temporarily restored by a core or
+ * the entry of a removed hook, the split pages are copied again and then the entries of the
+ * hooks of the shared table and the hooks of the private table are changed to the hooked state,
+ * should be called while holding the lock of the hooked pages and before the table is published
+ * 
+ * @param PageTable The private table of a core or a process view
+ * @return VOID 
+ */
+VOID
+EptRefreshPrivatePageTable(PVMM_EPT_PAGE_TABLE PageTable)
+{
+    PLIST_ENTRY             TempList;
+    PVMM_EPT_DYNAMIC_SPLIT  Split;
+    PEPT_PML2_POINTER       SharedPointer;
+    PEPT_HOOKED_PAGE_DETAIL HookedEntry;
+
+    //
+    // The split pages of the private table are at the same index of the PML2 entries
+    //
+    TempList = &PageTable->DynamicSplitList;
+    while (&PageTable->DynamicSplitList != TempList->Flink)
+    {
+        TempList      = TempList->Flink;
+        Split         = CONTAINING_RECORD(TempList, VMM_EPT_DYNAMIC_SPLIT, DynamicSplitList);
+        SharedPointer = (PEPT_PML2_POINTER)(&g_EptState->EptPageTable->PML2[0][0] + ((PEPT_PML2_ENTRY)Split->Pointer - &PageTable->PML2[0][0]));
+
+        RtlCopyMemory(&Split->PML1[0], (PVOID)PhysicalAddressToVirtualAddress(SharedPointer->PageFrameNumber * PAGE_SIZE), sizeof(Split->PML1));
+    }
+
+    TempList = &g_EptState->HookedPagesList;
+    while (&g_EptState->HookedPagesList != TempList->Flink)
+    {
+        TempList    = TempList->Flink;
+        HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+
+        if (HookedEntry->EptPageTable == PageTable)
+        {
+            HookedEntry->EntryAddress->Flags = HookedEntry->ChangedEntry.Flags;
+        }
+        else if (HookedEntry->EptPageTable == g_EptState->EptPageTable &&
+                 EptFindHookedPage(PageTable, HookedEntry->PhysicalBaseAddress) == NULL)
+        {
+            EptSetPrivateEntryOfHookedPage(PageTable, HookedEntry->PhysicalBaseAddress, HookedEntry->ChangedEntry);
+        }
+    }
+}
+
+/**
+ * @brief Write the entry of a hooked page of the shared table to the views
+ * @details The views that have their own hook on the page are not changed, should
+ * be called while holding the lock of the hooked pages, the cached translations of
+ * the views are invalidated after the current vm-exit (the other cores are notified
+ * by the callers)
+ * 
+ * @param HookedPage The detail of the hooked page of the shared table
+ * @param EntryValue The hooked entry or the original entry of the page
+ * @return VOID 
+ */
+VOID
+EptUpdateSharedHookOnViews(PEPT_HOOKED_PAGE_DETAIL HookedPage, EPT_PML1_ENTRY EntryValue)
+{
+    PVMM_EPT_PAGE_TABLE PageTable;
+    ULONG               ProcessorsCount;
+    UINT32              Index;
+    BOOLEAN             IsChanged = FALSE;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    //
+    // The private tables of the cores and then the tables of the process views
+    //
+    for (Index = 0; Index < ProcessorsCount + EPT_MAX_PROCESS_VIEWS; Index++)
+    {
+        PageTable = Index < ProcessorsCount ? g_GuestState[Index].EptView.PageTable : g_EptState->ProcessViews[Index - ProcessorsCount].PageTable;
+
+        if (PageTable == NULL || PageTable == g_EptState->EptPageTable ||
+            EptFindHookedPage(PageTable, HookedPage->PhysicalBaseAddress) != NULL)
+        {
+            continue;
+        }
+
+        IsChanged |= EptSetPrivateEntryOfHookedPage(PageTable, HookedPage->PhysicalBaseAddress, EntryValue);
+    }
+
+    if (IsChanged && g_GuestState[KeGetCurrentProcessorNumber()].HasLaunched)
+    {
+        InveptQueueAllContexts();
+    }
+}
+
+/**
+ * @brief Find the detail of a hooked physical page
+ * @details The lookup only walks the bucket of the page, the caller should
+ * hold the lock of the hooked pages
+ * 
+ * @param EptPageTable The page table of the hook, or NULL for the hook of any table
+ * @param PhysicalBaseAddress The page aligned physical address
+ * @return PEPT_HOOKED_PAGE_DETAIL The detail of the hooked page or NULL if the page is not hooked
+ */
+PEPT_HOOKED_PAGE_DETAIL
+EptFindHookedPage(PVMM_EPT_PAGE_TABLE EptPageTable, SIZE_T PhysicalBaseAddress)
+{
+    PLIST_ENTRY TempList   = 0;
+    PLIST_ENTRY BucketHead = &g_EptState->HookedPagesBuckets[EPT_HOOKED_PAGES_BUCKET(PhysicalBaseAddress)];
+
+    TempList = BucketHead;
+    while (BucketHead != TempList->Flink)
+    {
+        TempList                            = TempList->Flink;
+        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookBucketList);
+
+        if (HookedEntry->PhysicalBaseAddress == PhysicalBaseAddress &&
+            (EptPageTable == NULL || HookedEntry->EptPageTable == EptPageTable))
+        {
+            return HookedEntry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Remove the detail of a hooked page from the hooked pages lists and free it
+ * @details The hook should be already removed from the EPT table, the detours of the
+ * page are also removed from the table of detours, the caller should hold the lock
+ * of the hooked pages
+ * 
+ * @param HookedPage The detail of the hooked page
+ * @return VOID 
+ */
+VOID
+EptRemoveHookedPage(PEPT_HOOKED_PAGE_DETAIL HookedPage)
+{
+    UINT32 Index;
+    ULONG  ProcessorsCount;
+
+    RemoveEntryList(&HookedPage->PageHookList);
+    RemoveEntryList(&HookedPage->PageHookBucketList);
+
+    //
+    // The cores that wait for an MTF vm-exit to restore the hook don't touch the entry anymore
+    //
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (Index = 0; Index < ProcessorsCount; Index++)
+    {
+        if (g_GuestState[Index].MtfEptHookRestorePoint == HookedPage)
+        {
+            g_GuestState[Index].MtfEptHookRestorePoint = NULL;
+        }
+    }
+
+    //
+    // The trampolines are not freed, so a core that has already found one of them can still use it
+    //
+    for (Index = 0; Index < HookedPage->NumberOfDetourSites; Index++)
+    {
+        HiddenHooksDetourRemove(HookedPage->DetourSites[Index].TargetAddress, HookedPage->DetourSites[Index].Trampoline);
+    }
+
+    //
+    // The fake page is not referenced by any EPT entry anymore, so the buffer is
+    // returned to the pool manager (it's freed later from PASSIVE_LEVEL)
+    //
+    PoolManagerFreePool((UINT64)HookedPage);
+}
+
+/**
+ * @brief Unhook a page that is hooked while building a hook that failed
+ * @details The page has no detour, so only its entry is restored and its
+ * details are removed, the caller should hold the lock of the hooked pages
+ * 
+ * @param HookedPage The detail of the hooked page
+ * @return VOID 
+ */
+VOID
+EptUnHookNewPage(PEPT_HOOKED_PAGE_DETAIL HookedPage)
+{
+    EPT_PML1_ENTRY          RestoredEntry = HookedPage->OriginalEntry;
+    PEPT_HOOKED_PAGE_DETAIL SharedHook    = NULL;
+
+    //
+    // The entry of a view returns to the hook of the shared table (if any)
+    //
+    if (HookedPage->EptPageTable != g_EptState->EptPageTable)
+    {
+        SharedHook = EptFindHookedPage(g_EptState->EptPageTable, HookedPage->PhysicalBaseAddress);
+
+        if (SharedHook != NULL)
+        {
+            RestoredEntry = SharedHook->ChangedEntry;
+        }
+    }
+
+    if (!g_GuestState[KeGetCurrentProcessorIndex()].HasLaunched)
+    {
+        HookedPage->EntryAddress->Flags = RestoredEntry.Flags;
+    }
+    else
+    {
+        EptSetPML1AndInvalidateTLB(HookedPage->EptPageTable, HookedPage->EntryAddress, RestoredEntry);
+    }
+
+    if (HookedPage->EptPageTable == g_EptState->EptPageTable)
+    {
+        EptUpdateSharedHookOnViews(HookedPage, RestoredEntry);
+    }
+
+    EptRemoveHookedPage(HookedPage);
+}
+
+/**
+ * @brief Remove the details of all the hooks of a page table
+ * @details The table should not be used by any core anymore (it's going to be
+ * freed), so the entries of the table are not restored
+ * 
+ * @param PageTable The page table of a process view or a private view of a core
+ * @return VOID 
+ */
+VOID
+EptRemoveHooksOfPageTable(PVMM_EPT_PAGE_TABLE PageTable)
+{
+    PLIST_ENTRY             TempList;
+    PLIST_ENTRY             NextList;
+    PEPT_HOOKED_PAGE_DETAIL HookedEntry;
+    KIRQL                   OldIrql;
+
+    OldIrql = EptLockHookedPages();
+
+    TempList = g_EptState->HookedPagesList.Flink;
+    while (&g_EptState->HookedPagesList != TempList)
+    {
+        NextList    = TempList->Flink;
+        HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+
+        if (HookedEntry->EptPageTable == PageTable)
+        {
+            EptRemoveHookedPage(HookedEntry);
+        }
+
+        TempList = NextList;
+    }
+
+    EptUnlockHookedPages(OldIrql);
+}
+
+/**
+ * @brief Find the hooked pages that are linked to a hooked page by the detours that pass
+ * the end of a page
+ * @details The linked pages should be unhooked with the page, the pages that contain the
+ * head of a jump before the pages that contain its tail, the caller should hold the lock
+ * of the hooked pages
+ * 
+ * @param PhysicalBaseAddress The page aligned physical address
+ * @param FindPreviousPages Find the pages that their detours pass into this page instead of
+ * the pages that the detours of this page pass into
+ * @param PhysicalAddresses The physical addresses of the linked pages (EPT_MAX_SPANNED_PAGES entries)
+ * @return UINT32 Number of the linked pages
+ */
+UINT32
+EptGetSpannedHookedPages(SIZE_T PhysicalBaseAddress, BOOLEAN FindPreviousPages, SIZE_T * PhysicalAddresses)
+{
+    PLIST_ENTRY TempList      = 0;
+    UINT32      NumberOfPages = 0;
+    SIZE_T      LinkedAddress;
+    UINT32      Index;
+    UINT32      Counter;
+
+    TempList = &g_EptState->HookedPagesList;
+    while (&g_EptState->HookedPagesList != TempList->Flink)
+    {
+        TempList                            = TempList->Flink;
+        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+
+        for (Index = 0; Index < HookedEntry->NumberOfDetourSites; Index++)
+        {
+            if (HookedEntry->DetourSites[Index].SpannedPage == NULL)
+            {
+                continue;
+            }
+
+            if (FindPreviousPages && HookedEntry->DetourSites[Index].SpannedPage->PhysicalBaseAddress == PhysicalBaseAddress)
+            {
+                LinkedAddress = HookedEntry->PhysicalBaseAddress;
+            }
+            else if (!FindPreviousPages && HookedEntry->PhysicalBaseAddress == PhysicalBaseAddress)
+            {
+                LinkedAddress = HookedEntry->DetourSites[Index].SpannedPage->PhysicalBaseAddress;
+            }
+            else
+            {
+                continue;
+            }
+
+            for (Counter = 0; Counter < NumberOfPages && PhysicalAddresses[Counter] != LinkedAddress; Counter++)
+            {
+            }
+
+            if (Counter == NumberOfPages && NumberOfPages < EPT_MAX_SPANNED_PAGES)
+            {
+                PhysicalAddresses[NumberOfPages++] = LinkedAddress;
+            }
+        }
+    }
+
+    return NumberOfPages;
+}
+
+/**
+ * @brief Add a hook to a page that is already hooked
+ * @details Execution hooks add a detour to the shared fake page and read/write hooks
+ * remove more permissions from the hooked entry, the two types can't be mixed on a page
+ * 
+ * @param HookedPage The detail of the hooked page
+ * @param TargetAddress The address of function or memory address to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @param UnsetRead Hook READ Access
+ * @param UnsetWrite Hook WRITE Access
+ * @param UnsetExecute Hook EXECUTE Access
+ * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ */
+BOOLEAN
+EptPerformPageHookOnHookedPage(PEPT_HOOKED_PAGE_DETAIL HookedPage, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute)
+{
+    EPT_PML1_ENTRY ChangedEntry;
+
+    if (HookedPage->IsExecutionHook != UnsetExecute)
+    {
+        LogError("The page is already hooked by a different type of hook");
+        return FALSE;
+    }
+
+    if (UnsetExecute)
+    {
+        //
+        // The fake page is already mapped, the detour is visible as soon as it's written
+        // (no hook function means that only the fake page is needed)
+        //
+        if (HookFunction != NULL && !EptHookInstructionMemory(HookedPage, TargetAddress, HookFunction, OrigFunction))
+        {
+            LogError("Could not build the hook.");
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    ChangedEntry = HookedPage->ChangedEntry;
+
+    if (UnsetRead)
+        ChangedEntry.ReadAccess = 0;
+
+    if (UnsetWrite)
+        ChangedEntry.WriteAccess = 0;
+
+    HookedPage->ChangedEntry = ChangedEntry;
+
+    if (!g_GuestState[KeGetCurrentProcessorIndex()].HasLaunched)
+    {
+        HookedPage->EntryAddress->Flags = ChangedEntry.Flags;
+    }
+    else
+    {
+        EptSetPML1AndInvalidateTLB(HookedPage->EptPageTable, HookedPage->EntryAddress, ChangedEntry);
+    }
+
+    if (HookedPage->EptPageTable == g_EptState->EptPageTable)
+    {
+        EptUpdateSharedHookOnViews(HookedPage, ChangedEntry);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief The main function that performs EPT page hook
+ * @details This function returns false in VMX Non-Root Mode if the VM is already initialized
+ * This function have to be called through a VMCALL in VMX Root Mode while holding the lock of
+ * the hooked pages, the hooks of the shared table are also applied to the views that don't
+ * have their own hook on the page
+ * 
+ * @param EptPageTable The page table to apply the hook (the shared table or the table of a process view)
+ * @param TargetAddress The address of function or memory address to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @param UnsetRead Hook READ Access
+ * @param UnsetWrite Hook WRITE Access
+ * @param UnsetExecute Hook EXECUTE Access
+ * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ */
+BOOLEAN
+EptPerformPageHook(PVMM_EPT_PAGE_TABLE EptPageTable, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute)
+{
+    EPT_PML1_ENTRY          ChangedEntry;
+    INVEPT_DESCRIPTOR       Descriptor;
+    SIZE_T                  PhysicalAddress;
+    PVOID                   VirtualTarget;
+    PVOID                   TargetBuffer;
+    PEPT_PML1_ENTRY         TargetPage;
+    PEPT_PML2_ENTRY         TargetPml2;
+    PEPT_HOOKED_PAGE_DETAIL HookedPage;
+    PEPT_HOOKED_PAGE_DETAIL SharedHook;
+    ULONG                   LogicalCoreIndex;
+
+    //
+    // Check whether we are in VMX Root Mode or Not
+    //
+    LogicalCoreIndex = KeGetCurrentProcessorIndex();
+
+    if (g_GuestState[LogicalCoreIndex].IsOnVmxRootMode && !g_GuestState[LogicalCoreIndex].HasLaunched)
+    {
+        return FALSE;
+    }
+
+    if (EptPageTable == NULL)
+    {
+        LogError("Invalid EPT view for the hook");
+        return FALSE;
+    }
+
+    //
+    // Translate the page from a physical address to virtual so we can read its memory.
+    // This function will return NULL if the physical address was not already mapped in
+    // virtual memory.
+    //
+    VirtualTarget = PAGE_ALIGN(TargetAddress);
+
+    PhysicalAddress = (SIZE_T)VirtualAddressToPhysicalAddress(VirtualTarget);
+
+    if (!PhysicalAddress)
+    {
+        LogError("Target address could not be mapped to physical memory");
+        return FALSE;
+    }
+
+    //
+    // If the page is already hooked, the new hook shares the fake page of the previous hooks
+    //
+    HookedPage = EptFindHookedPage(EptPageTable, PhysicalAddress);
+
+    if (HookedPage != NULL)
+    {
+        return EptPerformPageHookOnHookedPage(HookedPage, TargetAddress, HookFunction, OrigFunction, UnsetRead, UnsetWrite, UnsetExecute);
+    }
+
+    //
+    // Set target buffer, request buffer from pool manager,
+    // we also need to allocate new page to replace the current page ASAP
+    // (the pool is only consumed if the page is not already split)
+    //
+    TargetPml2 = EptGetPml2Entry(EptPageTable, PhysicalAddress);
+
+    if (TargetPml2 == NULL || TargetPml2->LargePage)
+    {
+        TargetBuffer = PoolManagerRequestPool(SPLIT_2MB_PAGING_TO_4KB_PAGE, TRUE, sizeof(VMM_EPT_DYNAMIC_SPLIT));
+
+        if (!TargetBuffer)
+        {
+            LogError("There is no pre-allocated buffer available");
+            return FALSE;
+        }
+
+        if (!EptSplitLargePage(EptPageTable, TargetBuffer, PhysicalAddress, LogicalCoreIndex))
+        {
+            LogError("Could not split page for the address : 0x%llx", PhysicalAddress);
+            return FALSE;
+        }
+    }
+
+    //
+    // Pointer to the page entry in the page table
+    //
+    TargetPage = EptGetPml1Entry(EptPageTable, PhysicalAddress);
+
+    //
+    // Ensure the target is valid
+    //
+    if (!TargetPage)
+    {
+        LogError("Failed to get PML1 entry of the target address");
+        return FALSE;
+    }
+
+    //
+    // Save the original permissions of the page, the entry of a view might be the
+    // hooked entry of the shared table
+    //
+    SharedHook = EptPageTable != g_EptState->EptPageTable ? EptFindHookedPage(g_EptState->EptPageTable, PhysicalAddress) : NULL;
+
+    ChangedEntry = SharedHook != NULL ? SharedHook->OriginalEntry : *TargetPage;
+
+    //
+    // Execution is treated differently
+    //
+    if (UnsetRead)
+        ChangedEntry.ReadAccess = 0;
+    else
+        ChangedEntry.ReadAccess = 1;
+
+    if (UnsetWrite)
+        ChangedEntry.WriteAccess = 0;
+    else
+        ChangedEntry.WriteAccess = 1;
+
+    //
+    // Save the detail of hooked page to keep track of it
+    //
+    HookedPage = PoolManagerRequestPool(TRACKING_HOOKED_PAGES, TRUE, sizeof(EPT_HOOKED_PAGE_DETAIL));
+
+    if (!HookedPage)
+    {
+        LogError("There is no pre-allocated pool for saving hooked page details");
+        return FALSE;
+    }
+
+    //
+    // Save the virtual address
+    //
+    HookedPage->VirtualAddress = TargetAddress;
+
+    //
+    // Save the physical address
+    //
+    HookedPage->PhysicalBaseAddress = PhysicalAddress;
+
+    //
+    // Fake page content physical address
+    //
+    HookedPage->PhysicalBaseAddressOfFakePageContents = (SIZE_T)VirtualAddressToPhysicalAddress(&HookedPage->FakePageContents[0]) / PAGE_SIZE;
+
+    //
+    // Save the entry address
+    //
+    HookedPage->EntryAddress = TargetPage;
+
+    //
+    // Save the table that contains the entry
+    //
+    HookedPage->EptPageTable = EptPageTable;
+
+    //
+    // Save the orginal entry
+    //
+    HookedPage->OriginalEntry = SharedHook != NULL ? SharedHook->OriginalEntry : *TargetPage;
+
+    //
+    // There is no detour on this page yet
+    //
+    HookedPage->TrampolineBlock         = NULL;
+    HookedPage->TrampolineBlockUsedSize = 0;
+    HookedPage->NumberOfDetourSites     = 0;
+
+    //
+    // If it's Execution hook then we have to set extra fields
+    //
+    if (UnsetExecute)
+    {
+        //
+        // Show that entry has hidden hooks for execution
+        //
+        HookedPage->IsExecutionHook = TRUE;
+
+        //
+        // In execution hook, we have to make sure to unset read, write because
+        // an EPT violation should occur for these cases and we can swap the original page
+        //
+        ChangedEntry.ReadAccess    = 0;
+        ChangedEntry.WriteAccess   = 0;
+        ChangedEntry.ExecuteAccess = 1;
+
+        //
+        // Also set the current pfn to fake page
+        //
+        ChangedEntry.PageFrameNumber = HookedPage->PhysicalBaseAddressOfFakePageContents;
+
+        //
+        // Copy the content to the fake page
+        //
+        RtlCopyBytes(&HookedPage->FakePageContents, VirtualTarget, PAGE_SIZE);
+
+        //
+        // Create Hook (no hook function means that only the fake page is needed, e.g. for
+        // the tail of a detour jump that passes the end of the previous page)
+        //
+        if (HookFunction != NULL && !EptHookInstructionMemory(HookedPage, TargetAddress, HookFunction, OrigFunction))
+        {
+            LogError("Could not build the hook.");
+
+            //
+            // The page is not hooked yet, so only its details are returned (with
+            // its trampoline block that is not used by any detour)
+            //
+            if (HookedPage->TrampolineBlock != NULL)
+            {
+                PoolManagerFreePool((UINT64)HookedPage->TrampolineBlock);
+            }
+            PoolManagerFreePool((UINT64)HookedPage);
+
+            return FALSE;
+        }
+    }
+
+    //
+    // Save the modified entry
+    //
+    HookedPage->ChangedEntry = ChangedEntry;
+
+    //
+    // Add it to the list and to the bucket of its physical page
+    //
+    InsertHeadList(&g_EptState->HookedPagesList, &(HookedPage->PageHookList));
+    InsertHeadList(&g_EptState->HookedPagesBuckets[EPT_HOOKED_PAGES_BUCKET(PhysicalAddress)], &(HookedPage->PageHookBucketList));
+
+    //
+    // if not launched, there is no need to modify it on a safe environment
+    //
+    if (!g_GuestState[LogicalCoreIndex].HasLaunched)
+    {
+        //
+        // Apply the hook to EPT
+        //
+        TargetPage->Flags = ChangedEntry.Flags;
+    }
+    else
+    {
+        //
+        // Apply the hook to EPT, the tables of process views are not the current
+        // context so all the contexts should be invalidated
+        //
+        EptSetPML1AndInvalidateTLB(EptPageTable, TargetPage, ChangedEntry);
+    }
+
+    if (EptPageTable == g_EptState->EptPageTable)
+    {
+        EptUpdateSharedHookOnViews(HookedPage, ChangedEntry);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief This function allocates a buffer in VMX Non Root Mode and then invokes a VMCALL to set the hook
+ * on the table of a view
+ * 
+ * @param ViewIndex Zero for the shared table or the index of process view plus one
+ * @param TargetAddress The address of function or memory address to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @param SetHookForRead Hook READ Access
+ * @param SetHookForWrite Hook WRITE Access
+ * @param SetHookForExec Hook EXECUTE Access
+ * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ */
+BOOLEAN
+EptPageHookOnView(UINT32 ViewIndex, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec)
+{
+    ULONG                   LogicalProcCounts;
+    PVOID                   PreAllocBuff;
+    PVOID                   PagedAlignTarget;
+    PEPT_HOOKED_PAGE_DETAIL HookedPageDetail;
+    UINT32                  PageHookMask = 0;
+    ULONG                   LogicalCoreIndex;
+
+    //
+    // Check for the features to avoid EPT Violation problems
+    //
+    if (SetHookForExec && !g_ExecuteOnlySupport)
+    {
+        //
+        // In the current design of hyperdbg we use execute-only pages to implement hidden hooks for exec page,
+        // so your processor doesn't have this feature and you have to implment it in other ways :(
+        //
+        return FALSE;
+    }
+
+    if (SetHookForWrite && !SetHookForRead)
+    {
+        //
+        // The hidden hook with Write Enable and Read Disabled will cause EPT violation!
+        //
+        return FALSE;
+    }
+
+    //
+    // Check whether we are in VMX Root Mode or Not
+    //
+    LogicalCoreIndex = KeGetCurrentProcessorIndex();
+
+    if (SetHookForRead)
+    {
+        PageHookMask |= PAGE_ATTRIB_READ;
+    }
+    if (SetHookForWrite)
+    {
+        PageHookMask |= PAGE_ATTRIB_WRITE;
+    }
+    if (SetHookForExec)
+    {
+        PageHookMask |= PAGE_ATTRIB_EXEC;
+    }
+
+    if (PageHookMask == 0)
+    {
+        //
+        // nothing to hook
+        //
+        return FALSE;
+    }
+
+    if (g_GuestState[LogicalCoreIndex].HasLaunched)
+    {
+        //
+        // Move Attribute Mask to the bits 32 to 47 and the view to the bits 48 to 63 of the VMCALL Number
+        //
+        UINT64 VmcallNumber = ((UINT64)ViewIndex) << 48 | ((UINT64)PageHookMask) << 32 | VMCALL_CHANGE_PAGE_ATTRIB;
+
+        if (AsmVmxVmcall(VmcallNumber, TargetAddress, HookFunction, OrigFunction) == STATUS_SUCCESS)
+        {
+            LogInfo("Hook applied from VMX Root Mode");
+            if (!g_GuestState[LogicalCoreIndex].IsOnVmxRootMode)
+            {
+                //
+                // Now we have to notify all the core to invalidate their EPT, the tables
+                // of process views might be cached even if no core is using them now
+                //
+                HvNotifyAllToInvalidateEpt();
+            }
+            else
+            {
+                LogError("Unable to notify all cores to invalidate their TLB caches as you called hook on vmx-root mode.");
+            }
+
+            return TRUE;
+        }
+    }
+    else if (ViewIndex == 0)
+    {
+        //
+        // There is no vm-exit before the VM is launched, so the hooked pages are not locked
+        //
+        if (EptPerformPageHook(g_EptState->EptPageTable, TargetAddress, HookFunction, OrigFunction, SetHookForRead, SetHookForWrite, SetHookForExec) == TRUE)
+        {
+            LogInfo("[*] Hook applied (VM has not launched)");
+            return TRUE;
+        }
+    }
+    LogWarning("Hook not applied");
+
+    return FALSE;
+}
+
+/**
+ * @brief This function allocates a buffer in VMX Non Root Mode and then invokes a VMCALL to set the hook
+ * 
+ * @param TargetAddress The address of function or memory address to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @param SetHookForRead Hook READ Access
+ * @param SetHookForWrite Hook WRITE Access
+ * @param SetHookForExec Hook EXECUTE Access
+ * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ */
+BOOLEAN
+EptPageHook(PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec)
+{
+    return EptPageHookOnView(0, TargetAddress, HookFunction, OrigFunction, SetHookForRead, SetHookForWrite, SetHookForExec);
+}
+
+/**
+ * @brief Apply a hidden hook that is only visible to a single core
+ * @details The hook is applied to the private view of the core, each hook holds a
+ * reference to the view so the core keeps the private table until it's unhooked
+ * 
+ * @param CoreIndex The target core
+ * @param TargetAddress The address of function or memory address to be hooked
+ * @param HookFunction The function that will be called when hook triggered
+ * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
+ * @param SetHookForRead Hook READ Access
+ * @param SetHookForWrite Hook WRITE Access
+ * @param SetHookForExec Hook EXECUTE Access
+ * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ */
+BOOLEAN
+EptPageHookForCore(ULONG CoreIndex, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec)
+{
+    if (!g_GuestState[KeGetCurrentProcessorNumber()].HasLaunched)
+    {
+        LogError("The private EPT views of cores are available after launching the VM");
+        return FALSE;
+    }
+
+    if (!EptAcquireCorePrivateView(CoreIndex))
+    {
+        return FALSE;
+    }
+
+    if (!EptPageHookOnView(EPT_VIEW_INDEX_CORE_FLAG | CoreIndex, TargetAddress, HookFunction, OrigFunction, SetHookForRead, SetHookForWrite, SetHookForExec))
+    {
+        EptReleaseCorePrivateView(CoreIndex);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Remove all the hooks of a core
+ * @details All the references of the hooks are released at once, so the core
+ * switches back to the shared table and the private table is freed with its hooks,
+ * should be called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param CoreIndex The target core
+ * @return BOOLEAN Returns false if the core doesn't have a private view
+ */
+BOOLEAN
+EptPageUnHookForCore(ULONG CoreIndex)
+{
+    PEPT_CORE_VIEW View;
+
+    if (CoreIndex >= KeQueryActiveProcessorCount(0))
+    {
+        return FALSE;
+    }
+
+    View = &g_GuestState[CoreIndex].EptView;
+
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
+
+    if (View->ReferenceCount == 0)
+    {
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return FALSE;
+    }
+
+    InterlockedExchange(&View->ReferenceCount, 1);
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+    EptReleaseCorePrivateView(CoreIndex);
+
+    return TRUE;
+}
+
+/**
+ * @brief Create the EPT view of a process or find the previously created view
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param ProcessId The target process
+ * @param ViewIndex The index of the view plus one (zero is reserved for the shared table)
+ * @return BOOLEAN Returns true if the view is ready to use
+ */
+BOOLEAN
+EptCreateProcessView(UINT32 ProcessId, UINT32 * ViewIndex)
+{
+    PEPROCESS           Process;
+    UINT64              DirectoryTableBase;
+    UINT64              UserDirectoryTableBase;
+    UINT32              Index;
+    UINT32              FreeIndex = EPT_MAX_PROCESS_VIEWS;
+    PVMM_EPT_PAGE_TABLE PageTable;
+    PEPT_PROCESS_VIEW   View;
+    KIRQL               OldIrql;
+
+    if (!NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)ProcessId, &Process)))
+    {
+        LogError("Invalid process id : 0x%x", ProcessId);
+        return FALSE;
+    }
+
+    DirectoryTableBase     = ((NT_KPROCESS *)Process)->DirectoryTableBase & CR3_PAGE_FRAME_MASK;
+    UserDirectoryTableBase = EptGetUserDirectoryTableBase(Process, DirectoryTableBase);
+
+    ObDereferenceObject(Process);
+
+    //
+    // The mutex serializes the allocation and the broadcast, the spinlock is
+    // only held while the fields of the view change
+    //
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
+
+    for (Index = 0; Index < EPT_MAX_PROCESS_VIEWS; Index++)
+    {
+        if (g_EptState->ProcessViews[Index].PageTable == NULL)
+        {
+            if (FreeIndex == EPT_MAX_PROCESS_VIEWS)
+            {
+                FreeIndex = Index;
+            }
+            continue;
+        }
+
+        if (g_EptState->ProcessViews[Index].Cr3 == DirectoryTableBase)
+        {
+            //
+            // The view is already created
+            //
+            *ViewIndex = Index + 1;
+            ExReleaseFastMutex(&g_EptState->ViewsMutex);
+            return TRUE;
+        }
+    }
+
+    if (FreeIndex == EPT_MAX_PROCESS_VIEWS)
+    {
+        LogError("There is no free slot for a new EPT view");
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return FALSE;
+    }
+
+    PageTable = EptCreatePrivatePageTable();
 
-/**
- * @brief Write an absolute x64 jump to an arbitrary address to a buffer
- * 
- * @param TargetBuffer 
- * @param TargetAddress 
- * @return VOID 
- */
-VOID
-EptHookWriteAbsoluteJump(PCHAR TargetBuffer, SIZE_T TargetAddress)
-{
-    //
-    // call $ + 5 ; A 64-bit call instruction is still 5 bytes wide!
-    //
-    TargetBuffer[0] = 0xe8;
-    TargetBuffer[1] = 0x00;
-    TargetBuffer[2] = 0x00;
-    TargetBuffer[3] = 0x00;
-    TargetBuffer[4] = 0x00;
+    if (PageTable == NULL)
+    {
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return FALSE;
+    }
 
-    //
-    // mov r15, Target
-    //
-    TargetBuffer[5] = 0x49;
-    TargetBuffer[6] = 0xBB;
+    SpinlockLockExclusive(&EptCoreViewLock);
+    OldIrql = EptLockHookedPages();
 
-    //
-    // Target
-    //
-    *((PSIZE_T)&TargetBuffer[7]) = TargetAddress;
+    EptRefreshPrivatePageTable(PageTable);
 
-    //
-    // push r15
-    //
-    TargetBuffer[15] = 0x41;
-    TargetBuffer[16] = 0x53;
+    View             = &g_EptState->ProcessViews[FreeIndex];
+    View->ProcessId  = ProcessId;
+    View->PageTable  = PageTable;
+    View->EptPointer = EptCreateEptPointer(PageTable);
 
-    //
-    // ret
-    //
-    TargetBuffer[17] = 0xC3;
-}
+    if (g_EptState->EptpList)
+    {
+        g_EptState->EptpList[FreeIndex + 1] = View->EptPointer.Flags;
+    }
 
-/**
- * @brief Write an absolute x64 jump to an arbitrary address to a buffer
- * 
- * @param TargetBuffer 
- * @param TargetAddress 
- * @return VOID 
- */
-VOID
-EptHookWriteAbsoluteJump2(PCHAR TargetBuffer, SIZE_T TargetAddress)
-{
     //
-    // mov r15, Target
+    // Publish the view, the cr3 vm-exit handler only checks the cr3 fields
     //
-    TargetBuffer[0] = 0x49;
-    TargetBuffer[1] = 0xBB;
+    KeMemoryBarrier();
+    View->UserCr3 = UserDirectoryTableBase;
+    View->Cr3     = DirectoryTableBase;
 
-    //
-    // Target
-    //
-    *((PSIZE_T)&TargetBuffer[2]) = TargetAddress;
+    EptUnlockHookedPages(OldIrql);
+    SpinlockUnlockExclusive(&EptCoreViewLock);
 
-    //
-    // push r15
-    //
-    TargetBuffer[10] = 0x41;
-    TargetBuffer[11] = 0x53;
+    if (InterlockedIncrement(&g_EptState->NumberOfProcessViews) == 1)
+    {
+        //
+        // This is the first view, enable cr3 vm-exits on all the cores
+        //
+        KeGenericCallDpc(BroadcastDpcUpdateEptProcessViews, NULL);
+    }
 
-    //
-    // ret
-    //
-    TargetBuffer[12] = 0xC3;
+    *ViewIndex = FreeIndex + 1;
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+    return TRUE;
 }
 
 /**
- * @brief Hook ins
+ * @brief Remove the EPT view of a process and the hooks that are applied to the view
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL), the views
+ * are keyed by cr3 so the view is removed by EptProcessNotifyRoutine before the
+ * process terminates and its cr3 is reused
  * 
- * @param Hook The details of hooked pages
- * @param TargetFunction Target function that needs to be hooked
- * @param HookFunction The function that will be called when hook triggered
- * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
- * @return BOOLEAN Returns true if the hook was successfull or returns false if it was not successfull
+ * @param ProcessId The target process
+ * @return BOOLEAN Returns true if the view was found and removed
  */
 BOOLEAN
-EptHookInstructionMemory(PEPT_HOOKED_PAGE_DETAIL Hook, PVOID TargetFunction, PVOID HookFunction, PVOID * OrigFunction)
+EptRemoveProcessView(UINT32 ProcessId)
 {
-    PHIDDEN_HOOKS_DETOUR_DETAILS DetourHookDetails;
-    SIZE_T                       SizeOfHookedInstructions;
-    SIZE_T                       OffsetIntoPage;
+    UINT32              Index;
+    PEPT_PROCESS_VIEW   View = NULL;
+    PVMM_EPT_PAGE_TABLE PageTable;
+    KIRQL               OldIrql;
 
-    OffsetIntoPage = ADDRMASK_EPT_PML1_OFFSET((SIZE_T)TargetFunction);
-    LogInfo("OffsetIntoPage: 0x%llx", OffsetIntoPage);
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
 
-    if ((OffsetIntoPage + 18) > PAGE_SIZE - 1)
+    for (Index = 0; Index < EPT_MAX_PROCESS_VIEWS; Index++)
     {
-        LogError("Function extends past a page boundary. We just don't have the technology to solve this.....");
-        return FALSE;
+        if (g_EptState->ProcessViews[Index].PageTable != NULL && g_EptState->ProcessViews[Index].ProcessId == ProcessId)
+        {
+            View = &g_EptState->ProcessViews[Index];
+            break;
+        }
     }
 
-    //
-    // Determine the number of instructions necessary to overwrite using Length Disassembler Engine
-    //
-    for (SizeOfHookedInstructions = 0;
-         SizeOfHookedInstructions < 18;
-         SizeOfHookedInstructions += ldisasm(((UINT64)TargetFunction + SizeOfHookedInstructions) , 64))
+    if (View == NULL)
     {
-        //
-        // Get the full size of instructions necessary to copy
-        //
+        ExReleaseFastMutex(&g_EptState->ViewsMutex);
+        return FALSE;
     }
-    LogInfo("Number of bytes of instruction mem: %d", SizeOfHookedInstructions);
 
     //
-    // Build a trampoline
+    // Unpublish the view and make sure that no core uses it anymore
     //
+    SpinlockLockExclusive(&EptCoreViewLock);
 
-    //
-    // Allocate some executable memory for the trampoline
-    //
-    Hook->Trampoline = PoolManagerRequestPool(EXEC_TRAMPOLINE, TRUE, MAX_EXEC_TRAMPOLINE_SIZE);
+    View->Cr3     = 0;
+    View->UserCr3 = 0;
 
-    if (!Hook->Trampoline)
+    if (g_EptState->EptpList)
     {
-        LogError("Could not allocate trampoline function buffer.");
-        return FALSE;
+        g_EptState->EptpList[Index + 1] = 0;
     }
 
-    //
-    // Copy the trampoline instructions in
-    //
-    RtlCopyMemory(Hook->Trampoline, TargetFunction, SizeOfHookedInstructions);
+    SpinlockUnlockExclusive(&EptCoreViewLock);
 
-    //
-    // Add the absolute jump back to the original function
-    //
-    EptHookWriteAbsoluteJump2(&Hook->Trampoline[SizeOfHookedInstructions], (SIZE_T)TargetFunction + SizeOfHookedInstructions);
+    InterlockedDecrement(&g_EptState->NumberOfProcessViews);
 
-    LogInfo("Trampoline: 0x%llx", Hook->Trampoline);
-    LogInfo("HookFunction: 0x%llx", HookFunction);
+    KeGenericCallDpc(BroadcastDpcUpdateEptProcessViews, NULL);
 
     //
-    // Let the hook function call the original function
+    // The hooks of this view are removed with its table
     //
-    *OrigFunction = Hook->Trampoline;
+    PageTable = View->PageTable;
 
-    //
-    // Create the structure to return for the debugger, we do it here because it's the first
-    // function that changes the original function and if our structure is no ready after this
-    // fucntion then we probably see BSOD on other cores
-    //
-    DetourHookDetails                        = PoolManagerRequestPool(DETOUR_HOOK_DETAILS, TRUE, sizeof(HIDDEN_HOOKS_DETOUR_DETAILS));
-    DetourHookDetails->HookedFunctionAddress = TargetFunction;
-    DetourHookDetails->ReturnAddress         = Hook->Trampoline;
+    EptRemoveHooksOfPageTable(PageTable);
 
-    //
-    // Insert it to the list of hooked pages
-    //
-    InsertHeadList(&g_HiddenHooksDetourListHead, &(DetourHookDetails->OtherHooksList));
+    SpinlockLockExclusive(&EptCoreViewLock);
+    OldIrql = EptLockHookedPages();
+
+    RtlZeroMemory(View, sizeof(EPT_PROCESS_VIEW));
+
+    EptUnlockHookedPages(OldIrql);
+    SpinlockUnlockExclusive(&EptCoreViewLock);
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
 
     //
-    // Write the absolute jump to our shadow page memory to jump to our hook
+    // Invalidate the cached translations of the view before its memory is reused
     //
-    EptHookWriteAbsoluteJump(&Hook->FakePageContents[OffsetIntoPage], (SIZE_T)HookFunction);
+    HvNotifyAllToInvalidateEpt();
+
+    EptFreePageTable(PageTable);
 
     return TRUE;
 }
 
 /**
- * @brief Handles page hooks
+ * @brief Remove the EPT view of a process when the process exits
+ * @details This routine is registered by PsSetCreateProcessNotifyRoutine and it's called
+ * at PASSIVE_LEVEL before the address space of the exiting process is deleted, so a view
+ * is never matched with a cr3 that is reused by another process
  * 
- * @param HookedEntryDetails The entry that describes the hooked page
- * @param ViolationQualification The exit qualification of vm-exit
- * @param PhysicalAddress The physical address that cause this vm-exit
- * @return BOOLEAN Returns TRUE if the function was hook was handled or returns false 
- * if there was an unexpected ept violation
+ * @param ParentId The parent process
+ * @param ProcessId The process that is created or exits
+ * @param Create Whether the process is created or exits
+ * @return VOID 
  */
-BOOLEAN
-EptHandleHookedPage(EPT_HOOKED_PAGE_DETAIL * HookedEntryDetails, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, SIZE_T PhysicalAddress)
+VOID
+EptProcessNotifyRoutine(HANDLE ParentId, HANDLE ProcessId, BOOLEAN Create)
 {
-    ULONG64 GuestRip;
-    ULONG64 ExactAccessedAddress;
-    ULONG64 AlignedVirtualAddress;
-    ULONG64 AlignedPhysicalAddress;
-
-    //
-    // Get alignment
-    //
-    AlignedVirtualAddress  = PAGE_ALIGN(HookedEntryDetails->VirtualAddress);
-    AlignedPhysicalAddress = PAGE_ALIGN(PhysicalAddress);
-
-    //
-    // Let's read the exact address that was accesses
-    //
-    ExactAccessedAddress = AlignedVirtualAddress + PhysicalAddress - AlignedPhysicalAddress;
+    UNREFERENCED_PARAMETER(ParentId);
 
-    //
-    // Reading guest's RIP
-    //
-    __vmx_vmread(GUEST_RIP, &GuestRip);
-
-    if (!ViolationQualification.EptExecutable && ViolationQualification.ExecuteAccess)
-    {
-        LogInfo("Guest RIP : 0x%llx tries to execute the page at : 0x%llx", GuestRip, ExactAccessedAddress);
-    }
-    else if (!ViolationQualification.EptWriteable && ViolationQualification.WriteAccess)
+    if (Create || g_EptState->NumberOfProcessViews == 0)
     {
-        LogInfo("Guest RIP : 0x%llx tries to write on the page at :0x%llx", GuestRip, ExactAccessedAddress);
+        return;
     }
-    else if (!ViolationQualification.EptReadable && ViolationQualification.ReadAccess)
+
+    if (EptRemoveProcessView((UINT32)ProcessId))
     {
-        LogInfo("Guest RIP : 0x%llx tries to read the page at :0x%llx", GuestRip, ExactAccessedAddress);
+        LogInfo("The EPT view of process 0x%x is removed as the process exits", (UINT32)ProcessId);
     }
-    else
+}
+
+/**
+ * @brief Read the user-mode directory table base of a process
+ * @details When KVA shadowing is enabled, user-mode runs on a separate cr3 so a
+ * view that only matches the kernel cr3 is not used while the process is in user-mode
+ * 
+ * @param Process The target process
+ * @param DirectoryTableBase The page-aligned (kernel) directory table base of the process
+ * @return UINT64 The page-aligned user-mode directory table base or zero if the process
+ * doesn't have a separate one
+ */
+UINT64
+EptGetUserDirectoryTableBase(PEPROCESS Process, UINT64 DirectoryTableBase)
+{
+    RTL_OSVERSIONINFOW VersionInfo = {0};
+    UINT64             UserDirectoryTableBase;
+
+    VersionInfo.dwOSVersionInfoSize = sizeof(RTL_OSVERSIONINFOW);
+
+    if (!NT_SUCCESS(RtlGetVersion(&VersionInfo)) || VersionInfo.dwBuildNumber < NT_KPROCESS_USER_DIRECTORY_TABLE_BASE_MIN_BUILD)
     {
-        //
-        // there was an unexpected ept violation
-        //
-        return FALSE;
+        return 0;
     }
 
-    EptSetPML1AndInvalidateTLB(HookedEntryDetails->EntryAddress, HookedEntryDetails->OriginalEntry, INVEPT_SINGLE_CONTEXT);
+    UserDirectoryTableBase = *(UINT64 *)((PUCHAR)Process + NT_KPROCESS_USER_DIRECTORY_TABLE_BASE_OFFSET) & CR3_PAGE_FRAME_MASK;
 
     //
-    // Means that restore the Entry to the previous state after current instruction executed in the guest
+    // The field is zero (or only contains flags) when KVA shadowing is disabled
     //
-    return TRUE;
+    if (UserDirectoryTableBase == 0 || UserDirectoryTableBase == DirectoryTableBase ||
+        !MmIsAddressValid((PVOID)PhysicalAddressToVirtualAddress(UserDirectoryTableBase)))
+    {
+        return 0;
+    }
+
+    return UserDirectoryTableBase;
 }
 
 /**
- * @brief The main function that performs EPT page hook
- * @details This function returns false in VMX Non-Root Mode if the VM is already initialized
- * This function have to be called through a VMCALL in VMX Root Mode
+ * @brief Apply a hidden hook that is only visible to a single process
+ * @details The hook is applied to the EPT view of the process, the other
+ * processes use their own view or the shared table so they won't cause
+ * EPT violations when they access the same physical page (e.g. shared DLLs)
  * 
- * @param TargetAddress The address of function or memory address to be hooked
+ * @param ProcessId The target process
+ * @param TargetAddress The address of function or memory address to be hooked (in the address space of the process)
  * @param HookFunction The function that will be called when hook triggered
  * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
- * @param UnsetRead Hook READ Access
- * @param UnsetWrite Hook WRITE Access
- * @param UnsetExecute Hook EXECUTE Access
+ * @param SetHookForRead Hook READ Access
+ * @param SetHookForWrite Hook WRITE Access
+ * @param SetHookForExec Hook EXECUTE Access
  * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
  */
 BOOLEAN
-EptPerformPageHook(PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute)
+EptPageHookForProcess(UINT32 ProcessId, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec)
 {
-    EPT_PML1_ENTRY          ChangedEntry;
-    INVEPT_DESCRIPTOR       Descriptor;
-    SIZE_T                  PhysicalAddress;
-    PVOID                   VirtualTarget;
-    PVOID                   TargetBuffer;
-    PEPT_PML1_ENTRY         TargetPage;
-    PEPT_HOOKED_PAGE_DETAIL HookedPage;
-    ULONG                   LogicalCoreIndex;
-
-    //
-    // Check whether we are in VMX Root Mode or Not
-    //
-    LogicalCoreIndex = KeGetCurrentProcessorIndex();
+    PEPROCESS  Process;
+    KAPC_STATE State;
+    UINT32     ViewIndex;
+    BOOLEAN    Result;
 
-    if (g_GuestState[LogicalCoreIndex].IsOnVmxRootMode && !g_GuestState[LogicalCoreIndex].HasLaunched)
+    if (!g_GuestState[KeGetCurrentProcessorNumber()].HasLaunched)
     {
+        LogError("The EPT views of processes are available after launching the VM");
         return FALSE;
     }
 
-    //
-    // Translate the page from a physical address to virtual so we can read its memory.
-    // This function will return NULL if the physical address was not already mapped in
-    // virtual memory.
-    //
-    VirtualTarget = PAGE_ALIGN(TargetAddress);
-
-    PhysicalAddress = (SIZE_T)VirtualAddressToPhysicalAddress(VirtualTarget);
+    if (!EptCreateProcessView(ProcessId, &ViewIndex))
+    {
+        return FALSE;
+    }
 
-    if (!PhysicalAddress)
+    if (!NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)ProcessId, &Process)))
     {
-        LogError("Target address could not be mapped to physical memory");
         return FALSE;
     }
 
     //
-    // Set target buffer, request buffer from pool manager,
-    // we also need to allocate new page to replace the current page ASAP
+    // Attach to the process, so the target address is translated based on its address space
     //
-    TargetBuffer = PoolManagerRequestPool(SPLIT_2MB_PAGING_TO_4KB_PAGE, TRUE, sizeof(VMM_EPT_DYNAMIC_SPLIT));
+    KeStackAttachProcess(Process, &State);
+
+    Result = EptPageHookOnView(ViewIndex, TargetAddress, HookFunction, OrigFunction, SetHookForRead, SetHookForWrite, SetHookForExec);
+
+    KeUnstackDetachProcess(&State);
+
+    ObDereferenceObject(Process);
+
+    return Result;
+}
+
+/**
+ * @brief Find the page table of a view
+ * 
+ * @param ViewIndex Zero for the shared table, the index of process view plus one or
+ * EPT_VIEW_INDEX_CORE_FLAG with the index of a core that has a private view
+ * @return PVMM_EPT_PAGE_TABLE The page table or NULL if the view is not valid
+ */
+PVMM_EPT_PAGE_TABLE
+EptGetViewPageTable(UINT32 ViewIndex)
+{
+    ULONG CoreIndex;
 
-    if (!TargetBuffer)
+    if (ViewIndex == 0)
     {
-        LogError("There is no pre-allocated buffer available");
-        return FALSE;
+        return g_EptState->EptPageTable;
     }
 
-    if (!EptSplitLargePage(g_EptState->EptPageTable, TargetBuffer, PhysicalAddress, LogicalCoreIndex))
+    if (ViewIndex & EPT_VIEW_INDEX_CORE_FLAG)
     {
-        LogError("Could not split page for the address : 0x%llx", PhysicalAddress);
-        return FALSE;
+        CoreIndex = ViewIndex & ~EPT_VIEW_INDEX_CORE_FLAG;
+
+        if (CoreIndex >= KeQueryActiveProcessorCount(0) || g_GuestState[CoreIndex].EptView.ReferenceCount == 0)
+        {
+            return NULL;
+        }
+
+        return g_GuestState[CoreIndex].EptView.PageTable;
     }
 
-    //
-    // Pointer to the page entry in the page table
-    //
-    TargetPage = EptGetPml1Entry(g_EptState->EptPageTable, PhysicalAddress);
+    if (ViewIndex > EPT_MAX_PROCESS_VIEWS)
+    {
+        return NULL;
+    }
+
+    return g_EptState->ProcessViews[ViewIndex - 1].PageTable;
+}
+
+/**
+ * @brief Switch the EPTP of the current core based on the new cr3
+ * @details This function should be called from vmx root-mode, there is no need to
+ * invalidate EPT as the cached translations are tagged by the EPTP
+ * 
+ * @param GuestCr3 The new cr3 of the guest
+ * @return VOID 
+ */
+VOID
+EptSwitchProcessView(UINT64 GuestCr3)
+{
+    UINT64 DirectoryTableBase;
+    UINT64 EptPointer;
+    UINT32 Index;
 
     //
-    // Ensure the target is valid
+    // If the process doesn't have a view, the view of the core is used
     //
-    if (!TargetPage)
+    EptPointer = g_GuestState[KeGetCurrentProcessorNumber()].EptView.EptPointer.Flags;
+
+    if (g_EptState->NumberOfProcessViews != 0)
     {
-        LogError("Failed to get PML1 entry of the target address");
-        return FALSE;
+        DirectoryTableBase = GuestCr3 & CR3_PAGE_FRAME_MASK;
+
+        for (Index = 0; Index < EPT_MAX_PROCESS_VIEWS; Index++)
+        {
+            if (g_EptState->ProcessViews[Index].Cr3 == DirectoryTableBase ||
+                (g_EptState->ProcessViews[Index].UserCr3 == DirectoryTableBase && DirectoryTableBase != 0))
+            {
+                EptPointer = g_EptState->ProcessViews[Index].EptPointer.Flags;
+                break;
+            }
+        }
     }
 
-    //
-    // Save the original permissions of the page
-    //
-    ChangedEntry = *TargetPage;
+    __vmx_vmwrite(EPT_POINTER, EptPointer);
+}
 
-    //
-    // Execution is treated differently
-    //
-    if (UnsetRead)
-        ChangedEntry.ReadAccess = 0;
-    else
-        ChangedEntry.ReadAccess = 1;
+/**
+ * @brief Find the page table that is referenced by the current EPTP
+ * @details This function should be called from vmx root-mode
+ * 
+ * @return PVMM_EPT_PAGE_TABLE The table of the current process view or the view of the core
+ */
+PVMM_EPT_PAGE_TABLE
+EptGetCurrentPageTable()
+{
+    UINT64 EptPointer;
+    UINT32 Index;
 
-    if (UnsetWrite)
-        ChangedEntry.WriteAccess = 0;
-    else
-        ChangedEntry.WriteAccess = 1;
+    __vmx_vmread(EPT_POINTER, &EptPointer);
 
-    //
-    // Save the detail of hooked page to keep track of it
-    //
-    HookedPage = PoolManagerRequestPool(TRACKING_HOOKED_PAGES, TRUE, sizeof(EPT_HOOKED_PAGE_DETAIL));
+    if (g_EptState->NumberOfProcessViews != 0)
+    {
+        for (Index = 0; Index < EPT_MAX_PROCESS_VIEWS; Index++)
+        {
+            if (g_EptState->ProcessViews[Index].Cr3 != 0 && g_EptState->ProcessViews[Index].EptPointer.Flags == EptPointer)
+            {
+                return g_EptState->ProcessViews[Index].PageTable;
+            }
+        }
+    }
+
+    return g_GuestState[KeGetCurrentProcessorNumber()].EptView.PageTable;
+}
 
-    if (!HookedPage)
+/**
+ * @brief Enable or disable accessed and dirty flags for all the EPT tables
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param Enable Enable or disable the flags
+ * @return BOOLEAN Returns false if the processor doesn't support the flags
+ */
+BOOLEAN
+EptSetAccessDirtyFlags(BOOLEAN Enable)
+{
+    ULONG ProcessorsCount;
+    ULONG CoreIndex;
+    ULONG ViewIndex;
+
+    if (!g_EptState->IsAccessDirtyFlagsSupported)
     {
-        LogError("There is no pre-allocated pool for saving hooked page details");
+        LogError("The processor doesn't support accessed and dirty flags for EPT");
         return FALSE;
     }
 
-    //
-    // Save the virtual address
-    //
-    HookedPage->VirtualAddress = TargetAddress;
-
-    //
-    // Save the physical address
-    //
-    HookedPage->PhysicalBaseAddress = PhysicalAddress;
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
 
-    //
-    // Fake page content physical address
-    //
-    HookedPage->PhysicalBaseAddressOfFakePageContents = (SIZE_T)VirtualAddressToPhysicalAddress(&HookedPage->FakePageContents[0]) / PAGE_SIZE;
+    SpinlockLockExclusive(&EptCoreViewLock);
 
-    //
-    // Save the entry address
-    //
-    HookedPage->EntryAddress = TargetPage;
+    g_EptState->IsAccessDirtyFlagsEnabled            = Enable;
+    g_EptState->EptPointer.EnableAccessAndDirtyFlags = Enable;
 
     //
-    // Save the orginal entry
+    // Update the EPTP of all the views
     //
-    HookedPage->OriginalEntry = *TargetPage;
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
 
-    //
-    // If it's Execution hook then we have to set extra fields
-    //
-    if (UnsetExecute)
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
     {
-        //
-        // Show that entry has hidden hooks for execution
-        //
-        HookedPage->IsExecutionHook = TRUE;
-
-        //
-        // In execution hook, we have to make sure to unset read, write because
-        // an EPT violation should occur for these cases and we can swap the original page
-        //
-        ChangedEntry.ReadAccess    = 0;
-        ChangedEntry.WriteAccess   = 0;
-        ChangedEntry.ExecuteAccess = 1;
-
-        //
-        // Also set the current pfn to fake page
-        //
-        ChangedEntry.PageFrameNumber = HookedPage->PhysicalBaseAddressOfFakePageContents;
+        g_GuestState[CoreIndex].EptView.EptPointer.EnableAccessAndDirtyFlags = Enable;
+    }
 
-        //
-        // Copy the content to the fake page
-        //
-        RtlCopyBytes(&HookedPage->FakePageContents, VirtualTarget, PAGE_SIZE);
+    for (ViewIndex = 0; ViewIndex < EPT_MAX_PROCESS_VIEWS; ViewIndex++)
+    {
+        g_EptState->ProcessViews[ViewIndex].EptPointer.EnableAccessAndDirtyFlags = Enable;
 
-        //
-        // Create Hook
-        //
-        if (!EptHookInstructionMemory(HookedPage, TargetAddress, HookFunction, OrigFunction))
+        if (g_EptState->EptpList && g_EptState->ProcessViews[ViewIndex].Cr3 != 0)
         {
-            LogError("Could not build the hook.");
-            return FALSE;
+            g_EptState->EptpList[ViewIndex + 1] = g_EptState->ProcessViews[ViewIndex].EptPointer.Flags;
         }
     }
 
-    //
-    // Save the modified entry
-    //
-    HookedPage->ChangedEntry = ChangedEntry;
+    if (g_EptState->EptpList)
+    {
+        g_EptState->EptpList[0] = g_EptState->EptPointer.Flags;
+    }
+
+    SpinlockUnlockExclusive(&EptCoreViewLock);
 
     //
-    // Add it to the list
+    // Write the new EPTPs to the VMCS of all the cores
     //
-    InsertHeadList(&g_EptState->HookedPagesList, &(HookedPage->PageHookList));
+    KeGenericCallDpc(BroadcastDpcUpdateEptProcessViews, NULL);
+
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
 
     //
-    // if not launched, there is no need to modify it on a safe environment
+    // The cached translations don't set the flags, so they should be invalidated
     //
-    if (!g_GuestState[LogicalCoreIndex].HasLaunched)
-    {
-        //
-        // Apply the hook to EPT
-        //
-        TargetPage->Flags = ChangedEntry.Flags;
-    }
-    else
-    {
-        //
-        // Apply the hook to EPT
-        //
-        EptSetPML1AndInvalidateTLB(TargetPage, ChangedEntry, INVEPT_SINGLE_CONTEXT);
-    }
+    HvNotifyAllToInvalidateEpt();
 
     return TRUE;
 }
 
 /**
- * @brief This function allocates a buffer in VMX Non Root Mode and then invokes a VMCALL to set the hook
+ * @brief Append pages to the run-length encoded bitmap
  * 
- * @param TargetAddress The address of function or memory address to be hooked
- * @param HookFunction The function that will be called when hook triggered
- * @param OrigFunction A pointer to write the restore point on it (HookFunction should finally jump to this address)
- * @param SetHookForRead Hook READ Access
- * @param SetHookForWrite Hook WRITE Access
- * @param SetHookForExec Hook EXECUTE Access
- * @return BOOLEAN Returns true if the hook was successfull or false if there was an error
+ * @param Runs The runs buffer
+ * @param MaxRuns Maximum number of runs in the buffer
+ * @param NumberOfRuns Number of used runs (the last one is the current run)
+ * @param IsSet Whether the pages are set or clear
+ * @param Count Number of pages
+ * @return BOOLEAN Returns false if there is no room for a new run
  */
 BOOLEAN
-EptPageHook(PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec)
+EptAccessDirtyAppendRun(UINT32 * Runs, UINT32 MaxRuns, UINT32 * NumberOfRuns, BOOLEAN IsSet, UINT32 Count)
 {
-    ULONG                   LogicalProcCounts;
-    PVOID                   PreAllocBuff;
-    PVOID                   PagedAlignTarget;
-    PEPT_HOOKED_PAGE_DETAIL HookedPageDetail;
-    UINT32                  PageHookMask = 0;
-    ULONG                   LogicalCoreIndex;
-
     //
-    // Check for the features to avoid EPT Violation problems
+    // Even runs are clear and odd runs are set
     //
-    if (SetHookForExec && !g_ExecuteOnlySupport)
+    BOOLEAN IsCurrentRunSet = ((*NumberOfRuns - 1) % 2) == 1;
+
+    if (IsCurrentRunSet != IsSet)
     {
-        //
-        // In the current design of hyperdbg we use execute-only pages to implement hidden hooks for exec page,
-        // so your processor doesn't have this feature and you have to implment it in other ways :(
-        //
-        return FALSE;
+        if (*NumberOfRuns == MaxRuns)
+        {
+            return FALSE;
+        }
+
+        Runs[*NumberOfRuns] = 0;
+        (*NumberOfRuns)++;
     }
 
-    if (SetHookForWrite && !SetHookForRead)
+    Runs[*NumberOfRuns - 1] += Count;
+
+    return TRUE;
+}
+
+/**
+ * @brief Find the page table of the nth live view for the harvest of the flags
+ * @details ViewsMutex should be held
+ * 
+ * @param TableIndex Zero for the shared table, then the process views and the cores
+ * @return PVMM_EPT_PAGE_TABLE The page table or NULL if the view is not live
+ */
+PVMM_EPT_PAGE_TABLE
+EptAccessDirtyGetTable(ULONG TableIndex)
+{
+    PVMM_EPT_PAGE_TABLE PageTable;
+
+    if (TableIndex <= EPT_MAX_PROCESS_VIEWS)
     {
-        //
-        // The hidden hook with Write Enable and Read Disabled will cause EPT violation!
-        //
-        return FALSE;
+        return EptGetViewPageTable(TableIndex);
     }
 
+    PageTable = EptGetViewPageTable(EPT_VIEW_INDEX_CORE_FLAG | (TableIndex - EPT_MAX_PROCESS_VIEWS - 1));
+
     //
-    // Check whether we are in VMX Root Mode or Not
+    // The cores without a private view use the shared table
     //
-    LogicalCoreIndex = KeGetCurrentProcessorIndex();
+    return PageTable != g_EptState->EptPageTable ? PageTable : NULL;
+}
 
-    if (SetHookForRead)
+/**
+ * @brief Read the flags of the pages of a 2MB region of a table into a bitmap
+ * 
+ * @param PageTable The table
+ * @param Page The first page (all the pages are in the same 2MB region)
+ * @param NumberOfPages Number of the pages
+ * @param Flag The accessed or the dirty flag
+ * @param Bitmap The bitmap of the region, the flags are ORed into it
+ * @return VOID
+ */
+VOID
+EptAccessDirtyReadRegion(PVMM_EPT_PAGE_TABLE PageTable, UINT64 Page, UINT64 NumberOfPages, UINT64 Flag, UINT64 * Bitmap)
+{
+    EPT_PML2_ENTRY  Pml2;
+    PEPT_PML1_ENTRY Pml1;
+    UINT64          Index;
+
+    Pml2.Flags = (&PageTable->PML2[0][0] + (Page / VMM_EPT_PML1E_COUNT))->Flags;
+
+    for (Index = Page % VMM_EPT_PML1E_COUNT; Index < (Page % VMM_EPT_PML1E_COUNT) + NumberOfPages; Index++)
     {
-        PageHookMask |= PAGE_ATTRIB_READ;
+        if (Pml2.LargePage)
+        {
+            if (Pml2.Flags & Flag)
+            {
+                Bitmap[Index / 64] |= 1ULL << (Index % 64);
+            }
+            continue;
+        }
+
+        Pml1 = (PEPT_PML1_ENTRY)PhysicalAddressToVirtualAddress(((PEPT_PML2_POINTER)&Pml2)->PageFrameNumber * PAGE_SIZE);
+
+        if (Pml1[Index].Flags & Flag)
+        {
+            Bitmap[Index / 64] |= 1ULL << (Index % 64);
+        }
     }
-    if (SetHookForWrite)
+}
+
+/**
+ * @brief Clear the flags of the pages of a 2MB region of a table that are set in a bitmap
+ * @details The flag of a 2MB large page is cleared if any of its reported pages is set
+ * 
+ * @param PageTable The table
+ * @param Page The first page (all the pages are in the same 2MB region)
+ * @param NumberOfPages Number of the pages
+ * @param Flag The accessed or the dirty flag
+ * @param Bitmap The bitmap of the region
+ * @return VOID
+ */
+VOID
+EptAccessDirtyClearRegion(PVMM_EPT_PAGE_TABLE PageTable, UINT64 Page, UINT64 NumberOfPages, UINT64 Flag, UINT64 * Bitmap)
+{
+    PEPT_PML2_ENTRY Pml2;
+    PEPT_PML1_ENTRY Pml1;
+    UINT64          Index;
+
+    Pml2 = &PageTable->PML2[0][0] + (Page / VMM_EPT_PML1E_COUNT);
+
+    for (Index = Page % VMM_EPT_PML1E_COUNT; Index < (Page % VMM_EPT_PML1E_COUNT) + NumberOfPages; Index++)
     {
-        PageHookMask |= PAGE_ATTRIB_WRITE;
+        if (!(Bitmap[Index / 64] & (1ULL << (Index % 64))))
+        {
+            continue;
+        }
+
+        if (Pml2->LargePage)
+        {
+            InterlockedAnd64((LONG64 *)&Pml2->Flags, ~Flag);
+            return;
+        }
+
+        Pml1 = (PEPT_PML1_ENTRY)PhysicalAddressToVirtualAddress(((PEPT_PML2_POINTER)Pml2)->PageFrameNumber * PAGE_SIZE);
+
+        InterlockedAnd64((LONG64 *)&Pml1[Index].Flags, ~Flag);
     }
-    if (SetHookForExec)
+}
+
+/**
+ * @brief Harvest the accessed or dirty flags of a physical range
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL), a page is reported
+ * as set if it's set in the shared table or in any of the live views (private views
+ * of the cores and process views), the flags of a 2MB large page are reported for
+ * all of its 4KB pages, if the flags are cleared, then the caller should invalidate
+ * EPT on all the cores
+ * 
+ * @param PhysicalAddress Start of the physical range
+ * @param NumberOfPages Number of 4KB pages in the range
+ * @param HarvestDirtyFlags Harvest dirty flags or accessed flags
+ * @param ClearAfterHarvest Clear the harvested flags
+ * @param Runs The runs buffer (first run is clear pages)
+ * @param MaxRuns Maximum number of runs in the buffer
+ * @param NumberOfRuns Number of runs that are written
+ * @param NumberOfSetPages Number of pages that have the flag
+ * @return UINT64 Number of pages that are described by the runs
+ */
+UINT64
+EptHarvestAccessDirtyFlags(UINT64 PhysicalAddress, UINT64 NumberOfPages, BOOLEAN HarvestDirtyFlags, BOOLEAN ClearAfterHarvest, UINT32 * Runs, UINT32 MaxRuns, UINT32 * NumberOfRuns, UINT64 * NumberOfSetPages)
+{
+    UINT64              Flag;
+    UINT64              Page;
+    UINT64              EndPage;
+    UINT64              PagesInLargePage;
+    UINT64              ReportedPages;
+    UINT64              Index;
+    UINT64              Bitmap[VMM_EPT_PML1E_COUNT / 64];
+    BOOLEAN             IsSet;
+    ULONG               ProcessorsCount;
+    ULONG               TableIndex;
+    PVMM_EPT_PAGE_TABLE PageTable;
+
+    *NumberOfRuns     = 0;
+    *NumberOfSetPages = 0;
+
+    if (MaxRuns == 0)
     {
-        PageHookMask |= PAGE_ATTRIB_EXEC;
+        return 0;
     }
 
-    if (PageHookMask == 0)
+    Flag    = HarvestDirtyFlags ? EPT_ENTRY_DIRTY_FLAG : EPT_ENTRY_ACCESSED_FLAG;
+    Page    = PhysicalAddress / PAGE_SIZE;
+    EndPage = Page + NumberOfPages;
+
+    //
+    // The identity table only describes the first 512GB
+    //
+    if (EndPage > EPT_IDENTITY_MAP_SIZE / PAGE_SIZE)
     {
-        //
-        // nothing to hook
-        //
-        return FALSE;
+        EndPage = EPT_IDENTITY_MAP_SIZE / PAGE_SIZE;
     }
 
-    if (g_GuestState[LogicalCoreIndex].HasLaunched)
+    Runs[0]       = 0;
+    *NumberOfRuns = 1;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    //
+    // The views are not released (and their tables are not freed) during the harvest
+    //
+    ExAcquireFastMutex(&g_EptState->ViewsMutex);
+
+    while (Page < EndPage)
     {
+        PagesInLargePage = min(VMM_EPT_PML1E_COUNT - (Page % VMM_EPT_PML1E_COUNT), EndPage - Page);
+
         //
-        // Move Attribute Mask to the upper 32 bits of the VMCALL Number
+        // The pages might be touched through any of the tables
         //
-        UINT64 VmcallNumber = ((UINT64)PageHookMask) << 32 | VMCALL_CHANGE_PAGE_ATTRIB;
+        RtlZeroMemory(Bitmap, sizeof(Bitmap));
 
-        if (AsmVmxVmcall(VmcallNumber, TargetAddress, HookFunction, OrigFunction) == STATUS_SUCCESS)
+        for (TableIndex = 0; TableIndex <= EPT_MAX_PROCESS_VIEWS + ProcessorsCount; TableIndex++)
         {
-            LogInfo("Hook applied from VMX Root Mode");
-            if (!g_GuestState[LogicalCoreIndex].IsOnVmxRootMode)
+            PageTable = EptAccessDirtyGetTable(TableIndex);
+
+            if (PageTable != NULL)
             {
-                //
-                // Now we have to notify all the core to invalidate their EPT
-                //
-                HvNotifyAllToInvalidateEpt();
+                EptAccessDirtyReadRegion(PageTable, Page, PagesInLargePage, Flag, Bitmap);
             }
-            else
+        }
+
+        for (Index = Page % VMM_EPT_PML1E_COUNT; Index < (Page % VMM_EPT_PML1E_COUNT) + PagesInLargePage; Index++)
+        {
+            IsSet = (Bitmap[Index / 64] & (1ULL << (Index % 64))) ? TRUE : FALSE;
+
+            if (!EptAccessDirtyAppendRun(Runs, MaxRuns, NumberOfRuns, IsSet, 1))
             {
-                LogError("Unable to notify all cores to invalidate their TLB caches as you called hook on vmx-root mode.");
+                break;
             }
 
-            return TRUE;
+            if (IsSet)
+            {
+                (*NumberOfSetPages)++;
+            }
         }
-    }
-    else
-    {
-        if (EptPerformPageHook(TargetAddress, HookFunction, OrigFunction, SetHookForRead, SetHookForWrite, SetHookForExec) == TRUE)
+
+        ReportedPages = Index - (Page % VMM_EPT_PML1E_COUNT);
+
+        //
+        // Only the reported pages are cleared, in all the tables
+        //
+        if (ClearAfterHarvest && ReportedPages != 0)
         {
-            LogInfo("[*] Hook applied (VM has not launched)");
-            return TRUE;
+            for (TableIndex = 0; TableIndex <= EPT_MAX_PROCESS_VIEWS + ProcessorsCount; TableIndex++)
+            {
+                PageTable = EptAccessDirtyGetTable(TableIndex);
+
+                if (PageTable != NULL)
+                {
+                    EptAccessDirtyClearRegion(PageTable, Page, ReportedPages, Flag, Bitmap);
+                }
+            }
+        }
+
+        Page += ReportedPages;
+
+        //
+        // There is no room for more runs
+        //
+        if (ReportedPages != PagesInLargePage)
+        {
+            break;
         }
     }
-    LogWarning("Hook not applied");
 
-    return FALSE;
+    ExReleaseFastMutex(&g_EptState->ViewsMutex);
+
+    return Page - (PhysicalAddress / PAGE_SIZE);
 }
 
 /**
- * @brief This function set the specific PML1 entry in a spinlock protected area then invalidate the TLB
- * @details This function should be called from vmx root-mode
+ * @brief This function set the specific PML1 entry then invalidate the TLB
+ * @details This function should be called from vmx root-mode, the invalidation is
+ * deferred until the current vm-exit is finished so the changes of a vm-exit are
+ * invalidated once, the changes of the shared table only invalidate the context of
+ * the shared table, the views (that come and go) invalidate all the contexts
  * 
+ * @param PageTable The table that contains the entry
  * @param EntryAddress 
  * @param EntryValue 
- * @param InvalidationType 
  * @return VOID 
  */
 VOID
-EptSetPML1AndInvalidateTLB(PEPT_PML1_ENTRY EntryAddress, EPT_PML1_ENTRY EntryValue, INVEPT_TYPE InvalidationType)
+EptSetPML1AndInvalidateTLB(PVMM_EPT_PAGE_TABLE PageTable, PEPT_PML1_ENTRY EntryAddress, EPT_PML1_ENTRY EntryValue)
 {
     //
-    // acquire the lock
-    //
-    SpinlockLock(&Pml1ModificationAndInvalidationLock);
+    // set the value, the entry is replaced at once
     //
-    // set the value
-    //
-    EntryAddress->Flags = EntryValue.Flags;
+    InterlockedExchange64((LONG64 *)&EntryAddress->Flags, EntryValue.Flags);
+
     //
-    // invalidate the cache
+    // invalidate the cache before the next vm-entry
     //
-    if (InvalidationType == INVEPT_SINGLE_CONTEXT)
+    if (PageTable == g_EptState->EptPageTable)
     {
-        InveptSingleContext(g_EptState->EptPointer.Flags);
+        InveptQueueSingleContext(g_EptState->EptPointer.Flags);
     }
     else
     {
-        InveptAllContexts();
+        InveptQueueAllContexts();
     }
-    //
-    // release the lock
-    //
-    SpinlockUnlock(&Pml1ModificationAndInvalidationLock);
 }
 
 /**
@@ -1314,7 +3489,10 @@ EptSetPML1AndInvalidateTLB(PEPT_PML1_ENTRY EntryAddress, EPT_PML1_ENTRY EntryVal
 BOOLEAN
 EptPageUnHookSinglePage(SIZE_T PhysicalAddress)
 {
-    PLIST_ENTRY TempList = 0;
+    PLIST_ENTRY TempList   = 0;
+    PLIST_ENTRY BucketHead = &g_EptState->HookedPagesBuckets[EPT_HOOKED_PAGES_BUCKET(PAGE_ALIGN(PhysicalAddress))];
+    BOOLEAN     IsFound    = FALSE;
+    KIRQL       OldIrql;
 
     //
     // Should be called from vmx-root, for calling from vmx non-root use the corresponding VMCALL
@@ -1324,24 +3502,38 @@ EptPageUnHookSinglePage(SIZE_T PhysicalAddress)
         return FALSE;
     }
 
-    TempList = &g_EptState->HookedPagesList;
-    while (&g_EptState->HookedPagesList != TempList->Flink)
+    OldIrql = EptLockHookedPages();
+
+    //
+    // The page might be hooked on more than one table (the shared table and the tables of process views)
+    //
+    TempList = BucketHead;
+    while (BucketHead != TempList->Flink)
     {
         TempList                            = TempList->Flink;
-        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookBucketList);
         if (HookedEntry->PhysicalBaseAddress == PAGE_ALIGN(PhysicalAddress))
         {
             //
             // Undo the hook on the EPT table
             //
-            EptSetPML1AndInvalidateTLB(HookedEntry->EntryAddress, HookedEntry->OriginalEntry, INVEPT_SINGLE_CONTEXT);
-            return TRUE;
+            EptSetPML1AndInvalidateTLB(HookedEntry->EptPageTable, HookedEntry->EntryAddress, HookedEntry->OriginalEntry);
+
+            if (HookedEntry->EptPageTable == g_EptState->EptPageTable)
+            {
+                EptUpdateSharedHookOnViews(HookedEntry, HookedEntry->OriginalEntry);
+            }
+
+            IsFound = TRUE;
         }
     }
+
+    EptUnlockHookedPages(OldIrql);
+
     //
-    // Nothing found, probably the list is not found
+    // If nothing found, probably the list is not found
     //
-    return FALSE;
+    return IsFound;
 }
 
 /**
@@ -1354,6 +3546,7 @@ VOID
 EptPageUnHookAllPages()
 {
     PLIST_ENTRY TempList = 0;
+    KIRQL       OldIrql;
 
     //
     // Should be called from vmx-root, for calling from vmx non-root use the corresponding VMCALL
@@ -1363,6 +3556,8 @@ EptPageUnHookAllPages()
         return FALSE;
     }
 
+    OldIrql = EptLockHookedPages();
+
     TempList = &g_EptState->HookedPagesList;
     while (&g_EptState->HookedPagesList != TempList->Flink)
     {
@@ -1372,6 +3567,13 @@ EptPageUnHookAllPages()
         //
         // Undo the hook on the EPT table
         //
-        EptSetPML1AndInvalidateTLB(HookedEntry->EntryAddress, HookedEntry->OriginalEntry, INVEPT_SINGLE_CONTEXT);
+        EptSetPML1AndInvalidateTLB(HookedEntry->EptPageTable, HookedEntry->EntryAddress, HookedEntry->OriginalEntry);
+
+        if (HookedEntry->EptPageTable == g_EptState->EptPageTable)
+        {
+            EptUpdateSharedHookOnViews(HookedEntry, HookedEntry->OriginalEntry);
+        }
     }
+
+    EptUnlockHookedPages(OldIrql);
 }
@@ -11,6 +11,9 @@
  */
 #pragma once
 #include <ntddk.h>
+#include "Spinlock.h"
+#include "Mtrr.h"
+#include "Trampoline.h"
 
 //////////////////////////////////////////////////
 //					Constants					//
@@ -40,13 +43,55 @@
 #define MSR_IA32_MTRR_PHYSMASK8 0x00000211
 #define MSR_IA32_MTRR_PHYSMASK9 0x00000213
 
-/* Memory Types */
-#define MEMORY_TYPE_UNCACHEABLE     0x00000000
-#define MEMORY_TYPE_WRITE_COMBINING 0x00000001
-#define MEMORY_TYPE_WRITE_THROUGH   0x00000004
-#define MEMORY_TYPE_WRITE_PROTECTED 0x00000005
-#define MEMORY_TYPE_WRITE_BACK      0x00000006
-#define MEMORY_TYPE_INVALID         0x000000FF
+/* MTRR Fixed Range MSRs */
+#define MSR_IA32_MTRR_FIX64K_00000 0x00000250
+#define MSR_IA32_MTRR_FIX16K_80000 0x00000258
+#define MSR_IA32_MTRR_FIX16K_A0000 0x00000259
+#define MSR_IA32_MTRR_FIX4K_C0000  0x00000268
+#define MSR_IA32_MTRR_FIX4K_C8000  0x00000269
+#define MSR_IA32_MTRR_FIX4K_D0000  0x0000026A
+#define MSR_IA32_MTRR_FIX4K_D8000  0x0000026B
+#define MSR_IA32_MTRR_FIX4K_E0000  0x0000026C
+#define MSR_IA32_MTRR_FIX4K_E8000  0x0000026D
+#define MSR_IA32_MTRR_FIX4K_F0000  0x0000026E
+#define MSR_IA32_MTRR_FIX4K_F8000  0x0000026F
+
+/* The bits of cr3 that contain the page frame of the directory table base */
+#define CR3_PAGE_FRAME_MASK 0x000FFFFFFFFFF000ULL
+
+/* Maximum number of processes that have their own EPT view */
+#define EPT_MAX_PROCESS_VIEWS 16
+
+/* The view index of the private view of a core is this flag and the index of the core */
+#define EPT_VIEW_INDEX_CORE_FLAG 0x8000
+
+/* Accessed and dirty flags of EPT entries that map a page (bits 8 and 9) */
+#define EPT_ENTRY_ACCESSED_FLAG (1ULL << 8)
+#define EPT_ENTRY_DIRTY_FLAG    (1ULL << 9)
+
+/* Bit 0 of VM-function controls enables EPTP switching (VMFUNC leaf 0) */
+#define VM_FUNCTION_CONTROL_EPTP_SWITCHING 0x1
+
+/* Maximum number of detour sites that share the fake page of a hooked page */
+#define EPT_MAX_DETOURS_PER_PAGE 8
+
+/* Maximum size of the jump that is written on a detour site (TrampolineWriteDetourJump) */
+#define EPT_HOOK_DETOUR_JUMP_SIZE TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE
+
+/* Maximum number of hooked pages that are linked to a hooked page by the detours that pass the end of a page */
+#define EPT_MAX_SPANNED_PAGES 4
+
+/* The trampolines of all the detour sites of a hooked page are carved from one block */
+#define EPT_HOOK_TRAMPOLINE_BLOCK_SIZE (MAX_EXEC_TRAMPOLINE_SIZE * EPT_MAX_DETOURS_PER_PAGE)
+
+/* Number of buckets for finding the hooked pages by their physical address (power of two) */
+#define EPT_HOOKED_PAGES_BUCKETS 64
+
+/* Number of EPT Pointers that each core defers their invalidation, more pointers are invalidated by an all-contexts INVEPT */
+#define EPT_PENDING_INVALIDATIONS_MAX 4
+
+/* The bucket of a hooked physical page */
+#define EPT_HOOKED_PAGES_BUCKET(_PHYSICAL_ADDRESS_) (((_PHYSICAL_ADDRESS_) >> 12) & (EPT_HOOKED_PAGES_BUCKETS - 1))
 
 // Page attributes for internal use */
 #define PAGE_ATTRIB_READ  0x2
@@ -77,6 +122,9 @@
 /* Integer 2MB */
 #define SIZE_2_MB ((SIZE_T)(512 * PAGE_SIZE))
 
+/* Size of the physical memory that is identity mapped by our EPT table (512GB) */
+#define EPT_IDENTITY_MAP_SIZE ((UINT64)VMM_EPT_PML3E_COUNT * VMM_EPT_PML2E_COUNT * SIZE_2_MB)
+
 /* Offset into the 1st paging structure (4096 byte) */
 #define ADDRMASK_EPT_PML1_OFFSET(_VAR_) (_VAR_ & 0xFFFULL)
 
@@ -129,10 +177,20 @@
 //////////////////////////////////////////////////
 
 /**
- * @brief Vmx-root lock for changing EPT PML1 Entry and Invalidating TLB
+ * @brief Lock for publishing the private EPT views of the cores and the processes
+ * @details Only held for changing the fields of the views, the allocations and the
+ * broadcasts are serialized by the ViewsMutex of EPT_STATE
  * 
  */
-volatile LONG Pml1ModificationAndInvalidationLock;
+SPINLOCK_READ_WRITE EptCoreViewLock;
+
+/**
+ * @brief Lock for the list and the buckets of the hooked pages
+ * @details The vm-exits of EPT violations and MTF find the hooks while
+ * holding the lock, see EptLockHookedPages
+ * 
+ */
+SPINLOCK_TICKET EptHookedPagesLock;
 
 //////////////////////////////////////////////////
 //				Unions & Structs    			//
@@ -723,6 +781,11 @@ typedef struct _VMM_EPT_PAGE_TABLE
     DECLSPEC_ALIGN(PAGE_SIZE)
     EPT_PML2_ENTRY PML2[VMM_EPT_PML3E_COUNT][VMM_EPT_PML2E_COUNT];
 
+    /**
+	 * @brief List of 2MB pages of this table that are split to 4KB pages and owned by the table
+	 */
+    LIST_ENTRY DynamicSplitList;
+
 } VMM_EPT_PAGE_TABLE, *PVMM_EPT_PAGE_TABLE;
 
 /**
@@ -769,173 +832,93 @@ typedef union _EPTP
 } EPTP, *PEPTP;
 
 /**
- * @brief MSR_IA32_MTRR_DEF_TYPE Structure
+ * @brief Structure for INVEPT Instruction
  * 
  */
-typedef union _IA32_MTRR_DEF_TYPE_REGISTER
+typedef struct _INVEPT_DESCRIPTOR
 {
-    struct
-    {
-        /**
-		 * @brief [Bits 2:0] Default Memory Type.
-		 */
-        UINT64 DefaultMemoryType : 3;
-        UINT64 Reserved1 : 7;
-
-        /**
-		 * @brief [Bit 10] Fixed Range MTRR Enable.
-		 */
-        UINT64 FixedRangeMtrrEnable : 1;
-
-        /**
-		 * @brief [Bit 11] MTRR Enable.
-		 */
-        UINT64 MtrrEnable : 1;
-        UINT64 Reserved2 : 52;
-    };
-
-    UINT64 Flags;
-} IA32_MTRR_DEF_TYPE_REGISTER, *PIA32_MTRR_DEF_TYPE_REGISTER;
+    UINT64 EptPointer;
+    UINT64 Reserved; // Must be zero.
+} INVEPT_DESCRIPTOR, *PINVEPT_DESCRIPTOR;
 
 /**
- * @brief IA32_MTRR_CAPABILITIES Structure
+ * @brief The EPT view of a process
+ * @details The view is selected in the cr3 vm-exits, so the hooks that are applied
+ * to the table of a view only affect the target process, the view is matched by both
+ * the kernel and the user-mode cr3 of the process and it's removed when the process exits
  * 
  */
-typedef union _IA32_MTRR_CAPABILITIES_REGISTER
+typedef struct _EPT_PROCESS_VIEW
 {
-    struct
-    {
-        /**
-		 * @brief VCNT (variable range registers count) field
-		 *
-		 * [Bits 7:0] Indicates the number of variable ranges implemented on the processor.
-		 */
-        UINT64 VariableRangeCount : 8;
-
-        /**
-		 * @brief FIX (fixed range registers supported) flag
-		 *
-		 * [Bit 8] Fixed range MTRRs (MSR_IA32_MTRR_FIX64K_00000 through MSR_IA32_MTRR_FIX4K_0F8000) are supported when set; no fixed range
-		 * registers are supported when clear.
-		 */
-        UINT64 FixedRangeSupported : 1;
-        UINT64 Reserved1 : 1;
-
-        /**
-		 * @brief WC (write combining) flag
-		 *
-		 * [Bit 10] The write-combining (WC) memory type is supported when set; the WC type is not supported when clear.
-		 */
-        UINT64 WcSupported : 1;
-
-        /**
-		 * @brief SMRR (System-Management Range Register) flag
-		 *
-		 * [Bit 11] The system-management range register (SMRR) interface is supported when bit 11 is set; the SMRR interface is
-		 * not supported when clear.
-		 */
-        UINT64 SmrrSupported : 1;
-        UINT64 Reserved2 : 52;
-    };
+    UINT64              Cr3;        // Page-aligned directory table base of the process (zero means the slot is free)
+    UINT64              UserCr3;    // Page-aligned user-mode directory table base of the process (KVA shadowing) or zero
+    UINT32              ProcessId;  // The process that owns this view
+    PVMM_EPT_PAGE_TABLE PageTable;  // The private table of this view
+    EPTP                EptPointer; // Extended-Page-Table Pointer of the above table
 
-    UINT64 Flags;
-} IA32_MTRR_CAPABILITIES_REGISTER, *PIA32_MTRR_CAPABILITIES_REGISTER;
+} EPT_PROCESS_VIEW, *PEPT_PROCESS_VIEW;
 
 /**
- * @brief MSR_IA32_MTRR_PHYSBASE(0-9) Structure
+ * @brief Main structure for saving the state of EPT among the project
  * 
  */
-typedef union _IA32_MTRR_PHYSBASE_REGISTER
-{
-    struct
-    {
-        /**
-		 * @brief [Bits 7:0] Specifies the memory type for the range.
-		 */
-        UINT64 Type : 8;
-        UINT64 Reserved1 : 4;
-
-        /**
-		 * @brief [Bits 47:12] Specifies the base address of the address range. This 24-bit value, in the case where MAXPHYADDR is 36
-		 * bits, is extended by 12 bits at the low end to form the base address (this automatically aligns the address on a 4-KByte
-		 * boundary).
-		 */
-        UINT64 PageFrameNumber : 36;
-        UINT64 Reserved2 : 16;
-    };
-
-    UINT64 Flags;
-} IA32_MTRR_PHYSBASE_REGISTER, *PIA32_MTRR_PHYSBASE_REGISTER;
-
-// MSR_IA32_MTRR_PHYSMASK(0-9).
-typedef union _IA32_MTRR_PHYSMASK_REGISTER
+typedef struct _EPT_STATE
 {
-    struct
-    {
-        /**
-		 * @brief [Bits 7:0] Specifies the memory type for the range.
-		 */
-        UINT64 Type : 8;
-        UINT64 Reserved1 : 3;
-
-        /**
-		 * @brief [Bit 11] Enables the register pair when set; disables register pair when clear.
-		 */
-        UINT64 Valid : 1;
+    LIST_ENTRY            HookedPagesList;                              // A list of the details about hooked pages
+    LIST_ENTRY            HookedPagesBuckets[EPT_HOOKED_PAGES_BUCKETS]; // The hooked pages hashed by their physical page (for constant-time lookups)
+    MTRR_RANGE_DESCRIPTOR MemoryRanges[MTRR_MAP_MAX_RANGES];            // Sorted, non-overlapping physical memory ranges described by the MTRRs. Used to build the EPT identity mapping.
+    ULONG                 NumberOfEnabledMemoryRanges;                  // Number of memory ranges specified in MemoryRanges
+    EPTP                  EptPointer;                                   // Extended-Page-Table Pointer of the shared identity table
+    PVMM_EPT_PAGE_TABLE   EptPageTable;                                 // The shared identity table, referenced by all the cores that don't have a private view
+    EPT_PROCESS_VIEW      ProcessViews[EPT_MAX_PROCESS_VIEWS];          // The EPT views of processes, switched on cr3 writes
+    volatile LONG         NumberOfProcessViews;                         // Number of used slots in ProcessViews
+    PUINT64               EptpList;                                     // EPTP list of VMFUNC (not allocated, VMFUNC would let the guest leave the views), index 0 is the shared table and index n is ProcessViews[n - 1]
+    BOOLEAN               IsVmfuncEptpSwitchingSupported;               // Shows whether the processor supports EPTP switching by VMFUNC
+    BOOLEAN               IsAccessDirtyFlagsSupported;                  // Shows whether the processor supports accessed and dirty flags for EPT
+    BOOLEAN               IsAccessDirtyFlagsEnabled;                    // Shows whether the accessed and dirty flags are enabled in the EPTPs
+    BOOLEAN               IsPmlSupported;                               // Shows whether the processor supports Page Modification Logging
+    BOOLEAN               IsPmlEnabled;                                 // Shows whether Page Modification Logging is enabled on all the cores
+    BOOLEAN               IsAccessDirtyHarvestActive;                   // Shows whether the flags are enabled for harvesting, PML can't be enabled meanwhile as it clears the dirty flags (protected by PmlMutex)
+    BOOLEAN               IsAccessDirtyEnabledByPml;                    // Shows whether the flags are enabled by PmlEnable, they're disabled again by PmlDisable (protected by PmlMutex)
+    volatile LONG64       InvalidationBroadcastRequests;                // Ticket of the last requested broadcast EPT invalidation
+    volatile LONG64       InvalidationBroadcastsCompleted;              // The requests up to this ticket are covered by a completed broadcast
+    UINT64                InvalidationBroadcastsIssued;                 // Number of the broadcasts that are actually sent to the cores
+    FAST_MUTEX            InvalidationBroadcastMutex;                   // Serializes the broadcast EPT invalidations, the requests that arrive meanwhile are coalesced
+    FAST_MUTEX            ViewsMutex;                                   // Serializes creating and releasing the private views and the process views (PASSIVE_LEVEL)
+    BOOLEAN               IsProcessNotifyRoutineRegistered;             // Shows whether the process views are removed on process exit
 
-        /**
-		 * @brief [Bits 47:12] Specifies a mask (24 bits if the maximum physical address size is 36 bits, 28 bits if the maximum physical
-		 * address size is 40 bits). The mask determines the range of the region being mapped, according to the following
-		 * relationships:
-		 * - Address_Within_Range AND PhysMask = PhysBase AND PhysMask
-		 * - This value is extended by 12 bits at the low end to form the mask value.
-		 * - The width of the PhysMask field depends on the maximum physical address size supported by the processor.
-		 * CPUID.80000008H reports the maximum physical address size supported by the processor. If CPUID.80000008H is not
-		 * available, software may assume that the processor supports a 36-bit physical address size.
-		 *
-		 * @see Vol3A[11.11.3(Example Base and Mask Calculations)]
-		 */
-        UINT64 PageFrameNumber : 36;
-        UINT64 Reserved2 : 16;
-    };
-
-    UINT64 Flags;
-} IA32_MTRR_PHYSMASK_REGISTER, *PIA32_MTRR_PHYSMASK_REGISTER;
+} EPT_STATE, *PEPT_STATE;
 
 /**
- * @brief Structure for INVEPT Instruction
+ * @brief The EPT view of each core
+ * @details All the cores use the shared identity table unless a core needs a private
+ * view, then a private copy of the shared table is created for that core and it's
+ * freed when the last reference is released
  * 
  */
-typedef struct _INVEPT_DESCRIPTOR
+typedef struct _EPT_CORE_VIEW
 {
-    UINT64 EptPointer;
-    UINT64 Reserved; // Must be zero.
-} INVEPT_DESCRIPTOR, *PINVEPT_DESCRIPTOR;
+    PVMM_EPT_PAGE_TABLE PageTable;      // The table that is used by this core (shared or private)
+    EPTP                EptPointer;     // Extended-Page-Table Pointer of the above table
+    volatile LONG       ReferenceCount; // Number of references to the private table (zero means the shared table is used)
 
-/**
- * @brief MTRR Range Descriptor
- * 
- */
-typedef struct _MTRR_RANGE_DESCRIPTOR
-{
-    SIZE_T PhysicalBaseAddress;
-    SIZE_T PhysicalEndAddress;
-    UCHAR  MemoryType;
-} MTRR_RANGE_DESCRIPTOR, *PMTRR_RANGE_DESCRIPTOR;
+} EPT_CORE_VIEW, *PEPT_CORE_VIEW;
 
 /**
- * @brief Main structure for saving the state of EPT among the project
+ * @brief The EPT invalidations of each core that are deferred until the next vm-entry
+ * @details The requests of a vm-exit are coalesced, each EPT Pointer is invalidated
+ * once and an all-contexts invalidation covers all the single-context invalidations
  * 
  */
-typedef struct _EPT_STATE
+typedef struct _EPT_PENDING_INVALIDATIONS
 {
-    LIST_ENTRY            HookedPagesList;             // A list of the details about hooked pages
-    MTRR_RANGE_DESCRIPTOR MemoryRanges[9];             // Physical memory ranges described by the BIOS in the MTRRs. Used to build the EPT identity mapping.
-    ULONG                 NumberOfEnabledMemoryRanges; // Number of memory ranges specified in MemoryRanges
-    EPTP                  EptPointer;                  // Extended-Page-Table Pointer
-    PVMM_EPT_PAGE_TABLE   EptPageTable;                // Page table entries for EPT operation
+    BOOLEAN AllContexts;                                // An all-contexts invalidation is pending
+    UINT32  NumberOfEptPointers;                        // Number of the pending single-context invalidations
+    UINT64  EptPointers[EPT_PENDING_INVALIDATIONS_MAX]; // The EPT Pointers of the pending single-context invalidations
+    UINT64  RequestedCount;                             // Number of the requested invalidations
+    UINT64  IssuedCount;                                // Number of the executed INVEPT instructions
 
-} EPT_STATE, *PEPT_STATE;
+} EPT_PENDING_INVALIDATIONS, *PEPT_PENDING_INVALIDATIONS;
 
 typedef struct _VMM_EPT_DYNAMIC_SPLIT
 {
@@ -1069,6 +1052,22 @@ typedef union _VMX_EXIT_QUALIFICATION_EPT_VIOLATION
     UINT64 Flags;
 } VMX_EXIT_QUALIFICATION_EPT_VIOLATION, *PVMX_EXIT_QUALIFICATION_EPT_VIOLATION;
 
+/**
+ * @brief A detour of an execution hook, all the detours of a physical page share
+ * the fake page and the trampoline block of that page
+ * 
+ */
+typedef struct _EPT_HOOK_DETOUR_SITE
+{
+    PVOID  TargetAddress;            // The address of the hooked function
+    SIZE_T OffsetIntoPage;           // Offset of the detour jump in the fake page
+    SIZE_T SizeOfHookedInstructions; // Size of the instructions that are moved to the trampoline
+    PCHAR  Trampoline;               // The trampoline of this detour (in the trampoline block of the page)
+
+    struct _EPT_HOOKED_PAGE_DETAIL * SpannedPage; // The hooked next page if the detour jump passes the end of the page
+
+} EPT_HOOK_DETOUR_SITE, *PEPT_HOOK_DETOUR_SITE;
+
 /**
  * @brief Structure to save the state of each hooked pages
  * 
@@ -1117,15 +1116,40 @@ typedef struct _EPT_HOOKED_PAGE_DETAIL
     EPT_PML1_ENTRY ChangedEntry;
 
     /**
-	* @brief The buffer of the trampoline function which is used in the inline hook.
+	 * @brief Linked list entires for the bucket of the physical page.
+	 */
+    LIST_ENTRY PageHookBucketList;
+
+    /**
+	* @brief The buffer that the trampolines of all the detours of this page are carved from.
+	*/
+    PCHAR TrampolineBlock;
+
+    /**
+	* @brief Number of used bytes of the trampoline block.
+	*/
+    SIZE_T TrampolineBlockUsedSize;
+
+    /**
+	* @brief The detours of this page that share the fake page.
+	*/
+    EPT_HOOK_DETOUR_SITE DetourSites[EPT_MAX_DETOURS_PER_PAGE];
+
+    /**
+	* @brief Number of used detour sites.
 	*/
-    PCHAR Trampoline;
+    UINT32 NumberOfDetourSites;
 
     /**
 	 * @brief This field shows whether the hook contains a hidden hook for execution or not
 	 */
     BOOLEAN IsExecutionHook;
 
+    /**
+	 * @brief The page table that this hook is applied to (the shared table or the table of a process view)
+	 */
+    PVMM_EPT_PAGE_TABLE EptPageTable;
+
 } EPT_HOOKED_PAGE_DETAIL, *PEPT_HOOKED_PAGE_DETAIL;
 
 //////////////////////////////////////////////////
@@ -1154,31 +1178,112 @@ BOOLEAN
 EptBuildMtrrMap();
 /* Hook in VMX Root Mode (A pre-allocated buffer should be available) */
 BOOLEAN
-EptPerformPageHook(PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute);
+EptPerformPageHook(PVMM_EPT_PAGE_TABLE EptPageTable, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute);
+/* Add a hook to a page that is already hooked in VMX Root Mode */
+BOOLEAN
+EptPerformPageHookOnHookedPage(PEPT_HOOKED_PAGE_DETAIL HookedPage, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN UnsetRead, BOOLEAN UnsetWrite, BOOLEAN UnsetExecute);
 /* Hook in VMX Non Root Mode */
 BOOLEAN
 EptPageHook(PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec);
+/* Hook in VMX Non Root Mode, only visible to the target process */
+BOOLEAN
+EptPageHookForProcess(UINT32 ProcessId, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec);
+/* Remove the EPT view of a process and its hooks */
+BOOLEAN
+EptRemoveProcessView(UINT32 ProcessId);
+/* Remove the EPT view of a process when the process exits */
+VOID
+EptProcessNotifyRoutine(HANDLE ParentId, HANDLE ProcessId, BOOLEAN Create);
+/* Read the user-mode directory table base of a process (KVA shadowing) */
+UINT64
+EptGetUserDirectoryTableBase(PEPROCESS Process, UINT64 DirectoryTableBase);
+/* Hook in VMX Non Root Mode, only visible to the target core */
+BOOLEAN
+EptPageHookForCore(ULONG CoreIndex, PVOID TargetAddress, PVOID HookFunction, PVOID * OrigFunction, BOOLEAN SetHookForRead, BOOLEAN SetHookForWrite, BOOLEAN SetHookForExec);
+/* Remove the hooks of a core and switch it back to the shared table */
+BOOLEAN
+EptPageUnHookForCore(ULONG CoreIndex);
+/* Find the page table of a view (zero is the shared table) */
+PVMM_EPT_PAGE_TABLE
+EptGetViewPageTable(UINT32 ViewIndex);
+/* Switch the EPTP of the current core based on the new cr3 */
+VOID
+EptSwitchProcessView(UINT64 GuestCr3);
+/* Find the page table that is referenced by the current EPTP */
+PVMM_EPT_PAGE_TABLE
+EptGetCurrentPageTable();
+/* Enable or disable accessed and dirty flags for all the EPT tables */
+BOOLEAN
+EptSetAccessDirtyFlags(BOOLEAN Enable);
+/* Harvest the accessed or dirty flags of a physical range (and its views) as run-lengths */
+UINT64
+EptHarvestAccessDirtyFlags(UINT64 PhysicalAddress, UINT64 NumberOfPages, BOOLEAN HarvestDirtyFlags, BOOLEAN ClearAfterHarvest, UINT32 * Runs, UINT32 MaxRuns, UINT32 * NumberOfRuns, UINT64 * NumberOfSetPages);
+/* Free a page table and its split pages */
+VOID
+EptFreePageTable(PVMM_EPT_PAGE_TABLE PageTable);
+/* Create a private copy of the shared identity table */
+PVMM_EPT_PAGE_TABLE
+EptCreatePrivatePageTable();
+/* Create an EPT Pointer for a page table */
+EPTP
+EptCreateEptPointer(PVMM_EPT_PAGE_TABLE PageTable);
+/* Free the shared identity table and all the private tables */
+VOID
+EptFreeAllPageTables();
+/* Create or reference a private EPT view for a core */
+BOOLEAN
+EptAcquireCorePrivateView(ULONG CoreIndex);
+/* Release a reference to the private EPT view of a core */
+VOID
+EptReleaseCorePrivateView(ULONG CoreIndex);
+/* Compute the size of a page table and its split pages */
+UINT64
+EptGetPageTableSize(PVMM_EPT_PAGE_TABLE PageTable, UINT64 * NumberOfSplits);
 /* Initialize EPT Table based on Processor Index */
 BOOLEAN
 EptLogicalProcessorInitialize();
-/* Handle EPT Violation */
-BOOLEAN
-EptHandleEptViolation(ULONG ExitQualification, UINT64 GuestPhysicalAddr);
 /* Get the PML1 Entry of a special address */
 PEPT_PML1_ENTRY
 EptGetPml1Entry(PVMM_EPT_PAGE_TABLE EptPageTable, SIZE_T PhysicalAddress);
 /* Handle vm-exits for Monitor Trap Flag to restore previous state */
 VOID
-EptHandleMonitorTrapFlag(PEPT_HOOKED_PAGE_DETAIL HookedEntry);
+EptHandleMonitorTrapFlag(ULONG CoreIndex);
 /* Handle Ept Misconfigurations */
 VOID
 EptHandleMisconfiguration(UINT64 GuestAddress);
 /* This function set the specific PML1 entry in a spinlock protected area then	invalidate the TLB , this function should be called from vmx root-mode */
 VOID
-EptSetPML1AndInvalidateTLB(PEPT_PML1_ENTRY EntryAddress, EPT_PML1_ENTRY EntryValue, INVEPT_TYPE InvalidationType);
-/* Handle hooked pages in Vmx-root mode */
+EptSetPML1AndInvalidateTLB(PVMM_EPT_PAGE_TABLE PageTable, PEPT_PML1_ENTRY EntryAddress, EPT_PML1_ENTRY EntryValue);
+/* Acquire the lock of the hooked pages (both in vmx-root and vmx non-root) */
+KIRQL
+EptLockHookedPages();
+/* Release the lock of the hooked pages */
+VOID
+EptUnlockHookedPages(KIRQL OldIrql);
+/* Write an entry of a hooked page to a private table (the large page is split if needed) */
 BOOLEAN
-EptHandleHookedPage(EPT_HOOKED_PAGE_DETAIL * HookedEntryDetails, VMX_EXIT_QUALIFICATION_EPT_VIOLATION ViolationQualification, SIZE_T PhysicalAddress);
+EptSetPrivateEntryOfHookedPage(PVMM_EPT_PAGE_TABLE PageTable, SIZE_T PhysicalAddress, EPT_PML1_ENTRY EntryValue);
+/* Copy the shared table and the hooked entries to a private table before it's published */
+VOID
+EptRefreshPrivatePageTable(PVMM_EPT_PAGE_TABLE PageTable);
+/* Write the entry of a hooked page of the shared table to the views that don't have their own hook on the page */
+VOID
+EptUpdateSharedHookOnViews(PEPT_HOOKED_PAGE_DETAIL HookedPage, EPT_PML1_ENTRY EntryValue);
+/* Find the detail of a hooked physical page */
+PEPT_HOOKED_PAGE_DETAIL
+EptFindHookedPage(PVMM_EPT_PAGE_TABLE EptPageTable, SIZE_T PhysicalBaseAddress);
+/* Remove the detail of a hooked page from the hooked pages lists */
+VOID
+EptRemoveHookedPage(PEPT_HOOKED_PAGE_DETAIL HookedPage);
+/* Unhook a page that is hooked while building a hook that failed (vmx-root) */
+VOID
+EptUnHookNewPage(PEPT_HOOKED_PAGE_DETAIL HookedPage);
+/* Remove the details of all the hooks of a page table that is going to be freed */
+VOID
+EptRemoveHooksOfPageTable(PVMM_EPT_PAGE_TABLE PageTable);
+/* Find the hooked pages that are linked to a hooked page by the detours that pass the end of a page */
+UINT32
+EptGetSpannedHookedPages(SIZE_T PhysicalBaseAddress, BOOLEAN FindPreviousPages, SIZE_T * PhysicalAddresses);
 /* Remove a special hook from the hooked pages lists */
 BOOLEAN
 EptPageUnHookSinglePage(SIZE_T PhysicalAddress);
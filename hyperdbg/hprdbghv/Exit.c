@@ -20,6 +20,7 @@
 #include "Invept.h"
 #include "HypervisorRoutines.h"
 #include "Events.h"
+#include "Pml.h"
 
 /**
  * @brief VM-Exit handler for different exit reasons
@@ -136,7 +137,7 @@ VmxVmexitHandler(PGUEST_REGS GuestRegs)
         //
         __vmx_vmread(GUEST_PHYSICAL_ADDRESS, &GuestPhysicalAddr);
 
-        if (!EptHandleEptViolation(ExitQualification, GuestPhysicalAddr))
+        if (!EptHandleEptViolation(GuestRegs, ExitQualification, GuestPhysicalAddr))
             LogError("There were errors in handling Ept Violation");
 
         break;
@@ -149,6 +150,15 @@ VmxVmexitHandler(PGUEST_REGS GuestRegs)
 
         break;
     }
+    case EXIT_REASON_PML_FULL:
+    {
+        //
+        // Drain the dirty pages that are logged by this core
+        //
+        PmlHandleLogFull();
+
+        break;
+    }
     case EXIT_REASON_VMCALL:
     {
         //
@@ -231,17 +241,12 @@ VmxVmexitHandler(PGUEST_REGS GuestRegs)
         //
         // Monitor Trap Flag
         //
-        if (g_GuestState[CurrentProcessorIndex].MtfEptHookRestorePoint)
+        if (g_GuestState[CurrentProcessorIndex].MtfEptHookRestoreEntry)
         {
             //
-            // Restore the previous state
-            //
-            EptHandleMonitorTrapFlag(g_GuestState[CurrentProcessorIndex].MtfEptHookRestorePoint);
-
-            //
-            // Set it to NULL
+            // Restore the previous state (the hook might be removed meanwhile)
             //
-            g_GuestState[CurrentProcessorIndex].MtfEptHookRestorePoint = NULL;
+            EptHandleMonitorTrapFlag(CurrentProcessorIndex);
         }
         else if (g_GuestState[CurrentProcessorIndex].DebuggingState.UndefinedInstructionAddress != NULL)
         {
@@ -259,17 +264,22 @@ VmxVmexitHandler(PGUEST_REGS GuestRegs)
                 //
                 EventInjectUndefinedOpcode();
             }
-            else
+            else if (GuestRip == g_GuestState[CurrentProcessorIndex].DebuggingState.SyscallMsrs.Lstar)
             {
                 //
-                // It was because of Syscall, let's log it
+                // It was because of Syscall, let's log it with the registers
+                // before the SYSCALL (it has changed RCX and R11)
                 //
-                LogInfo("SYSCALL instruction => 0x%llX , process id : 0x%x , rax = 0x%llx",
-                        g_GuestState[CurrentProcessorIndex].DebuggingState.UndefinedInstructionAddress,
-                        PsGetCurrentProcessId(),
-                        GuestRegs->rax);
+                SyscallHookTraceSYSCALL(&g_GuestState[CurrentProcessorIndex].DebuggingState.SyscallRegs,
+                                        CurrentProcessorIndex,
+                                        g_GuestState[CurrentProcessorIndex].DebuggingState.UndefinedInstructionAddress);
             }
 
+            //
+            // Otherwise an interrupt or a page fault is delivered before the
+            // instruction, it causes another #UD when the guest returns to it
+            //
+
             //
             // Enable syscall hook again
             //
@@ -311,6 +321,14 @@ VmxVmexitHandler(PGUEST_REGS GuestRegs)
         HvResumeToNextInstruction();
     }
 
+    //
+    // Invalidate the EPT changes of this vm-exit once, before resuming the guest
+    //
+    if (!g_GuestState[CurrentProcessorIndex].VmxoffState.IsVmxoffExecuted)
+    {
+        InveptFlushPendingInvalidations();
+    }
+
     //
     // Set indicator of Vmx non root mode to false
     //
@@ -17,6 +17,7 @@
 #include "Common.h"
 #include "Hooks.h"
 #include "GlobalVariables.h"
+#include "Vmcall.h"
 
 /**
  * @brief routines for !syscallhook command (enable syscall hook)
@@ -26,7 +27,30 @@
 VOID
 ExtensionCommandEnableEferOnAllProcessors()
 {
-    KeGenericCallDpc(BroadcastDpcEnableEferSyscallEvents, 0x0);
+    BROADCAST_OPERATION Operation = {0};
+    UINT64              SysretAddress;
+
+    //
+    // The sysret is the same on all the cores, so it's resolved here
+    // instead of checking the code of each #UD in vmx-root
+    //
+    if (g_SyscallHookSysretAddresses[0] == 0)
+    {
+        SysretAddress = SyscallHookFindSysretAddress();
+
+        if (SysretAddress != 0)
+        {
+            SyscallHookAddVerifiedSysret(SysretAddress);
+        }
+    }
+
+    //
+    // Enable Syscall hook from vmx-root
+    //
+    Operation.Type   = BROADCAST_OPERATION_VMCALL;
+    Operation.Target = VMCALL_ENABLE_SYSCALL_HOOK_EFER;
+
+    BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES, &Operation, 1, NULL);
 }
 
 /**
@@ -37,7 +61,15 @@ ExtensionCommandEnableEferOnAllProcessors()
 VOID
 ExtensionCommandDisableEferOnAllProcessors()
 {
-    KeGenericCallDpc(BroadcastDpcDisableEferSyscallEvents, 0x0);
+    BROADCAST_OPERATION Operation = {0};
+
+    //
+    // Disable Syscall hook from vmx-root
+    //
+    Operation.Type   = BROADCAST_OPERATION_VMCALL;
+    Operation.Target = VMCALL_DISABLE_SYSCALL_HOOK_EFER;
+
+    BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES, &Operation, 1, NULL);
 }
 
 /**
@@ -48,7 +80,7 @@ ExtensionCommandDisableEferOnAllProcessors()
 VOID
 ExtensionCommandHiddenHookGeneralDetourEventHandler(PGUEST_REGS Regs, PVOID CalledFrom)
 {
-    PLIST_ENTRY TempList = 0;
+    PVOID ReturnAddress;
 
     //
     // As the context to event trigger, we send the address of function
@@ -69,20 +101,14 @@ ExtensionCommandHiddenHookGeneralDetourEventHandler(PGUEST_REGS Regs, PVOID Call
     //
 
     //
-    // Iterate through the list of hooked pages details to find
-    // and return where want to jump after this functions
+    // Find where want to jump after this functions (the table of detours
+    // is read without lock)
     //
-    TempList = &g_HiddenHooksDetourListHead;
+    ReturnAddress = HiddenHooksDetourFindReturnAddress(CalledFrom);
 
-    while (&g_HiddenHooksDetourListHead != TempList->Flink)
+    if (ReturnAddress != NULL)
     {
-        TempList                                          = TempList->Flink;
-        PHIDDEN_HOOKS_DETOUR_DETAILS CurrentHookedDetails = CONTAINING_RECORD(TempList, HIDDEN_HOOKS_DETOUR_DETAILS, OtherHooksList);
-
-        if (CurrentHookedDetails->HookedFunctionAddress == CalledFrom)
-        {
-            return CurrentHookedDetails->ReturnAddress;
-        }
+        return ReturnAddress;
     }
 
     //
@@ -17,6 +17,7 @@
 #include "Vmx.h"
 #include "Logging.h"
 #include "PoolManager.h"
+#include "Hooks.h"
 
 //////////////////////////////////////////////////
 //				Global Variables				//
@@ -67,7 +68,76 @@ BOOLEAN g_EnableDebuggerEvents;
 BOOLEAN g_HandleInUse;
 
 /**
- * @brief List header of hidden hooks detour
+ * @brief Table of hidden hooks detours keyed by the hooked function address
+ * @details Open addressing with linear probing, the slots are read without lock
  * 
  */
-LIST_ENTRY g_HiddenHooksDetourListHead;
+PHIDDEN_HOOKS_DETOUR_DETAILS volatile g_HiddenHooksDetourTable[HIDDEN_HOOKS_DETOUR_TABLE_SIZE];
+
+/**
+ * @brief Lock for the writers of the table of hidden hooks detours
+ * 
+ */
+SPINLOCK_TICKET g_HiddenHooksDetourTableLock;
+
+/**
+ * @brief Number of the detours in the table of hidden hooks detours
+ * @details The removed slots are reclaimed when the table becomes empty
+ * 
+ */
+UINT32 g_HiddenHooksDetourTableCount;
+
+/**
+ * @brief Addresses of the sysrets that Windows returns to the user mode with
+ * @details The first one is resolved when the EFER syscall hook is enabled, the
+ * others are added when their bytes are verified in the #UD handler, they're
+ * shared by all the cores and zero means a free slot
+ * 
+ */
+volatile UINT64 g_SyscallHookSysretAddresses[SYSCALL_HOOK_SYSRET_ADDRESSES];
+
+/**
+ * @brief The filter of the EFER syscall hook, NULL means that everything is watched
+ * @details It's replaced by a new filter under g_SyscallFilterMutex, the old filter
+ * is freed after every core has left the vm-exit that might read it
+ * 
+ */
+PDEBUGGER_SYSCALL_FILTER volatile g_SyscallFilter;
+
+/**
+ * @brief Serializes changing the filter of the EFER syscall hook (PASSIVE_LEVEL)
+ * 
+ */
+FAST_MUTEX g_SyscallFilterMutex;
+
+/**
+ * @brief Serializes configuring and reading the binary syscall trace (PASSIVE_LEVEL)
+ * 
+ */
+FAST_MUTEX g_SyscallTraceMutex;
+
+/**
+ * @brief Signaled by the flush timer when the binary syscall trace rings have records
+ * 
+ */
+KEVENT g_SyscallTraceEvent;
+
+/**
+ * @brief The periodic timer that wakes up the reader of the binary syscall trace
+ * 
+ */
+KTIMER g_SyscallTraceFlushTimer;
+KDPC   g_SyscallTraceFlushDpc;
+
+/**
+ * @brief The MSRs and the cores of the periodic MSR sampler
+ * @details It's not changed while the timers of the sampler are running
+ * 
+ */
+DEBUGGER_MSR_SAMPLER_REQUEST g_MsrSamplerConfiguration;
+
+/**
+ * @brief Serializes the requests that start or stop the MSR sampler
+ * 
+ */
+FAST_MUTEX g_MsrSamplerMutex;
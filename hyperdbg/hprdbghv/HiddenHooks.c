@@ -19,6 +19,7 @@
 #include "Logging.h"
 #include "Hooks.h"
 #include "HypervisorRoutines.h"
+#include "GlobalVariables.h"
 
 /**
  * @brief Hook function that HooksExAllocatePoolWithTag
@@ -59,3 +60,184 @@ HiddenHooksTest()
     //HvPerformPageUnHookAllPages();
     //
 }
+
+/**
+ * @brief Publish the details of a detour in the table of detours
+ * @details The details should be filled before calling this function, a hooked
+ * function might have more than one detour (e.g. on the tables of process views),
+ * all of them continue from equivalent trampolines
+ * 
+ * @param DetourDetails The details of the detour
+ * @return BOOLEAN Returns false if the table is full
+ */
+BOOLEAN
+HiddenHooksDetourInsert(PHIDDEN_HOOKS_DETOUR_DETAILS DetourDetails)
+{
+    UINT32  Index  = HIDDEN_HOOKS_DETOUR_TABLE_INDEX(DetourDetails->HookedFunctionAddress);
+    BOOLEAN Result = FALSE;
+
+    //
+    // A vm-exit on this core might wait for the lock, so vmx non-root
+    // doesn't take a ticket
+    //
+    if (g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        SpinlockTicketLock(&g_HiddenHooksDetourTableLock);
+    }
+    else
+    {
+        SpinlockTicketLockPolling(&g_HiddenHooksDetourTableLock);
+    }
+
+    for (UINT32 i = 0; i < HIDDEN_HOOKS_DETOUR_TABLE_SIZE; i++, Index = (Index + 1) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1))
+    {
+        if (g_HiddenHooksDetourTable[Index] == NULL || g_HiddenHooksDetourTable[Index] == HIDDEN_HOOKS_DETOUR_REMOVED_SLOT)
+        {
+            //
+            // The slot is published at last, the readers never see partial details
+            //
+            InterlockedExchangePointer(&g_HiddenHooksDetourTable[Index], DetourDetails);
+            g_HiddenHooksDetourTableCount++;
+            Result = TRUE;
+            break;
+        }
+    }
+
+    SpinlockTicketUnlock(&g_HiddenHooksDetourTableLock);
+
+    return Result;
+}
+
+/**
+ * @brief Remove the details of a detour from the table of detours
+ * @details The slot is marked as removed (not empty) so the readers continue
+ * probing after it; the removed slots that end a probing sequence are emptied
+ * and all of them are emptied when there is no detour in the table, the details
+ * are never freed while the hypervisor runs (the readers don't hold any lock and
+ * might still use them), the pool manager frees them when it's uninitialized
+ * 
+ * @param HookedFunctionAddress The address of the hooked function
+ * @param ReturnAddress The trampoline of the removed detour
+ * @return BOOLEAN Returns false if the detour is not found
+ */
+BOOLEAN
+HiddenHooksDetourRemove(PVOID HookedFunctionAddress, PVOID ReturnAddress)
+{
+    PHIDDEN_HOOKS_DETOUR_DETAILS DetourDetails;
+    PHIDDEN_HOOKS_DETOUR_DETAILS RemovedDetails = NULL;
+    UINT32                       Index          = HIDDEN_HOOKS_DETOUR_TABLE_INDEX(HookedFunctionAddress);
+
+    //
+    // A vm-exit on this core might wait for the lock, so vmx non-root
+    // doesn't take a ticket
+    //
+    if (g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        SpinlockTicketLock(&g_HiddenHooksDetourTableLock);
+    }
+    else
+    {
+        SpinlockTicketLockPolling(&g_HiddenHooksDetourTableLock);
+    }
+
+    for (UINT32 i = 0; i < HIDDEN_HOOKS_DETOUR_TABLE_SIZE; i++, Index = (Index + 1) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1))
+    {
+        DetourDetails = g_HiddenHooksDetourTable[Index];
+
+        if (DetourDetails == NULL)
+        {
+            break;
+        }
+
+        if (DetourDetails != HIDDEN_HOOKS_DETOUR_REMOVED_SLOT &&
+            DetourDetails->HookedFunctionAddress == HookedFunctionAddress &&
+            DetourDetails->ReturnAddress == ReturnAddress)
+        {
+            InterlockedExchangePointer(&g_HiddenHooksDetourTable[Index], HIDDEN_HOOKS_DETOUR_REMOVED_SLOT);
+            g_HiddenHooksDetourTableCount--;
+            RemovedDetails = DetourDetails;
+            break;
+        }
+    }
+
+    if (RemovedDetails != NULL)
+    {
+        HiddenHooksDetourReclaimRemovedSlots(Index);
+    }
+
+    SpinlockTicketUnlock(&g_HiddenHooksDetourTableLock);
+
+    return RemovedDetails != NULL;
+}
+
+/**
+ * @brief Empty the removed slots that are not needed for probing anymore
+ * @details Should be called while the lock of the table is held, a removed slot
+ * that is followed by an empty slot doesn't continue any probing sequence, so it
+ * can be emptied and the removed slots before it too; the new detours are inserted
+ * at the first free slot of their sequence, so a reader never misses a detour
+ * after an emptied slot
+ * 
+ * @param Index The slot that is removed
+ * @return VOID
+ */
+VOID
+HiddenHooksDetourReclaimRemovedSlots(UINT32 Index)
+{
+    UINT32 i;
+
+    if (g_HiddenHooksDetourTableCount == 0)
+    {
+        for (i = 0; i < HIDDEN_HOOKS_DETOUR_TABLE_SIZE; i++)
+        {
+            g_HiddenHooksDetourTable[i] = NULL;
+        }
+        return;
+    }
+
+    if (g_HiddenHooksDetourTable[(Index + 1) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1)] != NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < HIDDEN_HOOKS_DETOUR_TABLE_SIZE && g_HiddenHooksDetourTable[Index] == HIDDEN_HOOKS_DETOUR_REMOVED_SLOT; i++)
+    {
+        g_HiddenHooksDetourTable[Index] = NULL;
+        Index                           = (Index - 1) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1);
+    }
+}
+
+/**
+ * @brief Find the address that a detour continues from
+ * @details This function doesn't acquire any lock, it's called on each call
+ * to the hooked functions from all the cores
+ * 
+ * @param HookedFunctionAddress The address of the hooked function
+ * @return PVOID The trampoline of the detour or NULL if the function is not hooked
+ */
+PVOID
+HiddenHooksDetourFindReturnAddress(PVOID HookedFunctionAddress)
+{
+    PHIDDEN_HOOKS_DETOUR_DETAILS DetourDetails;
+    UINT32                       Index = HIDDEN_HOOKS_DETOUR_TABLE_INDEX(HookedFunctionAddress);
+
+    for (UINT32 i = 0; i < HIDDEN_HOOKS_DETOUR_TABLE_SIZE; i++, Index = (Index + 1) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1))
+    {
+        DetourDetails = g_HiddenHooksDetourTable[Index];
+
+        if (DetourDetails == NULL)
+        {
+            //
+            // An empty slot ends the probing
+            //
+            return NULL;
+        }
+
+        if (DetourDetails != HIDDEN_HOOKS_DETOUR_REMOVED_SLOT && DetourDetails->HookedFunctionAddress == HookedFunctionAddress)
+        {
+            return DetourDetails->ReturnAddress;
+        }
+    }
+
+    return NULL;
+}
@@ -22,6 +22,40 @@
 #define IMAGE_VXD_SIGNATURE    0x454C     // LE
 #define IMAGE_NT_SIGNATURE     0x00004550 // PE00
 
+//////////////////////////////////////////////////
+//				   Hidden Hooks					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Number of slots of the table of detours (a power of two)
+ * 
+ */
+#define HIDDEN_HOOKS_DETOUR_TABLE_SIZE 256
+
+/**
+ * @brief The slot of a removed detour, the readers continue probing after it
+ * 
+ */
+#define HIDDEN_HOOKS_DETOUR_REMOVED_SLOT ((PHIDDEN_HOOKS_DETOUR_DETAILS)1)
+
+/**
+ * @brief The first slot of a hooked function in the table of detours
+ * 
+ */
+#define HIDDEN_HOOKS_DETOUR_TABLE_INDEX(HookedFunctionAddress) \
+    ((((UINT64)(HookedFunctionAddress)) * 0x9E3779B97F4A7C15ull >> 32) & (HIDDEN_HOOKS_DETOUR_TABLE_SIZE - 1))
+
+//////////////////////////////////////////////////
+//				   Syscall Hook					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Number of the verified sysret addresses, the sysret of KiSystemCall64
+ * and KiKernelSysretExit (with KVA Shadowing) are used at the same time
+ * 
+ */
+#define SYSCALL_HOOK_SYSRET_ADDRESSES 2
+
 //////////////////////////////////////////////////
 //				   Structure					//
 //////////////////////////////////////////////////
@@ -42,11 +76,15 @@ typedef struct _SSDTStruct
     PCHAR pArgumentTable;
 } SSDTStruct, *PSSDTStruct;
 
+/**
+ * @brief The details of a detour, the details are not changed after they're
+ * published in the table of detours and they are never freed while the hypervisor runs
+ * 
+ */
 typedef struct _HIDDEN_HOOKS_DETOUR_DETAILS
 {
-    LIST_ENTRY OtherHooksList;
-    PVOID      HookedFunctionAddress;
-    PVOID      ReturnAddress;
+    PVOID HookedFunctionAddress;
+    PVOID ReturnAddress;
 } HIDDEN_HOOKS_DETOUR_DETAILS, *PHIDDEN_HOOKS_DETOUR_DETAILS;
 
 
@@ -97,10 +135,14 @@ NTSTATUS(*NtCreateFileOrig)
     PVOID              EaBuffer,
     ULONG              EaLength);
 
+PVOID
+SyscallHookGetKernelBase(PULONG pImageSize);
 VOID
 SSyscallHookEnableSCE();
 VOID
 SyscallHookDisableSCE();
+BOOLEAN
+SyscallHookIsSyscallWatched(UINT32 SyscallNumber);
 
 //////////////////////////////////////////////////
 //				   Hidden Hooks					//
@@ -116,3 +158,16 @@ PVOID(*ExAllocatePoolWithTagOrig)
 
 VOID
 HiddenHooksTest();
+
+/* Publish the details of a detour in the table of detours */
+BOOLEAN
+HiddenHooksDetourInsert(PHIDDEN_HOOKS_DETOUR_DETAILS DetourDetails);
+/* Remove the details of a detour from the table of detours */
+BOOLEAN
+HiddenHooksDetourRemove(PVOID HookedFunctionAddress, PVOID ReturnAddress);
+/* Empty the removed slots of the table of detours that are not needed for probing anymore */
+VOID
+HiddenHooksDetourReclaimRemovedSlots(UINT32 Index);
+/* Find the address that a detour continues from (lock-free, can be called from all cores) */
+PVOID
+HiddenHooksDetourFindReturnAddress(PVOID HookedFunctionAddress);
@@ -19,6 +19,10 @@
 #include "Vpid.h"
 #include "Vmcall.h"
 #include "Dpc.h"
+#include "Pml.h"
+#include "MemoryMapper.h"
+#include "DebuggerCommands.h"
+#include "Broadcast.h"
 
 /**
  * @brief Initialize Vmx operation
@@ -28,8 +32,9 @@
 BOOLEAN
 HvVmxInitialize()
 {
-    int                LogicalProcessorsCount;
-    IA32_VMX_BASIC_MSR VmxBasicMsr = {0};
+    int                 LogicalProcessorsCount;
+    IA32_VMX_BASIC_MSR  VmxBasicMsr         = {0};
+    BROADCAST_OPERATION InitializeOperation = {0};
 
     //
     // ****** Start Virtualizing Current System ******
@@ -75,18 +80,41 @@ HvVmxInitialize()
             //
             return FALSE;
         }
+
+        //
+        // Reserving the page that guest memory is read through in vmx-root
+        //
+        if (!MemoryMapperAllocateMappingAddress(ProcessorID))
+        {
+            return FALSE;
+        }
     }
 
     //
-    // As we want to support more than 32 processor (64 logical-core) we let windows execute our routine for us
+    // As we want to support more than 32 processor (64 logical-core) the routine is queued to all the cores
     //
-    KeGenericCallDpc(HvDpcBroadcastInitializeGuest, 0x0);
+    InitializeOperation.Type   = BROADCAST_OPERATION_ROUTINE;
+    InitializeOperation.Target = (UINT64)HvBroadcastInitializeGuest;
+
+    BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES, &InitializeOperation, 1, NULL);
 
     //
     // Check if everything is ok then return true otherwise false
     //
     if (AsmVmxVmcall(VMCALL_TEST, 0x22, 0x333, 0x4444) == STATUS_SUCCESS)
     {
+        //
+        // The EPT views of processes are removed when the processes exit
+        //
+        if (NT_SUCCESS(PsSetCreateProcessNotifyRoutine(EptProcessNotifyRoutine, FALSE)))
+        {
+            g_EptState->IsProcessNotifyRoutineRegistered = TRUE;
+        }
+        else
+        {
+            LogWarning("Unable to register the process notify routine, the EPT views of processes should be removed manually");
+        }
+
         return TRUE;
     }
     else
@@ -337,9 +365,18 @@ HvHandleControlRegisterAccess(PGUEST_REGS GuestState)
             break;
         case 3:
             NewCr3 = (*RegPtr & ~(1ULL << 63));
-            LogInfo("New process cr3 : 0x%llx , Proc id = : 0x%x", NewCr3, PsGetCurrentProcessId());
-            __vmx_vmwrite(GUEST_CR3, (*RegPtr & ~(1ULL << 63)));
+            __vmx_vmwrite(GUEST_CR3, NewCr3);
             InvvpidSingleContext(VPID_TAG);
+
+            //
+            // The cached translations of the memory mapper are flushed too
+            //
+            MemoryMapperInvalidateTranslationCache(KeGetCurrentProcessorNumber());
+
+            //
+            // Switch to the EPT view of the new process (if any)
+            //
+            EptSwitchProcessView(NewCr3);
             break;
         case 4:
             __vmx_vmwrite(GUEST_CR4, *RegPtr);
@@ -572,22 +609,52 @@ HvResumeToNextInstruction()
 
 /**
  * @brief Notify all core to invalidate their EPT
+ * @details The requests that arrive while another broadcast is being sent are
+ * coalesced into one broadcast, the function returns after a broadcast that is
+ * started after the request is completed, should be called at IRQL <= APC_LEVEL
+ * (the broadcasts are serialized by a mutex, so the sender might be preempted)
  * 
  * @return VOID 
  */
 VOID
 HvNotifyAllToInvalidateEpt()
 {
+    LONG64 Ticket;
+    LONG64 LastTicket;
+
+    //
+    // Any broadcast that is started after taking the ticket covers this request
+    //
+    Ticket = InterlockedIncrement64(&g_EptState->InvalidationBroadcastRequests);
+
+    ExAcquireFastMutex(&g_EptState->InvalidationBroadcastMutex);
+
+    if (g_EptState->InvalidationBroadcastsCompleted >= Ticket)
+    {
+        //
+        // Coalesced into the broadcast of another request
+        //
+        ExReleaseFastMutex(&g_EptState->InvalidationBroadcastMutex);
+        return;
+    }
+
+    LastTicket = g_EptState->InvalidationBroadcastRequests;
+
     //
-    // Let's notify them all
+    // Let's notify them all, each core invalidates all of its contexts once
     //
-    KeIpiGenericCall(HvInvalidateEptByVmcall, g_EptState->EptPointer.Flags);
+    KeIpiGenericCall(HvInvalidateEptByVmcall, NULL);
+
+    g_EptState->InvalidationBroadcastsCompleted = LastTicket;
+    g_EptState->InvalidationBroadcastsIssued++;
+
+    ExReleaseFastMutex(&g_EptState->InvalidationBroadcastMutex);
 }
 
 /**
  * @brief Invalidate EPT using Vmcall (should be called from Vmx non root mode)
  * 
- * @param Context Single context or all contexts
+ * @param Context NULL for all contexts, otherwise the single context of the current core
  * @return VOID 
  */
 VOID
@@ -603,9 +670,10 @@ HvInvalidateEptByVmcall(UINT64 Context)
     else
     {
         //
-        // We have to invalidate all contexts
+        // We have to invalidate the context of this core, each core might use
+        // a different EPT Pointer
         //
-        AsmVmxVmcall(VMCALL_INVEPT_SINGLE_CONTEXT, Context, NULL, NULL);
+        AsmVmxVmcall(VMCALL_INVEPT_SINGLE_CONTEXT, g_GuestState[KeGetCurrentProcessorNumber()].EptView.EptPointer.Flags, NULL, NULL);
     }
 }
 
@@ -632,24 +700,17 @@ HvReturnInstructionPointerForVmxoff()
 }
 
 //
-// The broadcast function which initialize the guest
+// The broadcast routine which initialize the guest
 //
-VOID
-HvDpcBroadcastInitializeGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+UINT64
+HvBroadcastInitializeGuest(UINT32 CoreIndex, PVOID Context)
 {
     //
     // Save the vmx state and prepare vmcs setup and finally execute vmlaunch instruction
     //
     AsmVmxSaveState();
-    //
-    // Wait for all DPCs to synchronize at this point
-    //
-    KeSignalCallDpcSynchronize(SystemArgument2);
 
-    //
-    // Mark the DPC as being complete
-    //
-    KeSignalCallDpcDone(SystemArgument1);
+    return 0;
 }
 
 /**
@@ -660,12 +721,43 @@ HvDpcBroadcastInitializeGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArg
 VOID
 HvTerminateVmx()
 {
+    BROADCAST_OPERATION TerminateOperation = {0};
+
     LogInfo("Terminating VMX...\n");
 
     //
     // ******* Terminating Vmx *******
     //
 
+    //
+    // Stop the timers of the MSR sampler as they're in the state of cores
+    //
+    DebuggerStopMsrSampler();
+
+    //
+    // Stop the binary syscall trace and free its rings as they're in the state of cores
+    //
+    DebuggerStopSyscallTrace();
+
+    //
+    // Free the filter of the EFER syscall hook
+    //
+    DebuggerClearSyscallFilter();
+
+    //
+    // Stop Page Modification Logging and its flush timer (if any)
+    //
+    PmlDisable();
+
+    //
+    // Stop removing the EPT views on process exit, it waits for the running notifications
+    //
+    if (g_EptState->IsProcessNotifyRoutineRegistered)
+    {
+        PsSetCreateProcessNotifyRoutine(EptProcessNotifyRoutine, TRUE);
+        g_EptState->IsProcessNotifyRoutineRegistered = FALSE;
+    }
+
     //
     // Remve All the hooks if any
     //
@@ -674,16 +766,24 @@ HvTerminateVmx()
     //
     // Broadcast to terminate Vmx
     //
-    KeGenericCallDpc(HvDpcBroadcastTerminateGuest, 0x0);
+    TerminateOperation.Type   = BROADCAST_OPERATION_ROUTINE;
+    TerminateOperation.Target = (UINT64)HvBroadcastTerminateGuest;
+
+    BroadcastWorkQueueSubmit(BROADCAST_ALL_CORES, &TerminateOperation, 1, NULL);
 
     //
     // ****** De-allocatee global variables ******
     //
 
     //
-    // Free Identity Page Table
+    // Free Identity Page Table and the private views of the cores
+    //
+    EptFreeAllPageTables();
+
+    //
+    // Free the mapping pages of the memory mapper
     //
-    MmFreeContiguousMemory(g_EptState->EptPageTable);
+    MemoryMapperFreeMappingAddresses();
 
     //
     // Free EptState
@@ -699,16 +799,14 @@ HvTerminateVmx()
 }
 
 /**
- * @brief The broadcast function which terminate the guest
+ * @brief The broadcast routine which terminate the guest
  * 
- * @param Dpc 
- * @param DeferredContext 
- * @param SystemArgument1 
- * @param SystemArgument2 
- * @return VOID 
+ * @param CoreIndex 
+ * @param Context 
+ * @return UINT64 
  */
-VOID
-HvDpcBroadcastTerminateGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+UINT64
+HvBroadcastTerminateGuest(UINT32 CoreIndex, PVOID Context)
 {
     //
     // Terminate Vmx using vmcall
@@ -716,17 +814,10 @@ HvDpcBroadcastTerminateGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgu
     if (!VmxTerminate())
     {
         LogError("There were an error terminating Vmx");
+        return FALSE;
     }
 
-    //
-    // Wait for all DPCs to synchronize at this point
-    //
-    KeSignalCallDpcSynchronize(SystemArgument2);
-
-    //
-    // Mark the DPC as being complete
-    //
-    KeSignalCallDpcDone(SystemArgument1);
+    return TRUE;
 }
 
 /**
@@ -900,11 +991,6 @@ HvDpcBroadcastRemoveHookAndInvalidateSingleEntry(KDPC * Dpc, PVOID DeferredConte
 BOOLEAN
 HvPerformPageUnHookSinglePage(UINT64 VirtualAddress)
 {
-    PLIST_ENTRY TempList = 0;
-    SIZE_T      PhysicalAddress;
-
-    PhysicalAddress = PAGE_ALIGN(VirtualAddressToPhysicalAddress(VirtualAddress));
-
     //
     // Should be called from vmx non-root
     //
@@ -913,42 +999,103 @@ HvPerformPageUnHookSinglePage(UINT64 VirtualAddress)
         return FALSE;
     }
 
-    TempList = &g_EptState->HookedPagesList;
-    while (&g_EptState->HookedPagesList != TempList->Flink)
+    return HvPerformPageUnHookSinglePhysicalPage((SIZE_T)PAGE_ALIGN(VirtualAddressToPhysicalAddress(VirtualAddress)));
+}
+
+/**
+ * @brief Remove the hooks of a physical page from the hooked pages list and invalidate TLB
+ * @details Should be called from vmx non-root, the pages that are linked to this page by
+ * the detours that pass the end of a page are also unhooked, the page that contains the
+ * head of a detour jump is unhooked before the page that contains its tail
+ * 
+ * @param PhysicalAddress The page aligned physical address to unhook
+ * @return BOOLEAN If unhook was successful it returns true or if it was not successful returns false
+ */
+BOOLEAN
+HvPerformPageUnHookSinglePhysicalPage(SIZE_T PhysicalAddress)
+{
+    PEPT_HOOKED_PAGE_DETAIL HookedEntry;
+    SIZE_T                  PreviousPages[EPT_MAX_SPANNED_PAGES];
+    SIZE_T                  NextPages[EPT_MAX_SPANNED_PAGES];
+    UINT32                  NumberOfPreviousPages;
+    UINT32                  NumberOfNextPages;
+    UINT32                  Index;
+    BOOLEAN                 IsHooked;
+    KIRQL                   OldIrql;
+
+    OldIrql = EptLockHookedPages();
+
+    if (EptFindHookedPage(NULL, PhysicalAddress) == NULL)
     {
-        TempList                            = TempList->Flink;
-        PEPT_HOOKED_PAGE_DETAIL HookedEntry = CONTAINING_RECORD(TempList, EPT_HOOKED_PAGE_DETAIL, PageHookList);
+        EptUnlockHookedPages(OldIrql);
 
-        if (HookedEntry->PhysicalBaseAddress == PhysicalAddress)
-        {
-            //
-            // Remove it in all the cores
-            //
-            KeGenericCallDpc(HvDpcBroadcastRemoveHookAndInvalidateSingleEntry, HookedEntry->PhysicalBaseAddress);
+        //
+        // Nothing found , probably the list is not found
+        //
+        return FALSE;
+    }
 
-            //
-            // remove the entry from the list
-            //
-            RemoveEntryList(HookedEntry->PageHookList.Flink);
+    //
+    // The linked pages are found before any of them is removed from the lists
+    //
+    NumberOfPreviousPages = EptGetSpannedHookedPages(PhysicalAddress, TRUE, PreviousPages);
+    NumberOfNextPages     = EptGetSpannedHookedPages(PhysicalAddress, FALSE, NextPages);
 
-            return TRUE;
-        }
+    EptUnlockHookedPages(OldIrql);
+
+    for (Index = 0; Index < NumberOfPreviousPages; Index++)
+    {
+        HvPerformPageUnHookSinglePhysicalPage(PreviousPages[Index]);
     }
+
     //
-    // Nothing found , probably the list is not found
+    // The page might be already removed as a linked page of a previous page
     //
-    return FALSE;
+    OldIrql  = EptLockHookedPages();
+    IsHooked = EptFindHookedPage(NULL, PhysicalAddress) != NULL;
+    EptUnlockHookedPages(OldIrql);
+
+    if (IsHooked)
+    {
+        //
+        // Remove it in all the cores (all the hooks of this page are removed)
+        //
+        KeGenericCallDpc(HvDpcBroadcastRemoveHookAndInvalidateSingleEntry, PhysicalAddress);
+
+        //
+        // remove the entries from the lists, the vm-exits of the other cores
+        // find the hooks while holding the same lock
+        //
+        OldIrql = EptLockHookedPages();
+
+        while ((HookedEntry = EptFindHookedPage(NULL, PhysicalAddress)) != NULL)
+        {
+            EptRemoveHookedPage(HookedEntry);
+        }
+
+        EptUnlockHookedPages(OldIrql);
+    }
+
+    for (Index = 0; Index < NumberOfNextPages; Index++)
+    {
+        HvPerformPageUnHookSinglePhysicalPage(NextPages[Index]);
+    }
+
+    return TRUE;
 }
 
 /**
  * @brief Remove all hooks from the hooked pages list and invalidate TLB
- * @detailsShould be called from Vmx Non-root
+ * @details Should be called from Vmx Non-root, the details of the hooked pages
+ * and their detours are removed too, so the table of detours becomes empty
  * 
  * @return VOID 
  */
 VOID
 HvPerformPageUnHookAllPages()
 {
+    KIRQL OldIrql;
+
     //
     // Should be called from vmx non-root
     //
@@ -963,6 +1110,14 @@ HvPerformPageUnHookAllPages()
     KeGenericCallDpc(HvDpcBroadcastRemoveHookAndInvalidateAllEntries, 0x0);
 
     //
-    // No need to remove the list as it will automatically remove by the pool uninitializer
+    // remove the entries from the lists (the buffers are freed later by the pool manager)
     //
+    OldIrql = EptLockHookedPages();
+
+    while (!IsListEmpty(&g_EptState->HookedPagesList))
+    {
+        EptRemoveHookedPage(CONTAINING_RECORD(g_EptState->HookedPagesList.Flink, EPT_HOOKED_PAGE_DETAIL, PageHookList));
+    }
+
+    EptUnlockHookedPages(OldIrql);
 }
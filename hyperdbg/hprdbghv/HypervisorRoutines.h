@@ -66,12 +66,12 @@ HvResumeToNextInstruction();
 /* Invalidate EPT using Vmcall (should be called from Vmx non root mode) */
 VOID
 HvInvalidateEptByVmcall(UINT64 Context);
-/* The broadcast function which initialize the guest */
-VOID
-HvDpcBroadcastInitializeGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
-/* The broadcast function which terminate the guest */
-VOID
-HvDpcBroadcastTerminateGuest(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+/* The broadcast routine which initialize the guest */
+UINT64
+HvBroadcastInitializeGuest(UINT32 CoreIndex, PVOID Context);
+/* The broadcast routine which terminate the guest */
+UINT64
+HvBroadcastTerminateGuest(UINT32 CoreIndex, PVOID Context);
 /* Terminate Vmx on all logical cores */
 VOID
 HvTerminateVmx();
@@ -95,6 +95,9 @@ HvRestoreRegisters();
 /* Remove single hook from the hooked pages list and invalidate TLB */
 BOOLEAN
 HvPerformPageUnHookSinglePage(UINT64 VirtualAddress);
+/* Remove the hooks of a physical page and its linked pages from the hooked pages list and invalidate TLB */
+BOOLEAN
+HvPerformPageUnHookSinglePhysicalPage(SIZE_T PhysicalAddress);
 /* Remove all hooks from the hooked pages list and invalidate TLB */
 VOID
 HvPerformPageUnHookAllPages();
@@ -11,6 +11,8 @@
  */
 #include "Invept.h"
 #include "InlineAsm.h"
+#include "GlobalVariables.h"
+#include "MemoryMapper.h"
 
 /**
  * @brief Invoke the Invept instruction
@@ -56,3 +58,99 @@ InveptAllContexts()
 {
     return Invept(INVEPT_ALL_CONTEXTS, NULL);
 }
+
+/**
+ * @brief Defer the invalidation of a single context until the next vm-entry
+ * @details This function should be called from vmx root-mode, the same EPT
+ * Pointer is invalidated once even if it's requested more than once
+ * 
+ * @param EptPointer 
+ * @return VOID 
+ */
+VOID
+InveptQueueSingleContext(UINT64 EptPointer)
+{
+    UINT32                     Index;
+    PEPT_PENDING_INVALIDATIONS Pending = &g_GuestState[KeGetCurrentProcessorNumber()].PendingInvalidations;
+
+    Pending->RequestedCount++;
+
+    if (Pending->AllContexts)
+    {
+        return;
+    }
+
+    for (Index = 0; Index < Pending->NumberOfEptPointers; Index++)
+    {
+        if (Pending->EptPointers[Index] == EptPointer)
+        {
+            return;
+        }
+    }
+
+    if (Pending->NumberOfEptPointers == EPT_PENDING_INVALIDATIONS_MAX)
+    {
+        //
+        // Too many contexts, invalidate all of them at once
+        //
+        Pending->AllContexts = TRUE;
+        return;
+    }
+
+    Pending->EptPointers[Pending->NumberOfEptPointers++] = EptPointer;
+}
+
+/**
+ * @brief Defer the invalidation of all contexts until the next vm-entry
+ * @details This function should be called from vmx root-mode
+ * 
+ * @return VOID 
+ */
+VOID
+InveptQueueAllContexts()
+{
+    PEPT_PENDING_INVALIDATIONS Pending = &g_GuestState[KeGetCurrentProcessorNumber()].PendingInvalidations;
+
+    Pending->RequestedCount++;
+    Pending->AllContexts = TRUE;
+}
+
+/**
+ * @brief Execute the deferred invalidations of the current core
+ * @details This function should be called from vmx root-mode before
+ * resuming the guest
+ * 
+ * @return VOID 
+ */
+VOID
+InveptFlushPendingInvalidations()
+{
+    UINT32                     Index;
+    PEPT_PENDING_INVALIDATIONS Pending = &g_GuestState[KeGetCurrentProcessorNumber()].PendingInvalidations;
+
+    if (Pending->AllContexts)
+    {
+        InveptAllContexts();
+        Pending->IssuedCount++;
+    }
+    else
+    {
+        for (Index = 0; Index < Pending->NumberOfEptPointers; Index++)
+        {
+            InveptSingleContext(Pending->EptPointers[Index]);
+            Pending->IssuedCount++;
+        }
+    }
+
+    //
+    // The cached translations of the memory mapper are dropped at the same points
+    // as the cached translations of the processor
+    //
+    if (Pending->AllContexts || Pending->NumberOfEptPointers != 0)
+    {
+        MemoryMapperInvalidateTranslationCache(KeGetCurrentProcessorNumber());
+    }
+
+    Pending->AllContexts         = FALSE;
+    Pending->NumberOfEptPointers = 0;
+}
@@ -34,3 +34,11 @@ unsigned char
 InveptAllContexts();
 unsigned char
 InveptSingleContext(UINT64 EptPonter);
+
+// Deferred invalidations of the current core (vmx-root)
+VOID
+InveptQueueSingleContext(UINT64 EptPointer);
+VOID
+InveptQueueAllContexts();
+VOID
+InveptFlushPendingInvalidations();
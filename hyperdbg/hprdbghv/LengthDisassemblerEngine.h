@@ -16,7 +16,7 @@
 #ifndef LDISASM_H
 #    define LDISASM_H
 
-#    include <ntddk.h>
+#    include "Portable.h"
 
 #    define LDISASM_R (*b >> 4)  // Four high-order bits of an opcode to index a row of the opcode table
 #    define LDISASM_C (*b & 0xF) // Four low-order bits to index a column of the table
@@ -27,7 +27,7 @@ static const UINT8 op1imm8[]        = {0x6A, 0x6B, 0x80, 0x82, 0x83, 0xA8, 0xC0,
 static const UINT8 op1imm32[]       = {0x68, 0x69, 0x81, 0xA9, 0xC7, 0xE8, 0xE9};
 static const UINT8 op2modrm[]       = {0x0D, 0xA3, 0xA4, 0xA5, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF};
 
-inline BOOLEAN
+static inline BOOLEAN
 findByte(const UINT8 * arr, const size_t N, const UINT8 x)
 {
     for (size_t i = 0; i < N; i++)
@@ -40,7 +40,7 @@ findByte(const UINT8 * arr, const size_t N, const UINT8 x)
     return FALSE;
 }
 
-inline void
+static inline void
 parseModRM(UINT8 ** b, const BOOLEAN addressPrefix)
 {
     UINT8 modrm = *++*b;
@@ -62,15 +62,26 @@ parseModRM(UINT8 ** b, const BOOLEAN addressPrefix)
         *b += 2;
 };
 
-inline size_t
-ldisasm(const void * const address, const BOOLEAN x86_64_mode)
+/**
+ * @brief Compute the length of an instruction and the offset of its ModR/M byte
+ * 
+ * @param address The address of the instruction
+ * @param x86_64_mode Whether the instruction is 64-bit code
+ * @param modrmOffset The offset of the ModR/M byte or zero if the instruction doesn't have it (optional)
+ * @return size_t The length of the instruction
+ */
+static inline size_t
+ldisasmex(const void * const address, const BOOLEAN x86_64_mode, size_t * const modrmOffset)
 {
     size_t  offset        = 0;
     BOOLEAN operandPrefix = FALSE, addressPrefix = FALSE, rexW = FALSE;
     UINT8 * b = (UINT8 *)(address);
 
+    if (modrmOffset)
+        *modrmOffset = 0;
+
     //Parse legacy prefixes & REX prefixes
-    for (int i = 0; i < 14 && findByte(legacyPrefixes, sizeof(legacyPrefixes), *b) || ((x86_64_mode) ? (LDISASM_R == 4) : FALSE); i++, b++)
+    for (int i = 0; (i < 14 && findByte(legacyPrefixes, sizeof(legacyPrefixes), *b)) || ((x86_64_mode) ? (LDISASM_R == 4) : FALSE); i++, b++)
     {
         if (*b == 0x66)
             operandPrefix = TRUE;
@@ -89,6 +100,8 @@ ldisasm(const void * const address, const BOOLEAN x86_64_mode)
             if (*b++ == 0x3A)
                 offset++;
 
+            if (modrmOffset)
+                *modrmOffset = (size_t)(b + 1 - (UINT8 *)address);
             parseModRM(&b, addressPrefix);
         }
         else // 2 bytes
@@ -100,7 +113,11 @@ ldisasm(const void * const address, const BOOLEAN x86_64_mode)
 
             //Check for ModR/M, SIB and displacement
             if (findByte(op2modrm, sizeof(op2modrm), *b) || (LDISASM_R != 3 && LDISASM_R > 0 && LDISASM_R < 7) || *b >= 0xD0 || (LDISASM_R == 7 && LDISASM_C != 7) || LDISASM_R == 9 || LDISASM_R == 0xB || (LDISASM_R == 0xC && LDISASM_C < 8) || (LDISASM_R == 0 && LDISASM_C < 4))
+            {
+                if (modrmOffset)
+                    *modrmOffset = (size_t)(b + 1 - (UINT8 *)address);
                 parseModRM(&b, addressPrefix);
+            }
         }
     }
     else // 1 byte
@@ -112,19 +129,29 @@ ldisasm(const void * const address, const BOOLEAN x86_64_mode)
             offset += 2;
         else if (*b == 0xC8) //imm16 + imm8
             offset += 3;
-        else if ((LDISASM_R < 4 && (LDISASM_C == 5 || LDISASM_C == 0xD)) || (LDISASM_R == 0xB && LDISASM_C >= 8) || (*b == 0xF7 && !(*(b + 1) & 48)) || findByte(op1imm32, sizeof(op1imm32), *b)) //imm32,16
-            offset += (rexW) ? 8 : (operandPrefix ? 2 : 4);
-        else if (LDISASM_R == 0xA && LDISASM_C < 4)
-            offset += (rexW) ? 8 : (addressPrefix ? 2 : 4);
+        else if ((LDISASM_R < 4 && (LDISASM_C == 5 || LDISASM_C == 0xD)) || (LDISASM_R == 0xB && LDISASM_C >= 8) || (*b == 0xF7 && !(*(b + 1) & 48)) || findByte(op1imm32, sizeof(op1imm32), *b)) //imm32,16 (only mov r64, imm64 has an imm64 and near branches ignore 0x66 in 64-bit mode)
+            offset += (rexW && LDISASM_R == 0xB) ? 8 : ((operandPrefix && !(x86_64_mode && (*b == 0xE8 || *b == 0xE9))) ? 2 : 4);
+        else if (LDISASM_R == 0xA && LDISASM_C < 4) //moffs
+            offset += (x86_64_mode) ? (addressPrefix ? 4 : 8) : (addressPrefix ? 2 : 4);
         else if (*b == 0xEA || *b == 0x9A) //imm32,48
             offset += operandPrefix ? 4 : 6;
 
         //Check for ModR/M, SIB and displacement
         if (findByte(op1modrm, sizeof(op1modrm), *b) || (LDISASM_R < 4 && (LDISASM_C < 4 || (LDISASM_C >= 8 && LDISASM_C < 0xC))) || LDISASM_R == 8 || (LDISASM_R == 0xD && LDISASM_C >= 8))
+        {
+            if (modrmOffset)
+                *modrmOffset = (size_t)(b + 1 - (UINT8 *)address);
             parseModRM(&b, addressPrefix);
+        }
     }
 
     return (size_t)((ptrdiff_t)(++b + offset) - (ptrdiff_t)(address));
 }
 
+static inline size_t
+ldisasm(const void * const address, const BOOLEAN x86_64_mode)
+{
+    return ldisasmex(address, x86_64_mode, NULL);
+}
+
 #endif //LDISASM_H
@@ -44,7 +44,7 @@ LogInitialize()
     //
     // Initialize the lock for Vmx-root mode (HIGH_IRQL Spinlock)
     //
-    VmxRootLoggingLock = 0;
+    RtlZeroMemory(&VmxRootLoggingLock, sizeof(SPINLOCK_TICKET));
 
     //
     // Allocate buffer for messages and initialize the core buffer information
@@ -148,7 +148,7 @@ LogSendBuffer(UINT32 OperationCode, PVOID Buffer, UINT32 BufferLength)
         // Set the index
         //
         Index = 1;
-        SpinlockLock(&VmxRootLoggingLock);
+        SpinlockTicketLock(&VmxRootLoggingLock);
     }
     else
     {
@@ -179,12 +179,22 @@ LogSendBuffer(UINT32 OperationCode, PVOID Buffer, UINT32 BufferLength)
     //
     BUFFER_HEADER * Header = (BUFFER_HEADER *)((UINT64)MessageBufferInformation[Index].BufferStartAddress + (MessageBufferInformation[Index].CurrentIndexToWrite * (PacketChunkSize + sizeof(BUFFER_HEADER))));
 
+    //
+    // The reader of the vmx-root buffer doesn't hold the vmx-root lock, so
+    // a message that is not read yet is never overwritten, the new message
+    // is dropped instead
+    //
+    if (IsVmxRoot && Header->Valid)
+    {
+        SpinlockTicketUnlock(&VmxRootLoggingLock);
+        return FALSE;
+    }
+
     //
     // Set the header
     //
     Header->OpeationNumber = OperationCode;
     Header->BufferLength   = BufferLength;
-    Header->Valid          = TRUE;
 
     //
     // ******** Now it's time to fill the buffer ********
@@ -200,6 +210,12 @@ LogSendBuffer(UINT32 OperationCode, PVOID Buffer, UINT32 BufferLength)
     //
     RtlCopyBytes(SavingBuffer, Buffer, BufferLength);
 
+    //
+    // The message is valid only after it's completely written
+    //
+    KeMemoryBarrier();
+    Header->Valid = TRUE;
+
     //
     // Increment the next index to write
     //
@@ -236,7 +252,7 @@ LogSendBuffer(UINT32 OperationCode, PVOID Buffer, UINT32 BufferLength)
     //
     if (IsVmxRoot)
     {
-        SpinlockUnlock(&VmxRootLoggingLock);
+        SpinlockTicketUnlock(&VmxRootLoggingLock);
     }
     else
     {
@@ -245,10 +261,16 @@ LogSendBuffer(UINT32 OperationCode, PVOID Buffer, UINT32 BufferLength)
         //
         KeReleaseSpinLock(&MessageBufferInformation[Index].BufferLock, OldIRQL);
     }
+
+    return TRUE;
 }
 
 /**
  * @brief Attempt to read the buffer 
+ * @details It's called in vmx non-root, the readers of both buffers are
+ * serialized by the windows spinlock of the buffer, the vmx-root lock is
+ * never acquired here because a vm-exit on this core might wait for it,
+ * the vmx-root writers don't touch a message until it's marked as read
  * 
  * @param IsVmxRoot Determine whether you want to read vmx root buffer or vmx non root buffer
  * @param BufferToSaveMessage Target buffer to save the message
@@ -263,33 +285,14 @@ LogReadBuffer(BOOLEAN IsVmxRoot, PVOID BufferToSaveMessage, UINT32 * ReturnedLen
     UINT32 Index;
 
     //
-    // Check if we're in Vmx-root, if it is then we use our customized HIGH_IRQL Spinlock,
-    // if not we use the windows spinlock
+    // Set the index of the vmx-root or the vmx non-root buffer
     //
-    if (IsVmxRoot)
-    {
-        //
-        // Set the index
-        //
-        Index = 1;
+    Index = IsVmxRoot ? 1 : 0;
 
-        //
-        // Acquire the lock
-        //
-        SpinlockLock(&VmxRootLoggingLock);
-    }
-    else
-    {
-        //
-        // Set the index
-        //
-        Index = 0;
-
-        //
-        // Acquire the lock
-        //
-        KeAcquireSpinLock(&MessageBufferInformation[Index].BufferLock, &OldIRQL);
-    }
+    //
+    // Acquire the lock of the readers
+    //
+    KeAcquireSpinLock(&MessageBufferInformation[Index].BufferLock, &OldIRQL);
 
     //
     // Compute the current buffer to read
@@ -301,12 +304,15 @@ LogReadBuffer(BOOLEAN IsVmxRoot, PVOID BufferToSaveMessage, UINT32 * ReturnedLen
         //
         // there is nothing to send
         //
+        KeReleaseSpinLock(&MessageBufferInformation[Index].BufferLock, OldIRQL);
         return FALSE;
     }
 
     //
-    // If we reached here, means that there is sth to send
+    // If we reached here, means that there is sth to send, the message is
+    // read after its valid flag
     //
+    KeMemoryBarrier();
 
     //
     // First copy the header
@@ -352,23 +358,25 @@ LogReadBuffer(BOOLEAN IsVmxRoot, PVOID BufferToSaveMessage, UINT32 * ReturnedLen
     }
 #endif
 
-    //
-    // Finally, set the current index to invalid as we sent it
-    //
-    Header->Valid = FALSE;
-
     //
     // Set the length to show as the ReturnedByted in usermode ioctl funtion + size of header
     //
     *ReturnedLength = Header->BufferLength + sizeof(UINT32);
 
     //
-    // Last step is to clear the current buffer (we can't do it once when CurrentIndexToSend is zero because
+    // Clear the current buffer (we can't do it once when CurrentIndexToSend is zero because
     // there might be multiple messages on the start of the queue that didn't read yet)
     // we don't free the header
     //
     RtlZeroMemory(SendingBuffer, Header->BufferLength);
 
+    //
+    // Finally, set the current index to invalid as we sent it, after this
+    // the writers can use it again
+    //
+    KeMemoryBarrier();
+    Header->Valid = FALSE;
+
     //
     // Check to see whether we passed the index or not
     //
@@ -385,20 +393,11 @@ LogReadBuffer(BOOLEAN IsVmxRoot, PVOID BufferToSaveMessage, UINT32 * ReturnedLen
     }
 
     //
-    // Check if we're in Vmx-root, if it is then we use our customized HIGH_IRQL Spinlock,
-    // if not we use the windows spinlock
+    // Release the lock of the readers
     //
-    if (IsVmxRoot)
-    {
-        SpinlockUnlock(&VmxRootLoggingLock);
-    }
-    else
-    {
-        //
-        // Release the lock
-        //
-        KeReleaseSpinLock(&MessageBufferInformation[Index].BufferLock, OldIRQL);
-    }
+    KeReleaseSpinLock(&MessageBufferInformation[Index].BufferLock, OldIRQL);
+
+    return TRUE;
 }
 
 /**
@@ -622,7 +621,7 @@ LogSendMessageToQueue(UINT32 OperationCode, BOOLEAN IsImmediateMessage, BOOLEAN
             // Set the index
             //
             Index = 1;
-            SpinlockLock(&VmxRootLoggingLockForNonImmBuffers);
+            SpinlockTicketLock(&VmxRootLoggingLockForNonImmBuffers);
         }
         else
         {
@@ -678,7 +677,7 @@ LogSendMessageToQueue(UINT32 OperationCode, BOOLEAN IsImmediateMessage, BOOLEAN
         //
         if (IsVmxRootMode)
         {
-            SpinlockUnlock(&VmxRootLoggingLockForNonImmBuffers);
+            SpinlockTicketUnlock(&VmxRootLoggingLockForNonImmBuffers);
         }
         else
         {
@@ -12,6 +12,7 @@
 
 #pragma once
 #include "Definition.h"
+#include "Spinlock.h"
 
 //////////////////////////////////////////////////
 //					Structures					//
@@ -82,10 +83,10 @@ typedef struct _DEBUGGER_CORE_EVENTS
 LOG_BUFFER_INFORMATION * MessageBufferInformation;
 
 /* Vmx-root lock for logging */
-volatile LONG VmxRootLoggingLock;
+SPINLOCK_TICKET VmxRootLoggingLock;
 
 /* Vmx-root lock for logging */
-volatile LONG VmxRootLoggingLockForNonImmBuffers;
+SPINLOCK_TICKET VmxRootLoggingLockForNonImmBuffers;
 
 //////////////////////////////////////////////////
 //					Illustration				//
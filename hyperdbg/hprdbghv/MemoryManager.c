@@ -12,14 +12,70 @@
 
 #include <ntifs.h>
 #include "Definition.h"
+#include "Debugger.h"
+
+/**
+ * @brief Copy the virtual memory of the current context page by page
+ * @details Each page is translated by itself because the pages of a
+ * virtual range are not physically contiguous, the copy stops at the
+ * first page that is not present
+ * 
+ * @param Address The virtual address
+ * @param Buffer The buffer to fill
+ * @param Size Size of the range
+ * @return SIZE_T Number of the copied bytes
+ */
+SIZE_T
+MemoryManagerCopyVirtualMemoryByPages(UINT64 Address, PVOID Buffer, SIZE_T Size)
+{
+    MM_COPY_ADDRESS  CopyAddress = {0};
+    PHYSICAL_ADDRESS PhysicalAddress;
+    SIZE_T           SizeOfChunk;
+    SIZE_T           CopiedBytes;
+    SIZE_T           TotalCopiedBytes = 0;
+
+    while (Size != 0)
+    {
+        SizeOfChunk = PAGE_SIZE - (Address & (PAGE_SIZE - 1));
+
+        if (SizeOfChunk > Size)
+        {
+            SizeOfChunk = Size;
+        }
+
+        PhysicalAddress = MmGetPhysicalAddress((PVOID)Address);
+
+        if (PhysicalAddress.QuadPart == NULL)
+        {
+            break;
+        }
+
+        CopyAddress.PhysicalAddress.QuadPart = PhysicalAddress.QuadPart;
+        CopiedBytes                          = 0;
+
+        MmCopyMemory(Buffer, CopyAddress, SizeOfChunk, MM_COPY_MEMORY_PHYSICAL, &CopiedBytes);
+
+        TotalCopiedBytes += CopiedBytes;
+
+        if (CopiedBytes != SizeOfChunk)
+        {
+            break;
+        }
+
+        Address += SizeOfChunk;
+        Buffer = (PVOID)((UINT64)Buffer + SizeOfChunk);
+        Size   -= SizeOfChunk;
+    }
+
+    return TotalCopiedBytes;
+}
 
 NTSTATUS
 MemoryManagerReadProcessMemoryNormal(HANDLE PID, PVOID Address, DEBUGGER_READ_MEMORY_TYPE MemType, PVOID UserBuffer, SIZE_T Size, PSIZE_T ReturnSize)
 {
-    PEPROCESS        SourceProcess;
-    MM_COPY_ADDRESS  CopyAddress         = {0};
-    KAPC_STATE       State               = {0};
-    PHYSICAL_ADDRESS TempPhysicalAddress = {0};
+    PEPROCESS       SourceProcess;
+    MM_COPY_ADDRESS CopyAddress = {0};
+    KAPC_STATE      State       = {0};
 
     //
     // Check if we want another process memory, this way we attach to that process
@@ -48,23 +104,21 @@ MemoryManagerReadProcessMemoryNormal(HANDLE PID, PVOID Address, DEBUGGER_READ_ME
             KeStackAttachProcess(SourceProcess, &State);
 
             //
-            // We're in context of another process let's read the memory
+            // We're in context of another process let's read the memory, each
+            // page is translated by itself as the range is not physically
+            // contiguous
             //
-            TempPhysicalAddress = MmGetPhysicalAddress(Address);
+            *ReturnSize = MemoryManagerCopyVirtualMemoryByPages((UINT64)Address, UserBuffer, Size);
 
             KeUnstackDetachProcess(&State);
-
-            //
-            // Now we have to read the physical address
-            //
-            CopyAddress.PhysicalAddress.QuadPart = TempPhysicalAddress.QuadPart;
-            MmCopyMemory(UserBuffer, CopyAddress, Size, MM_COPY_MEMORY_PHYSICAL, ReturnSize);
+            ObDereferenceObject(SourceProcess);
 
             return STATUS_SUCCESS;
         }
         __except (EXCEPTION_EXECUTE_HANDLER)
         {
             KeUnstackDetachProcess(&State);
+            ObDereferenceObject(SourceProcess);
             return STATUS_UNSUCCESSFUL;
         }
     }
@@ -107,3 +161,234 @@ MemoryManagerReadProcessMemoryNormal(HANDLE PID, PVOID Address, DEBUGGER_READ_ME
     }
 }
 
+
+/**
+ * @brief Read a list of ranges of a process under a single attach
+ * @details The offsets of the ranges are already validated, each range
+ * gets its own status so a range that is not present doesn't fail the others
+ * 
+ * @param PID The target process
+ * @param MemType Virtual or physical ranges
+ * @param Ranges The ranges to read
+ * @param NumberOfRanges Number of the ranges
+ * @param RequestBuffer Base of the offsets of the ranges
+ * @return NTSTATUS 
+ */
+NTSTATUS
+MemoryManagerReadProcessMemoryScatter(HANDLE PID, DEBUGGER_READ_MEMORY_TYPE MemType, PDEBUGGER_READ_MEMORY_RANGE Ranges, UINT32 NumberOfRanges, PVOID RequestBuffer)
+{
+    PEPROCESS       SourceProcess = NULL;
+    KAPC_STATE      State         = {0};
+    MM_COPY_ADDRESS CopyAddress   = {0};
+    SIZE_T          CopiedBytes;
+    PVOID           Destination;
+    NTSTATUS        Status = STATUS_SUCCESS;
+
+    //
+    // Reading physical addresses doesn't need to attach to another process
+    //
+    if (MemType == DEBUGGER_READ_VIRTUAL_ADDRESS && PsGetCurrentProcessId() != PID)
+    {
+        if (PsLookupProcessByProcessId(PID, &SourceProcess) != STATUS_SUCCESS)
+        {
+            //
+            // if the process not found
+            //
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        KeStackAttachProcess(SourceProcess, &State);
+    }
+
+    __try
+    {
+        for (UINT32 i = 0; i < NumberOfRanges; i++)
+        {
+            Destination = (PVOID)((UINT64)RequestBuffer + Ranges[i].Offset);
+
+            if (MemType == DEBUGGER_READ_VIRTUAL_ADDRESS)
+            {
+                CopiedBytes = MemoryManagerCopyVirtualMemoryByPages(Ranges[i].Address, Destination, Ranges[i].Size);
+            }
+            else
+            {
+                CopyAddress.PhysicalAddress.QuadPart = Ranges[i].Address;
+                CopiedBytes                          = 0;
+
+                MmCopyMemory(Destination, CopyAddress, Ranges[i].Size, MM_COPY_MEMORY_PHYSICAL, &CopiedBytes);
+            }
+
+            Ranges[i].ReadBytes = (UINT32)CopiedBytes;
+            Ranges[i].Status    = CopiedBytes == Ranges[i].Size ? STATUS_SUCCESS : STATUS_PARTIAL_COPY;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = STATUS_ACCESS_DENIED;
+    }
+
+    if (SourceProcess != NULL)
+    {
+        KeUnstackDetachProcess(&State);
+        ObDereferenceObject(SourceProcess);
+    }
+
+    return Status;
+}
+
+/**
+ * @brief Search the virtual memory of a process for a pattern
+ * @details The range is copied page by page under a single attach, the
+ * pages that can't be copied (not present) are skipped, and the last bytes
+ * of each page are kept before the next page so the matches that cross a
+ * page are found too. At most DEBUGGER_SEARCH_MEMORY_MAX_BYTES_PER_REQUEST
+ * bytes are scanned so a request doesn't keep the process attached for a
+ * long time, the caller continues the search from NextAddress
+ * 
+ * @param PID The target process
+ * @param Address Start of the range
+ * @param Length Size of the range
+ * @param Matcher The prepared pattern
+ * @param Results The addresses of the matches
+ * @param MaxResults Maximum number of the addresses
+ * @param NumberOfResults Number of the found addresses
+ * @param NextAddress Where to continue if there was no room for all of the matches or the
+ * range is not completely scanned, otherwise zero
+ * @return NTSTATUS 
+ */
+NTSTATUS
+MemoryManagerSearchProcessMemory(HANDLE PID, UINT64 Address, UINT64 Length, PPATTERN_MATCHER Matcher, PUINT64 Results, UINT32 MaxResults, PUINT32 NumberOfResults, PUINT64 NextAddress)
+{
+    PEPROCESS       SourceProcess = NULL;
+    KAPC_STATE      State         = {0};
+    MM_COPY_ADDRESS CopyAddress   = {0};
+    PUCHAR          Buffer;
+    UINT64          EndAddress;
+    UINT64          LimitAddress;
+    UINT64          CurrentAddress;
+    UINT64          NextPageAddress;
+    SIZE_T          SizeOfChunk;
+    SIZE_T          CopiedBytes;
+    SIZE_T          CarriedBytes = 0;
+    SIZE_T          AvailableBytes;
+    SIZE_T          Offset;
+    NTSTATUS        Status = STATUS_SUCCESS;
+
+    *NumberOfResults = 0;
+    *NextAddress     = 0;
+
+    if (Length == 0 || Address + Length < Address)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    EndAddress = Address + Length;
+
+    //
+    // The limit is at the start of a page, so a chunk doesn't cross it
+    //
+    LimitAddress = (Address & ~((UINT64)PAGE_SIZE - 1)) + DEBUGGER_SEARCH_MEMORY_MAX_BYTES_PER_REQUEST;
+
+    if (LimitAddress < Address || LimitAddress > EndAddress)
+    {
+        LimitAddress = EndAddress;
+    }
+
+    //
+    // A page and the bytes that are kept from the previous page
+    //
+    Buffer = ExAllocatePoolWithTag(NonPagedPool, PAGE_SIZE + Matcher->PatternLength, POOLTAG);
+
+    if (Buffer == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (PsGetCurrentProcessId() != PID)
+    {
+        if (PsLookupProcessByProcessId(PID, &SourceProcess) != STATUS_SUCCESS)
+        {
+            //
+            // if the process not found
+            //
+            ExFreePoolWithTag(Buffer, POOLTAG);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        KeStackAttachProcess(SourceProcess, &State);
+    }
+
+    __try
+    {
+        for (CurrentAddress = Address; CurrentAddress < LimitAddress; CurrentAddress = NextPageAddress)
+        {
+            NextPageAddress = (CurrentAddress & ~((UINT64)PAGE_SIZE - 1)) + PAGE_SIZE;
+            SizeOfChunk     = (NextPageAddress < EndAddress && NextPageAddress != 0 ? NextPageAddress : EndAddress) - CurrentAddress;
+
+            CopyAddress.VirtualAddress = (PVOID)CurrentAddress;
+
+            if (MmCopyMemory(Buffer + CarriedBytes, CopyAddress, SizeOfChunk, MM_COPY_MEMORY_VIRTUAL, &CopiedBytes) != STATUS_SUCCESS ||
+                CopiedBytes != SizeOfChunk)
+            {
+                //
+                // The page is not present, a match can't cross it
+                //
+                CarriedBytes = 0;
+            }
+            else
+            {
+                AvailableBytes = CarriedBytes + SizeOfChunk;
+                Offset         = 0;
+
+                while ((Offset = PatternMatcherFind(Matcher, Buffer, AvailableBytes, Offset)) != PATTERN_MATCHER_NOT_FOUND)
+                {
+                    if (*NumberOfResults == MaxResults)
+                    {
+                        *NextAddress = CurrentAddress - CarriedBytes + Offset;
+                        __leave;
+                    }
+
+                    Results[(*NumberOfResults)++] = CurrentAddress - CarriedBytes + Offset;
+                    Offset++;
+                }
+
+                //
+                // Keep the bytes that might be the start of a match in the next page
+                //
+                CarriedBytes = min(AvailableBytes, Matcher->PatternLength - 1);
+                RtlMoveMemory(Buffer, Buffer + AvailableBytes - CarriedBytes, CarriedBytes);
+            }
+
+            if (NextPageAddress == 0)
+            {
+                //
+                // The end of the address space
+                //
+                break;
+            }
+        }
+
+        //
+        // The next request scans the kept bytes again, they're shorter than the
+        // pattern so they don't have a match of their own
+        //
+        if (CurrentAddress == LimitAddress && LimitAddress != EndAddress)
+        {
+            *NextAddress = CurrentAddress - CarriedBytes;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = STATUS_ACCESS_DENIED;
+    }
+
+    if (SourceProcess != NULL)
+    {
+        KeUnstackDetachProcess(&State);
+        ObDereferenceObject(SourceProcess);
+    }
+
+    ExFreePoolWithTag(Buffer, POOLTAG);
+
+    return Status;
+}
@@ -0,0 +1,288 @@
+/**
+ * @file MemoryMapper.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Safe access to the guest memory from vmx-root
+ * @details Each core reserves a page of system address space, in vmx-root
+ * the PTE of this page is pointed to the target physical page so any guest
+ * physical page can be read without a page fault and without switching to
+ * the guest's cr3
+ * @version 0.1
+ * @date 2020-05-06
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "MemoryMapper.h"
+#include "Vmx.h"
+#include "Common.h"
+#include "GlobalVariables.h"
+
+/**
+ * @brief Find the PTE of a kernel virtual address in the current page table
+ * @details Should be called from vmx non-root mode, the paging structures of
+ * the kernel are shared among all processes so the PTE is valid in vmx-root too
+ * 
+ * @param VirtualAddress The kernel virtual address
+ * @return PUINT64 The virtual address of the PTE or NULL if it's not mapped by a 4KB page
+ */
+PUINT64
+MemoryMapperGetPteVirtualAddress(PVOID VirtualAddress)
+{
+    UINT64  TableAddress;
+    PUINT64 Entry;
+    UINT32  Shift;
+
+    TableAddress = __readcr3() & MEMORY_MAPPER_PAGE_FRAME_MASK;
+
+    //
+    // Walk PML4, PDPT and PD to reach the PTE
+    //
+    for (INT Level = 4; Level >= 1; Level--)
+    {
+        Shift = 12 + (Level - 1) * 9;
+        Entry = (PUINT64)PhysicalAddressToVirtualAddress(TableAddress + ((((UINT64)VirtualAddress) >> Shift) & 0x1ff) * sizeof(UINT64));
+
+        if (Entry == NULL)
+        {
+            return NULL;
+        }
+
+        if (Level == 1)
+        {
+            return Entry;
+        }
+
+        if (!(*Entry & MEMORY_MAPPER_PAGE_PRESENT) || (*Entry & MEMORY_MAPPER_PAGE_LARGE))
+        {
+            return NULL;
+        }
+
+        TableAddress = *Entry & MEMORY_MAPPER_PAGE_FRAME_MASK;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Reserve the mapping page of a core
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL)
+ * 
+ * @param ProcessorID Logical core index
+ * @return BOOLEAN Returns true if the page is reserved and its PTE is found
+ */
+BOOLEAN
+MemoryMapperAllocateMappingAddress(INT ProcessorID)
+{
+    PMEMORY_MAPPER_ADDRESSES Mapper = &g_GuestState[ProcessorID].MemoryMapper;
+
+    Mapper->VirtualAddress = (UINT64)MmAllocateMappingAddress(PAGE_SIZE, POOLTAG);
+
+    if (Mapper->VirtualAddress == NULL)
+    {
+        LogError("Insufficient system address space for the memory mapper");
+        return FALSE;
+    }
+
+    Mapper->PteVirtualAddress = MemoryMapperGetPteVirtualAddress((PVOID)Mapper->VirtualAddress);
+
+    if (Mapper->PteVirtualAddress == NULL)
+    {
+        LogError("Could not find the PTE of the memory mapper");
+        MmFreeMappingAddress((PVOID)Mapper->VirtualAddress, POOLTAG);
+        Mapper->VirtualAddress = NULL;
+        return FALSE;
+    }
+
+    Mapper->OriginalPte = *Mapper->PteVirtualAddress;
+
+    return TRUE;
+}
+
+/**
+ * @brief Release the mapping pages of all the cores
+ * @details The cores should not be in vmx operation when this function is called
+ * 
+ * @return VOID
+ */
+VOID
+MemoryMapperFreeMappingAddresses()
+{
+    ULONG ProcessorsCount;
+    ULONG CoreIndex;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        if (g_GuestState[CoreIndex].MemoryMapper.VirtualAddress != NULL)
+        {
+            MmFreeMappingAddress((PVOID)g_GuestState[CoreIndex].MemoryMapper.VirtualAddress, POOLTAG);
+        }
+
+        g_GuestState[CoreIndex].MemoryMapper.VirtualAddress    = NULL;
+        g_GuestState[CoreIndex].MemoryMapper.PteVirtualAddress = NULL;
+    }
+}
+
+/**
+ * @brief Read the physical memory through the mapping page of the current core
+ * @details Should be called from vmx-root mode, the range should not cross a page
+ * 
+ * @param CoreIndex Logical core index
+ * @param PhysicalAddress The target physical address
+ * @param Buffer The buffer to fill
+ * @param Size Size of the range
+ * @return BOOLEAN Returns false if the mapper is not available or the range crosses a page
+ */
+BOOLEAN
+MemoryMapperReadPhysicalMemory(UINT32 CoreIndex, UINT64 PhysicalAddress, PVOID Buffer, SIZE_T Size)
+{
+    PMEMORY_MAPPER_ADDRESSES Mapper = &g_GuestState[CoreIndex].MemoryMapper;
+
+    if (Mapper->PteVirtualAddress == NULL || (PhysicalAddress & (PAGE_SIZE - 1)) + Size > PAGE_SIZE)
+    {
+        return FALSE;
+    }
+
+    //
+    // Map the page as read-only and non-executable, the previous mapping
+    // of this core might be cached so it should be invalidated
+    //
+    *Mapper->PteVirtualAddress = (PhysicalAddress & MEMORY_MAPPER_PAGE_FRAME_MASK) | MEMORY_MAPPER_PAGE_PRESENT | MEMORY_MAPPER_PAGE_EXECUTE_DISABLE;
+    __invlpg((PVOID)Mapper->VirtualAddress);
+
+    RtlCopyMemory(Buffer, (PVOID)(Mapper->VirtualAddress + (PhysicalAddress & (PAGE_SIZE - 1))), Size);
+
+    //
+    // Don't leave the page mapped
+    //
+    *Mapper->PteVirtualAddress = Mapper->OriginalPte;
+    __invlpg((PVOID)Mapper->VirtualAddress);
+
+    return TRUE;
+}
+
+/**
+ * @brief Read a paging structure entry for the page walker
+ * 
+ * @param Context Logical core index
+ * @param PhysicalAddress Physical address of the entry
+ * @param Entry The value of the entry
+ * @return BOOLEAN
+ */
+static BOOLEAN
+MemoryMapperReadPagingEntry(PVOID Context, UINT64 PhysicalAddress, PUINT64 Entry)
+{
+    return MemoryMapperReadPhysicalMemory((UINT32)(UINT64)Context, PhysicalAddress, Entry, sizeof(UINT64));
+}
+
+/**
+ * @brief Remove the cached translations of a core
+ * @details Should be called from vmx-root mode on the same core, it's
+ * called when the guest loads cr3 (that flushes the guest's TLB too) and
+ * when EPT is invalidated on the core (the pages are hooked or unhooked)
+ * 
+ * @param CoreIndex Logical core index
+ * @return VOID 
+ */
+VOID
+MemoryMapperInvalidateTranslationCache(UINT32 CoreIndex)
+{
+    PMEMORY_MAPPER_TLB Tlb = &g_GuestState[CoreIndex].TranslationCache;
+
+    for (UINT32 i = 0; i < MEMORY_MAPPER_TLB_SIZE; i++)
+    {
+        Tlb->Entries[i].Cr3 = NULL;
+    }
+}
+
+/**
+ * @brief Translate a guest virtual address by walking the guest paging structures
+ * @details Should be called from vmx-root mode, the guest physical addresses are
+ * the same as the host physical addresses as EPT is an identity mapping. The
+ * translations are cached for each core, the upper entries of a cached walk are
+ * trusted until the cache is invalidated (cr3 loads and EPT invalidations) and
+ * only its leaf entry is read again, so a changed or unmapped page is not used
+ * 
+ * @param CoreIndex Logical core index
+ * @param GuestCr3 The cr3 of the guest (PCID bits are ignored)
+ * @param VirtualAddress The guest virtual address
+ * @param PhysicalAddress The translated physical address
+ * @return BOOLEAN Returns false if the address is not present
+ */
+BOOLEAN
+MemoryMapperTranslateGuestVirtualAddress(UINT32 CoreIndex, UINT64 GuestCr3, UINT64 VirtualAddress, PUINT64 PhysicalAddress)
+{
+    PMEMORY_MAPPER_TLB       Tlb = &g_GuestState[CoreIndex].TranslationCache;
+    PMEMORY_MAPPER_TLB_ENTRY TlbEntry;
+    PAGE_WALKER_RESULT       WalkResult;
+    UINT64                   VirtualPage = VirtualAddress & ~((UINT64)PAGE_SIZE - 1);
+
+    GuestCr3 &= MEMORY_MAPPER_PAGE_FRAME_MASK;
+    TlbEntry = &Tlb->Entries[(VirtualPage >> 12) & (MEMORY_MAPPER_TLB_SIZE - 1)];
+
+    if (TlbEntry->Cr3 == GuestCr3 && TlbEntry->VirtualPage == VirtualPage &&
+        PageWalkerIsLeafUnchanged(&TlbEntry->Walk, MemoryMapperReadPagingEntry, (PVOID)(UINT64)CoreIndex))
+    {
+        Tlb->NumberOfHits++;
+        *PhysicalAddress = TlbEntry->PhysicalPage | (VirtualAddress & (PAGE_SIZE - 1));
+        return TRUE;
+    }
+
+    Tlb->NumberOfMisses++;
+
+    if (!PageWalkerTranslate(GuestCr3, VirtualAddress, MemoryMapperReadPagingEntry, (PVOID)(UINT64)CoreIndex, &WalkResult))
+    {
+        TlbEntry->Cr3 = NULL;
+        return FALSE;
+    }
+
+    TlbEntry->Cr3          = GuestCr3;
+    TlbEntry->VirtualPage  = VirtualPage;
+    TlbEntry->PhysicalPage = WalkResult.PhysicalAddress & ~((UINT64)PAGE_SIZE - 1);
+    TlbEntry->Walk         = WalkResult;
+
+    *PhysicalAddress = WalkResult.PhysicalAddress;
+
+    return TRUE;
+}
+
+/**
+ * @brief Read the guest memory without raising a page fault
+ * @details Should be called from vmx-root mode
+ * 
+ * @param CoreIndex Logical core index
+ * @param GuestCr3 The cr3 of the guest
+ * @param VirtualAddress The guest virtual address
+ * @param Buffer The buffer to fill
+ * @param Size Size of the range
+ * @return BOOLEAN Returns false if any page of the range is not present
+ */
+BOOLEAN
+MemoryMapperReadGuestMemory(UINT32 CoreIndex, UINT64 GuestCr3, UINT64 VirtualAddress, PVOID Buffer, SIZE_T Size)
+{
+    UINT64 PhysicalAddress;
+    SIZE_T SizeOfChunk;
+
+    while (Size != 0)
+    {
+        SizeOfChunk = PAGE_SIZE - (VirtualAddress & (PAGE_SIZE - 1));
+
+        if (SizeOfChunk > Size)
+        {
+            SizeOfChunk = Size;
+        }
+
+        if (!MemoryMapperTranslateGuestVirtualAddress(CoreIndex, GuestCr3, VirtualAddress, &PhysicalAddress) ||
+            !MemoryMapperReadPhysicalMemory(CoreIndex, PhysicalAddress, Buffer, SizeOfChunk))
+        {
+            return FALSE;
+        }
+
+        VirtualAddress += SizeOfChunk;
+        Buffer = (PVOID)((UINT64)Buffer + SizeOfChunk);
+        Size   -= SizeOfChunk;
+    }
+
+    return TRUE;
+}
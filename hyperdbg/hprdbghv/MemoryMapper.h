@@ -0,0 +1,113 @@
+/**
+ * @file MemoryMapper.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the safe access to the guest memory from vmx-root
+ * @details
+ * @version 0.1
+ * @date 2020-05-06
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include <ntddk.h>
+#include "PageWalker.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief The present bit of a paging structure entry
+ * 
+ */
+#define MEMORY_MAPPER_PAGE_PRESENT (1ull << 0)
+
+/**
+ * @brief The page size bit of a PDPTE (1GB page) or a PDE (2MB page)
+ * 
+ */
+#define MEMORY_MAPPER_PAGE_LARGE (1ull << 7)
+
+/**
+ * @brief The execute-disable bit of a paging structure entry
+ * 
+ */
+#define MEMORY_MAPPER_PAGE_EXECUTE_DISABLE (1ull << 63)
+
+/**
+ * @brief The physical address bits of CR3 and the paging structure entries
+ * 
+ */
+#define MEMORY_MAPPER_PAGE_FRAME_MASK 0x000ffffffffff000ull
+
+/**
+ * @brief Number of the entries of the translation cache of each core (a power of two)
+ * 
+ */
+#define MEMORY_MAPPER_TLB_SIZE 64
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief The reserved page of each core that physical pages are mapped into
+ * 
+ */
+typedef struct _MEMORY_MAPPER_ADDRESSES
+{
+    UINT64  VirtualAddress;    // The reserved virtual address (a page)
+    PUINT64 PteVirtualAddress; // The PTE that maps the reserved page
+    UINT64  OriginalPte;       // The value of the PTE before any mapping
+
+} MEMORY_MAPPER_ADDRESSES, *PMEMORY_MAPPER_ADDRESSES;
+
+/**
+ * @brief A cached translation of a guest virtual page
+ * 
+ */
+typedef struct _MEMORY_MAPPER_TLB_ENTRY
+{
+    UINT64             Cr3;          // The address space of the translation (zero for a free entry)
+    UINT64             VirtualPage;  // The 4KB guest virtual page
+    UINT64             PhysicalPage; // The 4KB guest physical page
+    PAGE_WALKER_RESULT Walk;         // The entries of the walk when it's cached
+
+} MEMORY_MAPPER_TLB_ENTRY, *PMEMORY_MAPPER_TLB_ENTRY;
+
+/**
+ * @brief The translation cache of each core, it's direct-mapped by the
+ * virtual page and tagged by cr3
+ * 
+ */
+typedef struct _MEMORY_MAPPER_TLB
+{
+    MEMORY_MAPPER_TLB_ENTRY Entries[MEMORY_MAPPER_TLB_SIZE];
+    UINT64                  NumberOfHits;
+    UINT64                  NumberOfMisses;
+
+} MEMORY_MAPPER_TLB, *PMEMORY_MAPPER_TLB;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Reserve the mapping page of a core (PASSIVE_LEVEL) */
+BOOLEAN
+MemoryMapperAllocateMappingAddress(INT ProcessorID);
+/* Release the mapping pages of all the cores (PASSIVE_LEVEL) */
+VOID
+MemoryMapperFreeMappingAddresses();
+/* Read the physical memory through the mapping page of the current core (vmx-root) */
+BOOLEAN
+MemoryMapperReadPhysicalMemory(UINT32 CoreIndex, UINT64 PhysicalAddress, PVOID Buffer, SIZE_T Size);
+/* Remove the cached translations of a core (vmx-root) */
+VOID
+MemoryMapperInvalidateTranslationCache(UINT32 CoreIndex);
+/* Translate a guest virtual address by walking the guest paging structures (vmx-root) */
+BOOLEAN
+MemoryMapperTranslateGuestVirtualAddress(UINT32 CoreIndex, UINT64 GuestCr3, UINT64 VirtualAddress, PUINT64 PhysicalAddress);
+/* Read the guest memory without raising a page fault (vmx-root) */
+BOOLEAN
+MemoryMapperReadGuestMemory(UINT32 CoreIndex, UINT64 GuestCr3, UINT64 VirtualAddress, PVOID Buffer, SIZE_T Size);
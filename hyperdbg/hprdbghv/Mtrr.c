@@ -0,0 +1,353 @@
+/**
+ * @file Mtrr.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Building the map of memory types from the MTRR registers
+ * @details
+ * @version 0.1
+ * @date 2020-04-10
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+
+#include "Mtrr.h"
+
+/**
+ * @brief Resolve the memory type of two overlapping MTRR ranges
+ * @details Based on 11.11.4.1 MTRR Precedences, UC always takes precedence,
+ * WT takes precedence over WB and all the other combinations are undefined,
+ * so we treat them as UC to be safe
+ * 
+ * @param FirstType Memory type of the first range
+ * @param SecondType Memory type of the second range
+ * @return UCHAR The effective memory type
+ */
+UCHAR
+MtrrResolvePrecedence(UCHAR FirstType, UCHAR SecondType)
+{
+    if (FirstType == SecondType)
+    {
+        return FirstType;
+    }
+
+    if (FirstType == MEMORY_TYPE_UNCACHEABLE || SecondType == MEMORY_TYPE_UNCACHEABLE)
+    {
+        return MEMORY_TYPE_UNCACHEABLE;
+    }
+
+    if ((FirstType == MEMORY_TYPE_WRITE_THROUGH && SecondType == MEMORY_TYPE_WRITE_BACK) ||
+        (FirstType == MEMORY_TYPE_WRITE_BACK && SecondType == MEMORY_TYPE_WRITE_THROUGH))
+    {
+        return MEMORY_TYPE_WRITE_THROUGH;
+    }
+
+    //
+    // The behavior is undefined, UC is the safest choice
+    //
+    return MEMORY_TYPE_UNCACHEABLE;
+}
+
+/**
+ * @brief Append a range to the end of the MTRR map
+ * @details The ranges should be appended in an ascending order, if the new range
+ * is adjacent to the last range and has the same type, then it's merged with it
+ * 
+ * @param Map The MTRR map
+ * @param MaxRanges Maximum number of entries in the map
+ * @param NumberOfRanges Current number of entries in the map
+ * @param BaseAddress Base address of the range
+ * @param EndAddress End address of the range (inclusive)
+ * @param MemoryType Memory type of the range
+ * @return BOOLEAN Returns false if there is no free entry in the map
+ */
+BOOLEAN
+MtrrMapAppendRange(PMTRR_RANGE_DESCRIPTOR Map, UINT32 MaxRanges, UINT32 * NumberOfRanges, UINT64 BaseAddress, UINT64 EndAddress, UCHAR MemoryType)
+{
+    PMTRR_RANGE_DESCRIPTOR LastRange;
+
+    if (*NumberOfRanges != 0)
+    {
+        LastRange = &Map[*NumberOfRanges - 1];
+
+        if (LastRange->MemoryType == MemoryType && LastRange->PhysicalEndAddress + 1 == BaseAddress)
+        {
+            //
+            // Merge it with the previous range
+            //
+            LastRange->PhysicalEndAddress = EndAddress;
+            return TRUE;
+        }
+    }
+
+    if (*NumberOfRanges >= MaxRanges)
+    {
+        return FALSE;
+    }
+
+    Map[*NumberOfRanges].PhysicalBaseAddress = BaseAddress;
+    Map[*NumberOfRanges].PhysicalEndAddress  = EndAddress;
+    Map[*NumberOfRanges].MemoryType          = MemoryType;
+
+    *NumberOfRanges = *NumberOfRanges + 1;
+
+    return TRUE;
+}
+
+/**
+ * @brief Build a sorted and merged MTRR map from a snapshot of MTRR registers
+ * @details This function doesn't access any global variable or MSR, the result
+ * is a list of non-overlapping ranges in an ascending order which covers the whole
+ * physical memory that is mapped by EPT (0 to MapSize), so the memory type of
+ * each page can be found by sweeping the map
+ * 
+ * @param Registers The values of MTRR registers
+ * @param MapSize Size of the physical memory that the map should cover
+ * @param Map The array to save the ranges
+ * @param MaxRanges Maximum number of entries in the map
+ * @param NumberOfRanges The number of ranges that are written to the map
+ * @return BOOLEAN Returns false if the map doesn't have enough entries
+ */
+BOOLEAN
+MtrrBuildMapFromRegisters(PMTRR_REGISTERS_STATE Registers, UINT64 MapSize, PMTRR_RANGE_DESCRIPTOR Map, UINT32 MaxRanges, UINT32 * NumberOfRanges)
+{
+    MTRR_RANGE_DESCRIPTOR VariableRanges[MTRR_VARIABLE_RANGE_MAX_COUNT];
+    UINT64                Boundaries[(MTRR_VARIABLE_RANGE_MAX_COUNT * 2) + 2];
+    UINT32                NumberOfVariableRanges = 0;
+    UINT32                NumberOfBoundaries     = 0;
+    UINT32                VariableRangeCount;
+    UINT64                SweepStart;
+    UINT64                RangeBase;
+    UINT64                RangeSize;
+    UINT64                RegisterMask;
+    UINT64                Temp;
+    UCHAR                 MemoryType;
+    BOOLEAN               IsCovered;
+    UINT32                i, j, k;
+
+    *NumberOfRanges = 0;
+
+    //
+    // If MTRRs are disabled, then the whole physical memory is UC
+    //
+    if (!Registers->DefaultType.MtrrEnable)
+    {
+        return MtrrMapAppendRange(Map, MaxRanges, NumberOfRanges, 0, MapSize - 1, MEMORY_TYPE_UNCACHEABLE);
+    }
+
+    //
+    // Collect the enabled variable ranges
+    //
+    VariableRangeCount = Registers->Capabilities.VariableRangeCount;
+
+    if (VariableRangeCount > MTRR_VARIABLE_RANGE_MAX_COUNT)
+    {
+        VariableRangeCount = MTRR_VARIABLE_RANGE_MAX_COUNT;
+    }
+
+    for (i = 0; i < VariableRangeCount; i++)
+    {
+        if (!Registers->PhysMask[i].Valid)
+        {
+            continue;
+        }
+
+        //
+        // The lowest bit of the mask that is set to 1 specifies the size of the range
+        //
+        RegisterMask = (UINT64)Registers->PhysMask[i].PageFrameNumber * PAGE_SIZE;
+        RangeSize    = RegisterMask & (~RegisterMask + 1);
+
+        if (RangeSize == 0)
+        {
+            continue;
+        }
+
+        RangeBase = (UINT64)Registers->PhysBase[i].PageFrameNumber * PAGE_SIZE;
+
+        VariableRanges[NumberOfVariableRanges].PhysicalBaseAddress = RangeBase;
+        VariableRanges[NumberOfVariableRanges].PhysicalEndAddress  = RangeBase + RangeSize - 1;
+        VariableRanges[NumberOfVariableRanges].MemoryType          = (UCHAR)Registers->PhysBase[i].Type;
+        NumberOfVariableRanges++;
+    }
+
+    //
+    // The first 1MB is described by the fixed range MTRRs (if they're enabled),
+    // they take precedence over the variable ranges
+    //
+    SweepStart = 0;
+
+    if (Registers->Capabilities.FixedRangeSupported && Registers->DefaultType.FixedRangeMtrrEnable)
+    {
+        for (i = 0; i < MTRR_FIXED_RANGE_REGISTERS; i++)
+        {
+            //
+            // FIX64K_00000 : 8 * 64KB, FIX16K_80000 and FIX16K_A0000 : 8 * 16KB,
+            // FIX4K_C0000 to FIX4K_F8000 : 8 * 4KB
+            //
+            if (i == 0)
+            {
+                RangeBase = 0;
+                RangeSize = 0x10000;
+            }
+            else if (i < 3)
+            {
+                RangeBase = 0x80000 + ((i - 1) * 0x20000);
+                RangeSize = 0x4000;
+            }
+            else
+            {
+                RangeBase = 0xC0000 + ((i - 3) * 0x8000);
+                RangeSize = 0x1000;
+            }
+
+            //
+            // Each byte of the register is the memory type of one sub-range
+            //
+            for (j = 0; j < 8; j++)
+            {
+                MemoryType = (UCHAR)((Registers->FixedRanges[i] >> (j * 8)) & 0xff);
+
+                if (!MtrrMapAppendRange(Map, MaxRanges, NumberOfRanges, RangeBase + (j * RangeSize), RangeBase + ((j + 1) * RangeSize) - 1, MemoryType))
+                {
+                    return FALSE;
+                }
+            }
+        }
+
+        SweepStart = MTRR_FIXED_RANGE_END;
+    }
+
+    //
+    // Collect the boundaries of the variable ranges, each two consecutive
+    // boundaries make an interval with a single memory type
+    //
+    Boundaries[NumberOfBoundaries++] = SweepStart;
+    Boundaries[NumberOfBoundaries++] = MapSize;
+
+    for (i = 0; i < NumberOfVariableRanges; i++)
+    {
+        Boundaries[NumberOfBoundaries++] = VariableRanges[i].PhysicalBaseAddress;
+        Boundaries[NumberOfBoundaries++] = VariableRanges[i].PhysicalEndAddress + 1;
+    }
+
+    //
+    // Sort the boundaries (insertion sort, there are only a few of them)
+    //
+    for (i = 1; i < NumberOfBoundaries; i++)
+    {
+        Temp = Boundaries[i];
+
+        for (j = i; j > 0 && Boundaries[j - 1] > Temp; j--)
+        {
+            Boundaries[j] = Boundaries[j - 1];
+        }
+
+        Boundaries[j] = Temp;
+    }
+
+    //
+    // Sweep the intervals and resolve the precedence of overlapping ranges once
+    //
+    for (i = 0; i + 1 < NumberOfBoundaries; i++)
+    {
+        if (Boundaries[i] == Boundaries[i + 1] || Boundaries[i] < SweepStart || Boundaries[i] >= MapSize)
+        {
+            //
+            // Empty interval or the interval is out of the sweep area
+            //
+            continue;
+        }
+
+        IsCovered  = FALSE;
+        MemoryType = (UCHAR)Registers->DefaultType.DefaultMemoryType;
+
+        for (k = 0; k < NumberOfVariableRanges; k++)
+        {
+            if (VariableRanges[k].PhysicalBaseAddress <= Boundaries[i] && VariableRanges[k].PhysicalEndAddress >= Boundaries[i + 1] - 1)
+            {
+                MemoryType = IsCovered ? MtrrResolvePrecedence(MemoryType, VariableRanges[k].MemoryType) : VariableRanges[k].MemoryType;
+                IsCovered  = TRUE;
+            }
+        }
+
+        if (!MtrrMapAppendRange(Map, MaxRanges, NumberOfRanges, Boundaries[i], Boundaries[i + 1] - 1, MemoryType))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Find the memory type of a physical range by sweeping the MTRR map
+ * @details The caller should call this function with ascending addresses as
+ * the cursor only moves forward
+ * 
+ * @param Map The MTRR map
+ * @param NumberOfRanges Number of entries in the map
+ * @param Cursor The current index into the MTRR map
+ * @param PhysicalAddress Start address of the range
+ * @param Size Size of the range
+ * @param IsMixed Set to true if the range contains more than one memory type
+ * @return UCHAR The memory type of the first byte of the range
+ */
+UCHAR
+MtrrSweepMemoryType(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges, UINT32 * Cursor, SIZE_T PhysicalAddress, SIZE_T Size, BOOLEAN * IsMixed)
+{
+    PMTRR_RANGE_DESCRIPTOR Range;
+
+    while (*Cursor < NumberOfRanges && Map[*Cursor].PhysicalEndAddress < PhysicalAddress)
+    {
+        *Cursor = *Cursor + 1;
+    }
+
+    if (*Cursor >= NumberOfRanges)
+    {
+        //
+        // Not described by the map (shouldn't happen as the map covers the whole range)
+        //
+        *IsMixed = FALSE;
+        return MEMORY_TYPE_UNCACHEABLE;
+    }
+
+    Range    = &Map[*Cursor];
+    *IsMixed = Range->PhysicalEndAddress < PhysicalAddress + Size - 1;
+
+    return Range->MemoryType;
+}
+
+/**
+ * @brief Find the index of the MTRR map range which contains an address
+ * 
+ * @param Map The MTRR map
+ * @param NumberOfRanges Number of entries in the map
+ * @param PhysicalAddress The target physical address
+ * @return UINT32 Index of the range in the map
+ */
+UINT32
+MtrrFindRangeIndex(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges, SIZE_T PhysicalAddress)
+{
+    UINT32 Low  = 0;
+    UINT32 High = NumberOfRanges;
+    UINT32 Middle;
+
+    //
+    // Binary search for the first range that ends at or after the address
+    //
+    while (Low < High)
+    {
+        Middle = Low + ((High - Low) / 2);
+
+        if (Map[Middle].PhysicalEndAddress < PhysicalAddress)
+        {
+            Low = Middle + 1;
+        }
+        else
+        {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file Mtrr.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the MTRR map builder
+ * @details The builder doesn't access any MSR or global variable, so it's also
+ * built by the user-mode tests
+ * @version 0.1
+ * @date 2020-04-11
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include "Portable.h"
+
+//////////////////////////////////////////////////
+//					Constants					//
+//////////////////////////////////////////////////
+
+/* Number of MTRR registers */
+#define MTRR_VARIABLE_RANGE_MAX_COUNT 10
+#define MTRR_FIXED_RANGE_REGISTERS    11
+
+/* The fixed range MTRRs describe the first 1MB of the physical memory */
+#define MTRR_FIXED_RANGE_END 0x100000ULL
+
+/* Maximum number of non-overlapping intervals in the merged MTRR map */
+#define MTRR_MAP_MAX_RANGES 128
+
+/* Memory Types */
+#define MEMORY_TYPE_UNCACHEABLE     0x00000000
+#define MEMORY_TYPE_WRITE_COMBINING 0x00000001
+#define MEMORY_TYPE_WRITE_THROUGH   0x00000004
+#define MEMORY_TYPE_WRITE_PROTECTED 0x00000005
+#define MEMORY_TYPE_WRITE_BACK      0x00000006
+#define MEMORY_TYPE_INVALID         0x000000FF
+
+//////////////////////////////////////////////////
+//				Unions & Structs    			//
+//////////////////////////////////////////////////
+
+/**
+ * @brief MSR_IA32_MTRR_DEF_TYPE Structure
+ * 
+ */
+typedef union _IA32_MTRR_DEF_TYPE_REGISTER
+{
+    struct
+    {
+        /**
+		 * @brief [Bits 2:0] Default Memory Type.
+		 */
+        UINT64 DefaultMemoryType : 3;
+        UINT64 Reserved1 : 7;
+
+        /**
+		 * @brief [Bit 10] Fixed Range MTRR Enable.
+		 */
+        UINT64 FixedRangeMtrrEnable : 1;
+
+        /**
+		 * @brief [Bit 11] MTRR Enable.
+		 */
+        UINT64 MtrrEnable : 1;
+        UINT64 Reserved2 : 52;
+    };
+
+    UINT64 Flags;
+} IA32_MTRR_DEF_TYPE_REGISTER, *PIA32_MTRR_DEF_TYPE_REGISTER;
+
+/**
+ * @brief IA32_MTRR_CAPABILITIES Structure
+ * 
+ */
+typedef union _IA32_MTRR_CAPABILITIES_REGISTER
+{
+    struct
+    {
+        /**
+		 * @brief VCNT (variable range registers count) field
+		 *
+		 * [Bits 7:0] Indicates the number of variable ranges implemented on the processor.
+		 */
+        UINT64 VariableRangeCount : 8;
+
+        /**
+		 * @brief FIX (fixed range registers supported) flag
+		 *
+		 * [Bit 8] Fixed range MTRRs (MSR_IA32_MTRR_FIX64K_00000 through MSR_IA32_MTRR_FIX4K_0F8000) are supported when set; no fixed range
+		 * registers are supported when clear.
+		 */
+        UINT64 FixedRangeSupported : 1;
+        UINT64 Reserved1 : 1;
+
+        /**
+		 * @brief WC (write combining) flag
+		 *
+		 * [Bit 10] The write-combining (WC) memory type is supported when set; the WC type is not supported when clear.
+		 */
+        UINT64 WcSupported : 1;
+
+        /**
+		 * @brief SMRR (System-Management Range Register) flag
+		 *
+		 * [Bit 11] The system-management range register (SMRR) interface is supported when bit 11 is set; the SMRR interface is
+		 * not supported when clear.
+		 */
+        UINT64 SmrrSupported : 1;
+        UINT64 Reserved2 : 52;
+    };
+
+    UINT64 Flags;
+} IA32_MTRR_CAPABILITIES_REGISTER, *PIA32_MTRR_CAPABILITIES_REGISTER;
+
+/**
+ * @brief MSR_IA32_MTRR_PHYSBASE(0-9) Structure
+ * 
+ */
+typedef union _IA32_MTRR_PHYSBASE_REGISTER
+{
+    struct
+    {
+        /**
+		 * @brief [Bits 7:0] Specifies the memory type for the range.
+		 */
+        UINT64 Type : 8;
+        UINT64 Reserved1 : 4;
+
+        /**
+		 * @brief [Bits 47:12] Specifies the base address of the address range. This 24-bit value, in the case where MAXPHYADDR is 36
+		 * bits, is extended by 12 bits at the low end to form the base address (this automatically aligns the address on a 4-KByte
+		 * boundary).
+		 */
+        UINT64 PageFrameNumber : 36;
+        UINT64 Reserved2 : 16;
+    };
+
+    UINT64 Flags;
+} IA32_MTRR_PHYSBASE_REGISTER, *PIA32_MTRR_PHYSBASE_REGISTER;
+
+// MSR_IA32_MTRR_PHYSMASK(0-9).
+typedef union _IA32_MTRR_PHYSMASK_REGISTER
+{
+    struct
+    {
+        /**
+		 * @brief [Bits 7:0] Specifies the memory type for the range.
+		 */
+        UINT64 Type : 8;
+        UINT64 Reserved1 : 3;
+
+        /**
+		 * @brief [Bit 11] Enables the register pair when set; disables register pair when clear.
+		 */
+        UINT64 Valid : 1;
+
+        /**
+		 * @brief [Bits 47:12] Specifies a mask (24 bits if the maximum physical address size is 36 bits, 28 bits if the maximum physical
+		 * address size is 40 bits). The mask determines the range of the region being mapped, according to the following
+		 * relationships:
+		 * - Address_Within_Range AND PhysMask = PhysBase AND PhysMask
+		 * - This value is extended by 12 bits at the low end to form the mask value.
+		 * - The width of the PhysMask field depends on the maximum physical address size supported by the processor.
+		 * CPUID.80000008H reports the maximum physical address size supported by the processor. If CPUID.80000008H is not
+		 * available, software may assume that the processor supports a 36-bit physical address size.
+		 *
+		 * @see Vol3A[11.11.3(Example Base and Mask Calculations)]
+		 */
+        UINT64 PageFrameNumber : 36;
+        UINT64 Reserved2 : 16;
+    };
+
+    UINT64 Flags;
+} IA32_MTRR_PHYSMASK_REGISTER, *PIA32_MTRR_PHYSMASK_REGISTER;
+
+/**
+ * @brief MTRR Range Descriptor
+ * 
+ */
+typedef struct _MTRR_RANGE_DESCRIPTOR
+{
+    SIZE_T PhysicalBaseAddress;
+    SIZE_T PhysicalEndAddress;
+    UCHAR  MemoryType;
+} MTRR_RANGE_DESCRIPTOR, *PMTRR_RANGE_DESCRIPTOR;
+
+/**
+ * @brief Raw values of the MTRR registers, used as the input of the MTRR map builder
+ * @details Fixed ranges are in the order of MSRs (FIX64K_00000, FIX16K_80000, FIX16K_A0000,
+ * FIX4K_C0000 to FIX4K_F8000)
+ * 
+ */
+typedef struct _MTRR_REGISTERS_STATE
+{
+    IA32_MTRR_CAPABILITIES_REGISTER Capabilities;
+    IA32_MTRR_DEF_TYPE_REGISTER     DefaultType;
+    UINT64                          FixedRanges[MTRR_FIXED_RANGE_REGISTERS];
+    IA32_MTRR_PHYSBASE_REGISTER     PhysBase[MTRR_VARIABLE_RANGE_MAX_COUNT];
+    IA32_MTRR_PHYSMASK_REGISTER     PhysMask[MTRR_VARIABLE_RANGE_MAX_COUNT];
+
+} MTRR_REGISTERS_STATE, *PMTRR_REGISTERS_STATE;
+
+//////////////////////////////////////////////////
+//				    Functions					//
+//////////////////////////////////////////////////
+
+/* Resolve the memory type of two overlapping MTRR ranges */
+UCHAR
+MtrrResolvePrecedence(UCHAR FirstType, UCHAR SecondType);
+/* Append a range to the end of the MTRR map */
+BOOLEAN
+MtrrMapAppendRange(PMTRR_RANGE_DESCRIPTOR Map, UINT32 MaxRanges, UINT32 * NumberOfRanges, UINT64 BaseAddress, UINT64 EndAddress, UCHAR MemoryType);
+/* Build a sorted and merged MTRR map from a snapshot of MTRR registers */
+BOOLEAN
+MtrrBuildMapFromRegisters(PMTRR_REGISTERS_STATE Registers, UINT64 MapSize, PMTRR_RANGE_DESCRIPTOR Map, UINT32 MaxRanges, UINT32 * NumberOfRanges);
+/* Find the index of the MTRR map range which contains an address */
+UINT32
+MtrrFindRangeIndex(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges, SIZE_T PhysicalAddress);
+/* Find the memory type of a physical range by sweeping the MTRR map */
+UCHAR
+MtrrSweepMemoryType(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges, UINT32 * Cursor, SIZE_T PhysicalAddress, SIZE_T Size, BOOLEAN * IsMixed);
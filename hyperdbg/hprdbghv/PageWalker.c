@@ -0,0 +1,102 @@
+/**
+ * @file PageWalker.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Software walker of the 4-level paging structures
+ * @details The walker doesn't use any kernel routine, the entries are read
+ * by the caller so it works on the physical view of vmx-root as well as on
+ * synthetic paging structures
+ * @version 0.1
+ * @date 2020-05-09
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "Portable.h"
+#include "PageWalker.h"
+
+/**
+ * @brief Translate a virtual address by walking the paging structures of a cr3
+ * @details The PCID bits of cr3 are ignored, 1GB and 2MB pages end the
+ * walk at the PDPT and the PD
+ * 
+ * @param Cr3 The cr3 of the address space
+ * @param VirtualAddress The virtual address
+ * @param ReadEntry Reads an entry from the physical memory
+ * @param Context Passed to ReadEntry
+ * @param Result The translated address and the entries of the walk
+ * @return BOOLEAN Returns false if the address is not canonical or not present
+ */
+BOOLEAN
+PageWalkerTranslate(UINT64 Cr3, UINT64 VirtualAddress, PAGE_WALKER_READ_ENTRY ReadEntry, PVOID Context, PPAGE_WALKER_RESULT Result)
+{
+    UINT64 TableAddress;
+    UINT64 EntryAddress;
+    UINT64 Entry;
+    UINT64 PageMask;
+    UINT32 Shift;
+
+    //
+    // Bits 63:47 should be the same
+    //
+    if (((INT64)VirtualAddress >> 47) != 0 && ((INT64)VirtualAddress >> 47) != -1)
+    {
+        return FALSE;
+    }
+
+    TableAddress            = Cr3 & PAGE_WALKER_FRAME_MASK;
+    Result->NumberOfEntries = 0;
+
+    for (INT Level = 4; Level >= 1; Level--)
+    {
+        Shift        = 12 + (Level - 1) * 9;
+        EntryAddress = TableAddress + ((VirtualAddress >> Shift) & 0x1ff) * sizeof(UINT64);
+
+        if (!ReadEntry(Context, EntryAddress, &Entry) || !(Entry & PAGE_WALKER_ENTRY_PRESENT))
+        {
+            return FALSE;
+        }
+
+        Result->EntryAddresses[Result->NumberOfEntries] = EntryAddress;
+        Result->Entries[Result->NumberOfEntries]        = Entry;
+        Result->NumberOfEntries++;
+
+        if (Level == 1 || ((Level == 3 || Level == 2) && (Entry & PAGE_WALKER_ENTRY_LARGE)))
+        {
+            PageMask                = (1ull << Shift) - 1;
+            Result->PhysicalAddress = (Entry & PAGE_WALKER_FRAME_MASK & ~PageMask) | (VirtualAddress & PageMask);
+            Result->PageSize        = PageMask + 1;
+            return TRUE;
+        }
+
+        TableAddress = Entry & PAGE_WALKER_FRAME_MASK;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Check whether the leaf entry of a previous walk still has the same value
+ * @details Only the entry that maps the page is read again, the upper entries
+ * are trusted, so the caller should drop the walks when the upper entries might
+ * be changed (like the processor drops its paging-structure caches on a cr3 load)
+ * 
+ * @param Result The result of a previous successful walk
+ * @param ReadEntry Reads an entry from the physical memory
+ * @param Context Passed to ReadEntry
+ * @return BOOLEAN Returns false if the leaf entry is changed or can't be read
+ */
+BOOLEAN
+PageWalkerIsLeafUnchanged(PPAGE_WALKER_RESULT Result, PAGE_WALKER_READ_ENTRY ReadEntry, PVOID Context)
+{
+    UINT64 Entry;
+    UINT32 Leaf;
+
+    if (Result->NumberOfEntries == 0 || Result->NumberOfEntries > PAGE_WALKER_MAX_LEVELS)
+    {
+        return FALSE;
+    }
+
+    Leaf = Result->NumberOfEntries - 1;
+
+    return ReadEntry(Context, Result->EntryAddresses[Leaf], &Entry) && Entry == Result->Entries[Leaf];
+}
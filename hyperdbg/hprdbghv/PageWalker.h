@@ -0,0 +1,76 @@
+/**
+ * @file PageWalker.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the software walker of the 4-level paging structures
+ * @details
+ * @version 0.1
+ * @date 2020-05-09
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include "Portable.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief The present bit of a paging structure entry
+ * 
+ */
+#define PAGE_WALKER_ENTRY_PRESENT (1ull << 0)
+
+/**
+ * @brief The page size bit of a PDPTE (1GB page) or a PDE (2MB page)
+ * 
+ */
+#define PAGE_WALKER_ENTRY_LARGE (1ull << 7)
+
+/**
+ * @brief The physical address bits of CR3 and the paging structure entries
+ * 
+ */
+#define PAGE_WALKER_FRAME_MASK 0x000ffffffffff000ull
+
+/**
+ * @brief The number of the levels of the paging structures (PML4, PDPT, PD and PT)
+ * 
+ */
+#define PAGE_WALKER_MAX_LEVELS 4
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Read a paging structure entry from the physical memory
+ * 
+ */
+typedef BOOLEAN (*PAGE_WALKER_READ_ENTRY)(PVOID Context, UINT64 PhysicalAddress, PUINT64 Entry);
+
+/**
+ * @brief The result of a translation
+ * 
+ */
+typedef struct _PAGE_WALKER_RESULT
+{
+    UINT64 PhysicalAddress;                        // The translated address
+    UINT64 PageSize;                               // 4KB, 2MB or 1GB
+    UINT32 NumberOfEntries;                        // Number of the entries of the walk, the last one maps the page
+    UINT64 EntryAddresses[PAGE_WALKER_MAX_LEVELS]; // Physical address of each entry of the walk (PML4E first)
+    UINT64 Entries[PAGE_WALKER_MAX_LEVELS];        // Value of each entry of the walk
+
+} PAGE_WALKER_RESULT, *PPAGE_WALKER_RESULT;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Translate a virtual address by walking the paging structures of a cr3 */
+BOOLEAN
+PageWalkerTranslate(UINT64 Cr3, UINT64 VirtualAddress, PAGE_WALKER_READ_ENTRY ReadEntry, PVOID Context, PPAGE_WALKER_RESULT Result);
+/* Check whether the leaf entry of a previous walk still has the same value */
+BOOLEAN
+PageWalkerIsLeafUnchanged(PPAGE_WALKER_RESULT Result, PAGE_WALKER_READ_ENTRY ReadEntry, PVOID Context);
@@ -0,0 +1,195 @@
+/**
+ * @file PatternMatcher.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Masked byte pattern matcher
+ * @details The buffer is scanned 16 bytes at a time for one exact byte of
+ * the pattern (the anchor) and only the candidates are compared with the
+ * whole pattern. The matcher doesn't use any kernel routine (it's also built
+ * by the user-mode tests), SSE2 is part of x64 and the XMM registers can be
+ * used in the kernel without saving them
+ * @version 0.1
+ * @date 2020-05-08
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "Portable.h"
+#include <emmintrin.h>
+#include "PatternMatcher.h"
+
+#if defined(_KERNEL_MODE)
+#    include <intrin.h>
+#endif
+
+/**
+ * @brief Index of the lowest set bit of a non-zero value
+ * 
+ * @param Value The value
+ * @return UINT32
+ */
+static UINT32
+PatternMatcherLowestBit(UINT32 Value)
+{
+#if defined(_KERNEL_MODE)
+    ULONG Bit;
+
+    _BitScanForward(&Bit, Value);
+
+    return Bit;
+#else
+    return (UINT32)__builtin_ctz(Value);
+#endif
+}
+
+/**
+ * @brief Check whether a byte is a poor anchor
+ * @details Padding and zero bytes are everywhere in the images, so
+ * they generate too many candidates
+ * 
+ * @param Byte The byte of the pattern
+ * @return BOOLEAN
+ */
+static BOOLEAN
+PatternMatcherIsCommonByte(UCHAR Byte)
+{
+    return Byte == 0x00 || Byte == 0xff || Byte == 0xcc || Byte == 0x90;
+}
+
+/**
+ * @brief Compare the whole pattern at an address
+ * 
+ * @param Matcher The prepared pattern
+ * @param Data Start of the candidate
+ * @return BOOLEAN
+ */
+static BOOLEAN
+PatternMatcherIsMatch(PPATTERN_MATCHER Matcher, const UCHAR * Data)
+{
+    for (SIZE_T i = 0; i < Matcher->PatternLength; i++)
+    {
+        if ((Data[i] & Matcher->Mask[i]) != (Matcher->Pattern[i] & Matcher->Mask[i]))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Prepare a pattern and choose its anchor byte
+ * @details The pattern and the mask are not copied, they should be
+ * valid as long as the matcher is used
+ * 
+ * @param Matcher The matcher to fill
+ * @param Pattern Bytes of the pattern
+ * @param Mask Mask of each byte of the pattern
+ * @param PatternLength Number of bytes of the pattern
+ * @return BOOLEAN Returns false if the pattern is empty
+ */
+BOOLEAN
+PatternMatcherInitialize(PPATTERN_MATCHER Matcher, const UCHAR * Pattern, const UCHAR * Mask, SIZE_T PatternLength)
+{
+    if (PatternLength == 0)
+    {
+        return FALSE;
+    }
+
+    Matcher->Pattern       = Pattern;
+    Matcher->Mask          = Mask;
+    Matcher->PatternLength = PatternLength;
+    Matcher->AnchorIndex   = 0;
+    Matcher->HasAnchor     = FALSE;
+
+    //
+    // Prefer an exact byte that is rare in the memory, otherwise
+    // the first exact byte
+    //
+    for (SIZE_T i = 0; i < PatternLength; i++)
+    {
+        if (Mask[i] != 0xff)
+        {
+            continue;
+        }
+
+        if (!Matcher->HasAnchor || (PatternMatcherIsCommonByte(Pattern[Matcher->AnchorIndex]) && !PatternMatcherIsCommonByte(Pattern[i])))
+        {
+            Matcher->AnchorIndex = i;
+            Matcher->HasAnchor   = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Find the first match that starts at or after an offset of the buffer
+ * 
+ * @param Matcher The prepared pattern
+ * @param Buffer The buffer to search
+ * @param BufferSize Size of the buffer
+ * @param StartOffset The first offset that a match can start at
+ * @return SIZE_T Offset of the match or PATTERN_MATCHER_NOT_FOUND
+ */
+SIZE_T
+PatternMatcherFind(PPATTERN_MATCHER Matcher, const UCHAR * Buffer, SIZE_T BufferSize, SIZE_T StartOffset)
+{
+    SIZE_T  Offset = StartOffset;
+    SIZE_T  LastOffset;
+    __m128i Anchor;
+    __m128i Block;
+    UINT32  Candidates;
+    UINT32  Bit;
+
+    if (BufferSize < Matcher->PatternLength)
+    {
+        return PATTERN_MATCHER_NOT_FOUND;
+    }
+
+    //
+    // The last offset that the whole pattern fits after it
+    //
+    LastOffset = BufferSize - Matcher->PatternLength;
+
+    if (Matcher->HasAnchor)
+    {
+        Anchor = _mm_set1_epi8((CHAR)Matcher->Pattern[Matcher->AnchorIndex]);
+
+        //
+        // Each block checks the anchor of 16 offsets, the block
+        // never reads after the end of the buffer
+        //
+        while (Offset + 15 <= LastOffset)
+        {
+            Block      = _mm_loadu_si128((const __m128i *)(Buffer + Offset + Matcher->AnchorIndex));
+            Candidates = (UINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(Block, Anchor));
+
+            while (Candidates != 0)
+            {
+                Bit = PatternMatcherLowestBit(Candidates);
+
+                if (PatternMatcherIsMatch(Matcher, Buffer + Offset + Bit))
+                {
+                    return Offset + Bit;
+                }
+
+                Candidates &= Candidates - 1;
+            }
+
+            Offset += 16;
+        }
+    }
+
+    //
+    // The remaining offsets (or all of them if the pattern has no exact byte)
+    //
+    for (; Offset <= LastOffset; Offset++)
+    {
+        if (PatternMatcherIsMatch(Matcher, Buffer + Offset))
+        {
+            return Offset;
+        }
+    }
+
+    return PATTERN_MATCHER_NOT_FOUND;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file PatternMatcher.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the masked byte pattern matcher
+ * @details
+ * @version 0.1
+ * @date 2020-05-08
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include "Portable.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Returned when the pattern is not found in the buffer
+ * 
+ */
+#define PATTERN_MATCHER_NOT_FOUND ((SIZE_T)-1)
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief A prepared pattern, the bytes are compared after masking (0xff
+ * for exact bytes, 0x00 for wildcards and 0xf0 or 0x0f for nibbles)
+ * 
+ */
+typedef struct _PATTERN_MATCHER
+{
+    const UCHAR * Pattern;       // Bytes of the pattern
+    const UCHAR * Mask;          // Mask of each byte of the pattern
+    SIZE_T        PatternLength; // Number of bytes of the pattern and the mask
+    SIZE_T        AnchorIndex;   // The exact byte that is searched with SSE2
+    BOOLEAN       HasAnchor;     // FALSE if all the bytes have a wildcard
+
+} PATTERN_MATCHER, *PPATTERN_MATCHER;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Prepare a pattern and choose its anchor byte */
+BOOLEAN
+PatternMatcherInitialize(PPATTERN_MATCHER Matcher, const UCHAR * Pattern, const UCHAR * Mask, SIZE_T PatternLength);
+/* Find the first match that starts at or after an offset of the buffer */
+SIZE_T
+PatternMatcherFind(PPATTERN_MATCHER Matcher, const UCHAR * Buffer, SIZE_T BufferSize, SIZE_T StartOffset);
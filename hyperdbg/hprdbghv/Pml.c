@@ -0,0 +1,525 @@
+/**
+ * @file Pml.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Page Modification Logging (PML) for high-rate dirty page logging
+ * @details Each core has a 4KB buffer that the processor fills with the guest
+ * physical addresses of the pages that their EPT dirty flag is set, when the
+ * buffer is full a vm-exit occurs and the buffer is drained into the ring of
+ * the core, a periodic timer flushes the rings into the log buffer as a compact
+ * stream of page frame numbers
+ * @version 0.1
+ * @date 2020-04-30
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "Pml.h"
+#include "Vmx.h"
+#include "Ept.h"
+#include "Invept.h"
+#include "Vmcall.h"
+#include "Common.h"
+#include "Broadcast.h"
+#include "GlobalVariables.h"
+
+/**
+ * @brief Initialize the locks and the flush timer of PML
+ * @details Should be called once from vmx non-root mode before enabling PML
+ * 
+ * @return VOID
+ */
+VOID
+PmlInitialize()
+{
+    ExInitializeFastMutex(&PmlMutex);
+    KeInitializeSpinLock(&PmlFlushLock);
+    KeInitializeTimer(&PmlFlushTimer);
+    KeInitializeDpc(&PmlFlushDpc, PmlFlushDpcRoutine, NULL);
+}
+
+/**
+ * @brief Enable Page Modification Logging on all the cores
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL), the accessed
+ * and dirty flags of EPT are enabled until PML is disabled, it fails while the
+ * flags are harvested as both of them clear the dirty flags
+ * 
+ * @return BOOLEAN Returns false if PML is not supported or there was an error
+ */
+BOOLEAN
+PmlEnable()
+{
+    ULONG            ProcessorsCount;
+    ULONG            CoreIndex;
+    PVOID            PmlBuffer;
+    PPML_CORE_RING   Ring;
+    PHYSICAL_ADDRESS MaxSize;
+    LARGE_INTEGER    DueTime;
+
+    if (!g_EptState->IsPmlSupported)
+    {
+        LogError("The processor doesn't support Page Modification Logging");
+        return FALSE;
+    }
+
+    ExAcquireFastMutex(&PmlMutex);
+
+    if (g_EptState->IsPmlEnabled)
+    {
+        ExReleaseFastMutex(&PmlMutex);
+        return TRUE;
+    }
+
+    //
+    // The harvest would miss the dirty flags that are cleared by the drains of PML
+    //
+    if (g_EptState->IsAccessDirtyHarvestActive)
+    {
+        LogError("The accessed and dirty flags are harvested, disable them by '!eptad disable' before enabling PML");
+        ExReleaseFastMutex(&PmlMutex);
+        return FALSE;
+    }
+
+    //
+    // The processor only logs the pages when it sets their dirty flags
+    //
+    if (!g_EptState->IsAccessDirtyFlagsEnabled)
+    {
+        if (!EptSetAccessDirtyFlags(TRUE))
+        {
+            ExReleaseFastMutex(&PmlMutex);
+            return FALSE;
+        }
+
+        g_EptState->IsAccessDirtyEnabledByPml = TRUE;
+    }
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    //
+    // Allocate address anywhere in the OS's memory space
+    //
+    MaxSize.QuadPart = MAXULONG64;
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        //
+        // The PML address should be 4KB aligned
+        //
+        PmlBuffer = MmAllocateContiguousMemory(PAGE_SIZE, MaxSize);
+        Ring      = ExAllocatePoolWithTag(NonPagedPool, sizeof(PML_CORE_RING), POOLTAG);
+
+        if (PmlBuffer == NULL || Ring == NULL)
+        {
+            LogError("Insufficient memory in allocating PML buffer");
+
+            if (PmlBuffer != NULL)
+            {
+                MmFreeContiguousMemory(PmlBuffer);
+            }
+
+            if (Ring != NULL)
+            {
+                ExFreePoolWithTag(Ring, POOLTAG);
+            }
+
+            PmlFreeBuffers();
+            PmlRestoreAccessDirtyFlags();
+            ExReleaseFastMutex(&PmlMutex);
+            return FALSE;
+        }
+
+        RtlZeroMemory(PmlBuffer, PAGE_SIZE);
+        RtlZeroMemory(Ring, sizeof(PML_CORE_RING));
+
+        g_GuestState[CoreIndex].PmlBufferVirtualAddress  = (UINT64)PmlBuffer;
+        g_GuestState[CoreIndex].PmlBufferPhysicalAddress = VirtualAddressToPhysicalAddress(PmlBuffer);
+        g_GuestState[CoreIndex].PmlRing                  = Ring;
+    }
+
+    //
+    // Set the PML address and the PML control on all the cores
+    //
+    KeGenericCallDpc(BroadcastDpcEnablePml, NULL);
+
+    //
+    // Flush the rings periodically
+    //
+    DueTime.QuadPart = -(PML_FLUSH_INTERVAL * 10000LL);
+    KeSetTimerEx(&PmlFlushTimer, DueTime, PML_FLUSH_INTERVAL, &PmlFlushDpc);
+
+    g_EptState->IsPmlEnabled = TRUE;
+
+    ExReleaseFastMutex(&PmlMutex);
+
+    return TRUE;
+}
+
+/**
+ * @brief Disable Page Modification Logging on all the cores
+ * @details Should be called from vmx non-root mode (PASSIVE_LEVEL), the remaining
+ * logged pages of each core are drained and flushed before the buffers are freed,
+ * then the accessed and dirty flags are disabled if PmlEnable enabled them
+ * 
+ * @return VOID
+ */
+VOID
+PmlDisable()
+{
+    ExAcquireFastMutex(&PmlMutex);
+
+    if (!g_EptState->IsPmlEnabled)
+    {
+        ExReleaseFastMutex(&PmlMutex);
+        return;
+    }
+
+    //
+    // No core logs pages or causes page-modification log full vm-exits after this broadcast
+    //
+    KeGenericCallDpc(BroadcastDpcDisablePml, NULL);
+
+    //
+    // Wait for the flush DPC that might be running, then flush the remaining pages
+    //
+    KeCancelTimer(&PmlFlushTimer);
+    KeFlushQueuedDpcs();
+
+    PmlFlushRings();
+
+    g_EptState->IsPmlEnabled = FALSE;
+
+    PmlFreeBuffers();
+
+    PmlRestoreAccessDirtyFlags();
+
+    ExReleaseFastMutex(&PmlMutex);
+}
+
+/**
+ * @brief Disable the accessed and dirty flags of EPT if they're enabled by PmlEnable
+ * @details PmlMutex should be held
+ * 
+ * @return VOID
+ */
+VOID
+PmlRestoreAccessDirtyFlags()
+{
+    if (g_EptState->IsAccessDirtyEnabledByPml)
+    {
+        EptSetAccessDirtyFlags(FALSE);
+        g_EptState->IsAccessDirtyEnabledByPml = FALSE;
+    }
+}
+
+/**
+ * @brief Free the PML buffers of all the cores
+ * @details The PML control of the cores should be disabled before calling this function
+ * 
+ * @return VOID
+ */
+VOID
+PmlFreeBuffers()
+{
+    ULONG ProcessorsCount;
+    ULONG CoreIndex;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        if (g_GuestState[CoreIndex].PmlBufferVirtualAddress != NULL)
+        {
+            MmFreeContiguousMemory((PVOID)g_GuestState[CoreIndex].PmlBufferVirtualAddress);
+        }
+
+        if (g_GuestState[CoreIndex].PmlRing != NULL)
+        {
+            ExFreePoolWithTag(g_GuestState[CoreIndex].PmlRing, POOLTAG);
+        }
+
+        g_GuestState[CoreIndex].PmlBufferVirtualAddress  = NULL;
+        g_GuestState[CoreIndex].PmlBufferPhysicalAddress = 0;
+        g_GuestState[CoreIndex].PmlRing                  = NULL;
+    }
+}
+
+/**
+ * @brief Enable Page Modification Logging on the current core
+ * @details This function should be called from vmx root-mode
+ * 
+ * @return VOID
+ */
+VOID
+PmlEnableOnCurrentCore()
+{
+    ULONG SecondaryProcBasedVmExecControls = 0;
+    ULONG CurrentProcessorIndex            = KeGetCurrentProcessorNumber();
+
+    if (g_GuestState[CurrentProcessorIndex].PmlBufferPhysicalAddress == 0)
+    {
+        return;
+    }
+
+    __vmx_vmwrite(PML_ADDRESS, g_GuestState[CurrentProcessorIndex].PmlBufferPhysicalAddress);
+
+    //
+    // The processor logs the pages from the last entry to the first entry
+    //
+    __vmx_vmwrite(GUEST_PML_INDEX, PML_ENTRY_COUNT - 1);
+
+    __vmx_vmread(SECONDARY_VM_EXEC_CONTROL, &SecondaryProcBasedVmExecControls);
+    __vmx_vmwrite(SECONDARY_VM_EXEC_CONTROL, SecondaryProcBasedVmExecControls | CPU_BASED_CTL2_ENABLE_PML);
+}
+
+/**
+ * @brief Drain the logged pages and disable Page Modification Logging on the current core
+ * @details This function should be called from vmx root-mode
+ * 
+ * @return VOID
+ */
+VOID
+PmlDisableOnCurrentCore()
+{
+    ULONG SecondaryProcBasedVmExecControls = 0;
+
+    __vmx_vmread(SECONDARY_VM_EXEC_CONTROL, &SecondaryProcBasedVmExecControls);
+
+    if (!(SecondaryProcBasedVmExecControls & CPU_BASED_CTL2_ENABLE_PML))
+    {
+        return;
+    }
+
+    PmlDrainCurrentCore();
+
+    __vmx_vmwrite(SECONDARY_VM_EXEC_CONTROL, SecondaryProcBasedVmExecControls & ~CPU_BASED_CTL2_ENABLE_PML);
+}
+
+/**
+ * @brief Drain the PML buffer of the current core into the ring of the core
+ * @details This function should be called from vmx root-mode, the dirty flags of
+ * the logged pages are cleared in the current EPT table so the next writes to these
+ * pages are logged again, a write from another core that has a cached translation
+ * of the same page is not logged until that translation is invalidated, no lock is
+ * acquired as the current core is the only writer of its ring
+ * 
+ * @return VOID
+ */
+VOID
+PmlDrainCurrentCore()
+{
+    UINT64              PmlIndex = 0;
+    UINT64              EptPointer;
+    UINT64              GuestPhysicalAddress;
+    UINT32              Index;
+    UINT32              FirstIndex;
+    PUINT64             PmlBuffer;
+    PEPT_PML1_ENTRY     Pml1;
+    PEPT_PML2_ENTRY     Pml2;
+    PVMM_EPT_PAGE_TABLE PageTable;
+    PPML_CORE_RING      Ring;
+    LONG64              Head;
+    LONG64              Tail;
+    ULONG               CurrentProcessorIndex = KeGetCurrentProcessorNumber();
+
+    PmlBuffer = (PUINT64)g_GuestState[CurrentProcessorIndex].PmlBufferVirtualAddress;
+    Ring      = g_GuestState[CurrentProcessorIndex].PmlRing;
+
+    if (PmlBuffer == NULL || Ring == NULL)
+    {
+        return;
+    }
+
+    __vmx_vmread(GUEST_PML_INDEX, &PmlIndex);
+    PmlIndex &= PML_INDEX_MASK;
+
+    //
+    // The valid entries are after the current index, or all of them if the index is wrapped
+    //
+    FirstIndex = PmlIndex >= PML_ENTRY_COUNT ? 0 : (UINT32)PmlIndex + 1;
+
+    if (FirstIndex == PML_ENTRY_COUNT)
+    {
+        //
+        // Nothing is logged
+        //
+        return;
+    }
+
+    PageTable = EptGetCurrentPageTable();
+
+    //
+    // The tail is only increased by the consumer, so an old value is safe to use
+    //
+    Head = Ring->Head;
+    Tail = Ring->Tail;
+
+    for (Index = FirstIndex; Index < PML_ENTRY_COUNT; Index++)
+    {
+        GuestPhysicalAddress = PmlBuffer[Index];
+
+        //
+        // Clear the dirty flag so the next write to this page is logged again
+        //
+        Pml1 = EptGetPml1Entry(PageTable, GuestPhysicalAddress);
+
+        if (Pml1 != NULL)
+        {
+            InterlockedAnd64((LONG64 *)&Pml1->Flags, ~EPT_ENTRY_DIRTY_FLAG);
+        }
+        else
+        {
+            Pml2 = EptGetPml2Entry(PageTable, GuestPhysicalAddress);
+
+            if (Pml2 != NULL)
+            {
+                InterlockedAnd64((LONG64 *)&Pml2->Flags, ~EPT_ENTRY_DIRTY_FLAG);
+            }
+        }
+
+        if (Head - Tail < PML_RING_ENTRY_COUNT)
+        {
+            Ring->PageFrameNumbers[Head & (PML_RING_ENTRY_COUNT - 1)] = (UINT32)(GuestPhysicalAddress / PAGE_SIZE);
+            Head++;
+        }
+        else
+        {
+            Ring->DroppedPages++;
+        }
+    }
+
+    //
+    // Publish the pages to the consumer
+    //
+    InterlockedExchange64(&Ring->Head, Head);
+
+    //
+    // Reset the buffer
+    //
+    __vmx_vmwrite(GUEST_PML_INDEX, PML_ENTRY_COUNT - 1);
+
+    //
+    // The cleared dirty flags are not set again by the cached translations
+    //
+    __vmx_vmread(EPT_POINTER, &EptPointer);
+    InveptQueueSingleContext(EptPointer);
+}
+
+/**
+ * @brief Handle the vm-exit of page-modification log full
+ * @details This function should be called from vmx root-mode, the write that caused
+ * the vm-exit is not completed so the instruction should be executed again
+ * 
+ * @return VOID
+ */
+VOID
+PmlHandleLogFull()
+{
+    ULONG SecondaryProcBasedVmExecControls = 0;
+
+    if (g_GuestState[KeGetCurrentProcessorNumber()].PmlRing == NULL)
+    {
+        //
+        // The buffers are not available, stop logging on this core instead of
+        // causing a vm-exit on each write
+        //
+        __vmx_vmread(SECONDARY_VM_EXEC_CONTROL, &SecondaryProcBasedVmExecControls);
+        __vmx_vmwrite(SECONDARY_VM_EXEC_CONTROL, SecondaryProcBasedVmExecControls & ~CPU_BASED_CTL2_ENABLE_PML);
+    }
+    else
+    {
+        PmlDrainCurrentCore();
+    }
+
+    //
+    // Redo the instruction
+    //
+    g_GuestState[KeGetCurrentProcessorNumber()].IncrementRip = FALSE;
+}
+
+/**
+ * @brief Flush the rings of all the cores into the log buffer
+ * @details Should be called from vmx non-root mode (IRQL <= DISPATCH_LEVEL), the
+ * pages are sent as OPERATION_LOG_PML_DIRTY_PAGES packets, the number of the pages
+ * that are dropped since the previous packet of a core is reported in the packet
+ * 
+ * @return VOID
+ */
+VOID
+PmlFlushRings()
+{
+    ULONG                  ProcessorsCount;
+    ULONG                  CoreIndex;
+    PPML_CORE_RING         Ring;
+    LONG64                 Head;
+    LONG64                 Tail;
+    LONG64                 DroppedPages;
+    UINT32                 Index;
+    KIRQL                  OldIrql;
+    PML_DIRTY_PAGES_PACKET Packet;
+
+    ProcessorsCount = KeQueryActiveProcessorCount(0);
+
+    KeAcquireSpinLock(&PmlFlushLock, &OldIrql);
+
+    for (CoreIndex = 0; CoreIndex < ProcessorsCount; CoreIndex++)
+    {
+        Ring = g_GuestState[CoreIndex].PmlRing;
+
+        if (Ring == NULL)
+        {
+            continue;
+        }
+
+        //
+        // Read the head before the entries that it publishes
+        //
+        Head = InterlockedCompareExchange64(&Ring->Head, 0, 0);
+        Tail = Ring->Tail;
+
+        DroppedPages = Ring->DroppedPages;
+
+        while (Tail != Head || DroppedPages != Ring->ReportedDroppedPages)
+        {
+            Packet.Header.CoreIndex     = CoreIndex;
+            Packet.Header.NumberOfPages = (UINT32)min(Head - Tail, (LONG64)PML_DIRTY_PAGES_RECORD_MAX_PAGES);
+            Packet.Header.DroppedPages  = (UINT32)min(DroppedPages - Ring->ReportedDroppedPages, (LONG64)MAXUINT32);
+
+            for (Index = 0; Index < Packet.Header.NumberOfPages; Index++)
+            {
+                Packet.PageFrameNumbers[Index] = Ring->PageFrameNumbers[(Tail + Index) & (PML_RING_ENTRY_COUNT - 1)];
+            }
+
+            LogSendBuffer(OPERATION_LOG_PML_DIRTY_PAGES, &Packet, sizeof(PML_DIRTY_PAGES_RECORD) + Packet.Header.NumberOfPages * sizeof(UINT32));
+
+            Tail += Packet.Header.NumberOfPages;
+            Ring->ReportedDroppedPages = DroppedPages;
+
+            //
+            // Give the entries back to the core
+            //
+            InterlockedExchange64(&Ring->Tail, Tail);
+        }
+    }
+
+    KeReleaseSpinLock(&PmlFlushLock, OldIrql);
+}
+
+/**
+ * @brief The DPC of the flush timer
+ * 
+ * @param Dpc
+ * @param DeferredContext
+ * @param SystemArgument1
+ * @param SystemArgument2
+ * @return VOID 
+ */
+VOID
+PmlFlushDpcRoutine(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    PmlFlushRings();
+}
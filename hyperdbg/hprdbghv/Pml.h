@@ -0,0 +1,135 @@
+/**
+ * @file Pml.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of Page Modification Logging (PML)
+ * @details
+ * @version 0.1
+ * @date 2020-04-30
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include <ntddk.h>
+#include "Logging.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Number of entries in the PML buffer (a 4KB page of guest physical addresses)
+ * 
+ */
+#define PML_ENTRY_COUNT 512
+
+/**
+ * @brief The PML index is decremented after each logged page, so when the
+ * buffer is full the 16-bit index is wrapped to 0xffff
+ * 
+ */
+#define PML_INDEX_MASK 0xffff
+
+/**
+ * @brief Number of page frame numbers in the ring of each core (should be a power of two)
+ * 
+ */
+#define PML_RING_ENTRY_COUNT 0x10000
+
+/**
+ * @brief Interval of flushing the rings of the cores into the log buffer (in milliseconds)
+ * 
+ */
+#define PML_FLUSH_INTERVAL 100
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief The ring of the dirty pages of a core
+ * @details The core writes the logged pages to its ring from vmx-root without
+ * acquiring any lock (it's the only producer), the flush timer is the only consumer
+ * 
+ */
+typedef struct _PML_CORE_RING
+{
+    volatile LONG64 Head;                 // Number of the pages that are written by the core (vmx-root)
+    volatile LONG64 DroppedPages;         // Number of the pages that are dropped as the ring was full (vmx-root)
+    volatile LONG64 Tail;                 // Number of the pages that are flushed to the log buffer
+    LONG64          ReportedDroppedPages; // Number of the dropped pages that are reported in the log packets
+    UINT32          PageFrameNumbers[PML_RING_ENTRY_COUNT];
+
+} PML_CORE_RING, *PPML_CORE_RING;
+
+/**
+ * @brief A log packet of dirty pages
+ * 
+ */
+typedef struct _PML_DIRTY_PAGES_PACKET
+{
+    PML_DIRTY_PAGES_RECORD Header;
+    UINT32                 PageFrameNumbers[PML_DIRTY_PAGES_RECORD_MAX_PAGES];
+
+} PML_DIRTY_PAGES_PACKET, *PPML_DIRTY_PAGES_PACKET;
+
+//////////////////////////////////////////////////
+//					Variables					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Serializes enabling and disabling PML (PASSIVE_LEVEL)
+ * 
+ */
+FAST_MUTEX PmlMutex;
+
+/**
+ * @brief The periodic timer that flushes the rings of the cores
+ * 
+ */
+KTIMER PmlFlushTimer;
+KDPC   PmlFlushDpc;
+
+/**
+ * @brief Serializes the consumers of the rings (the flush timer and disabling PML)
+ * 
+ */
+KSPIN_LOCK PmlFlushLock;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Initialize the locks and the flush timer of PML (vmx non-root) */
+VOID
+PmlInitialize();
+/* Enable Page Modification Logging on all the cores (vmx non-root) */
+BOOLEAN
+PmlEnable();
+/* Disable Page Modification Logging on all the cores (vmx non-root) */
+VOID
+PmlDisable();
+/* Disable the accessed and dirty flags of EPT if they're enabled by PmlEnable (vmx non-root) */
+VOID
+PmlRestoreAccessDirtyFlags();
+/* Free the PML buffers of all the cores */
+VOID
+PmlFreeBuffers();
+/* Enable Page Modification Logging on the current core (vmx-root) */
+VOID
+PmlEnableOnCurrentCore();
+/* Drain the logged pages and disable Page Modification Logging on the current core (vmx-root) */
+VOID
+PmlDisableOnCurrentCore();
+/* Drain the PML buffer of the current core into the ring of the core (vmx-root) */
+VOID
+PmlDrainCurrentCore();
+/* Flush the rings of all the cores into the log buffer (vmx non-root) */
+VOID
+PmlFlushRings();
+/* The DPC of the flush timer */
+VOID
+PmlFlushDpcRoutine(KDPC * Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+/* Handle the vm-exit of page-modification log full */
+VOID
+PmlHandleLogFull();
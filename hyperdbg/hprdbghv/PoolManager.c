@@ -66,7 +66,7 @@ PoolManagerInitialize()
     //
     // Request pages to be allocated for Trampoline of Executable hooked pages
     //
-    PoolManagerRequestAllocation(MAX_EXEC_TRAMPOLINE_SIZE, 10, EXEC_TRAMPOLINE);
+    PoolManagerRequestAllocation(EPT_HOOK_TRAMPOLINE_BLOCK_SIZE, 10, EXEC_TRAMPOLINE);
 
     //
     // Request pages to be allocated for detour hooked pages details
@@ -129,11 +129,64 @@ PoolManagerUninitialize()
 UINT64
 PoolManagerRequestPool(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPool, UINT32 Size)
 {
-    PLIST_ENTRY ListTemp = 0;
-    UINT64      Address  = 0;
-    ListTemp             = ListOfAllocatedPoolsHead;
+    return PoolManagerRequestPoolNearAddress(Intention, RequestNewPool, Size, 0);
+}
+
+/**
+ * @brief Check whether all the bytes of a pool are reachable by 32-bit displacements
+ * @details A page of margin is kept, so the pool is reachable from the whole page of
+ * a page aligned address
+ * 
+ * @param Address The address of the pool
+ * @param Size The size of the pool
+ * @param NearAddress The address that should reach the pool
+ * @return BOOLEAN Returns true if the pool is reachable
+ */
+BOOLEAN
+PoolManagerIsNearAddress(UINT64 Address, SIZE_T Size, UINT64 NearAddress)
+{
+    INT64 Start = (INT64)(Address - NearAddress);
+    INT64 End   = (INT64)(Address + Size - NearAddress);
+
+    //
+    // MINLONG and MAXLONG are unsigned constants, so the limits are written as signed values
+    //
+    return Start > -0x80000000LL + PAGE_SIZE && End < 0x7fffffffLL - PAGE_SIZE;
+}
 
-    SpinlockLock(&LockForReadingPool);
+/**
+ * @brief This function should be called from vmx-root in order to get a pool that is
+ * reachable by 32-bit displacements from an address
+ * @details If there is no free pool near the address then any free pool is returned
+ * 
+ * @param Intention The intention why we need this pool for (buffer tag)
+ * @param RequestNewPool Create a request to allocate a new pool with the same size, next time
+ * that it's safe to allocate (this way we never ran out of pools for this "Intention")
+ * @param Size If the RequestNewPool is true the we should specify a size for the new pool
+ * @param NearAddress The address that the pool is used from or zero for any pool
+ * @return UINT64 Returns a pool address or retuns null if there was an error
+ */
+UINT64
+PoolManagerRequestPoolNearAddress(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPool, UINT32 Size, UINT64 NearAddress)
+{
+    PLIST_ENTRY ListTemp      = 0;
+    PPOOL_TABLE SelectedTable = NULL;
+    PPOOL_TABLE FarTable      = NULL;
+    UINT64      Address       = 0;
+    ListTemp                  = ListOfAllocatedPoolsHead;
+
+    //
+    // A vm-exit on this core might wait for the lock, so vmx non-root
+    // doesn't take a ticket
+    //
+    if (g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        SpinlockTicketLock(&LockForReadingPool);
+    }
+    else
+    {
+        SpinlockTicketLockPolling(&LockForReadingPool);
+    }
 
     while (ListOfAllocatedPoolsHead != ListTemp->Flink)
     {
@@ -146,13 +199,31 @@ PoolManagerRequestPool(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPo
 
         if (PoolTable->Intention == Intention && PoolTable->IsBusy == FALSE)
         {
-            PoolTable->IsBusy = TRUE;
-            Address           = PoolTable->Address;
-            break;
+            if (NearAddress == 0 || PoolManagerIsNearAddress(PoolTable->Address, PoolTable->Size, NearAddress))
+            {
+                SelectedTable = PoolTable;
+                break;
+            }
+
+            if (FarTable == NULL)
+            {
+                FarTable = PoolTable;
+            }
         }
     }
 
-    SpinlockUnlock(&LockForReadingPool);
+    if (SelectedTable == NULL)
+    {
+        SelectedTable = FarTable;
+    }
+
+    if (SelectedTable != NULL)
+    {
+        SelectedTable->IsBusy = TRUE;
+        Address               = SelectedTable->Address;
+    }
+
+    SpinlockTicketUnlock(&LockForReadingPool);
 
     //
     // Check if we need additional pools e.g another pool or the pool
@@ -169,6 +240,111 @@ PoolManagerRequestPool(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPo
     return Address;
 }
 
+/**
+ * @brief Return a pool that is requested by PoolManagerRequestPool to the pool manager
+ * @details The buffer is not freed immediately, it's marked and it's freed the next time
+ * that PoolManagerCheckAndPerformAllocation is called from PASSIVE_LEVEL, so this function
+ * can be called from vmx-root
+ * 
+ * @param AddressToFree The address of the pool
+ * @return BOOLEAN Returns true if the address belongs to a busy pool
+ */
+BOOLEAN
+PoolManagerFreePool(UINT64 AddressToFree)
+{
+    PLIST_ENTRY ListTemp = 0;
+    BOOLEAN     Result   = FALSE;
+    ListTemp             = ListOfAllocatedPoolsHead;
+
+    //
+    // A vm-exit on this core might wait for the lock, so vmx non-root
+    // doesn't take a ticket
+    //
+    if (g_GuestState[KeGetCurrentProcessorNumber()].IsOnVmxRootMode)
+    {
+        SpinlockTicketLock(&LockForReadingPool);
+    }
+    else
+    {
+        SpinlockTicketLockPolling(&LockForReadingPool);
+    }
+
+    while (ListOfAllocatedPoolsHead != ListTemp->Flink)
+    {
+        ListTemp = ListTemp->Flink;
+
+        //
+        // Get the head of the record
+        //
+        PPOOL_TABLE PoolTable = (PPOOL_TABLE)CONTAINING_RECORD(ListTemp, POOL_TABLE, PoolsList);
+
+        if (PoolTable->Address == AddressToFree && PoolTable->IsBusy && !PoolTable->ShouldBeFreed)
+        {
+            PoolTable->ShouldBeFreed          = TRUE;
+            IsNewRequestForAllocationRecieved = TRUE;
+
+            Result = TRUE;
+            break;
+        }
+    }
+
+    SpinlockTicketUnlock(&LockForReadingPool);
+
+    return Result;
+}
+
+/**
+ * @brief Free the pools that are marked by PoolManagerFreePool
+ * @details Should be called from PASSIVE_LEVEL, the records are removed from the list
+ * while the lock is held and the buffers are freed after releasing the lock
+ * 
+ * @return VOID 
+ */
+VOID
+PoolManagerFreeMarkedPools()
+{
+    PLIST_ENTRY ListTemp = 0;
+    PLIST_ENTRY NextList = 0;
+    LIST_ENTRY  FreeList;
+
+    InitializeListHead(&FreeList);
+
+    //
+    // It's PASSIVE_LEVEL, vmx-root might wait for the lock
+    //
+    SpinlockTicketLockPolling(&LockForReadingPool);
+
+    ListTemp = ListOfAllocatedPoolsHead->Flink;
+
+    while (ListOfAllocatedPoolsHead != ListTemp)
+    {
+        NextList = ListTemp->Flink;
+
+        //
+        // Get the head of the record
+        //
+        PPOOL_TABLE PoolTable = (PPOOL_TABLE)CONTAINING_RECORD(ListTemp, POOL_TABLE, PoolsList);
+
+        if (PoolTable->ShouldBeFreed)
+        {
+            RemoveEntryList(&PoolTable->PoolsList);
+            InsertHeadList(&FreeList, &PoolTable->PoolsList);
+        }
+
+        ListTemp = NextList;
+    }
+
+    SpinlockTicketUnlock(&LockForReadingPool);
+
+    while (!IsListEmpty(&FreeList))
+    {
+        PPOOL_TABLE PoolTable = (PPOOL_TABLE)CONTAINING_RECORD(RemoveHeadList(&FreeList), POOL_TABLE, PoolsList);
+
+        ExFreePoolWithTag((PVOID)PoolTable->Address, POOLTAG);
+        ExFreePoolWithTag(PoolTable, POOLTAG);
+    }
+}
+
 /**
  * @brief Allocate the new pools and add them to pool table
  * @details This function doesn't need lock as it just calls once from PASSIVE_LEVEL
@@ -243,6 +419,11 @@ PoolManagerCheckAndPerformAllocation()
 
     PAGED_CODE();
 
+    //
+    // Free the pools that are returned to the pool manager
+    //
+    PoolManagerFreeMarkedPools();
+
     if (RequestNewAllocation->Size0 != 0)
     {
         Result = PoolManagerAllocateAndAddToPoolTable(RequestNewAllocation->Size0, RequestNewAllocation->Count0, RequestNewAllocation->Intention0);
@@ -11,6 +11,7 @@
  */
 #pragma once
 #include <ntddk.h>
+#include "Spinlock.h"
 
 //////////////////////////////////////////////////
 //                   Definition	    			//
@@ -111,8 +112,8 @@ typedef struct _REQUEST_NEW_ALLOCATION
  */
 REQUEST_NEW_ALLOCATION * RequestNewAllocation;
 
-volatile LONG LockForRequestAllocation;
-volatile LONG LockForReadingPool;
+volatile LONG   LockForRequestAllocation;
+SPINLOCK_TICKET LockForReadingPool;
 
 /**
  * @brief We set it when there is a new allocation
@@ -143,6 +144,18 @@ PoolManagerRequestAllocation(SIZE_T Size, UINT32 Count, POOL_ALLOCATION_INTENTIO
 /* next time it's safe the pool will be allocated */
 UINT64
 PoolManagerRequestPool(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPool, UINT32 Size);
+/* Check whether all the bytes of a pool are reachable by 32-bit displacements from an address */
+BOOLEAN
+PoolManagerIsNearAddress(UINT64 Address, SIZE_T Size, UINT64 NearAddress);
+/* Same as PoolManagerRequestPool but it prefers a pool that is reachable by 32-bit displacements from an address */
+UINT64
+PoolManagerRequestPoolNearAddress(POOL_ALLOCATION_INTENTION Intention, BOOLEAN RequestNewPool, UINT32 Size, UINT64 NearAddress);
+/* Return a pool to the pool manager, it can be called from vmx-root as the pool is freed later from PASSIVE_LEVEL */
+BOOLEAN
+PoolManagerFreePool(UINT64 AddressToFree);
+/* Free the pools that are returned to the pool manager (should be called in PASSIVE_LEVEL) */
+VOID
+PoolManagerFreeMarkedPools();
 /* De-allocate all the allocated pools */
 VOID
 PoolManagerUninitialize();
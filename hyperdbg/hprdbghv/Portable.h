@@ -0,0 +1,81 @@
+/**
+ * @file Portable.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief The types of the modules that don't depend on the kernel
+ * @details These modules are also built in user-mode by the tests (the
+ * tests directory), so they include this header instead of ntddk.h
+ * @version 0.1
+ * @date 2020-05-13
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#pragma once
+
+#if defined(_KERNEL_MODE)
+
+#    include <ntddk.h>
+
+#else
+
+#    include <stddef.h>
+#    include <stdint.h>
+#    include <string.h>
+
+typedef void      VOID;
+typedef void *    PVOID;
+typedef char      CHAR;
+typedef uint8_t   UCHAR;
+typedef uint8_t * PUCHAR;
+typedef uint8_t   BOOLEAN;
+typedef int32_t   INT;
+typedef int32_t   LONG;
+typedef uint32_t  ULONG;
+typedef int64_t   LONG64;
+typedef uint8_t   UINT8;
+typedef uint16_t  UINT16;
+typedef uint32_t  UINT32;
+typedef uint64_t  UINT64;
+typedef int32_t   INT32;
+typedef int64_t   INT64;
+typedef uint8_t * PUINT8;
+typedef uint32_t * PUINT32;
+typedef uint64_t * PUINT64;
+typedef size_t    SIZE_T;
+typedef size_t *  PSIZE_T;
+
+#    define TRUE  1
+#    define FALSE 0
+
+#    ifndef PAGE_SIZE
+#        define PAGE_SIZE 0x1000
+#    endif
+
+#    define RtlZeroMemory(Destination, Length)         memset((Destination), 0, (Length))
+#    define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+
+//
+// The interlocked operations and the intrinsics of the spinlocks
+//
+#    include <x86intrin.h>
+
+#    define InterlockedIncrement(Addend) __atomic_add_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#    define InterlockedDecrement(Addend) __atomic_sub_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#    define InterlockedCompareExchange(Destination, Exchange, Comparand) \
+        __sync_val_compare_and_swap((Destination), (Comparand), (Exchange))
+#    define _interlockedbittestandset(Base, Offset) \
+        ((__atomic_fetch_or((Base), 1 << (Offset), __ATOMIC_SEQ_CST) >> (Offset)) & 1)
+#    define KeMemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#    ifndef max
+#        define max(a, b) (((a) > (b)) ? (a) : (b))
+#    endif
+
+//
+// The kernel logs are not available in user-mode
+//
+#    define LogInfo(format, ...)
+#    define LogWarning(format, ...)
+#    define LogError(format, ...)
+
+#endif
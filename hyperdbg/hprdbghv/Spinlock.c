@@ -3,12 +3,13 @@
  * @author Sina Karvandi (sina@rayanfam.com)
  * @brief This is the implementation for custom spinlock.
  * 
- * @details This implementation is derived from Hvpp by Petr Benes 
+ * @details The test-and-set spinlock is derived from Hvpp by Petr Benes 
  *      - https://github.com/wbenny/hvpp
- * Based on my benchmarks, this simple implementation beats other (often
- * more complex) spinlock implementations - such as queue spinlocks, ticket
- * spinlocks, MCS locks.  The only difference between this implementation
- * and completely naive spinlock is the "backoff".
+ * The only difference between this implementation and completely naive
+ * spinlock is the "backoff". It's the cheapest lock when there is little
+ * contention, but it's not fair and its waiters keep writing the lock, so
+ * under contention the ticket spinlock below is fairer and often faster
+ * (tests/bench_spinlock.c compares them).
  * 
  * Also, benefit of this implementation is that we can use it with
  * STL lock guards, e.g.: std::lock_guard.
@@ -17,6 +18,10 @@
  *      - https://locklessinc.com/articles/locks/
  *      - https://github.com/cyfdecyf/spinlock
  * 
+ * The ticket spinlock is for the locks that many cores compete for (e.g. in
+ * vmx-root), it's fair and the waiters don't write the lock while they wait,
+ * the reader-writer spinlock is built on it for the read-mostly tables.
+ * 
  * @version 0.1
  * @date 2020-04-10
  * 
@@ -24,7 +29,8 @@
  * 
  */
 
-#include <ntddk.h>
+#include "Portable.h"
+#include "Spinlock.h"
 
 /**
  * @brief The maximum wait before PAUSE
@@ -32,13 +38,19 @@
  */
 static unsigned MaxWait = 65536;
 
+/**
+ * @brief The pauses of a ticket waiter for each of the waiters before it
+ * 
+ */
+#define SPINLOCK_TICKET_PAUSES_PER_WAITER 32
+
 /**
  * @brief Tries to get the lock otherwise returns
  * 
  * @param LONG Lock variable
  * @return BOOLEAN If it was successfull on getting the lock
  */
-inline BOOLEAN
+BOOLEAN
 SpinlockTryLock(volatile LONG * Lock)
 {
     return (!(*Lock) && !_interlockedbittestandset(Lock, 0));
@@ -88,3 +100,218 @@ SpinlockUnlock(volatile LONG * Lock)
 {
     *Lock = 0;
 }
+
+/**
+ * @brief Tries to get the ticket spinlock if it's free, otherwise returns
+ * 
+ * @param Lock The ticket spinlock
+ * @return BOOLEAN If it was successfull on getting the lock
+ */
+BOOLEAN
+SpinlockTicketTryLock(PSPINLOCK_TICKET Lock)
+{
+    LONG NowServing = Lock->NowServing;
+
+    //
+    // The lock is free only if the next ticket is the served ticket
+    //
+    if (InterlockedCompareExchange(&Lock->NextTicket, NowServing + 1, NowServing) != NowServing)
+    {
+        return FALSE;
+    }
+
+#if CollectSpinlockContentionStatistics
+    Lock->Statistics.Acquisitions++;
+#endif
+
+    return TRUE;
+}
+
+/**
+ * @brief Gets a ticket and waits until the ticket is served
+ * @details The waiters pause in proportion to the number of the
+ * waiters before them
+ * 
+ * @param Lock The ticket spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockTicketLock(PSPINLOCK_TICKET Lock)
+{
+    ULONG Ticket = (ULONG)InterlockedIncrement(&Lock->NextTicket) - 1;
+    ULONG Distance;
+
+#if CollectSpinlockContentionStatistics
+    UINT64 Spins     = 0;
+    UINT64 StartTime = 0;
+#endif
+
+    while ((Distance = Ticket - (ULONG)Lock->NowServing) != 0)
+    {
+#if CollectSpinlockContentionStatistics
+        if (StartTime == 0)
+        {
+            StartTime = __rdtsc();
+        }
+        Spins += Distance * SPINLOCK_TICKET_PAUSES_PER_WAITER;
+#endif
+
+        for (ULONG i = 0; i < Distance * SPINLOCK_TICKET_PAUSES_PER_WAITER; i++)
+        {
+            _mm_pause();
+        }
+    }
+
+#if CollectSpinlockContentionStatistics
+    //
+    // Only the owner updates the counters
+    //
+    Lock->Statistics.Acquisitions++;
+
+    if (StartTime != 0)
+    {
+        Lock->Statistics.Contentions++;
+        Lock->Statistics.Spins += Spins;
+        Lock->Statistics.MaxWait = max(Lock->Statistics.MaxWait, __rdtsc() - StartTime);
+    }
+#endif
+}
+
+/**
+ * @brief Waits until the ticket spinlock is free and gets it without
+ * taking a ticket while it waits
+ * @details It's for vmx non-root when the lock is also acquired in vmx-root,
+ * a vm-exit on this core that waits for the lock only waits for the owner
+ * (as in the test-and-set spinlock) and never for the ticket of its own guest,
+ * this waiter is not fair to the waiters with a ticket
+ * 
+ * @param Lock The ticket spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockTicketLockPolling(PSPINLOCK_TICKET Lock)
+{
+    unsigned Wait = 1;
+
+#if CollectSpinlockContentionStatistics
+    UINT64 Spins     = 0;
+    UINT64 StartTime = 0;
+#endif
+
+    while (!SpinlockTicketTryLock(Lock))
+    {
+#if CollectSpinlockContentionStatistics
+        if (StartTime == 0)
+        {
+            StartTime = __rdtsc();
+        }
+        Spins += Wait;
+#endif
+
+        for (unsigned i = 0; i < Wait; ++i)
+        {
+            _mm_pause();
+        }
+
+        if (Wait * 2 > MaxWait)
+        {
+            Wait = MaxWait;
+        }
+        else
+        {
+            Wait = Wait * 2;
+        }
+    }
+
+#if CollectSpinlockContentionStatistics
+    //
+    // The acquisition is counted by SpinlockTicketTryLock
+    //
+    if (StartTime != 0)
+    {
+        Lock->Statistics.Contentions++;
+        Lock->Statistics.Spins += Spins;
+        Lock->Statistics.MaxWait = max(Lock->Statistics.MaxWait, __rdtsc() - StartTime);
+    }
+#endif
+}
+
+/**
+ * @brief Release the ticket spinlock and serve the next ticket
+ * 
+ * @param Lock The ticket spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockTicketUnlock(PSPINLOCK_TICKET Lock)
+{
+    //
+    // Only the owner writes the served ticket
+    //
+    Lock->NowServing = Lock->NowServing + 1;
+}
+
+/**
+ * @brief Enter the reader-writer spinlock as a reader
+ * @details The reader waits for the writers that arrived before it,
+ * then the other readers can enter the lock too
+ * 
+ * @param Lock The reader-writer spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockLockShared(PSPINLOCK_READ_WRITE Lock)
+{
+    SpinlockTicketLock(&Lock->Writer);
+
+    InterlockedIncrement(&Lock->Readers);
+
+    SpinlockTicketUnlock(&Lock->Writer);
+}
+
+/**
+ * @brief Leave the reader-writer spinlock as a reader
+ * 
+ * @param Lock The reader-writer spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockUnlockShared(PSPINLOCK_READ_WRITE Lock)
+{
+    InterlockedDecrement(&Lock->Readers);
+}
+
+/**
+ * @brief Enter the reader-writer spinlock as the writer
+ * @details The new readers wait on the ticket of the writer, so the
+ * writer only waits for the readers that are already in the lock
+ * 
+ * @param Lock The reader-writer spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockLockExclusive(PSPINLOCK_READ_WRITE Lock)
+{
+    SpinlockTicketLock(&Lock->Writer);
+
+    while (Lock->Readers != 0)
+    {
+        _mm_pause();
+
+#if CollectSpinlockContentionStatistics
+        Lock->Writer.Statistics.Spins++;
+#endif
+    }
+}
+
+/**
+ * @brief Leave the reader-writer spinlock as the writer
+ * 
+ * @param Lock The reader-writer spinlock
+ * @return VOID 
+ */
+VOID
+SpinlockUnlockExclusive(PSPINLOCK_READ_WRITE Lock)
+{
+    SpinlockTicketUnlock(&Lock->Writer);
+}
@@ -0,0 +1,93 @@
+/**
+ * @file Spinlock.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the test-and-set, the ticket and the reader-writer spinlocks
+ * @details The spinlocks don't depend on the kernel, they're also built in
+ * user-mode by the benchmark of the tests directory
+ * @version 0.1
+ * @date 2020-05-12
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include "Portable.h"
+#include "Configuration.h"
+
+//////////////////////////////////////////////////
+//					Structures					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Contention counters of a spinlock (CollectSpinlockContentionStatistics)
+ * @details They're updated by the owner of the lock
+ * 
+ */
+typedef struct _SPINLOCK_STATISTICS
+{
+    UINT64 Acquisitions; // Number of the times that the lock is acquired
+    UINT64 Contentions;  // Acquisitions that had to wait for the lock
+    UINT64 Spins;        // Total number of pauses of the waiters
+    UINT64 MaxWait;      // The longest wait for the lock (tsc cycles)
+
+} SPINLOCK_STATISTICS, *PSPINLOCK_STATISTICS;
+
+/**
+ * @brief A fair (first-come, first-served) ticket spinlock, each waiter only
+ * reads the lock until its ticket is served, it can be used at any IRQL and
+ * in vmx-root, a zeroed lock is unlocked
+ * @details A waiter can't be interrupted by a vm-exit that waits for the same
+ * lock on its core, so if a lock is also acquired in vmx-root, then vmx
+ * non-root acquires it by SpinlockTicketLockPolling (without a ticket)
+ * 
+ */
+typedef struct _SPINLOCK_TICKET
+{
+    volatile LONG NextTicket; // The ticket of the next acquirer
+    volatile LONG NowServing; // The ticket of the owner
+
+#if CollectSpinlockContentionStatistics
+    SPINLOCK_STATISTICS Statistics;
+#endif
+
+} SPINLOCK_TICKET, *PSPINLOCK_TICKET;
+
+/**
+ * @brief A reader-writer spinlock for the read-mostly tables, the readers and
+ * the writers enter in the order of their arrival so the writers don't starve,
+ * a zeroed lock is unlocked
+ * 
+ */
+typedef struct _SPINLOCK_READ_WRITE
+{
+    SPINLOCK_TICKET Writer;  // Held by the writer and briefly by each entering reader
+    volatile LONG   Readers; // Number of the readers that are in the critical section
+
+} SPINLOCK_READ_WRITE, *PSPINLOCK_READ_WRITE;
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+BOOLEAN
+SpinlockTryLock(volatile LONG * Lock);
+void
+SpinlockLock(volatile LONG * Lock);
+void
+SpinlockUnlock(volatile LONG * Lock);
+BOOLEAN
+SpinlockTicketTryLock(PSPINLOCK_TICKET Lock);
+VOID
+SpinlockTicketLock(PSPINLOCK_TICKET Lock);
+VOID
+SpinlockTicketLockPolling(PSPINLOCK_TICKET Lock);
+VOID
+SpinlockTicketUnlock(PSPINLOCK_TICKET Lock);
+VOID
+SpinlockLockShared(PSPINLOCK_READ_WRITE Lock);
+VOID
+SpinlockUnlockShared(PSPINLOCK_READ_WRITE Lock);
+VOID
+SpinlockLockExclusive(PSPINLOCK_READ_WRITE Lock);
+VOID
+SpinlockUnlockExclusive(PSPINLOCK_READ_WRITE Lock);
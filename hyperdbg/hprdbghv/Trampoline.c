@@ -0,0 +1,432 @@
+/**
+ * @file Trampoline.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief The relocating trampoline builder of the detour hooks
+ * @details The instructions that are overwritten by a detour are moved to a trampoline,
+ * the relative branches and the RIP-relative operands of these instructions are rewritten
+ * to keep their targets, and the shortest jump that reaches the target is used
+ * @version 0.1
+ * @date 2020-05-04
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#include "Trampoline.h"
+#include "LengthDisassemblerEngine.h"
+#if defined(_KERNEL_MODE)
+#    include "Logging.h"
+#endif
+
+/**
+ * @brief Check whether a displacement fits in a signed byte
+ * @details MINCHAR and MINLONG of ntdef.h are unsigned constants (0x80 and
+ * 0x80000000), so the ranges are checked by sign-extending the truncated value
+ * 
+ * @param Displacement The displacement
+ * @return BOOLEAN Returns true if the displacement fits in 8 bits
+ */
+static BOOLEAN
+TrampolineIsRel8Displacement(INT64 Displacement)
+{
+    return (INT64)(CHAR)Displacement == Displacement;
+}
+
+/**
+ * @brief Check whether a target is reachable by a 32-bit displacement
+ * 
+ * @param NextInstructionAddress The address after the branch (the displacement is relative to it)
+ * @param TargetAddress The target of the branch
+ * @return BOOLEAN Returns true if the target is in the range of a 32-bit displacement
+ */
+BOOLEAN
+TrampolineIsRel32Reachable(UINT64 NextInstructionAddress, UINT64 TargetAddress)
+{
+    INT64 Displacement = (INT64)(TargetAddress - NextInstructionAddress);
+
+    return (INT64)(INT32)Displacement == Displacement;
+}
+
+/**
+ * @brief Write the shortest jump that reaches the target
+ * 
+ * @param Buffer The buffer to write the jump
+ * @param Address The address that the jump is executed from
+ * @param TargetAddress The target of the jump
+ * @return SIZE_T The size of the jump
+ */
+SIZE_T
+TrampolineWriteJump(PUCHAR Buffer, UINT64 Address, UINT64 TargetAddress)
+{
+    INT64 Displacement = (INT64)(TargetAddress - (Address + 2));
+
+    if (TrampolineIsRel8Displacement(Displacement))
+    {
+        //
+        // jmp rel8
+        //
+        Buffer[0] = 0xeb;
+        Buffer[1] = (UCHAR)Displacement;
+        return 2;
+    }
+
+    if (TrampolineIsRel32Reachable(Address + TRAMPOLINE_REL32_BRANCH_SIZE, TargetAddress))
+    {
+        //
+        // jmp rel32
+        //
+        Buffer[0]            = 0xe9;
+        *(INT32 *)&Buffer[1] = (INT32)(TargetAddress - (Address + TRAMPOLINE_REL32_BRANCH_SIZE));
+        return TRAMPOLINE_REL32_BRANCH_SIZE;
+    }
+
+    //
+    // jmp qword ptr [rip+0]
+    //
+    Buffer[0]             = 0xff;
+    Buffer[1]             = 0x25;
+    *(UINT32 *)&Buffer[2] = 0;
+    *(UINT64 *)&Buffer[6] = TargetAddress;
+
+    return TRAMPOLINE_ABSOLUTE_JUMP_SIZE;
+}
+
+/**
+ * @brief Write the shortest call that reaches the target
+ * 
+ * @param Buffer The buffer to write the call
+ * @param Address The address that the call is executed from
+ * @param TargetAddress The target of the call
+ * @return SIZE_T The size of the call
+ */
+SIZE_T
+TrampolineWriteCall(PUCHAR Buffer, UINT64 Address, UINT64 TargetAddress)
+{
+    if (TrampolineIsRel32Reachable(Address + TRAMPOLINE_REL32_BRANCH_SIZE, TargetAddress))
+    {
+        //
+        // call rel32
+        //
+        Buffer[0]            = 0xe8;
+        *(INT32 *)&Buffer[1] = (INT32)(TargetAddress - (Address + TRAMPOLINE_REL32_BRANCH_SIZE));
+        return TRAMPOLINE_REL32_BRANCH_SIZE;
+    }
+
+    //
+    // call qword ptr [rip+2] ; jmp $+10 ; the target
+    //
+    Buffer[0]             = 0xff;
+    Buffer[1]             = 0x15;
+    *(UINT32 *)&Buffer[2] = 2;
+    Buffer[6]             = 0xeb;
+    Buffer[7]             = 0x08;
+    *(UINT64 *)&Buffer[8] = TargetAddress;
+
+    return 16;
+}
+
+/**
+ * @brief Write the shortest conditional jump that reaches the target
+ * 
+ * @param Buffer The buffer to write the conditional jump
+ * @param Address The address that the conditional jump is executed from
+ * @param Condition The condition code (the low 4 bits of the opcode)
+ * @param TargetAddress The target of the conditional jump
+ * @return SIZE_T The size of the conditional jump
+ */
+SIZE_T
+TrampolineWriteConditionalJump(PUCHAR Buffer, UINT64 Address, UCHAR Condition, UINT64 TargetAddress)
+{
+    INT64  Displacement = (INT64)(TargetAddress - (Address + 2));
+    SIZE_T JumpSize;
+
+    if (TrampolineIsRel8Displacement(Displacement))
+    {
+        //
+        // jcc rel8
+        //
+        Buffer[0] = 0x70 | Condition;
+        Buffer[1] = (UCHAR)Displacement;
+        return 2;
+    }
+
+    if (TrampolineIsRel32Reachable(Address + 6, TargetAddress))
+    {
+        //
+        // jcc rel32
+        //
+        Buffer[0]            = 0x0f;
+        Buffer[1]            = 0x80 | Condition;
+        *(INT32 *)&Buffer[2] = (INT32)(TargetAddress - (Address + 6));
+        return 6;
+    }
+
+    //
+    // The inverted condition skips the jump, the jump is written first as it
+    // might be shorter than an absolute jump (e.g. a jmp rel32 reaches a target
+    // that is one byte out of the range of the jcc rel32)
+    //
+    JumpSize = TrampolineWriteJump(&Buffer[2], Address + 2, TargetAddress);
+
+    Buffer[0] = 0x70 | (Condition ^ 1);
+    Buffer[1] = (UCHAR)JumpSize;
+
+    return 2 + JumpSize;
+}
+
+/**
+ * @brief Write the jump of a detour site to the hook function
+ * @details The detour site is always a call, so the hook function sees the address of the
+ * detour site plus five on the stack; a call with a 32-bit displacement is used if the hook
+ * function or a jump stub at the free space of the trampoline block is reachable from the
+ * detour site, otherwise a call to the next instruction and an absolute jump are used (no
+ * register is changed and there is no unpaired ret)
+ * 
+ * @param Buffer The buffer to write the jump
+ * @param Address The address of the detour site
+ * @param HookFunction The function that will be called when hook triggered
+ * @param Stub The free space of the trampoline block for a jump stub to the hook function
+ * @param StubSize The size of the free space
+ * @param SizeOfStub The size of the written stub (zero if no stub is used)
+ * @return SIZE_T The size of the jump
+ */
+SIZE_T
+TrampolineWriteDetourJump(PUCHAR Buffer, UINT64 Address, UINT64 HookFunction, PUCHAR Stub, SIZE_T StubSize, PSIZE_T SizeOfStub)
+{
+    UINT64 NextInstructionAddress = Address + TRAMPOLINE_REL32_BRANCH_SIZE;
+
+    *SizeOfStub = 0;
+
+    if (TrampolineIsRel32Reachable(NextInstructionAddress, HookFunction))
+    {
+        return TrampolineWriteCall(Buffer, Address, HookFunction);
+    }
+
+    if (StubSize >= TRAMPOLINE_ABSOLUTE_JUMP_SIZE && TrampolineIsRel32Reachable(NextInstructionAddress, (UINT64)Stub))
+    {
+        //
+        // The stub is near the detour site but the hook function is not, so the stub uses the
+        // shortest jump that reaches the hook function from the trampoline block
+        //
+        *SizeOfStub = TrampolineWriteJump(Stub, (UINT64)Stub, HookFunction);
+
+        return TrampolineWriteCall(Buffer, Address, (UINT64)Stub);
+    }
+
+    //
+    // call $+5 ; jmp qword ptr [rip+0] ; the hook function
+    //
+    Buffer[0]              = 0xe8;
+    *(UINT32 *)&Buffer[1]  = 0;
+    Buffer[5]              = 0xff;
+    Buffer[6]              = 0x25;
+    *(UINT32 *)&Buffer[7]  = 0;
+    *(UINT64 *)&Buffer[11] = HookFunction;
+
+    return TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE;
+}
+
+/**
+ * @brief Compute the size of the whole instructions that cover at least the minimum size
+ * 
+ * @param Address The address of the first instruction
+ * @param MinimumSize The minimum size
+ * @return SIZE_T The size of the instructions or zero if an instruction is not decoded
+ */
+SIZE_T
+TrampolineGetSizeOfInstructions(PVOID Address, SIZE_T MinimumSize)
+{
+    SIZE_T Size = 0;
+    SIZE_T Length;
+
+    while (Size < MinimumSize)
+    {
+        Length = ldisasm((PVOID)((UINT64)Address + Size), TRUE);
+
+        if (Length == 0 || Length > TRAMPOLINE_MAX_INSTRUCTION_LENGTH)
+        {
+            return 0;
+        }
+
+        Size += Length;
+    }
+
+    return Size;
+}
+
+/**
+ * @brief Relocate instructions into a trampoline and add the jump back to the original code
+ * @details The relative branches (jmp, call and jcc) are rewritten to their shortest
+ * form that reaches the original target and the RIP-relative displacements are adjusted,
+ * the instructions that can't be relocated (e.g. loop, jrcxz, VEX encoded instructions
+ * or branches into the relocated instructions) cause the build to fail
+ * 
+ * @param TargetFunction The address of the instructions
+ * @param SizeOfInstructions The size of the whole instructions to relocate
+ * @param Trampoline The final address of the trampoline
+ * @param TrampolineSize The available size at the trampoline
+ * @param SizeOfTrampoline The size of the built trampoline
+ * @return BOOLEAN Returns false if the instructions can't be relocated
+ */
+BOOLEAN
+TrampolineBuild(PVOID TargetFunction, SIZE_T SizeOfInstructions, PUCHAR Trampoline, SIZE_T TrampolineSize, PSIZE_T SizeOfTrampoline)
+{
+    UINT64  Start   = (UINT64)TargetFunction;
+    UINT64  End     = Start + SizeOfInstructions;
+    SIZE_T  Offset  = 0;
+    SIZE_T  Written = 0;
+    SIZE_T  Length;
+    SIZE_T  ModRmOffset;
+    SIZE_T  Index;
+    PUCHAR  Instruction;
+    UINT64  InstructionAddress;
+    UINT64  OutputAddress;
+    UINT64  BranchTarget;
+    INT64   Displacement;
+    UCHAR   Opcode;
+    BOOLEAN IsAddressSizePrefix;
+
+    while (Offset < SizeOfInstructions)
+    {
+        InstructionAddress = Start + Offset;
+        Instruction        = (PUCHAR)InstructionAddress;
+        OutputAddress      = (UINT64)&Trampoline[Written];
+
+        Length = ldisasmex(Instruction, TRUE, &ModRmOffset);
+
+        if (Length == 0 || Length > TRAMPOLINE_MAX_INSTRUCTION_LENGTH || Offset + Length > SizeOfInstructions)
+        {
+            LogError("Could not decode the instruction at 0x%llx", InstructionAddress);
+            return FALSE;
+        }
+
+        if (Written + (Length > TRAMPOLINE_MAX_RELOCATED_INSTRUCTION_SIZE ? Length : TRAMPOLINE_MAX_RELOCATED_INSTRUCTION_SIZE) > TrampolineSize)
+        {
+            LogError("There is no room for the relocated instructions in the trampoline");
+            return FALSE;
+        }
+
+        //
+        // Skip the legacy and REX prefixes
+        //
+        IsAddressSizePrefix = FALSE;
+
+        for (Index = 0; Index < Length - 1; Index++)
+        {
+            if (Instruction[Index] == 0x67)
+            {
+                IsAddressSizePrefix = TRUE;
+            }
+            else if (Instruction[Index] != 0x66 && Instruction[Index] != 0xf0 && Instruction[Index] != 0xf2 &&
+                     Instruction[Index] != 0xf3 && Instruction[Index] != 0x2e && Instruction[Index] != 0x36 &&
+                     Instruction[Index] != 0x3e && Instruction[Index] != 0x26 && Instruction[Index] != 0x64 &&
+                     Instruction[Index] != 0x65 && (Instruction[Index] & 0xf0) != 0x40)
+            {
+                break;
+            }
+        }
+
+        Opcode = Instruction[Index];
+
+        //
+        // VEX and EVEX encodings are not decoded by the length disassembler, loop and jrcxz
+        // have no form with a wider displacement and xbegin is relative to RIP
+        //
+        if (Opcode == 0xc4 || Opcode == 0xc5 || Opcode == 0x62 || (Opcode >= 0xe0 && Opcode <= 0xe3) ||
+            (Opcode == 0xc7 && Instruction[Index + 1] == 0xf8))
+        {
+            LogError("The instruction at 0x%llx can't be relocated", InstructionAddress);
+            return FALSE;
+        }
+
+        if (Opcode == 0xeb || Opcode == 0xe9 || Opcode == 0xe8 || (Opcode & 0xf0) == 0x70 ||
+            (Opcode == 0x0f && (Instruction[Index + 1] & 0xf0) == 0x80))
+        {
+            //
+            // Relative branches
+            //
+            if (Opcode == 0xeb || (Opcode & 0xf0) == 0x70)
+            {
+                Displacement = *(CHAR *)&Instruction[Index + 1];
+            }
+            else if (Opcode == 0x0f)
+            {
+                Displacement = *(INT32 *)&Instruction[Index + 2];
+            }
+            else
+            {
+                Displacement = *(INT32 *)&Instruction[Index + 1];
+            }
+
+            BranchTarget = InstructionAddress + Length + Displacement;
+
+            if (BranchTarget > Start && BranchTarget < End)
+            {
+                LogError("The instruction at 0x%llx branches into the relocated instructions", InstructionAddress);
+                return FALSE;
+            }
+
+            if (Opcode == 0xeb || Opcode == 0xe9)
+            {
+                Written += TrampolineWriteJump(&Trampoline[Written], OutputAddress, BranchTarget);
+            }
+            else if (Opcode == 0xe8)
+            {
+                Written += TrampolineWriteCall(&Trampoline[Written], OutputAddress, BranchTarget);
+            }
+            else if (Opcode == 0x0f)
+            {
+                Written += TrampolineWriteConditionalJump(&Trampoline[Written], OutputAddress, Instruction[Index + 1] & 0xf, BranchTarget);
+            }
+            else
+            {
+                Written += TrampolineWriteConditionalJump(&Trampoline[Written], OutputAddress, Opcode & 0xf, BranchTarget);
+            }
+        }
+        else if (ModRmOffset != 0 && (Instruction[ModRmOffset] & 0xc7) == 0x05)
+        {
+            //
+            // RIP-relative operand, the displacement is right after the ModR/M
+            //
+            if (IsAddressSizePrefix)
+            {
+                LogError("The instruction at 0x%llx can't be relocated", InstructionAddress);
+                return FALSE;
+            }
+
+            BranchTarget = InstructionAddress + Length + *(INT32 *)&Instruction[ModRmOffset + 1];
+
+            if (!TrampolineIsRel32Reachable(OutputAddress + Length, BranchTarget))
+            {
+                LogError("The RIP-relative operand of 0x%llx is not reachable from the trampoline", InstructionAddress);
+                return FALSE;
+            }
+
+            RtlCopyMemory(&Trampoline[Written], Instruction, Length);
+            *(INT32 *)&Trampoline[Written + ModRmOffset + 1] = (INT32)(BranchTarget - (OutputAddress + Length));
+
+            Written += Length;
+        }
+        else
+        {
+            RtlCopyMemory(&Trampoline[Written], Instruction, Length);
+            Written += Length;
+        }
+
+        Offset += Length;
+    }
+
+    //
+    // Add the jump back to the original code
+    //
+    if (Written + TRAMPOLINE_ABSOLUTE_JUMP_SIZE > TrampolineSize)
+    {
+        LogError("There is no room for the relocated instructions in the trampoline");
+        return FALSE;
+    }
+
+    Written += TrampolineWriteJump(&Trampoline[Written], (UINT64)&Trampoline[Written], End);
+
+    *SizeOfTrampoline = Written;
+
+    return TRUE;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file Trampoline.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Headers of the relocating trampoline builder of the detour hooks
+ * @details The builder doesn't access any global variable, so it's also built
+ * by the user-mode tests
+ * @version 0.1
+ * @date 2020-05-04
+ * 
+ * @copyright This project is released under the GNU Public License v3.
+ * 
+ */
+#pragma once
+#include "Portable.h"
+
+//////////////////////////////////////////////////
+//					Definitions					//
+//////////////////////////////////////////////////
+
+/**
+ * @brief Size of a near jump or a near call with a 32-bit displacement
+ * 
+ */
+#define TRAMPOLINE_REL32_BRANCH_SIZE 5
+
+/**
+ * @brief Size of a jump to an absolute address (jmp qword ptr [rip+0] and the address)
+ * 
+ */
+#define TRAMPOLINE_ABSOLUTE_JUMP_SIZE 14
+
+/**
+ * @brief Size of the detour jump that is used if neither the hook function nor a stub
+ * is reachable (call $+5 and an absolute jump)
+ * 
+ */
+#define TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE (TRAMPOLINE_REL32_BRANCH_SIZE + TRAMPOLINE_ABSOLUTE_JUMP_SIZE)
+
+/**
+ * @brief Maximum size of a relocated instruction
+ * @details An inverted conditional jump over an absolute jump, or an absolute call
+ * 
+ */
+#define TRAMPOLINE_MAX_RELOCATED_INSTRUCTION_SIZE 16
+
+/**
+ * @brief Maximum length of an x86 instruction
+ * 
+ */
+#define TRAMPOLINE_MAX_INSTRUCTION_LENGTH 15
+
+//////////////////////////////////////////////////
+//					Functions					//
+//////////////////////////////////////////////////
+
+/* Check whether a target is reachable by a 32-bit displacement */
+BOOLEAN
+TrampolineIsRel32Reachable(UINT64 NextInstructionAddress, UINT64 TargetAddress);
+/* Write the shortest jump that reaches the target */
+SIZE_T
+TrampolineWriteJump(PUCHAR Buffer, UINT64 Address, UINT64 TargetAddress);
+/* Write the shortest call that reaches the target */
+SIZE_T
+TrampolineWriteCall(PUCHAR Buffer, UINT64 Address, UINT64 TargetAddress);
+/* Write the shortest conditional jump that reaches the target */
+SIZE_T
+TrampolineWriteConditionalJump(PUCHAR Buffer, UINT64 Address, UCHAR Condition, UINT64 TargetAddress);
+/* Write the jump of a detour site to the hook function */
+SIZE_T
+TrampolineWriteDetourJump(PUCHAR Buffer, UINT64 Address, UINT64 HookFunction, PUCHAR Stub, SIZE_T StubSize, PSIZE_T SizeOfStub);
+/* Compute the size of the whole instructions that cover at least the minimum size */
+SIZE_T
+TrampolineGetSizeOfInstructions(PVOID Address, SIZE_T MinimumSize);
+/* Relocate instructions into a trampoline and add the jump back to the original code */
+BOOLEAN
+TrampolineBuild(PVOID TargetFunction, SIZE_T SizeOfInstructions, PUCHAR Trampoline, SIZE_T TrampolineSize, PSIZE_T SizeOfTrampoline);
@@ -15,6 +15,8 @@
 #include "Hooks.h"
 #include "Common.h"
 #include "Invept.h"
+#include "HypervisorRoutines.h"
+#include "Pml.h"
 
 /**
  * @brief Main Vmcall Handler
@@ -36,6 +38,8 @@ VmxVmcallHandler(UINT64 VmcallNumber,
     BOOLEAN  UnsetExec    = FALSE;
     BOOLEAN  UnsetWrite   = FALSE;
     BOOLEAN  UnsetRead    = FALSE;
+    UINT64   GuestCr3     = 0;
+    KIRQL    OldIrql;
 
     //
     // Only 32bit of Vmcall is valid, this way we can use the upper 32 bit of the Vmcall
@@ -62,32 +66,46 @@ VmxVmcallHandler(UINT64 VmcallNumber,
         //
         // Upper 32 bits of the Vmcall contains the attribute mask
         //
-        UINT32 AttributeMask = (UINT32)((VmcallNumber & 0xFFFFFFFF00000000LL) >> 32);
+        UINT32 AttributeMask = (UINT32)((VmcallNumber & 0x0000FFFF00000000LL) >> 32);
+
+        //
+        // Bits 48 to 63 of the Vmcall contains the EPT view
+        //
+        UINT32 ViewIndex = (UINT32)((VmcallNumber & 0xFFFF000000000000LL) >> 48);
 
         UnsetRead  = (AttributeMask & PAGE_ATTRIB_READ) ? TRUE : FALSE;
         UnsetWrite = (AttributeMask & PAGE_ATTRIB_WRITE) ? TRUE : FALSE;
         UnsetExec  = (AttributeMask & PAGE_ATTRIB_EXEC) ? TRUE : FALSE;
 
-        HookResult = EptPerformPageHook(OptionalParam1 /* TargetAddress */,
+        //
+        // The hook might be built on more than one page, the lock is held
+        // until all of them are added to the hooked pages
+        //
+        OldIrql = EptLockHookedPages();
+
+        HookResult = EptPerformPageHook(EptGetViewPageTable(ViewIndex),
+                                        OptionalParam1 /* TargetAddress */,
                                         OptionalParam2 /* Hook Function*/,
                                         OptionalParam3 /* OrigFunction */,
                                         UnsetRead,
                                         UnsetWrite,
                                         UnsetExec);
 
+        EptUnlockHookedPages(OldIrql);
+
         VmcallStatus = (HookResult == TRUE) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
 
         break;
     }
     case VMCALL_INVEPT_SINGLE_CONTEXT:
     {
-        InveptSingleContext(OptionalParam1);
+        InveptQueueSingleContext(OptionalParam1);
         VmcallStatus = STATUS_SUCCESS;
         break;
     }
     case VMCALL_INVEPT_ALL_CONTEXTS:
     {
-        InveptAllContexts();
+        InveptQueueAllContexts();
         VmcallStatus = STATUS_SUCCESS;
         break;
     }
@@ -115,6 +133,47 @@ VmxVmcallHandler(UINT64 VmcallNumber,
         SyscallHookConfigureEFER(FALSE);
         break;
     }
+    case VMCALL_CHANGE_EPT_POINTER:
+    {
+        //
+        // The view of the current process takes precedence over the view of the core
+        //
+        __vmx_vmread(GUEST_CR3, &GuestCr3);
+        EptSwitchProcessView(GuestCr3);
+        InveptQueueSingleContext(OptionalParam1);
+        VmcallStatus = STATUS_SUCCESS;
+        break;
+    }
+    case VMCALL_UPDATE_PROCESS_VIEWS:
+    {
+        //
+        // cr3 vm-exits are only needed when there is a view
+        //
+        HvSetExitOnCr3Change(g_EptState->NumberOfProcessViews != 0);
+
+        __vmx_vmread(GUEST_CR3, &GuestCr3);
+        EptSwitchProcessView(GuestCr3);
+        VmcallStatus = STATUS_SUCCESS;
+        break;
+    }
+    case VMCALL_ENABLE_PML:
+    {
+        PmlEnableOnCurrentCore();
+        VmcallStatus = STATUS_SUCCESS;
+        break;
+    }
+    case VMCALL_DISABLE_PML:
+    {
+        PmlDisableOnCurrentCore();
+        VmcallStatus = STATUS_SUCCESS;
+        break;
+    }
+    case VMCALL_CONFIGURE_SYSCALL_TRACE:
+    {
+        SyscallHookConfigureTrace(KeGetCurrentProcessorNumber(), (BOOLEAN)OptionalParam1, (UINT32)OptionalParam2);
+        VmcallStatus = STATUS_SUCCESS;
+        break;
+    }
     default:
     {
         LogError("Unsupported VMCALL");
@@ -25,6 +25,11 @@
 #define VMCALL_UNHOOK_SINGLE_PAGE        0x7 // VMCALL to remove a single physical address from hook list
 #define VMCALL_ENABLE_SYSCALL_HOOK_EFER  0x8 // VMCALL to enable syscall hook using EFER SCE bit
 #define VMCALL_DISABLE_SYSCALL_HOOK_EFER 0x9 // VMCALL to disable syscall hook using EFER SCE bit
+#define VMCALL_CHANGE_EPT_POINTER        0xA // VMCALL to change the EPT Pointer of the current core
+#define VMCALL_UPDATE_PROCESS_VIEWS      0xB // VMCALL to apply the EPT views of processes to the current core
+#define VMCALL_ENABLE_PML                0xC // VMCALL to enable Page Modification Logging on the current core
+#define VMCALL_DISABLE_PML               0xD // VMCALL to disable Page Modification Logging on the current core
+#define VMCALL_CONFIGURE_SYSCALL_TRACE   0xE // VMCALL to enable or disable the binary syscall trace of the current core
 
 //////////////////////////////////////////////////
 //				    Functions					//
@@ -21,6 +21,7 @@
 #include "Vpid.h"
 #include "Dpc.h"
 #include "Events.h"
+#include "Pml.h"
 
 /**
  * @brief Initialize VMX Operation
@@ -61,6 +62,24 @@ VmxInitializer()
     //
     InitializeListHead(&g_EptState->HookedPagesList);
 
+    for (size_t i = 0; i < EPT_HOOKED_PAGES_BUCKETS; i++)
+    {
+        InitializeListHead(&g_EptState->HookedPagesBuckets[i]);
+    }
+
+    ExInitializeFastMutex(&g_EptState->ViewsMutex);
+    ExInitializeFastMutex(&g_EptState->InvalidationBroadcastMutex);
+
+    //
+    // Initialize the locks and the flush timer of Page Modification Logging
+    //
+    PmlInitialize();
+
+    //
+    // Initialize the lock and the flush timer of the binary syscall trace
+    //
+    SyscallHookInitializeTrace();
+
     //
     // Check whether EPT is supported or not
     //
@@ -369,7 +388,8 @@ VmxSetupVmcs(VIRTUAL_MACHINE_STATE * CurrentGuestState, PVOID GuestStack)
 
     SecondaryProcBasedVmExecControls = HvAdjustControls(CPU_BASED_CTL2_RDTSCP |
                                                             CPU_BASED_CTL2_ENABLE_EPT | CPU_BASED_CTL2_ENABLE_INVPCID |
-                                                            CPU_BASED_CTL2_ENABLE_XSAVE_XRSTORS | CPU_BASED_CTL2_ENABLE_VPID,
+                                                            CPU_BASED_CTL2_ENABLE_XSAVE_XRSTORS | CPU_BASED_CTL2_ENABLE_VPID |
+                                                            (g_EptState->EptpList ? CPU_BASED_CTL2_ENABLE_VMFUNC : 0),
                                                         MSR_IA32_VMX_PROCBASED_CTLS2);
 
     __vmx_vmwrite(SECONDARY_VM_EXEC_CONTROL, SecondaryProcBasedVmExecControls);
@@ -441,7 +461,17 @@ VmxSetupVmcs(VIRTUAL_MACHINE_STATE * CurrentGuestState, PVOID GuestStack)
     //
     // Set up EPT
     //
-    __vmx_vmwrite(EPT_POINTER, g_EptState->EptPointer.Flags);
+    __vmx_vmwrite(EPT_POINTER, CurrentGuestState->EptView.EptPointer.Flags);
+
+    //
+    // Set up EPTP switching, the guest can switch between the EPT views that are in the
+    // EPTP list by VMFUNC without a vm-exit (the list is not allocated, see EptLogicalProcessorInitialize)
+    //
+    if (g_EptState->EptpList)
+    {
+        __vmx_vmwrite(VM_FUNCTION_CONTROL, VM_FUNCTION_CONTROL_EPTP_SWITCHING);
+        __vmx_vmwrite(EPTP_LIST_ADDR, VirtualAddressToPhysicalAddress(g_EptState->EptpList));
+    }
 
     //
     // Set up VPID
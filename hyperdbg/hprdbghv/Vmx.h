@@ -13,6 +13,7 @@
 #include <ntddk.h>
 #include "Debugger.h"
 #include "Ept.h"
+#include "MemoryMapper.h"
 
 //////////////////////////////////////////////////
 //					Constants					//
@@ -62,6 +63,7 @@
 #define CPU_BASED_CTL2_VIRTUAL_INTERRUPT_DELIVERY 0x200
 #define CPU_BASED_CTL2_ENABLE_INVPCID             0x1000
 #define CPU_BASED_CTL2_ENABLE_VMFUNC              0x2000
+#define CPU_BASED_CTL2_ENABLE_PML                 0x20000
 #define CPU_BASED_CTL2_ENABLE_XSAVE_XRSTORS       0x100000
 
 /* VM-exit Control Bits */
@@ -363,7 +365,15 @@ typedef struct _VIRTUAL_MACHINE_STATE
     PROCESSOR_DEBUGGING_STATE DebuggingState;             // Holds the debugging state of the processor (used by HyperDbg to execute commands)
     VMX_VMXOFF_STATE          VmxoffState;                // Shows the vmxoff state of the guest
     PEPT_HOOKED_PAGE_DETAIL   MtfEptHookRestorePoint;     // It shows the detail of the hooked paged that should be restore in MTF vm-exit
+    PEPT_PML1_ENTRY           MtfEptHookRestoreEntry;     // The entry of the current view that should be restored in MTF vm-exit
     DEBUGGER_CORE_EVENTS      Events;                     // Core specific events (for debugger)
+    EPT_CORE_VIEW             EptView;                    // The EPT table and EPT Pointer that are used by this core
+    UINT64                    PmlBufferVirtualAddress;    // Page Modification Logging buffer Virtual Address
+    UINT64                    PmlBufferPhysicalAddress;   // Page Modification Logging buffer Physical Address
+    PVOID                     PmlRing;                    // The ring that the logged pages of this core are drained into (PML_CORE_RING)
+    EPT_PENDING_INVALIDATIONS PendingInvalidations;       // The EPT invalidations that are flushed before the next vm-entry
+    MEMORY_MAPPER_ADDRESSES   MemoryMapper;               // The reserved page that guest physical pages are mapped into (in vmx-root)
+    MEMORY_MAPPER_TLB         TranslationCache;           // Guest virtual to physical translations of the memory mapper (in vmx-root)
 } VIRTUAL_MACHINE_STATE, *PVIRTUAL_MACHINE_STATE;
 
 /**
@@ -44,3 +44,17 @@
  * UseDbgPrintInsteadOfUsermodeMessageTracking to FALSE
  */
 #define UseImmediateMessaging FALSE
+
+/**
+ * @brief Fill the EPT identity page table on all cores (each core fills a
+ * slice of the table) instead of filling it on the current core
+ *
+ */
+#define BuildEptIdentityTableOnAllCores TRUE
+
+/**
+ * @brief Count the acquisitions, spins and the longest wait of each ticket
+ * and reader-writer spinlock (it makes the locks a bit slower)
+ *
+ */
+#define CollectSpinlockContentionStatistics FALSE
@@ -45,6 +45,88 @@
 #define OPERATION_LOG_ERROR_MESSAGE 0x3
 #define OPERATION_LOG_NON_IMMEDIATE_MESSAGE 0x4
 #define OPERATION_LOG_WITH_TAG 0x5
+#define OPERATION_LOG_PML_DIRTY_PAGES 0x6
+#define OPERATION_LOG_MSR_SAMPLES 0x8
+
+/**
+ * @brief The record of dirty pages that are logged by Page Modification
+ * Logging (PML), the page frame numbers (UINT32) of the guest physical
+ * addresses are placed after this structure
+ *
+ */
+typedef struct _PML_DIRTY_PAGES_RECORD {
+
+  UINT32 CoreIndex;     // The core that logged the pages
+  UINT32 NumberOfPages; // Number of page frame numbers after this structure
+  UINT32 DroppedPages;  // Pages that are dropped since the previous record
+                        // of this core (its ring was full)
+
+} PML_DIRTY_PAGES_RECORD, *PPML_DIRTY_PAGES_RECORD;
+
+/* Maximum number of page frame numbers in one record (one log packet) */
+#define PML_DIRTY_PAGES_RECORD_MAX_PAGES                                       \
+  ((PacketChunkSize - 1 - sizeof(PML_DIRTY_PAGES_RECORD)) / sizeof(UINT32))
+
+/**
+ * @brief The header of the syscall trace records of a core, the records are
+ * placed after this structure and each of them is followed by the captured
+ * stack arguments (UINT64), the buffer of IOCTL_DEBUGGER_READ_SYSCALL_TRACE
+ * is a sequence of these headers and their records
+ *
+ */
+typedef struct _SYSCALL_TRACE_RECORDS_HEADER {
+
+  UINT32 CoreIndex;              // The core that executed the syscalls
+  UINT32 NumberOfRecords;        // Number of records after this structure
+  UINT32 NumberOfStackArguments; // Number of stack arguments of each record
+  UINT32 DroppedRecords;         // Records that are dropped since the previous
+                                 // header of this core (its ring was full)
+
+} SYSCALL_TRACE_RECORDS_HEADER, *PSYSCALL_TRACE_RECORDS_HEADER;
+
+/**
+ * @brief A syscall that is traced by the EFER syscall hook
+ *
+ */
+typedef struct _SYSCALL_TRACE_RECORD {
+
+  UINT64 TimeStampCounter; // TSC of the syscall
+  UINT64 Cr3;              // Guest's cr3
+  UINT64 ServiceNumber;    // RAX
+  UINT64 Arguments[4];     // R10, RDX, R8 and R9
+  UINT32 ProcessId;
+  UINT32 ThreadId;
+
+} SYSCALL_TRACE_RECORD, *PSYSCALL_TRACE_RECORD;
+
+/* Maximum number of the stack arguments that are captured for each syscall */
+#define SYSCALL_TRACE_MAX_STACK_ARGUMENTS 8
+
+/* Size of a record and its stack arguments */
+#define SYSCALL_TRACE_RECORD_SIZE(NumberOfStackArguments)                      \
+  (sizeof(SYSCALL_TRACE_RECORD) + (NumberOfStackArguments) * sizeof(UINT64))
+
+/* Size of the buffer that the client reads the syscall trace records into */
+#define SYSCALL_TRACE_READ_BUFFER_SIZE 0x100000
+
+/**
+ * @brief The header of a packet of MSR samples, each record is the TSC of the
+ * sample (UINT64) followed by the values of the sampled MSRs (UINT64) in the
+ * order of the request
+ *
+ */
+typedef struct _MSR_SAMPLE_RECORDS_HEADER {
+
+  UINT32 CoreIndex;       // The core that read the MSRs
+  UINT16 NumberOfRecords; // Number of records after this structure
+  UINT16 NumberOfMsrs;    // Number of MSR values of each record
+  UINT64 SessionId;       // The session of the request that started the sampler
+
+} MSR_SAMPLE_RECORDS_HEADER, *PMSR_SAMPLE_RECORDS_HEADER;
+
+/* Size of a sample of MSRs */
+#define MSR_SAMPLE_RECORD_SIZE(NumberOfMsrs)                                   \
+  (sizeof(UINT64) + (NumberOfMsrs) * sizeof(UINT64))
 
 //////////////////////////////////////////////////
 //		    	Callback Definitions			//
@@ -99,6 +181,44 @@ typedef struct _DEBUGGER_READ_MEMORY {
 
 } DEBUGGER_READ_MEMORY, *PDEBUGGER_READ_MEMORY;
 
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_READ_MEMORY_SCATTER_REQUEST                            \
+  sizeof(DEBUGGER_READ_MEMORY_SCATTER_REQUEST)
+
+#define DEBUGGER_READ_MEMORY_SCATTER_MAX_RANGES 0x400
+
+/**
+ * @brief A range of a scatter-gather read, the driver fills the offset of the
+ * data of the range and the result of reading it
+ *
+ */
+typedef struct _DEBUGGER_READ_MEMORY_RANGE {
+
+  UINT64 Address;   // Start of the range
+  UINT32 Size;      // Size of the range
+  UINT32 Offset;    // Offset of the data from the start of the request
+  UINT32 ReadBytes; // The range is read until the first page that is not
+                    // present
+  UINT32 Status;    // NTSTATUS of reading the range
+
+} DEBUGGER_READ_MEMORY_RANGE, *PDEBUGGER_READ_MEMORY_RANGE;
+
+/**
+ * @brief Read a list of ranges in a single request, the ranges are after this
+ * structure and the data of the ranges is after the ranges (in the same
+ * order)
+ *
+ */
+typedef struct _DEBUGGER_READ_MEMORY_SCATTER_REQUEST {
+
+  UINT32 Pid; // Read from the memory of what process
+  DEBUGGER_READ_MEMORY_TYPE MemoryType;
+  UINT32 NumberOfRanges; // Number of ranges after this structure
+
+} DEBUGGER_READ_MEMORY_SCATTER_REQUEST, *PDEBUGGER_READ_MEMORY_SCATTER_REQUEST;
+
 /* ==============================================================================================
  */
 
@@ -121,11 +241,301 @@ typedef struct _DEBUGGER_READ_AND_WRITE_ON_MSR {
 
 } DEBUGGER_READ_AND_WRITE_ON_MSR, *PDEBUGGER_READ_AND_WRITE_ON_MSR;
 
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_MSR_BATCH_REQUEST sizeof(DEBUGGER_MSR_BATCH_REQUEST)
+
+#define DEBUGGER_MSR_BATCH_MAX_MSRS 0x100
+#define DEBUGGER_MSR_BATCH_APPLY_ALL_CORES 0xffffffffffffffff
+
+/**
+ * @brief Offset of the results from the start of the request, the MSRs are
+ * UINT32 and the results are aligned to 8 bytes
+ *
+ */
+#define DEBUGGER_MSR_BATCH_RESULTS_OFFSET(NumberOfMsrs)                        \
+  (SIZEOF_DEBUGGER_MSR_BATCH_REQUEST +                                         \
+   ((((NumberOfMsrs) * sizeof(UINT32)) + 7) & ~7))
+
+/**
+ * @brief Read or write a list of MSRs on a set of cores in a single broadcast,
+ * the MSRs (UINT32) are after this structure and the results are a matrix of
+ * UINT64 after the MSRs, a row for each of the selected cores (in ascending
+ * order of the core index) and a column for each of the MSRs
+ *
+ */
+typedef struct _DEBUGGER_MSR_BATCH_REQUEST {
+
+  DEBUGGER_MSR_ACTION_TYPE ActionType; // rdmsr or wrmsr
+  UINT64 CoreMask; // Bit n selects the core n, the driver removes the cores
+                   // that are not present
+  UINT64 Value;    // The value to write on all of the MSRs (wrmsr)
+  UINT32 NumberOfMsrs;  // Number of the MSRs after this structure
+  UINT32 NumberOfCores; // Number of the selected cores (rows of the results)
+
+} DEBUGGER_MSR_BATCH_REQUEST, *PDEBUGGER_MSR_BATCH_REQUEST;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_MSR_SAMPLER_REQUEST sizeof(DEBUGGER_MSR_SAMPLER_REQUEST)
+
+#define DEBUGGER_MSR_SAMPLER_MAX_MSRS 16
+
+/**
+ * @brief Start or stop reading a set of MSRs on each of the selected cores
+ * periodically, the samples are sent as OPERATION_LOG_MSR_SAMPLES packets
+ *
+ */
+typedef struct _DEBUGGER_MSR_SAMPLER_REQUEST {
+
+  BOOLEAN IsEnabled; // Start or stop the sampler
+  UINT32 Interval;   // Milliseconds between the samples (the resolution is
+                     // the resolution of the system timer)
+  UINT64 CoreMask;   // Bit n selects the core n
+  UINT32 NumberOfMsrs;
+  UINT32 Msrs[DEBUGGER_MSR_SAMPLER_MAX_MSRS];
+  UINT64 SessionId; // Chosen by the debugger, the packets of the samples are
+                    // tagged with it so the packets of an older session that
+                    // are still in the log buffer can be dropped
+
+} DEBUGGER_MSR_SAMPLER_REQUEST, *PDEBUGGER_MSR_SAMPLER_REQUEST;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_EPT_MEMORY_FOOTPRINT                                   \
+  sizeof(DEBUGGER_EPT_MEMORY_FOOTPRINT)
+
+typedef struct _DEBUGGER_EPT_MEMORY_FOOTPRINT {
+
+  UINT64 SharedTableSize;       // Size of the shared identity table (bytes)
+  UINT64 SharedTableSplitPages; // Number of 2MB pages of the shared table that
+                                // are split to 4KB pages
+  UINT64 NumberOfPrivateTables; // Number of cores with a private EPT view
+  UINT64 PrivateTablesSize;     // Size of all the private tables (bytes)
+  UINT64 NumberOfHookedPages;   // Number of hooked pages
+  UINT64 HookedPagesSize;       // Size of the details of hooked pages (bytes)
+  UINT64 TotalSize;             // Sum of all the above sizes (bytes)
+  UINT64 InveptRequested;       // Number of requested EPT invalidations
+  UINT64 InveptIssued;          // Number of executed INVEPT instructions
+  UINT64 InvalidationBroadcastsRequested; // Number of requested broadcasts
+  UINT64 InvalidationBroadcastsIssued;    // Number of sent broadcasts
+
+} DEBUGGER_EPT_MEMORY_FOOTPRINT, *PDEBUGGER_EPT_MEMORY_FOOTPRINT;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_SPINLOCK_STATISTICS                                    \
+  sizeof(DEBUGGER_SPINLOCK_STATISTICS)
+
+/**
+ * @brief The ticket spinlocks of the hypervisor that have contention counters
+ *
+ */
+typedef enum _DEBUGGER_SPINLOCK_TYPE {
+  DEBUGGER_SPINLOCK_VMX_ROOT_LOGGING,
+  DEBUGGER_SPINLOCK_VMX_ROOT_LOGGING_NON_IMMEDIATE,
+  DEBUGGER_SPINLOCK_READING_POOL,
+  DEBUGGER_SPINLOCK_EPT_CORE_VIEW,
+  DEBUGGER_SPINLOCK_HIDDEN_HOOKS_DETOUR_TABLE,
+  DEBUGGER_SPINLOCK_EPT_HOOKED_PAGES,
+  DEBUGGER_SPINLOCK_COUNT
+} DEBUGGER_SPINLOCK_TYPE;
+
+/**
+ * @brief The contention counters of the spinlocks, they're only collected if
+ * the driver is built with CollectSpinlockContentionStatistics
+ *
+ */
+typedef struct _DEBUGGER_SPINLOCK_STATISTICS {
+
+  BOOLEAN Reset;       // Reset the counters after reading them (input)
+  BOOLEAN IsCollected; // The driver collects the counters (output)
+
+  struct {
+    UINT64 Acquisitions; // Number of the times that the lock is acquired
+    UINT64 Contentions;  // Acquisitions that had to wait for the lock
+    UINT64 Spins;        // Total number of pauses of the waiters
+    UINT64 MaxWait;      // The longest wait for the lock (tsc cycles)
+  } Locks[DEBUGGER_SPINLOCK_COUNT]; // Indexed by DEBUGGER_SPINLOCK_TYPE
+
+} DEBUGGER_SPINLOCK_STATISTICS, *PDEBUGGER_SPINLOCK_STATISTICS;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_EPT_ACCESS_DIRTY_REQUEST                               \
+  sizeof(DEBUGGER_EPT_ACCESS_DIRTY_REQUEST)
+
+typedef enum _DEBUGGER_EPT_ACCESS_DIRTY_ACTION {
+  DEBUGGER_EPT_ACCESS_DIRTY_ENABLE,
+  DEBUGGER_EPT_ACCESS_DIRTY_DISABLE,
+  DEBUGGER_EPT_ACCESS_DIRTY_HARVEST,
+  DEBUGGER_EPT_ACCESS_DIRTY_ENABLE_PML,
+  DEBUGGER_EPT_ACCESS_DIRTY_DISABLE_PML
+} DEBUGGER_EPT_ACCESS_DIRTY_ACTION;
+
+/**
+ * @brief The harvested bitmap is compressed as run-lengths (UINT32) that are
+ * placed after this structure in the output buffer, the runs alternate between
+ * clear and set pages and the first run is always clear (it might be zero)
+ *
+ */
+typedef struct _DEBUGGER_EPT_ACCESS_DIRTY_REQUEST {
+
+  DEBUGGER_EPT_ACCESS_DIRTY_ACTION Action; // Enable, disable or harvest
+  BOOLEAN HarvestDirtyFlags;  // TRUE for dirty pages and FALSE for accessed
+                              // pages (working-set)
+  BOOLEAN ClearAfterHarvest;  // Clear the harvested flags
+  UINT64 PhysicalAddress;     // Start of the physical range (page aligned)
+  UINT64 NumberOfPages;       // Number of 4KB pages in the range
+  UINT64 NumberOfHarvestedPages; // Number of pages that are described by the
+                                 // runs (less than NumberOfPages if the output
+                                 // buffer is not large enough)
+  UINT64 NumberOfSetPages;       // Number of accessed or dirty pages
+  UINT32 NumberOfRuns;           // Number of runs after this structure
+
+} DEBUGGER_EPT_ACCESS_DIRTY_REQUEST, *PDEBUGGER_EPT_ACCESS_DIRTY_REQUEST;
+
+/* ==============================================================================================
+ */
+
+/**
+ * @brief The syscall bitmap covers the service numbers of both of the system
+ * service tables (ntoskrnl and win32k)
+ *
+ */
+#define DEBUGGER_SYSCALL_FILTER_MAX_SYSCALL_NUMBER 0x2000
+
+/**
+ * @brief Maximum number of processes in the process filter
+ *
+ */
+#define DEBUGGER_SYSCALL_FILTER_MAX_PROCESSES 8
+
+#define SIZEOF_DEBUGGER_SYSCALL_FILTER_REQUEST                                 \
+  sizeof(DEBUGGER_SYSCALL_FILTER_REQUEST)
+
+typedef enum _DEBUGGER_SYSCALL_FILTER_ACTION {
+  DEBUGGER_SYSCALL_FILTER_WATCH_SYSCALLS,
+  DEBUGGER_SYSCALL_FILTER_IGNORE_SYSCALLS,
+  DEBUGGER_SYSCALL_FILTER_WATCH_PROCESS,
+  DEBUGGER_SYSCALL_FILTER_IGNORE_PROCESS,
+  DEBUGGER_SYSCALL_FILTER_CLEAR
+} DEBUGGER_SYSCALL_FILTER_ACTION;
+
+/**
+ * @brief The filter of the EFER syscall hook, the syscalls that are not
+ * watched are emulated without being logged or triggering the events, if
+ * there is no syscall in the filter then all of the syscalls are watched and
+ * if there is no watched process in the filter then all of the processes
+ * except the ignored processes are watched
+ *
+ */
+typedef struct _DEBUGGER_SYSCALL_FILTER_REQUEST {
+
+  DEBUGGER_SYSCALL_FILTER_ACTION Action; // Watch, ignore or clear
+  UINT32 FirstSyscallNumber;             // Start of the range of syscalls
+  UINT32 LastSyscallNumber;              // End of the range (inclusive)
+  UINT32 ProcessId;                      // Process to watch or ignore
+
+} DEBUGGER_SYSCALL_FILTER_REQUEST, *PDEBUGGER_SYSCALL_FILTER_REQUEST;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_SYSCALL_TRACE_REQUEST                                  \
+  sizeof(DEBUGGER_SYSCALL_TRACE_REQUEST)
+
+/**
+ * @brief Enable or disable the binary trace of the EFER syscall hook, the
+ * watched syscalls are written to the rings of the cores instead of text
+ * messages (without triggering the events) and they're read in bulk by
+ * IOCTL_DEBUGGER_READ_SYSCALL_TRACE
+ *
+ */
+typedef struct _DEBUGGER_SYSCALL_TRACE_REQUEST {
+
+  BOOLEAN IsEnabled;             // Enable or disable the binary trace
+  UINT32 NumberOfStackArguments; // Arguments after the fourth argument that
+                                 // are read from the user-mode stack
+
+} DEBUGGER_SYSCALL_TRACE_REQUEST, *PDEBUGGER_SYSCALL_TRACE_REQUEST;
+
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_SEARCH_MEMORY_REQUEST                                  \
+  sizeof(DEBUGGER_SEARCH_MEMORY_REQUEST)
+
+#define DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH 64
+
+/**
+ * @brief The most bytes of the range that are scanned by one search request,
+ * then the request shows where the search should continue (16MB)
+ *
+ */
+#define DEBUGGER_SEARCH_MEMORY_MAX_BYTES_PER_REQUEST 0x1000000
+
+/**
+ * @brief Search the virtual memory of a process for a pattern, each byte of
+ * the pattern is compared after masking it (0xff for exact bytes, 0x00 for
+ * wildcards and 0xf0 or 0x0f for nibbles), the pages that are not present are
+ * skipped. The addresses of the matches (UINT64) are after this structure
+ *
+ */
+typedef struct _DEBUGGER_SEARCH_MEMORY_REQUEST {
+
+  UINT32 Pid;           // Search in the memory of what process
+  UINT64 Address;       // Start of the range
+  UINT64 Length;        // Size of the range
+  UINT32 PatternLength; // Number of bytes of the pattern and the mask
+  UCHAR Pattern[DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH];
+  UCHAR Mask[DEBUGGER_SEARCH_MEMORY_MAX_PATTERN_LENGTH];
+  UINT32 NumberOfResults; // Number of addresses after this structure
+  UINT64 NextAddress;     // Where to continue if the output buffer is full
+                          // or the scanned bytes reached the limit of a
+                          // request, zero if the whole range is searched
+
+} DEBUGGER_SEARCH_MEMORY_REQUEST, *PDEBUGGER_SEARCH_MEMORY_REQUEST;
+
 /* ==============================================================================================
  */
 
 #define DEBUGGER_EVENT_APPLY_TO_ALL_CORES 0xffffffff
 
+/* ==============================================================================================
+ */
+
+#define SIZEOF_DEBUGGER_HIDDEN_HOOK_REQUEST sizeof(DEBUGGER_HIDDEN_HOOK_REQUEST)
+
+typedef enum _DEBUGGER_HIDDEN_HOOK_ACTION {
+  DEBUGGER_HIDDEN_HOOK_APPLY,
+  DEBUGGER_HIDDEN_HOOK_REMOVE
+} DEBUGGER_HIDDEN_HOOK_ACTION;
+
+/**
+ * @brief Apply or remove a hidden hook, the hook is visible to all the cores,
+ * only to a single core (its private EPT view) or only to a single process
+ * (its EPT view), removing the hooks of a core or a process removes all of
+ * them at once. The execute hooks trigger the HIDDEN_HOOK_EXEC_DETOUR events
+ *
+ */
+typedef struct _DEBUGGER_HIDDEN_HOOK_REQUEST {
+
+  DEBUGGER_HIDDEN_HOOK_ACTION Action; // Apply or remove
+  UINT64 Address;   // Virtual address to hook (or unhook if it's for all cores)
+  UINT32 CoreId;    // DEBUGGER_EVENT_APPLY_TO_ALL_CORES or the target core
+  UINT32 ProcessId; // Zero or the target process (CoreId should be all cores)
+  BOOLEAN SetHookForRead;
+  BOOLEAN SetHookForWrite;
+  BOOLEAN SetHookForExec;
+
+} DEBUGGER_HIDDEN_HOOK_REQUEST, *PDEBUGGER_HIDDEN_HOOK_REQUEST;
+
 //
 // Pseudo Regs Mask (It's a mask not a value)
 //
@@ -307,3 +717,36 @@ typedef struct _DEBUGGER_EVENT {
 
 #define IOCTL_DEBUGGER_READ_OR_WRITE_MSR                                       \
   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_QUERY_EPT_MEMORY_FOOTPRINT                              \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_EPT_ACCESS_DIRTY_FLAGS                                  \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_SYSCALL_FILTER                                          \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_SYSCALL_TRACE                                           \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_SEARCH_MEMORY                                           \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_READ_MEMORY_SCATTER                                     \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80a, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_MSR_BATCH                                               \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80b, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_MSR_SAMPLER                                             \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80c, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_HIDDEN_HOOK                                             \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80d, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_READ_SYSCALL_TRACE                                      \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80e, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_DEBUGGER_QUERY_SPINLOCK_STATISTICS                               \
+  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80f, METHOD_BUFFERED, FILE_ANY_ACCESS)
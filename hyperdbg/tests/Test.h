@@ -0,0 +1,58 @@
+/**
+ * @file Test.h
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief The checks and timers of the user-mode tests and benchmarks
+ * @details
+ * @version 0.1
+ * @date 2020-05-13
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Number of failed checks of the current test program
+ *
+ */
+static unsigned int g_TestFailures __attribute__((unused)) = 0;
+
+/**
+ * @brief Check a condition and report it if it's false
+ *
+ */
+#define TEST_CHECK(_CONDITION_)                                                     \
+    do                                                                              \
+    {                                                                               \
+        if (!(_CONDITION_))                                                         \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_CONDITION_); \
+            g_TestFailures++;                                                       \
+        }                                                                           \
+    } while (0)
+
+/**
+ * @brief Print the result of the test program and make its exit code
+ *
+ */
+#define TEST_RESULT(_NAME_) \
+    (printf("%s: %s\n", (_NAME_), g_TestFailures ? "FAILED" : "passed"), g_TestFailures ? 1 : 0)
+
+/**
+ * @brief Current time in nanoseconds (monotonic)
+ *
+ * @return uint64_t
+ */
+static inline uint64_t
+TestNanoseconds()
+{
+    struct timespec Time;
+
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+
+    return (uint64_t)Time.tv_sec * 1000000000ULL + (uint64_t)Time.tv_nsec;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file bench_detour.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Benchmark of the call overhead through each form of the detour jump
+ * @details A function is hooked like EptHookInstructionMemory does (the detour
+ * jump, the stub and the trampoline are written by the trampoline builder) and
+ * the hook function continues to the trampoline like AsmGeneralDetourHook does
+ * by replacing its return address
+ * @version 0.1
+ * @date 2020-05-14
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <sys/mman.h>
+#include "Trampoline.h"
+#include "Test.h"
+
+/* Size of the trampoline block of the hooked page */
+#define BENCH_TRAMPOLINE_BLOCK_SIZE 0x100
+
+/* Number of calls of each form */
+#define BENCH_CALLS 10000000
+
+/* lea eax, [rdi+1] ; nop (8 bytes) ; nop (8 bytes) ; nop (4 bytes) ; ret */
+static const UINT8 g_Function[] = {0x8d, 0x47, 0x01, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x1f, 0x40, 0x00, 0xc3};
+
+/**
+ * @brief Write a hook function that continues to the trampoline
+ * @details mov rax, Trampoline ; mov [rsp], rax ; ret
+ *
+ * @param Buffer Where the hook function is written
+ * @param Trampoline The trampoline of the hooked function
+ */
+static void
+BenchWriteHookFunction(UINT8 * Buffer, UINT64 Trampoline)
+{
+    Buffer[0]             = 0x48;
+    Buffer[1]             = 0xb8;
+    *(UINT64 *)&Buffer[2] = Trampoline;
+    Buffer[10]            = 0x48;
+    Buffer[11]            = 0x89;
+    Buffer[12]            = 0x04;
+    Buffer[13]            = 0x24;
+    Buffer[14]            = 0xc3;
+}
+
+/**
+ * @brief Hook a copy of the function and measure the calls
+ *
+ * @param Name Name of the form
+ * @param Site Where the hooked copy of the function is placed
+ * @param Block The trampoline block of the hooked copy
+ * @param StubSize The available size for a stub in the block
+ * @param Hook Where the hook function is placed
+ * @param ExpectedSize The expected size of the detour jump
+ */
+static void
+BenchDetourForm(const char * Name, UINT8 * Site, UINT8 * Block, SIZE_T StubSize, UINT8 * Hook, SIZE_T ExpectedSize)
+{
+    UINT8  DetourJump[TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE];
+    SIZE_T SizeOfDetourJump;
+    SIZE_T SizeOfStub = 0;
+    SIZE_T SizeOfInstructions;
+    SIZE_T SizeOfTrampoline;
+    UINT64 Start, Elapsed;
+    UINT32 i;
+    int (*Function)(int) = (int (*)(int))Site;
+    volatile int Result  = 0;
+
+    memcpy(Site, g_Function, sizeof(g_Function));
+
+    SizeOfDetourJump = TrampolineWriteDetourJump(DetourJump, (UINT64)Site, (UINT64)Hook, Block, StubSize, &SizeOfStub);
+
+    if (SizeOfDetourJump != ExpectedSize)
+    {
+        printf("%-32s: skipped (the detour jump is %zu bytes)\n", Name, SizeOfDetourJump);
+        return;
+    }
+
+    SizeOfInstructions = TrampolineGetSizeOfInstructions(Site, SizeOfDetourJump);
+
+    if (!TrampolineBuild(Site, SizeOfInstructions, Block + SizeOfStub, BENCH_TRAMPOLINE_BLOCK_SIZE - SizeOfStub, &SizeOfTrampoline))
+    {
+        printf("%-32s: skipped (the trampoline is not built)\n", Name);
+        return;
+    }
+
+    BenchWriteHookFunction(Hook, (UINT64)(Block + SizeOfStub));
+    memcpy(Site, DetourJump, SizeOfDetourJump);
+
+    __builtin___clear_cache((char *)Site, (char *)Site + sizeof(g_Function));
+    __builtin___clear_cache((char *)Block, (char *)Block + BENCH_TRAMPOLINE_BLOCK_SIZE);
+    __builtin___clear_cache((char *)Hook, (char *)Hook + 16);
+
+    Start = TestNanoseconds();
+
+    for (i = 0; i < BENCH_CALLS; i++)
+    {
+        Result += Function(i);
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+
+    printf("%-32s: %2zu bytes, %.2f ns per call\n", Name, SizeOfDetourJump, (double)Elapsed / BENCH_CALLS);
+}
+
+int
+main()
+{
+    UINT8 * Near;
+    UINT8 * Far;
+    UINT64  Start, Elapsed;
+    UINT32  i;
+    int (*Function)(int);
+    volatile int Result = 0;
+
+    //
+    // Each form has its own page in the near mapping (the function, the trampoline
+    // block and the near hook function), the far mapping is 64GB away
+    //
+    Near = mmap(NULL, 0x4000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (Near == MAP_FAILED)
+    {
+        printf("bench_detour: no executable mapping\n");
+        return 1;
+    }
+
+    Far = mmap(Near + (64ULL << 30), 0x1000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (Far != MAP_FAILED && TrampolineIsRel32Reachable((UINT64)Near, (UINT64)Far))
+    {
+        munmap(Far, 0x1000);
+        Far = MAP_FAILED;
+    }
+
+    //
+    // The function without a hook
+    //
+    memcpy(Near, g_Function, sizeof(g_Function));
+    __builtin___clear_cache((char *)Near, (char *)Near + sizeof(g_Function));
+
+    Function = (int (*)(int))Near;
+    Start    = TestNanoseconds();
+
+    for (i = 0; i < BENCH_CALLS; i++)
+    {
+        Result += Function(i);
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+    printf("%-32s: %.2f ns per call\n", "not hooked", (double)Elapsed / BENCH_CALLS);
+
+    BenchDetourForm("call rel32 -> hook", Near + 0x1000, Near + 0x1100, BENCH_TRAMPOLINE_BLOCK_SIZE, Near + 0x1800, TRAMPOLINE_REL32_BRANCH_SIZE);
+
+    if (Far == MAP_FAILED)
+    {
+        printf("bench_detour: no far mapping, the far forms are skipped\n");
+    }
+    else
+    {
+        BenchDetourForm("call rel32 -> stub -> hook", Near + 0x2000, Near + 0x2100, BENCH_TRAMPOLINE_BLOCK_SIZE, Far, TRAMPOLINE_REL32_BRANCH_SIZE);
+        BenchDetourForm("call $+5 ; jmp [rip+0] -> hook", Near + 0x3000, Near + 0x3100, 0, Far + 0x800, TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE);
+        munmap(Far, 0x1000);
+    }
+
+    munmap(Near, 0x4000);
+
+    return 0;
+}
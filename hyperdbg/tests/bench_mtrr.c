@@ -0,0 +1,97 @@
+/**
+ * @file bench_mtrr.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Benchmark of building the MTRR map and sweeping it like the EPT
+ * identity map initialization does
+ * @details
+ * @version 0.1
+ * @date 2020-05-13
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include "Mtrr.h"
+#include "Test.h"
+
+/* Size of the physical memory that is covered by the map (512GB, same as EPT) */
+#define BENCH_MAP_SIZE (1ULL << 39)
+
+int
+main()
+{
+    MTRR_REGISTERS_STATE  Registers = {0};
+    MTRR_RANGE_DESCRIPTOR Map[MTRR_MAP_MAX_RANGES];
+    UINT32                NumberOfRanges = 0;
+    UINT32                Cursor;
+    BOOLEAN               IsMixed;
+    UINT64                Start, Elapsed, Address;
+    UINT64                Checksum = 0;
+    UINT32                Round, i;
+
+    //
+    // A typical desktop layout, WB below 4GB with a UC hole for the MMIO
+    // and WB above 4GB, plus the fixed ranges
+    //
+    Registers.Capabilities.FixedRangeSupported = 1;
+    Registers.Capabilities.VariableRangeCount  = MTRR_VARIABLE_RANGE_MAX_COUNT;
+    Registers.DefaultType.MtrrEnable           = 1;
+    Registers.DefaultType.FixedRangeMtrrEnable = 1;
+    Registers.DefaultType.DefaultMemoryType    = MEMORY_TYPE_UNCACHEABLE;
+
+    for (i = 0; i < MTRR_FIXED_RANGE_REGISTERS; i++)
+    {
+        Registers.FixedRanges[i] = (i == 2) ? 0 : 0x0505050506060606ULL;
+    }
+
+    for (i = 0; i < MTRR_VARIABLE_RANGE_MAX_COUNT; i++)
+    {
+        UINT64 Size = 1ULL << (28 + i);
+        UINT64 Base = (i < 5) ? 0 : (1ULL << 32);
+
+        Registers.PhysBase[i].Type            = (i == 3) ? MEMORY_TYPE_UNCACHEABLE : MEMORY_TYPE_WRITE_BACK;
+        Registers.PhysBase[i].PageFrameNumber = (Base + ((i == 3) ? 0xc0000000 : 0)) >> 12;
+        Registers.PhysMask[i].Valid           = 1;
+        Registers.PhysMask[i].PageFrameNumber = ((~(Size - 1)) & ((1ULL << 48) - 1)) >> 12;
+    }
+
+    Start = TestNanoseconds();
+
+    for (Round = 0; Round < 100000; Round++)
+    {
+        MtrrBuildMapFromRegisters(&Registers, BENCH_MAP_SIZE, Map, MTRR_MAP_MAX_RANGES, &NumberOfRanges);
+        Checksum += NumberOfRanges;
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+    printf("MtrrBuildMapFromRegisters: %u ranges, %.1f ns per build\n", NumberOfRanges, (double)Elapsed / Round);
+
+    //
+    // Sweep the whole 512GB by 4KB pages (the worst case of splitting every page)
+    //
+    Start  = TestNanoseconds();
+    Cursor = MtrrFindRangeIndex(Map, NumberOfRanges, 0);
+
+    for (Address = 0; Address < BENCH_MAP_SIZE; Address += 0x1000)
+    {
+        Checksum += MtrrSweepMemoryType(Map, NumberOfRanges, &Cursor, Address, 0x1000, &IsMixed);
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+    printf("MtrrSweepMemoryType: %.2f ns per 4KB page\n", (double)Elapsed / (BENCH_MAP_SIZE / 0x1000));
+
+    //
+    // Lookups of random 2MB pages
+    //
+    Start = TestNanoseconds();
+
+    for (Round = 0, Address = 0x12345; Round < 1000000; Round++)
+    {
+        Address  = (Address * 6364136223846793005ULL + 1442695040888963407ULL);
+        Checksum += MtrrFindRangeIndex(Map, NumberOfRanges, (Address >> 25) & (BENCH_MAP_SIZE - 1));
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+    printf("MtrrFindRangeIndex: %.2f ns per lookup (checksum %llu)\n", (double)Elapsed / Round, (unsigned long long)Checksum);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file bench_pattern.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Benchmark of the masked byte pattern matcher
+ * @details A buffer that looks like code (mostly random bytes with padding)
+ * is searched for patterns that are not in it, so the whole buffer is scanned
+ * @version 0.1
+ * @date 2020-05-15
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <stdlib.h>
+#include "PatternMatcher.h"
+#include "Test.h"
+
+/* Size of the searched buffer */
+#define BENCH_BUFFER_SIZE (256ULL << 20)
+
+/**
+ * @brief Search the whole buffer and print the throughput
+ *
+ * @param Name Name of the pattern
+ * @param Buffer The buffer
+ * @param Pattern Bytes of the pattern
+ * @param Mask Mask of each byte of the pattern
+ * @param PatternLength Number of bytes of the pattern
+ */
+static void
+BenchPattern(const char * Name, const UCHAR * Buffer, const UCHAR * Pattern, const UCHAR * Mask, SIZE_T PatternLength)
+{
+    PATTERN_MATCHER Matcher;
+    SIZE_T          Offset  = 0;
+    UINT64          Matches = 0;
+    UINT64          Start, Elapsed;
+
+    PatternMatcherInitialize(&Matcher, Pattern, Mask, PatternLength);
+
+    Start = TestNanoseconds();
+
+    while ((Offset = PatternMatcherFind(&Matcher, Buffer, BENCH_BUFFER_SIZE, Offset)) != PATTERN_MATCHER_NOT_FOUND)
+    {
+        Matches++;
+        Offset++;
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+
+    printf("%-32s: %.2f GB/s (%llu matches)\n", Name, (double)BENCH_BUFFER_SIZE / Elapsed, (unsigned long long)Matches);
+}
+
+int
+main()
+{
+    UCHAR * Buffer;
+    UINT64  State = 0x12345;
+
+    const UCHAR RarePattern[] = {0x48, 0x8b, 0x05, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x05, 0xc3};
+    const UCHAR RareMask[]    = {0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff};
+    const UCHAR PadPattern[]  = {0xcc, 0xcc, 0xcc, 0xcc, 0x90, 0x90, 0xc3, 0x48};
+    const UCHAR PadMask[]     = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    const UCHAR NibPattern[]  = {0x40, 0x89, 0x5c, 0x24, 0x08};
+    const UCHAR NibMask[]     = {0xf0, 0xff, 0x00, 0xff, 0xff};
+    const UCHAR AnyPattern[]  = {0x00, 0x00, 0x00};
+    const UCHAR AnyMask[]     = {0xf0, 0x0f, 0xf0};
+
+    Buffer = malloc(BENCH_BUFFER_SIZE);
+
+    if (Buffer == NULL)
+    {
+        printf("bench_pattern: no memory\n");
+        return 1;
+    }
+
+    //
+    // Random bytes with a run of padding every 256 bytes
+    //
+    for (UINT64 i = 0; i < BENCH_BUFFER_SIZE; i++)
+    {
+        State     = State * 6364136223846793005ULL + 1442695040888963407ULL;
+        Buffer[i] = (i & 0xff) < 8 ? 0xcc : (UCHAR)(State >> 56);
+    }
+
+    BenchPattern("rare anchor (10 bytes)", Buffer, RarePattern, RareMask, sizeof(RarePattern));
+    BenchPattern("padding with a rare byte", Buffer, PadPattern, PadMask, sizeof(PadPattern));
+    BenchPattern("nibble and wildcard", Buffer, NibPattern, NibMask, sizeof(NibPattern));
+    BenchPattern("no exact byte (nibbles only)", Buffer, AnyPattern, AnyMask, sizeof(AnyPattern));
+
+    free(Buffer);
+
+    return 0;
+}
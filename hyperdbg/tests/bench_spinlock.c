@@ -0,0 +1,243 @@
+/**
+ * @file bench_spinlock.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Benchmark of the test-and-set, the ticket and the reader-writer spinlocks
+ * @details 2 to 64 threads acquire a lock for a fixed time, a short critical
+ * section writes a few cache lines and the threads pause a little between the
+ * acquisitions; the throughput and the fairness (the least and the most
+ * acquisitions of a thread) are printed for each lock
+ * @version 0.1
+ * @date 2020-05-17
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include "Spinlock.h"
+#include "Test.h"
+
+/* Duration of each run (milliseconds) */
+#define BENCH_DURATION_MS 200
+
+/* The most threads of a run */
+#define BENCH_MAX_THREADS 64
+
+/* Number of the cache lines that are written in the critical section */
+#define BENCH_CRITICAL_LINES 4
+
+/* Number of the pauses between the acquisitions of a thread */
+#define BENCH_OUTSIDE_PAUSES 16
+
+/* Percentage of the writers of the reader-writer lock */
+#define BENCH_WRITERS_PERCENT 10
+
+/**
+ * @brief The lock that is used by the threads
+ *
+ */
+typedef enum _BENCH_LOCK_TYPE
+{
+    BENCH_LOCK_TEST_AND_SET,
+    BENCH_LOCK_TICKET,
+    BENCH_LOCK_READ_WRITE
+
+} BENCH_LOCK_TYPE;
+
+/**
+ * @brief The counters of a thread (on its own cache line)
+ *
+ */
+typedef struct _BENCH_THREAD
+{
+    pthread_t Thread;
+    UINT64    Acquisitions;
+    UINT64    Writes;
+
+} __attribute__((aligned(64))) BENCH_THREAD;
+
+static volatile LONG       g_TestAndSetLock;
+static SPINLOCK_TICKET     g_TicketLock;
+static SPINLOCK_READ_WRITE g_ReadWriteLock;
+static BENCH_LOCK_TYPE     g_LockType;
+static volatile BOOLEAN    g_Stop;
+static pthread_barrier_t   g_Barrier;
+static BENCH_THREAD        g_Threads[BENCH_MAX_THREADS];
+
+/**
+ * @brief The data that is protected by the locks
+ *
+ */
+static volatile UINT64 g_SharedData[BENCH_CRITICAL_LINES * 8] __attribute__((aligned(64)));
+
+/**
+ * @brief Write the protected cache lines
+ *
+ */
+static inline void
+BenchWriteSharedData()
+{
+    for (UINT32 i = 0; i < BENCH_CRITICAL_LINES; i++)
+    {
+        g_SharedData[i * 8] = g_SharedData[i * 8] + 1;
+    }
+}
+
+/**
+ * @brief Acquire the lock until the run is stopped
+ *
+ * @param Context The counters of the thread
+ * @return void *
+ */
+static void *
+BenchLockThread(void * Context)
+{
+    BENCH_THREAD * Thread = Context;
+    UINT64         State  = (UINT64)Context;
+    UINT64         Value;
+
+    pthread_barrier_wait(&g_Barrier);
+
+    while (!g_Stop)
+    {
+        switch (g_LockType)
+        {
+        case BENCH_LOCK_TEST_AND_SET:
+            SpinlockLock(&g_TestAndSetLock);
+            BenchWriteSharedData();
+            SpinlockUnlock(&g_TestAndSetLock);
+            Thread->Writes++;
+            break;
+
+        case BENCH_LOCK_TICKET:
+            SpinlockTicketLock(&g_TicketLock);
+            BenchWriteSharedData();
+            SpinlockTicketUnlock(&g_TicketLock);
+            Thread->Writes++;
+            break;
+
+        case BENCH_LOCK_READ_WRITE:
+            State = State * 6364136223846793005ULL + 1442695040888963407ULL;
+
+            if ((State >> 33) % 100 < BENCH_WRITERS_PERCENT)
+            {
+                SpinlockLockExclusive(&g_ReadWriteLock);
+                BenchWriteSharedData();
+                SpinlockUnlockExclusive(&g_ReadWriteLock);
+                Thread->Writes++;
+            }
+            else
+            {
+                SpinlockLockShared(&g_ReadWriteLock);
+                for (UINT32 i = 0; i < BENCH_CRITICAL_LINES; i++)
+                {
+                    Value = g_SharedData[i * 8];
+                }
+                SpinlockUnlockShared(&g_ReadWriteLock);
+            }
+            break;
+        }
+
+        Thread->Acquisitions++;
+
+        for (UINT32 i = 0; i < BENCH_OUTSIDE_PAUSES; i++)
+        {
+            _mm_pause();
+        }
+    }
+
+    (void)Value;
+
+    return NULL;
+}
+
+/**
+ * @brief Run the threads on a lock and print the results
+ *
+ * @param Name Name of the lock
+ * @param LockType The lock
+ * @param NumberOfThreads Number of the threads
+ * @return BOOLEAN Returns false if the protected data is not consistent
+ */
+static BOOLEAN
+BenchLock(const char * Name, BENCH_LOCK_TYPE LockType, UINT32 NumberOfThreads)
+{
+    UINT64 Start, Elapsed;
+    UINT64 Total = 0, Writes = 0, Least = ~0ULL, Most = 0;
+
+    g_LockType = LockType;
+    g_Stop     = FALSE;
+    memset((void *)g_SharedData, 0, sizeof(g_SharedData));
+    memset(g_Threads, 0, sizeof(g_Threads));
+
+    pthread_barrier_init(&g_Barrier, NULL, NumberOfThreads + 1);
+
+    for (UINT32 i = 0; i < NumberOfThreads; i++)
+    {
+        pthread_create(&g_Threads[i].Thread, NULL, BenchLockThread, &g_Threads[i]);
+    }
+
+    pthread_barrier_wait(&g_Barrier);
+    Start = TestNanoseconds();
+
+    usleep(BENCH_DURATION_MS * 1000);
+    g_Stop = TRUE;
+
+    for (UINT32 i = 0; i < NumberOfThreads; i++)
+    {
+        pthread_join(g_Threads[i].Thread, NULL);
+    }
+
+    Elapsed = TestNanoseconds() - Start;
+    pthread_barrier_destroy(&g_Barrier);
+
+    for (UINT32 i = 0; i < NumberOfThreads; i++)
+    {
+        Total += g_Threads[i].Acquisitions;
+        Writes += g_Threads[i].Writes;
+        Least = g_Threads[i].Acquisitions < Least ? g_Threads[i].Acquisitions : Least;
+        Most  = g_Threads[i].Acquisitions > Most ? g_Threads[i].Acquisitions : Most;
+    }
+
+    printf("%-16s %3u threads: %8.2f M/s, least/most per thread %.3f\n",
+           Name,
+           NumberOfThreads,
+           (double)Total * 1000.0 / Elapsed,
+           Most ? (double)Least / Most : 0.0);
+
+    //
+    // Every write is in the critical section so no increment is lost
+    //
+    for (UINT32 i = 0; i < BENCH_CRITICAL_LINES; i++)
+    {
+        if (g_SharedData[i * 8] != Writes)
+        {
+            printf("bench_spinlock: %s lost updates\n", Name);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+int
+main()
+{
+    const UINT32 Processors = (UINT32)sysconf(_SC_NPROCESSORS_ONLN);
+    BOOLEAN      Result     = TRUE;
+
+    //
+    // With more threads than processors the waiters of a ticket lock spin
+    // until the preempted threads with earlier tickets run again
+    //
+    printf("%u processors, %u ms per run\n", Processors, BENCH_DURATION_MS);
+
+    for (UINT32 Threads = 2; Threads <= BENCH_MAX_THREADS; Threads *= 2)
+    {
+        Result &= BenchLock("test-and-set", BENCH_LOCK_TEST_AND_SET, Threads);
+        Result &= BenchLock("ticket", BENCH_LOCK_TICKET, Threads);
+        Result &= BenchLock("reader-writer", BENCH_LOCK_READ_WRITE, Threads);
+    }
+
+    return Result ? 0 : 1;
+}
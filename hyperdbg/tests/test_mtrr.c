@@ -0,0 +1,390 @@
+/**
+ * @file test_mtrr.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the MTRR map builder with synthetic MTRR registers
+ * @details The memory type of random addresses is compared with a reference
+ * that evaluates the registers directly (Intel SDM 11.11.4.1)
+ * @version 0.1
+ * @date 2020-05-13
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <stdlib.h>
+#include "Mtrr.h"
+#include "Test.h"
+
+/* Size of the physical memory that is covered by the maps (512GB, same as EPT) */
+#define TEST_MAP_SIZE (1ULL << 39)
+
+/**
+ * @brief Set a variable range of the synthetic registers
+ *
+ */
+static void
+SetVariableRange(PMTRR_REGISTERS_STATE Registers, UINT32 Index, UINT64 Base, UINT64 Size, UCHAR Type)
+{
+    Registers->PhysBase[Index].Flags           = 0;
+    Registers->PhysBase[Index].Type            = Type;
+    Registers->PhysBase[Index].PageFrameNumber = Base >> 12;
+
+    Registers->PhysMask[Index].Flags           = 0;
+    Registers->PhysMask[Index].Valid           = 1;
+    Registers->PhysMask[Index].PageFrameNumber = ((~(Size - 1)) & ((1ULL << 48) - 1)) >> 12;
+}
+
+/**
+ * @brief Evaluate the memory type of an address from the registers
+ *
+ */
+static UCHAR
+ReferenceMemoryType(PMTRR_REGISTERS_STATE Registers, UINT64 Address)
+{
+    UINT64  Mask;
+    UCHAR   Type    = 0;
+    BOOLEAN Matched = FALSE;
+    UINT32  i;
+
+    if (!Registers->DefaultType.MtrrEnable)
+    {
+        return MEMORY_TYPE_UNCACHEABLE;
+    }
+
+    if (Address < MTRR_FIXED_RANGE_END && Registers->Capabilities.FixedRangeSupported && Registers->DefaultType.FixedRangeMtrrEnable)
+    {
+        if (Address < 0x80000)
+        {
+            return (UCHAR)(Registers->FixedRanges[0] >> ((Address / 0x10000) * 8));
+        }
+        else if (Address < 0xC0000)
+        {
+            return (UCHAR)(Registers->FixedRanges[1 + (Address - 0x80000) / 0x20000] >> ((((Address - 0x80000) % 0x20000) / 0x4000) * 8));
+        }
+        else
+        {
+            return (UCHAR)(Registers->FixedRanges[3 + (Address - 0xC0000) / 0x8000] >> ((((Address - 0xC0000) % 0x8000) / 0x1000) * 8));
+        }
+    }
+
+    for (i = 0; i < Registers->Capabilities.VariableRangeCount && i < MTRR_VARIABLE_RANGE_MAX_COUNT; i++)
+    {
+        if (!Registers->PhysMask[i].Valid)
+        {
+            continue;
+        }
+
+        Mask = (UINT64)Registers->PhysMask[i].PageFrameNumber << 12;
+
+        if ((Address & Mask) != (((UINT64)Registers->PhysBase[i].PageFrameNumber << 12) & Mask))
+        {
+            continue;
+        }
+
+        if (!Matched)
+        {
+            Type = (UCHAR)Registers->PhysBase[i].Type;
+        }
+        else if (Type != Registers->PhysBase[i].Type)
+        {
+            if (Type == MEMORY_TYPE_UNCACHEABLE || Registers->PhysBase[i].Type == MEMORY_TYPE_UNCACHEABLE)
+                Type = MEMORY_TYPE_UNCACHEABLE;
+            else if ((Type == MEMORY_TYPE_WRITE_THROUGH || Type == MEMORY_TYPE_WRITE_BACK) &&
+                     (Registers->PhysBase[i].Type == MEMORY_TYPE_WRITE_THROUGH || Registers->PhysBase[i].Type == MEMORY_TYPE_WRITE_BACK))
+                Type = MEMORY_TYPE_WRITE_THROUGH;
+            else
+                Type = MEMORY_TYPE_UNCACHEABLE;
+        }
+
+        Matched = TRUE;
+    }
+
+    return Matched ? Type : (UCHAR)Registers->DefaultType.DefaultMemoryType;
+}
+
+/**
+ * @brief The memory type of an address in the map
+ *
+ */
+static UCHAR
+MapMemoryType(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges, UINT64 Address)
+{
+    UINT32 Index = MtrrFindRangeIndex(Map, NumberOfRanges, Address);
+
+    if (Index >= NumberOfRanges || Map[Index].PhysicalBaseAddress > Address)
+    {
+        return MEMORY_TYPE_INVALID;
+    }
+
+    return Map[Index].MemoryType;
+}
+
+/**
+ * @brief Check that the map is sorted, merged and covers the whole memory
+ *
+ */
+static void
+CheckMapShape(PMTRR_RANGE_DESCRIPTOR Map, UINT32 NumberOfRanges)
+{
+    UINT32 i;
+
+    TEST_CHECK(NumberOfRanges != 0);
+    TEST_CHECK(Map[0].PhysicalBaseAddress == 0);
+    TEST_CHECK(Map[NumberOfRanges - 1].PhysicalEndAddress == TEST_MAP_SIZE - 1);
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        TEST_CHECK(Map[i].PhysicalBaseAddress <= Map[i].PhysicalEndAddress);
+
+        if (i != 0)
+        {
+            TEST_CHECK(Map[i - 1].PhysicalEndAddress + 1 == Map[i].PhysicalBaseAddress);
+            TEST_CHECK(Map[i - 1].MemoryType != Map[i].MemoryType);
+        }
+    }
+}
+
+/**
+ * @brief Build a map and compare it with the reference at the given addresses
+ * and at the edges of all the ranges
+ *
+ */
+static void
+CheckMap(PMTRR_REGISTERS_STATE Registers, const UINT64 * Addresses, UINT32 NumberOfAddresses)
+{
+    MTRR_RANGE_DESCRIPTOR Map[MTRR_MAP_MAX_RANGES];
+    UINT32                NumberOfRanges = 0;
+    UINT32                i;
+
+    TEST_CHECK(MtrrBuildMapFromRegisters(Registers, TEST_MAP_SIZE, Map, MTRR_MAP_MAX_RANGES, &NumberOfRanges));
+    CheckMapShape(Map, NumberOfRanges);
+
+    for (i = 0; i < NumberOfAddresses; i++)
+    {
+        TEST_CHECK(MapMemoryType(Map, NumberOfRanges, Addresses[i]) == ReferenceMemoryType(Registers, Addresses[i]));
+    }
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        TEST_CHECK(Map[i].MemoryType == ReferenceMemoryType(Registers, Map[i].PhysicalBaseAddress));
+        TEST_CHECK(Map[i].MemoryType == ReferenceMemoryType(Registers, Map[i].PhysicalEndAddress));
+    }
+}
+
+static void
+TestMtrrDisabled()
+{
+    MTRR_REGISTERS_STATE  Registers = {0};
+    MTRR_RANGE_DESCRIPTOR Map[MTRR_MAP_MAX_RANGES];
+    UINT32                NumberOfRanges = 0;
+
+    Registers.Capabilities.VariableRangeCount = 8;
+    Registers.DefaultType.DefaultMemoryType   = MEMORY_TYPE_WRITE_BACK;
+    SetVariableRange(&Registers, 0, 0, 1ULL << 32, MEMORY_TYPE_WRITE_BACK);
+
+    TEST_CHECK(MtrrBuildMapFromRegisters(&Registers, TEST_MAP_SIZE, Map, MTRR_MAP_MAX_RANGES, &NumberOfRanges));
+    TEST_CHECK(NumberOfRanges == 1);
+    TEST_CHECK(Map[0].MemoryType == MEMORY_TYPE_UNCACHEABLE);
+    CheckMapShape(Map, NumberOfRanges);
+}
+
+static void
+TestFixedRanges()
+{
+    MTRR_REGISTERS_STATE Registers   = {0};
+    const UINT64         Addresses[] = {0, 0x9f000, 0xa0000, 0xbf000, 0xc0000, 0xc8000, 0xf0000, 0xff000, 0x100000, 0x200000};
+    UINT32               i;
+
+    Registers.Capabilities.FixedRangeSupported  = 1;
+    Registers.DefaultType.MtrrEnable            = 1;
+    Registers.DefaultType.FixedRangeMtrrEnable  = 1;
+    Registers.DefaultType.DefaultMemoryType     = MEMORY_TYPE_WRITE_BACK;
+    Registers.Capabilities.VariableRangeCount   = 2;
+
+    for (i = 0; i < MTRR_FIXED_RANGE_REGISTERS; i++)
+    {
+        Registers.FixedRanges[i] = 0x0606060606060606ULL;
+    }
+
+    //
+    // Legacy video memory (A0000-BFFFF) is UC and the option ROMs are WP
+    //
+    Registers.FixedRanges[2] = 0x0000000000000000ULL;
+    Registers.FixedRanges[3] = 0x0505050505050505ULL;
+    Registers.FixedRanges[4] = 0x0505050505050505ULL;
+
+    //
+    // A variable range in the first 1MB is ignored as the fixed ranges take precedence
+    //
+    SetVariableRange(&Registers, 0, 0, 0x100000, MEMORY_TYPE_UNCACHEABLE);
+
+    CheckMap(&Registers, Addresses, sizeof(Addresses) / sizeof(Addresses[0]));
+}
+
+static void
+TestOverlappingRanges()
+{
+    MTRR_REGISTERS_STATE Registers   = {0};
+    const UINT64         Addresses[] = {0, 0x7fffffff, 0x80000000, 0x8fffffff, 0x90000000, 0xbfffffff, 0xc0000000, 0xffffffff, 0x100000000, 0x17fffffff, 0x180000000};
+
+    Registers.DefaultType.MtrrEnable          = 1;
+    Registers.DefaultType.DefaultMemoryType   = MEMORY_TYPE_UNCACHEABLE;
+    Registers.Capabilities.VariableRangeCount = 10;
+
+    //
+    // 0-4GB is WB, 3GB-4GB is UC (UC wins), 2GB-2.25GB is WT (WT wins over WB)
+    // and 4GB-6GB is WB by two ranges with the same type
+    //
+    SetVariableRange(&Registers, 0, 0, 1ULL << 32, MEMORY_TYPE_WRITE_BACK);
+    SetVariableRange(&Registers, 1, 0xc0000000, 1ULL << 30, MEMORY_TYPE_UNCACHEABLE);
+    SetVariableRange(&Registers, 2, 0x80000000, 1ULL << 28, MEMORY_TYPE_WRITE_THROUGH);
+    SetVariableRange(&Registers, 3, 1ULL << 32, 1ULL << 32, MEMORY_TYPE_WRITE_BACK);
+    SetVariableRange(&Registers, 4, 1ULL << 32, 1ULL << 31, MEMORY_TYPE_WRITE_BACK);
+
+    //
+    // WB and WC overlap is undefined, so it should be UC
+    //
+    SetVariableRange(&Registers, 5, 0x140000000, 1ULL << 30, MEMORY_TYPE_WRITE_COMBINING);
+
+    CheckMap(&Registers, Addresses, sizeof(Addresses) / sizeof(Addresses[0]));
+}
+
+static void
+TestDefaultTypeHoles()
+{
+    MTRR_REGISTERS_STATE Registers   = {0};
+    const UINT64         Addresses[] = {0, 0x7fffffff, 0x80000000, 0xfee00000, 0x100000000, TEST_MAP_SIZE - 1};
+
+    Registers.DefaultType.MtrrEnable          = 1;
+    Registers.DefaultType.DefaultMemoryType   = MEMORY_TYPE_UNCACHEABLE;
+    Registers.Capabilities.VariableRangeCount = 10;
+
+    //
+    // 0-2GB and 4GB-8GB are WB, everything else is the default type,
+    // the disabled register is ignored
+    //
+    SetVariableRange(&Registers, 0, 0, 1ULL << 31, MEMORY_TYPE_WRITE_BACK);
+    SetVariableRange(&Registers, 1, 1ULL << 32, 1ULL << 32, MEMORY_TYPE_WRITE_BACK);
+    SetVariableRange(&Registers, 2, 0x80000000, 1ULL << 31, MEMORY_TYPE_WRITE_BACK);
+    Registers.PhysMask[2].Valid = 0;
+
+    CheckMap(&Registers, Addresses, sizeof(Addresses) / sizeof(Addresses[0]));
+}
+
+static void
+TestSweep()
+{
+    MTRR_REGISTERS_STATE  Registers = {0};
+    MTRR_RANGE_DESCRIPTOR Map[MTRR_MAP_MAX_RANGES];
+    UINT32                NumberOfRanges = 0;
+    UINT32                Cursor;
+    BOOLEAN               IsMixed;
+    UINT32                i;
+
+    Registers.DefaultType.MtrrEnable          = 1;
+    Registers.DefaultType.DefaultMemoryType   = MEMORY_TYPE_WRITE_BACK;
+    Registers.Capabilities.VariableRangeCount = 10;
+
+    //
+    // A single UC page in the middle of a 2MB page
+    //
+    SetVariableRange(&Registers, 0, 0x1001000, 0x1000, MEMORY_TYPE_UNCACHEABLE);
+
+    TEST_CHECK(MtrrBuildMapFromRegisters(&Registers, TEST_MAP_SIZE, Map, MTRR_MAP_MAX_RANGES, &NumberOfRanges));
+    TEST_CHECK(NumberOfRanges == 3);
+
+    Cursor = MtrrFindRangeIndex(Map, NumberOfRanges, 0x1000000);
+    TEST_CHECK(MtrrSweepMemoryType(Map, NumberOfRanges, &Cursor, 0x1000000, 0x200000, &IsMixed) == MEMORY_TYPE_WRITE_BACK);
+    TEST_CHECK(IsMixed);
+
+    //
+    // Sweep the 4KB pages of the 2MB page in an ascending order
+    //
+    Cursor = MtrrFindRangeIndex(Map, NumberOfRanges, 0x1000000);
+
+    for (i = 0; i < 512; i++)
+    {
+        TEST_CHECK(MtrrSweepMemoryType(Map, NumberOfRanges, &Cursor, 0x1000000 + (i * 0x1000), 0x1000, &IsMixed) ==
+                   (i == 1 ? MEMORY_TYPE_UNCACHEABLE : MEMORY_TYPE_WRITE_BACK));
+        TEST_CHECK(!IsMixed);
+    }
+
+    Cursor = MtrrFindRangeIndex(Map, NumberOfRanges, 0x1200000);
+    TEST_CHECK(MtrrSweepMemoryType(Map, NumberOfRanges, &Cursor, 0x1200000, 0x200000, &IsMixed) == MEMORY_TYPE_WRITE_BACK);
+    TEST_CHECK(!IsMixed);
+}
+
+static void
+TestMapTooSmall()
+{
+    MTRR_REGISTERS_STATE  Registers = {0};
+    MTRR_RANGE_DESCRIPTOR Map[4];
+    UINT32                NumberOfRanges = 0;
+
+    Registers.Capabilities.FixedRangeSupported = 1;
+    Registers.DefaultType.MtrrEnable           = 1;
+    Registers.DefaultType.FixedRangeMtrrEnable = 1;
+    Registers.FixedRanges[0]                   = 0x0600060006000600ULL;
+
+    TEST_CHECK(!MtrrBuildMapFromRegisters(&Registers, TEST_MAP_SIZE, Map, 4, &NumberOfRanges));
+    TEST_CHECK(NumberOfRanges <= 4);
+}
+
+static void
+TestRandomRegisters()
+{
+    static const UCHAR   Types[] = {MEMORY_TYPE_UNCACHEABLE, MEMORY_TYPE_WRITE_COMBINING, MEMORY_TYPE_WRITE_THROUGH, MEMORY_TYPE_WRITE_PROTECTED, MEMORY_TYPE_WRITE_BACK};
+    MTRR_REGISTERS_STATE Registers;
+    UINT64               Addresses[64];
+    UINT64               Size;
+    UINT32               Round, i;
+
+    srand(1);
+
+    for (Round = 0; Round < 2000; Round++)
+    {
+        memset(&Registers, 0, sizeof(Registers));
+
+        Registers.DefaultType.MtrrEnable           = 1;
+        Registers.DefaultType.FixedRangeMtrrEnable = rand() & 1;
+        Registers.DefaultType.DefaultMemoryType    = Types[rand() % 5];
+        Registers.Capabilities.FixedRangeSupported = 1;
+        Registers.Capabilities.VariableRangeCount  = MTRR_VARIABLE_RANGE_MAX_COUNT;
+
+        for (i = 0; i < MTRR_FIXED_RANGE_REGISTERS; i++)
+        {
+            Registers.FixedRanges[i] = (rand() & 1) ? 0x0606060606060606ULL : ((UINT64)Types[rand() % 5] << ((rand() % 8) * 8));
+        }
+
+        for (i = 0; i < MTRR_VARIABLE_RANGE_MAX_COUNT; i++)
+        {
+            Size = 1ULL << (12 + (rand() % 27));
+            SetVariableRange(&Registers, i, ((((UINT64)rand() << 20) ^ (UINT64)rand()) % TEST_MAP_SIZE) & ~(Size - 1), Size, Types[rand() % 5]);
+
+            if ((rand() % 4) == 0)
+            {
+                Registers.PhysMask[i].Valid = 0;
+            }
+        }
+
+        for (i = 0; i < 64; i++)
+        {
+            Addresses[i] = (i < 16) ? ((UINT64)rand() % MTRR_FIXED_RANGE_END) : ((((UINT64)rand() << 20) ^ (UINT64)rand()) % TEST_MAP_SIZE);
+        }
+
+        CheckMap(&Registers, Addresses, 64);
+    }
+}
+
+int
+main()
+{
+    TestMtrrDisabled();
+    TestFixedRanges();
+    TestOverlappingRanges();
+    TestDefaultTypeHoles();
+    TestSweep();
+    TestMapTooSmall();
+    TestRandomRegisters();
+
+    return TEST_RESULT("test_mtrr");
+}
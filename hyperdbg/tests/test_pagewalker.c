@@ -0,0 +1,258 @@
+/**
+ * @file test_pagewalker.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the software walker of the paging structures
+ * @details The paging structures are built in a buffer that is used as the
+ * physical memory, the entries are read by the callback of the walker
+ * @version 0.1
+ * @date 2020-05-16
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include "PageWalker.h"
+#include "Test.h"
+
+/* Number of the pages of the synthetic physical memory */
+#define TEST_PHYSICAL_PAGES 16
+
+/* Physical addresses of the tables */
+#define TEST_PML4 0x1000
+#define TEST_PDPT 0x2000
+#define TEST_PD   0x3000
+#define TEST_PT   0x4000
+#define TEST_PT2  0x5000
+
+/* Present and writable */
+#define TEST_TABLE_FLAGS 0x3
+
+/**
+ * @brief The synthetic physical memory
+ *
+ */
+static UINT64 g_PhysicalMemory[TEST_PHYSICAL_PAGES * PAGE_SIZE / sizeof(UINT64)];
+
+/**
+ * @brief Number of the reads of the walker
+ *
+ */
+static UINT32 g_NumberOfReads;
+
+/**
+ * @brief Read an entry of the synthetic physical memory
+ *
+ * @param Context Unused
+ * @param PhysicalAddress Physical address of the entry
+ * @param Entry The value of the entry
+ * @return BOOLEAN Returns false if the address is outside of the memory
+ */
+static BOOLEAN
+TestReadEntry(PVOID Context, UINT64 PhysicalAddress, PUINT64 Entry)
+{
+    (void)Context;
+
+    g_NumberOfReads++;
+
+    if (PhysicalAddress >= sizeof(g_PhysicalMemory) || (PhysicalAddress & 7) != 0)
+    {
+        return FALSE;
+    }
+
+    *Entry = g_PhysicalMemory[PhysicalAddress / sizeof(UINT64)];
+
+    return TRUE;
+}
+
+/**
+ * @brief Write an entry of a table for a virtual address
+ *
+ * @param Table Physical address of the table
+ * @param VirtualAddress The virtual address
+ * @param Level 4 for PML4 to 1 for PT
+ * @param Entry The value of the entry
+ */
+static void
+TestSetEntry(UINT64 Table, UINT64 VirtualAddress, UINT32 Level, UINT64 Entry)
+{
+    UINT64 Index = (VirtualAddress >> (12 + (Level - 1) * 9)) & 0x1ff;
+
+    g_PhysicalMemory[(Table + Index * sizeof(UINT64)) / sizeof(UINT64)] = Entry;
+}
+
+/**
+ * @brief Translate an address and return the physical address (or ~0 if it's not present)
+ *
+ * @param Cr3 The cr3
+ * @param VirtualAddress The virtual address
+ * @param Result The result of the walk
+ * @return UINT64
+ */
+static UINT64
+TestTranslate(UINT64 Cr3, UINT64 VirtualAddress, PPAGE_WALKER_RESULT Result)
+{
+    if (!PageWalkerTranslate(Cr3, VirtualAddress, TestReadEntry, NULL, Result))
+    {
+        return ~0ull;
+    }
+
+    return Result->PhysicalAddress;
+}
+
+/**
+ * @brief Check 4KB, 2MB and 1GB pages and the entries of each walk
+ *
+ */
+static void
+TestPageSizes()
+{
+    PAGE_WALKER_RESULT Result;
+    const UINT64       Small = 0x00007f0012345678ull;
+    const UINT64       Large = 0x00007f0012600abcull;
+    const UINT64       Huge  = 0xffff800040123456ull;
+
+    memset(g_PhysicalMemory, 0, sizeof(g_PhysicalMemory));
+
+    //
+    // A 4KB page and a 2MB page in the same PDPT, a 1GB page in the upper half
+    //
+    TestSetEntry(TEST_PML4, Small, 4, TEST_PDPT | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PDPT, Small, 3, TEST_PD | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PD, Small, 2, TEST_PT | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PT, Small, 1, 0x8000000000abc000ull | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PD, Large, 2, 0x0000000123401000ull | PAGE_WALKER_ENTRY_LARGE | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PML4, Huge, 4, TEST_PT2 | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PT2, Huge, 3, 0x0000004c0000e000ull | PAGE_WALKER_ENTRY_LARGE | TEST_TABLE_FLAGS);
+
+    g_NumberOfReads = 0;
+    TEST_CHECK(TestTranslate(TEST_PML4, Small, &Result) == 0xabc678);
+    TEST_CHECK(Result.PageSize == 0x1000 && Result.NumberOfEntries == 4 && g_NumberOfReads == 4);
+    TEST_CHECK(Result.EntryAddresses[0] == TEST_PML4 + ((Small >> 39) & 0x1ff) * 8);
+    TEST_CHECK(Result.EntryAddresses[3] == TEST_PT + ((Small >> 12) & 0x1ff) * 8);
+    TEST_CHECK(Result.Entries[1] == (TEST_PD | TEST_TABLE_FLAGS));
+
+    //
+    // The ignored bits of a large entry (the PAT bit) are not a part of the address
+    //
+    TEST_CHECK(TestTranslate(TEST_PML4, Large, &Result) == 0x123400abcull);
+    TEST_CHECK(Result.PageSize == 0x200000 && Result.NumberOfEntries == 3);
+
+    TEST_CHECK(TestTranslate(TEST_PML4, Huge, &Result) == 0x4c00123456ull);
+    TEST_CHECK(Result.PageSize == 0x40000000 && Result.NumberOfEntries == 2);
+
+    //
+    // The PCID bits and the flags of cr3 are ignored
+    //
+    TEST_CHECK(TestTranslate(TEST_PML4 | 0x18, Small, &Result) == 0xabc678);
+    TEST_CHECK(TestTranslate(TEST_PML4 | 0xfff, Large, &Result) == 0x123400abcull);
+}
+
+/**
+ * @brief Check the addresses that are not translated
+ *
+ */
+static void
+TestNotPresent()
+{
+    PAGE_WALKER_RESULT Result;
+    const UINT64       Address = 0x00000000c0201000ull;
+
+    memset(g_PhysicalMemory, 0, sizeof(g_PhysicalMemory));
+
+    //
+    // A non-present entry at each level
+    //
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+
+    TestSetEntry(TEST_PML4, Address, 4, TEST_PDPT | TEST_TABLE_FLAGS);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+
+    TestSetEntry(TEST_PDPT, Address, 3, TEST_PD | TEST_TABLE_FLAGS);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+
+    TestSetEntry(TEST_PD, Address, 2, TEST_PT | TEST_TABLE_FLAGS);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+
+    TestSetEntry(TEST_PT, Address, 1, 0x7000 | 0x2);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+
+    TestSetEntry(TEST_PT, Address, 1, 0x7000 | TEST_TABLE_FLAGS);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == 0x7000);
+
+    //
+    // Non-canonical addresses are not walked
+    //
+    g_NumberOfReads = 0;
+    TEST_CHECK(TestTranslate(TEST_PML4, Address | 0x0000800000000000ull, &Result) == ~0ull);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address | 0x8000000000000000ull, &Result) == ~0ull);
+    TEST_CHECK(g_NumberOfReads == 0);
+
+    //
+    // An entry that can't be read (a table outside of the memory)
+    //
+    TestSetEntry(TEST_PD, Address, 2, 0x100000000ull | TEST_TABLE_FLAGS);
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == ~0ull);
+}
+
+/**
+ * @brief Check that a changed leaf entry of a walk is detected and the upper
+ * entries are trusted
+ *
+ */
+static void
+TestLeafUnchanged()
+{
+    PAGE_WALKER_RESULT Result;
+    PAGE_WALKER_RESULT Empty   = {0};
+    const UINT64       Address = 0x0000123456789000ull;
+
+    memset(g_PhysicalMemory, 0, sizeof(g_PhysicalMemory));
+
+    TestSetEntry(TEST_PML4, Address, 4, TEST_PDPT | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PDPT, Address, 3, TEST_PD | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PD, Address, 2, TEST_PT | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PT, Address, 1, 0x7000 | TEST_TABLE_FLAGS);
+    TestSetEntry(TEST_PT2, Address, 1, 0x8000 | TEST_TABLE_FLAGS);
+
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == 0x7000);
+    TEST_CHECK(PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+
+    //
+    // The PDE points to another PT, the old leaf entry is not changed so the
+    // walk is still trusted until the caller drops it
+    //
+    TestSetEntry(TEST_PD, Address, 2, TEST_PT2 | TEST_TABLE_FLAGS);
+    TEST_CHECK(PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == 0x8000);
+    TEST_CHECK(PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+
+    //
+    // The accessed bit of the PML4E is set, then the leaf is changed
+    //
+    TestSetEntry(TEST_PML4, Address, 4, TEST_PDPT | TEST_TABLE_FLAGS | 0x20);
+    TEST_CHECK(PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+
+    TestSetEntry(TEST_PT2, Address, 1, 0x9000 | TEST_TABLE_FLAGS);
+    TEST_CHECK(!PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+    TEST_CHECK(TestTranslate(TEST_PML4, Address, &Result) == 0x9000);
+
+    //
+    // The page is unmapped
+    //
+    TestSetEntry(TEST_PT2, Address, 1, 0);
+    TEST_CHECK(!PageWalkerIsLeafUnchanged(&Result, TestReadEntry, NULL));
+
+    //
+    // A result without a walk is never valid
+    //
+    TEST_CHECK(!PageWalkerIsLeafUnchanged(&Empty, TestReadEntry, NULL));
+}
+
+int
+main()
+{
+    TestPageSizes();
+    TestNotPresent();
+    TestLeafUnchanged();
+
+    return TEST_RESULT("test_pagewalker");
+}
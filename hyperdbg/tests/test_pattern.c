@@ -0,0 +1,188 @@
+/**
+ * @file test_pattern.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the masked byte pattern matcher
+ * @details The matcher is compared with a byte by byte search on random
+ * buffers and patterns (exact bytes, wildcards and nibbles)
+ * @version 0.1
+ * @date 2020-05-15
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <stdlib.h>
+#include "PatternMatcher.h"
+#include "Test.h"
+
+/* Size of the random buffers */
+#define TEST_BUFFER_SIZE 0x1000
+
+/* Number of the random patterns */
+#define TEST_ROUNDS 20000
+
+/**
+ * @brief Find the first match by comparing every offset
+ *
+ * @param Pattern Bytes of the pattern
+ * @param Mask Mask of each byte of the pattern
+ * @param PatternLength Number of bytes of the pattern
+ * @param Buffer The buffer to search
+ * @param BufferSize Size of the buffer
+ * @param StartOffset The first offset that a match can start at
+ * @return SIZE_T
+ */
+static SIZE_T
+TestFindReference(const UCHAR * Pattern, const UCHAR * Mask, SIZE_T PatternLength, const UCHAR * Buffer, SIZE_T BufferSize, SIZE_T StartOffset)
+{
+    for (SIZE_T Offset = StartOffset; Offset + PatternLength <= BufferSize; Offset++)
+    {
+        SIZE_T i;
+
+        for (i = 0; i < PatternLength; i++)
+        {
+            if ((Buffer[Offset + i] & Mask[i]) != (Pattern[i] & Mask[i]))
+            {
+                break;
+            }
+        }
+
+        if (i == PatternLength)
+        {
+            return Offset;
+        }
+    }
+
+    return PATTERN_MATCHER_NOT_FOUND;
+}
+
+/**
+ * @brief Check the prepared patterns and the edges of the buffer
+ *
+ */
+static void
+TestEdges()
+{
+    PATTERN_MATCHER Matcher;
+    UCHAR           Buffer[64];
+    const UCHAR     Pattern[] = {0x48, 0x8b, 0x05, 0x00};
+    const UCHAR     Mask[]    = {0xff, 0xff, 0xff, 0x00};
+    const UCHAR     Padding[] = {0xcc, 0xcc, 0x12};
+    const UCHAR     Exact[]   = {0xff, 0xff, 0xff};
+    const UCHAR     Any[]     = {0x00, 0x00};
+
+    //
+    // An empty pattern is rejected
+    //
+    TEST_CHECK(!PatternMatcherInitialize(&Matcher, Pattern, Mask, 0));
+
+    //
+    // The anchor is an exact byte, a rare byte is preferred to padding
+    //
+    TEST_CHECK(PatternMatcherInitialize(&Matcher, Padding, Exact, sizeof(Padding)));
+    TEST_CHECK(Matcher.HasAnchor && Matcher.AnchorIndex == 2);
+
+    TEST_CHECK(PatternMatcherInitialize(&Matcher, Pattern, Any, sizeof(Any)));
+    TEST_CHECK(!Matcher.HasAnchor);
+
+    //
+    // A match at the last offset, before the start offset and in a short buffer
+    //
+    memset(Buffer, 0x90, sizeof(Buffer));
+    memcpy(Buffer + sizeof(Buffer) - 3, Pattern, 3);
+
+    TEST_CHECK(PatternMatcherInitialize(&Matcher, Pattern, Mask, 3));
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), 0) == sizeof(Buffer) - 3);
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), sizeof(Buffer) - 2) == PATTERN_MATCHER_NOT_FOUND);
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, 2, 0) == PATTERN_MATCHER_NOT_FOUND);
+
+    //
+    // The trailing wildcard doesn't fit after the last offset
+    //
+    TEST_CHECK(PatternMatcherInitialize(&Matcher, Pattern, Mask, 4));
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), 0) == PATTERN_MATCHER_NOT_FOUND);
+
+    memcpy(Buffer + 10, Pattern, 3);
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), 0) == 10);
+    TEST_CHECK(PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), 11) == PATTERN_MATCHER_NOT_FOUND);
+}
+
+/**
+ * @brief Compare the matcher with the reference on random buffers and patterns
+ *
+ */
+static void
+TestRandom()
+{
+    static UCHAR    Buffer[TEST_BUFFER_SIZE];
+    UCHAR           Pattern[32];
+    UCHAR           Mask[32];
+    PATTERN_MATCHER Matcher;
+    SIZE_T          PatternLength;
+    SIZE_T          StartOffset;
+    SIZE_T          Expected;
+    SIZE_T          Found;
+    UINT32          Round;
+    UINT32          Mismatches = 0;
+
+    srand(1);
+
+    for (Round = 0; Round < TEST_ROUNDS; Round++)
+    {
+        //
+        // A small alphabet makes the anchor byte appear everywhere
+        //
+        UINT32 Alphabet = (Round % 3 == 0) ? 4 : 256;
+
+        for (SIZE_T i = 0; i < sizeof(Buffer); i++)
+        {
+            Buffer[i] = (UCHAR)(rand() % Alphabet);
+        }
+
+        PatternLength = 1 + rand() % sizeof(Pattern);
+
+        //
+        // Usually the pattern is taken from the buffer so it has a match
+        //
+        if (rand() % 4 != 0 && PatternLength <= sizeof(Buffer))
+        {
+            memcpy(Pattern, Buffer + rand() % (sizeof(Buffer) - PatternLength + 1), PatternLength);
+        }
+        else
+        {
+            for (SIZE_T i = 0; i < PatternLength; i++)
+            {
+                Pattern[i] = (UCHAR)(rand() % Alphabet);
+            }
+        }
+
+        for (SIZE_T i = 0; i < PatternLength; i++)
+        {
+            static const UCHAR Masks[] = {0xff, 0xff, 0xff, 0x00, 0xf0, 0x0f};
+
+            Mask[i] = Masks[rand() % sizeof(Masks)];
+        }
+
+        StartOffset = (rand() % 2) ? 0 : rand() % sizeof(Buffer);
+
+        TEST_CHECK(PatternMatcherInitialize(&Matcher, Pattern, Mask, PatternLength));
+
+        Expected = TestFindReference(Pattern, Mask, PatternLength, Buffer, sizeof(Buffer), StartOffset);
+        Found    = PatternMatcherFind(&Matcher, Buffer, sizeof(Buffer), StartOffset);
+
+        if (Expected != Found)
+        {
+            Mismatches++;
+        }
+    }
+
+    TEST_CHECK(Mismatches == 0);
+}
+
+int
+main()
+{
+    TestEdges();
+    TestRandom();
+
+    return TEST_RESULT("test_pattern");
+}
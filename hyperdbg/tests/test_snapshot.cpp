@@ -0,0 +1,353 @@
+/**
+ * @file test_snapshot.cpp
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the memory snapshots and their diff engine
+ * @details The snapshots are taken from a synthetic process, its pages are
+ * given to the engine by the read callback
+ * @version 0.1
+ * @date 2020-05-16
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include "snapshot.h"
+#include "Test.h"
+
+/**
+ * @brief A page of the synthetic process
+ *
+ */
+typedef struct _TEST_PAGE
+{
+    uint8_t  Data[SNAPSHOT_PAGE_SIZE];
+    uint32_t ValidBytes;
+
+} TEST_PAGE, *PTEST_PAGE;
+
+/**
+ * @brief The synthetic process, the pages that are not in it are not readable
+ *
+ */
+typedef struct _TEST_PROCESS
+{
+    uint32_t                      Pid;
+    std::map<uint64_t, TEST_PAGE> Pages;
+    uint32_t                      NumberOfRequests;
+    bool                          Fail;
+
+} TEST_PROCESS, *PTEST_PROCESS;
+
+/**
+ * @brief Read the pages of the synthetic process
+ *
+ * @param Context The synthetic process
+ * @param Pid Process id
+ * @param Pages The pages to read
+ * @param NumberOfPages Number of the pages
+ * @param Buffer The data of the pages
+ * @param ValidBytes The read bytes of each page
+ * @return bool Returns false if the process is not found or fails on purpose
+ */
+static bool
+TestReadPages(void * Context, uint32_t Pid, const uint64_t * Pages, uint32_t NumberOfPages, uint8_t * Buffer, uint32_t * ValidBytes)
+{
+    PTEST_PROCESS Process = (PTEST_PROCESS)Context;
+
+    Process->NumberOfRequests++;
+
+    if (Process->Fail || Process->Pid != Pid)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < NumberOfPages; i++)
+    {
+        auto Item = Process->Pages.find(Pages[i]);
+
+        if (Item == Process->Pages.end())
+        {
+            continue;
+        }
+
+        memcpy(Buffer + i * SNAPSHOT_PAGE_SIZE, Item->second.Data, Item->second.ValidBytes);
+        ValidBytes[i] = Item->second.ValidBytes;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Add a page to the synthetic process
+ *
+ * @param Process The synthetic process
+ * @param Address Address of the page
+ * @param Fill Value of the bytes of the page
+ * @return PTEST_PAGE
+ */
+static PTEST_PAGE
+TestAddPage(PTEST_PROCESS Process, uint64_t Address, uint8_t Fill)
+{
+    PTEST_PAGE Page = &Process->Pages[Address];
+
+    memset(Page->Data, Fill, sizeof(Page->Data));
+    Page->ValidBytes = SNAPSHOT_PAGE_SIZE;
+
+    return Page;
+}
+
+/**
+ * @brief Compress and decompress a page and compare it with the original
+ *
+ * @param Page The page
+ * @return size_t Size of the compressed page (zero if it's not compressible)
+ */
+static size_t
+TestRoundTrip(const uint8_t * Page)
+{
+    uint8_t Compressed[SNAPSHOT_PAGE_SIZE];
+    uint8_t Decompressed[SNAPSHOT_PAGE_SIZE];
+    size_t  Size = SnapshotCompress(Page, Compressed);
+
+    if (Size != 0)
+    {
+        TEST_CHECK(Size < SNAPSHOT_PAGE_SIZE);
+        TEST_CHECK(SnapshotDecompress(Compressed, Size, Decompressed));
+        TEST_CHECK(memcmp(Page, Decompressed, SNAPSHOT_PAGE_SIZE) == 0);
+
+        //
+        // A truncated stream is rejected
+        //
+        TEST_CHECK(!SnapshotDecompress(Compressed, Size - 1, Decompressed));
+    }
+
+    return Size;
+}
+
+/**
+ * @brief Check the compression on runs of every length and on random pages
+ *
+ */
+static void
+TestCompression()
+{
+    uint8_t Page[SNAPSHOT_PAGE_SIZE];
+    uint8_t Corrupted[] = {0x7f, 0x00};
+
+    //
+    // A zero page is a few repeat blocks
+    //
+    memset(Page, 0, sizeof(Page));
+    TEST_CHECK(TestRoundTrip(Page) <= 2 * (SNAPSHOT_PAGE_SIZE / 130 + 1));
+
+    //
+    // Runs of 1 to 300 bytes, the short runs are literals
+    //
+    for (size_t Length = 1; Length <= 300; Length++)
+    {
+        uint8_t Value = 0;
+
+        for (size_t i = 0; i < sizeof(Page); i++)
+        {
+            if (i % Length == 0)
+            {
+                Value++;
+            }
+            Page[i] = Value;
+        }
+
+        TestRoundTrip(Page);
+    }
+
+    //
+    // Random bytes are not compressible, random bytes with zeros between them are
+    //
+    srand(1);
+
+    for (size_t i = 0; i < sizeof(Page); i++)
+    {
+        Page[i] = (uint8_t)rand();
+    }
+
+    TEST_CHECK(TestRoundTrip(Page) == 0);
+
+    for (size_t i = 0; i < sizeof(Page); i++)
+    {
+        Page[i] = (i % 64) < 16 ? (uint8_t)rand() : 0;
+    }
+
+    TEST_CHECK(TestRoundTrip(Page) != 0);
+
+    //
+    // A literal block that passes the end of the stream
+    //
+    TEST_CHECK(!SnapshotDecompress(Corrupted, sizeof(Corrupted), Page));
+}
+
+/**
+ * @brief Check the pages of a snapshot and the shared store
+ *
+ */
+static void
+TestTakeAndDeduplicate()
+{
+    TEST_PROCESS              Process = {};
+    SNAPSHOT_STORE_STATISTICS Statistics;
+    uint8_t                   Page[SNAPSHOT_PAGE_SIZE];
+    PTEST_PAGE                Partial;
+
+    SnapshotDeleteAll();
+    Process.Pid = 4;
+
+    //
+    // 64 zero pages, 64 pages of the same code and a partially read page
+    //
+    for (uint64_t i = 0; i < 64; i++)
+    {
+        TestAddPage(&Process, 0x10000 + i * SNAPSHOT_PAGE_SIZE, 0);
+        TestAddPage(&Process, 0x80000 + i * SNAPSHOT_PAGE_SIZE, 0xcc);
+    }
+
+    Partial             = TestAddPage(&Process, 0x200000, 0x90);
+    Partial->ValidBytes = 0x800;
+
+    //
+    // The overlapping ranges read each page once, the unreadable pages are not kept
+    //
+    TEST_CHECK(SnapshotTake("a", 4, {{0x10000, 0x40000}, {0x80000, 0x40000}, {0x20000, 0x1}, {0x1ff000, 0x1800}}, TestReadPages, &Process));
+    TEST_CHECK(SnapshotTake("b", 4, {{0x10000, 0x40000}}, TestReadPages, &Process));
+
+    auto List = SnapshotList();
+
+    TEST_CHECK(List.size() == 2 && List[0].Name == "a" && List[0].Pid == 4 && List[0].NumberOfPages == 129);
+    TEST_CHECK(List[1].NumberOfPages == 64);
+
+    SnapshotGetStoreStatistics(&Statistics);
+    TEST_CHECK(Statistics.NumberOfPages == 193);
+    TEST_CHECK(Statistics.NumberOfUniquePages == 3);
+    TEST_CHECK(Statistics.StoredBytes < SNAPSHOT_PAGE_SIZE);
+
+    //
+    // The rest of a partially read page is zero
+    //
+    TEST_CHECK(SnapshotReadPage("a", 0x200000, Page));
+    TEST_CHECK(Page[0x7ff] == 0x90 && Page[0x800] == 0 && Page[0xfff] == 0);
+    TEST_CHECK(!SnapshotReadPage("a", 0x1ff000, Page));
+    TEST_CHECK(!SnapshotReadPage("c", 0x10000, Page));
+
+    //
+    // A failed snapshot doesn't replace the old one
+    //
+    Process.Fail = true;
+    TEST_CHECK(!SnapshotTake("b", 4, {{0x80000, 0x1000}}, TestReadPages, &Process));
+    TEST_CHECK(SnapshotList()[1].NumberOfPages == 64);
+    Process.Fail = false;
+
+    //
+    // The pages that are not used anymore are removed from the store
+    //
+    TEST_CHECK(SnapshotDelete("a"));
+    TEST_CHECK(!SnapshotDelete("a"));
+
+    SnapshotGetStoreStatistics(&Statistics);
+    TEST_CHECK(Statistics.NumberOfPages == 64 && Statistics.NumberOfUniquePages == 1);
+
+    SnapshotDeleteAll();
+    SnapshotGetStoreStatistics(&Statistics);
+    TEST_CHECK(Statistics.NumberOfPages == 0 && Statistics.NumberOfUniquePages == 0);
+}
+
+/**
+ * @brief Check the diff of two snapshots
+ *
+ */
+static void
+TestDiff()
+{
+    TEST_PROCESS  Process = {};
+    SNAPSHOT_DIFF Diff;
+
+    SnapshotDeleteAll();
+    Process.Pid = 8;
+
+    for (uint64_t i = 0; i < 8; i++)
+    {
+        TestAddPage(&Process, 0x400000 + i * SNAPSHOT_PAGE_SIZE, (uint8_t)i);
+    }
+
+    TEST_CHECK(SnapshotTake("before", 8, {{0x400000, 0x8000}, {0x500000, 0x1000}}, TestReadPages, &Process));
+
+    //
+    // A run that crosses a page, two separate bytes, a removed page and an added page
+    //
+    Process.Pages[0x401000].Data[0xffe] = 0xaa;
+    Process.Pages[0x401000].Data[0xfff] = 0xaa;
+    Process.Pages[0x402000].Data[0x000] = 0xaa;
+    Process.Pages[0x402000].Data[0x001] = 0xaa;
+    Process.Pages[0x405000].Data[0x010] = 0xbb;
+    Process.Pages[0x405000].Data[0x012] = 0xbb;
+    Process.Pages.erase(0x407000);
+    TestAddPage(&Process, 0x500000, 0x11);
+
+    TEST_CHECK(SnapshotTake("after", 8, {{0x400000, 0x8000}, {0x500000, 0x1000}}, TestReadPages, &Process));
+
+    TEST_CHECK(SnapshotDiff("before", "after", &Diff));
+    TEST_CHECK(Diff.IdenticalPages == 4 && Diff.ChangedPages == 3 && Diff.ChangedBytes == 6);
+    TEST_CHECK(Diff.Runs.size() == 3);
+    TEST_CHECK(Diff.Runs[0].Address == 0x401ffe && Diff.Runs[0].Length == 4);
+    TEST_CHECK(Diff.Runs[1].Address == 0x405010 && Diff.Runs[1].Length == 1);
+    TEST_CHECK(Diff.Runs[2].Address == 0x405012 && Diff.Runs[2].Length == 1);
+    TEST_CHECK(Diff.RemovedPages.size() == 1 && Diff.RemovedPages[0] == 0x407000);
+    TEST_CHECK(Diff.AddedPages.size() == 1 && Diff.AddedPages[0] == 0x500000);
+
+    //
+    // The same snapshot has no differences
+    //
+    TEST_CHECK(SnapshotDiff("after", "after", &Diff));
+    TEST_CHECK(Diff.IdenticalPages == 8 && Diff.ChangedPages == 0 && Diff.Runs.empty());
+    TEST_CHECK(!SnapshotDiff("before", "missing", &Diff));
+
+    //
+    // Every byte of the page is changed (the compared blocks end at the page)
+    //
+    memset(Process.Pages[0x403000].Data, 0x55, SNAPSHOT_PAGE_SIZE);
+    TEST_CHECK(SnapshotTake("all", 8, {{0x403000, 0x1000}}, TestReadPages, &Process));
+    TEST_CHECK(SnapshotDiff("before", "all", &Diff));
+    TEST_CHECK(Diff.ChangedBytes == SNAPSHOT_PAGE_SIZE && Diff.Runs.size() == 1 && Diff.Runs[0].Length == SNAPSHOT_PAGE_SIZE);
+
+    SnapshotDeleteAll();
+}
+
+/**
+ * @brief Check the ranges at the end of the address space
+ *
+ */
+static void
+TestLastPage()
+{
+    TEST_PROCESS Process = {};
+
+    SnapshotDeleteAll();
+    Process.Pid = 12;
+
+    TestAddPage(&Process, 0xfffffffffffff000ull, 0x42);
+
+    TEST_CHECK(SnapshotTake("last", 12, {{0xfffffffffffff000ull, 0x1000}, {0xffffffffffffe800ull, 0x1800}}, TestReadPages, &Process));
+    TEST_CHECK(Process.NumberOfRequests == 1);
+    TEST_CHECK(SnapshotList()[0].NumberOfPages == 1);
+
+    SnapshotDeleteAll();
+}
+
+int
+main()
+{
+    TestCompression();
+    TestTakeAndDeduplicate();
+    TestDiff();
+    TestLastPage();
+
+    return TEST_RESULT("test_snapshot");
+}
@@ -0,0 +1,245 @@
+/**
+ * @file test_spinlock.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the test-and-set, the ticket and the reader-writer spinlocks
+ * @details The states of the locks are checked on a single thread, then the
+ * threads increment a counter in the critical sections and the counter is
+ * compared with the number of the acquisitions
+ * @version 0.1
+ * @date 2020-05-17
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include "Spinlock.h"
+#include "Test.h"
+
+/* Number of the threads that compete for the locks */
+#define TEST_THREADS 4
+
+/* Number of the acquisitions of each thread */
+#define TEST_ITERATIONS 20000
+
+/*
+ * Number of the acquisitions of each thread if there are more threads than
+ * processors, a waiter of the ticket lock spins until a preempted thread with
+ * an earlier ticket runs again, so each acquisition might take a time slice
+ */
+#define TEST_ITERATIONS_OVERSUBSCRIBED 1000
+
+/**
+ * @brief The lock that is used by the threads
+ *
+ */
+typedef enum _TEST_LOCK_TYPE
+{
+    TEST_LOCK_TEST_AND_SET,
+    TEST_LOCK_TICKET,
+    TEST_LOCK_TICKET_POLLING,
+    TEST_LOCK_READ_WRITE
+
+} TEST_LOCK_TYPE;
+
+static volatile LONG       g_TestAndSetLock;
+static SPINLOCK_TICKET     g_TicketLock;
+static SPINLOCK_READ_WRITE g_ReadWriteLock;
+static TEST_LOCK_TYPE      g_LockType;
+static UINT32              g_Iterations;
+
+/**
+ * @brief The counter that is changed in the critical sections
+ *
+ */
+static volatile UINT64 g_Counter;
+
+/**
+ * @brief Number of the times that a reader saw a writer in the critical section
+ *
+ */
+static volatile UINT64 g_ReaderViolations;
+
+/**
+ * @brief Acquire the lock many times and increment the counter
+ *
+ * @param Context The index of the thread
+ * @return void *
+ */
+static void *
+TestLockThread(void * Context)
+{
+    UINT64 Index = (UINT64)Context;
+
+    for (UINT32 i = 0; i < g_Iterations; i++)
+    {
+        switch (g_LockType)
+        {
+        case TEST_LOCK_TEST_AND_SET:
+            SpinlockLock(&g_TestAndSetLock);
+            g_Counter = g_Counter + 1;
+            SpinlockUnlock(&g_TestAndSetLock);
+            break;
+
+        case TEST_LOCK_TICKET:
+            SpinlockTicketLock(&g_TicketLock);
+            g_Counter = g_Counter + 1;
+            SpinlockTicketUnlock(&g_TicketLock);
+            break;
+
+        case TEST_LOCK_TICKET_POLLING:
+            //
+            // Half of the threads take tickets and half of them poll
+            //
+            if (Index & 1)
+            {
+                SpinlockTicketLockPolling(&g_TicketLock);
+            }
+            else
+            {
+                SpinlockTicketLock(&g_TicketLock);
+            }
+            g_Counter = g_Counter + 1;
+            SpinlockTicketUnlock(&g_TicketLock);
+            break;
+
+        case TEST_LOCK_READ_WRITE:
+            //
+            // The writer makes the counter odd while it's in the critical section
+            //
+            if (i % 4 == Index % 4)
+            {
+                SpinlockLockExclusive(&g_ReadWriteLock);
+                g_Counter = g_Counter + 1;
+                g_Counter = g_Counter + 1;
+                SpinlockUnlockExclusive(&g_ReadWriteLock);
+            }
+            else
+            {
+                SpinlockLockShared(&g_ReadWriteLock);
+                if (g_Counter & 1)
+                {
+                    __atomic_add_fetch(&g_ReaderViolations, 1, __ATOMIC_SEQ_CST);
+                }
+                SpinlockUnlockShared(&g_ReadWriteLock);
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run the threads on a lock and return the counter
+ *
+ * @param LockType The lock
+ * @return UINT64
+ */
+static UINT64
+TestRunThreads(TEST_LOCK_TYPE LockType)
+{
+    pthread_t Threads[TEST_THREADS];
+
+    g_LockType = LockType;
+    g_Counter  = 0;
+
+    for (UINT64 i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_create(&Threads[i], NULL, TestLockThread, (void *)i);
+    }
+
+    for (UINT32 i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(Threads[i], NULL);
+    }
+
+    return g_Counter;
+}
+
+/**
+ * @brief Check the states of the locks on one thread
+ *
+ */
+static void
+TestStates()
+{
+    SPINLOCK_TICKET     Ticket    = {0};
+    SPINLOCK_READ_WRITE ReadWrite = {0};
+    volatile LONG       Lock      = 0;
+
+    TEST_CHECK(SpinlockTryLock(&Lock));
+    TEST_CHECK(!SpinlockTryLock(&Lock));
+    SpinlockUnlock(&Lock);
+    TEST_CHECK(SpinlockTryLock(&Lock));
+
+    //
+    // A zeroed ticket lock is free, a held one can't be taken by trying
+    //
+    TEST_CHECK(SpinlockTicketTryLock(&Ticket));
+    TEST_CHECK(!SpinlockTicketTryLock(&Ticket));
+    SpinlockTicketUnlock(&Ticket);
+
+    SpinlockTicketLock(&Ticket);
+    TEST_CHECK(!SpinlockTicketTryLock(&Ticket));
+    SpinlockTicketUnlock(&Ticket);
+
+    SpinlockTicketLockPolling(&Ticket);
+    TEST_CHECK(Ticket.NextTicket == Ticket.NowServing + 1);
+    SpinlockTicketUnlock(&Ticket);
+    TEST_CHECK(Ticket.NextTicket == Ticket.NowServing);
+
+    //
+    // The tickets wrap around
+    //
+    Ticket.NextTicket = Ticket.NowServing = 0x7fffffff;
+    SpinlockTicketLock(&Ticket);
+    SpinlockTicketUnlock(&Ticket);
+    TEST_CHECK(SpinlockTicketTryLock(&Ticket));
+    SpinlockTicketUnlock(&Ticket);
+
+    //
+    // The readers share the lock and leave the writer's ticket free
+    //
+    SpinlockLockShared(&ReadWrite);
+    SpinlockLockShared(&ReadWrite);
+    TEST_CHECK(ReadWrite.Readers == 2);
+    TEST_CHECK(SpinlockTicketTryLock(&ReadWrite.Writer));
+    SpinlockTicketUnlock(&ReadWrite.Writer);
+    SpinlockUnlockShared(&ReadWrite);
+    SpinlockUnlockShared(&ReadWrite);
+
+    SpinlockLockExclusive(&ReadWrite);
+    TEST_CHECK(ReadWrite.Readers == 0 && !SpinlockTicketTryLock(&ReadWrite.Writer));
+    SpinlockUnlockExclusive(&ReadWrite);
+}
+
+/**
+ * @brief Check the mutual exclusion of the locks on many threads
+ *
+ */
+static void
+TestThreads()
+{
+    g_Iterations = sysconf(_SC_NPROCESSORS_ONLN) >= TEST_THREADS ? TEST_ITERATIONS : TEST_ITERATIONS_OVERSUBSCRIBED;
+
+    TEST_CHECK(TestRunThreads(TEST_LOCK_TEST_AND_SET) == TEST_THREADS * g_Iterations);
+    TEST_CHECK(TestRunThreads(TEST_LOCK_TICKET) == TEST_THREADS * g_Iterations);
+    TEST_CHECK(TestRunThreads(TEST_LOCK_TICKET_POLLING) == TEST_THREADS * g_Iterations);
+
+    //
+    // A quarter of the acquisitions are the writers (two increments each)
+    //
+    TEST_CHECK(TestRunThreads(TEST_LOCK_READ_WRITE) == TEST_THREADS * g_Iterations / 2);
+    TEST_CHECK(g_ReaderViolations == 0);
+    TEST_CHECK(g_ReadWriteLock.Readers == 0);
+}
+
+int
+main()
+{
+    TestStates();
+    TestThreads();
+
+    return TEST_RESULT("test_spinlock");
+}
@@ -0,0 +1,473 @@
+/**
+ * @file test_trampoline.c
+ * @author Sina Karvandi (sina@rayanfam.com)
+ * @brief Tests of the relocating trampoline builder of the detour hooks
+ * @details A corpus of real function prologues is relocated to a near and
+ * to a far trampoline and the targets of the relative instructions of each
+ * trampoline are checked against the original ones, then a few functions are
+ * executed through their trampolines
+ * @version 0.1
+ * @date 2020-05-14
+ *
+ * @copyright This project is released under the GNU Public License v3.
+ *
+ */
+#include <sys/mman.h>
+#include "Trampoline.h"
+#include "LengthDisassemblerEngine.h"
+#include "Test.h"
+
+/* Size of the trampolines of the tests (same as a block of the hooks) */
+#define TEST_TRAMPOLINE_SIZE 0x100
+
+/* Maximum number of the targets of a relocated prologue */
+#define TEST_MAX_TARGETS 16
+
+/**
+ * @brief A prologue of the corpus
+ *
+ */
+typedef struct _TEST_PROLOGUE
+{
+    const char *  Name;
+    const UINT8 * Bytes;
+    SIZE_T        Length;
+    BOOLEAN       IsRelocatable;
+    BOOLEAN       HasRipRelativeOperand;
+
+} TEST_PROLOGUE;
+
+#define TEST_PROLOGUE_ENTRY(_NAME_, _RELOCATABLE_, _RIP_RELATIVE_, ...)                                                \
+    {                                                                                                                  \
+        _NAME_, (const UINT8[]) {__VA_ARGS__}, sizeof((const UINT8[]) {__VA_ARGS__}), _RELOCATABLE_, _RIP_RELATIVE_ \
+    }
+
+/**
+ * @brief Prologues of the x64 Windows kernel functions (MSVC output)
+ *
+ */
+static const TEST_PROLOGUE g_Prologues[] = {
+    /* mov [rsp+8], rbx ; push rdi ; sub rsp, 20h */
+    TEST_PROLOGUE_ENTRY("home-rbx", TRUE, FALSE, 0x48, 0x89, 0x5c, 0x24, 0x08, 0x57, 0x48, 0x83, 0xec, 0x20),
+    /* mov rax, rsp ; mov [rax+8], rbx ; mov [rax+10h], rbp */
+    TEST_PROLOGUE_ENTRY("frame-rax", TRUE, FALSE, 0x48, 0x8b, 0xc4, 0x48, 0x89, 0x58, 0x08, 0x48, 0x89, 0x68, 0x10),
+    /* push rbx ; sub rsp, 20h ; mov rbx, rcx */
+    TEST_PROLOGUE_ENTRY("push-rex", TRUE, FALSE, 0x40, 0x53, 0x48, 0x83, 0xec, 0x20, 0x48, 0x8b, 0xd9),
+    /* mov r11, rsp ; mov [r11+8], rbx */
+    TEST_PROLOGUE_ENTRY("frame-r11", TRUE, FALSE, 0x4c, 0x8b, 0xdc, 0x49, 0x89, 0x5b, 0x08),
+    /* mov [rsp+8], rcx ; sub rsp, 88h */
+    TEST_PROLOGUE_ENTRY("large-frame", TRUE, FALSE, 0x48, 0x89, 0x4c, 0x24, 0x08, 0x48, 0x81, 0xec, 0x88, 0x00, 0x00, 0x00),
+    /* mov rax, gs:[188h] ; mov rcx, [rax+0b8h] */
+    TEST_PROLOGUE_ENTRY("current-thread", TRUE, FALSE, 0x65, 0x48, 0x8b, 0x04, 0x25, 0x88, 0x01, 0x00, 0x00, 0x48, 0x8b, 0x88, 0xb8, 0x00, 0x00, 0x00),
+    /* sub rsp, 28h ; mov rax, [rip+1234h] */
+    TEST_PROLOGUE_ENTRY("rip-load", TRUE, TRUE, 0x48, 0x83, 0xec, 0x28, 0x48, 0x8b, 0x05, 0x34, 0x12, 0x00, 0x00),
+    /* cmp byte [rip+100h], 0 ; jne +20h */
+    TEST_PROLOGUE_ENTRY("rip-compare-imm", TRUE, TRUE, 0x80, 0x3d, 0x00, 0x01, 0x00, 0x00, 0x00, 0x75, 0x20),
+    /* lea rcx, [rip-500h] ; call rel32 */
+    TEST_PROLOGUE_ENTRY("lea-call", TRUE, TRUE, 0x48, 0x8d, 0x0d, 0x00, 0xfb, 0xff, 0xff, 0xe8, 0x10, 0x20, 0x30, 0x00),
+    /* test rcx, rcx ; je +10h ; mov eax, [rcx] */
+    TEST_PROLOGUE_ENTRY("null-check", TRUE, FALSE, 0x48, 0x85, 0xc9, 0x74, 0x10, 0x8b, 0x01),
+    /* cmp edx, 1 ; jne rel32 ; xor eax, eax */
+    TEST_PROLOGUE_ENTRY("jcc-rel32", TRUE, FALSE, 0x83, 0xfa, 0x01, 0x0f, 0x85, 0x00, 0x00, 0x10, 0x00, 0x33, 0xc0),
+    /* jmp rel32 (import thunk) */
+    TEST_PROLOGUE_ENTRY("thunk", TRUE, FALSE, 0xe9, 0x00, 0x00, 0x40, 0x00),
+    /* jmp short -10h ; nop dword [rax+rax] */
+    TEST_PROLOGUE_ENTRY("short-back-jump", TRUE, FALSE, 0xeb, 0xf0, 0x0f, 0x1f, 0x44, 0x00, 0x00),
+    /* lock cmpxchg [rcx], rdx ; sete al */
+    TEST_PROLOGUE_ENTRY("lock-cmpxchg", TRUE, FALSE, 0xf0, 0x48, 0x0f, 0xb1, 0x11, 0x0f, 0x94, 0xc0),
+    /* mov eax, [rip+10h] ; ret */
+    TEST_PROLOGUE_ENTRY("rip-dword", TRUE, TRUE, 0x8b, 0x05, 0x10, 0x00, 0x00, 0x00, 0xc3),
+    /* nop ; dec ecx ; jne -4 (into the relocated instructions) ; ret */
+    TEST_PROLOGUE_ENTRY("inner-branch", FALSE, FALSE, 0x90, 0xff, 0xc9, 0x75, 0xfc, 0xc3),
+    /* jrcxz +10h ; mov rax, rcx */
+    TEST_PROLOGUE_ENTRY("jrcxz", FALSE, FALSE, 0xe3, 0x10, 0x48, 0x8b, 0xc1),
+    /* vzeroupper ; sub rsp, 28h */
+    TEST_PROLOGUE_ENTRY("vex", FALSE, FALSE, 0xc5, 0xf8, 0x77, 0x48, 0x83, 0xec, 0x28),
+};
+
+/**
+ * @brief Collect the absolute targets of the relative instructions
+ * @details The targets inside the decoded code (e.g. the inverted condition over
+ * an absolute jump) are not collected, the absolute jumps and calls of the
+ * trampoline builder are decoded as their targets too
+ *
+ * @param Code The instructions
+ * @param Size Size of the instructions
+ * @param Targets The collected targets
+ * @return UINT32 Number of the targets, or -1 if an instruction is not decoded
+ */
+static UINT32
+TestCollectTargets(const UINT8 * Code, SIZE_T Size, UINT64 * Targets)
+{
+    UINT64 Start           = (UINT64)Code;
+    UINT32 NumberOfTargets = 0;
+    SIZE_T Offset          = 0;
+    SIZE_T Length;
+    SIZE_T ModRmOffset;
+    SIZE_T Index;
+    UINT64 Target;
+
+    while (Offset < Size)
+    {
+        const UINT8 * Instruction = &Code[Offset];
+
+        Length = ldisasmex(Instruction, TRUE, &ModRmOffset);
+        Target = 0;
+
+        for (Index = 0; Index < Length - 1 && (Instruction[Index] & 0xf0) == 0x40; Index++)
+        {
+        }
+
+        if (Instruction[Index] == 0xff && Instruction[Index + 1] == 0x25 && *(UINT32 *)&Instruction[Index + 2] == 0)
+        {
+            //
+            // jmp qword ptr [rip+0] and the address
+            //
+            Target = *(UINT64 *)&Instruction[6];
+            Length = TRAMPOLINE_ABSOLUTE_JUMP_SIZE;
+        }
+        else if (Instruction[Index] == 0xff && Instruction[Index + 1] == 0x15 && *(UINT32 *)&Instruction[Index + 2] == 2)
+        {
+            //
+            // call qword ptr [rip+2] ; jmp $+10 ; the address
+            //
+            Target = *(UINT64 *)&Instruction[8];
+            Length = 16;
+        }
+        else if (Instruction[Index] == 0xeb || (Instruction[Index] & 0xf0) == 0x70)
+        {
+            Target = (UINT64)Instruction + Length + *(const CHAR *)&Instruction[Index + 1];
+        }
+        else if (Instruction[Index] == 0xe8 || Instruction[Index] == 0xe9)
+        {
+            Target = (UINT64)Instruction + Length + *(const INT32 *)&Instruction[Index + 1];
+        }
+        else if (Instruction[Index] == 0x0f && (Instruction[Index + 1] & 0xf0) == 0x80)
+        {
+            Target = (UINT64)Instruction + Length + *(const INT32 *)&Instruction[Index + 2];
+        }
+        else if (ModRmOffset != 0 && (Instruction[ModRmOffset] & 0xc7) == 0x05)
+        {
+            Target = (UINT64)Instruction + Length + *(const INT32 *)&Instruction[ModRmOffset + 1];
+        }
+
+        if (Length == 0 || Length > TRAMPOLINE_MAX_INSTRUCTION_LENGTH + 1 || NumberOfTargets == TEST_MAX_TARGETS)
+        {
+            return (UINT32)-1;
+        }
+
+        if (Target != 0 && (Target < Start || Target > Start + Size))
+        {
+            Targets[NumberOfTargets++] = Target;
+        }
+
+        Offset += Length;
+    }
+
+    return NumberOfTargets;
+}
+
+/**
+ * @brief Relocate a prologue and check the targets of the trampoline
+ *
+ * @param Prologue The prologue
+ * @param Source Where the prologue is placed
+ * @param Trampoline Where the trampoline is built
+ * @param IsFar Whether the trampoline is out of the range of a 32-bit displacement
+ */
+static void
+TestRelocatePrologue(const TEST_PROLOGUE * Prologue, UINT8 * Source, UINT8 * Trampoline, BOOLEAN IsFar)
+{
+    UINT64  OriginalTargets[TEST_MAX_TARGETS];
+    UINT64  RelocatedTargets[TEST_MAX_TARGETS];
+    UINT32  NumberOfOriginalTargets;
+    UINT32  NumberOfRelocatedTargets;
+    SIZE_T  SizeOfInstructions;
+    SIZE_T  SizeOfTrampoline = 0;
+    BOOLEAN IsBuilt;
+    BOOLEAN IsExpected;
+    UINT32  i;
+
+    memset(Source, 0xcc, 64);
+    memcpy(Source, Prologue->Bytes, Prologue->Length);
+    memset(Trampoline, 0xcc, TEST_TRAMPOLINE_SIZE);
+
+    SizeOfInstructions = TrampolineGetSizeOfInstructions(Source, TRAMPOLINE_REL32_BRANCH_SIZE);
+
+    TEST_CHECK(SizeOfInstructions >= TRAMPOLINE_REL32_BRANCH_SIZE && SizeOfInstructions <= Prologue->Length);
+
+    IsBuilt = TrampolineBuild(Source, SizeOfInstructions, Trampoline, TEST_TRAMPOLINE_SIZE, &SizeOfTrampoline);
+
+    //
+    // The RIP-relative operands can't reach their data from a far trampoline
+    //
+    IsExpected = Prologue->IsRelocatable && !(IsFar && Prologue->HasRipRelativeOperand);
+
+    if (IsBuilt != IsExpected)
+    {
+        fprintf(stderr, "prologue %s (%s): built %d, expected %d\n", Prologue->Name, IsFar ? "far" : "near", IsBuilt, IsExpected);
+    }
+    TEST_CHECK(IsBuilt == IsExpected);
+
+    if (!IsBuilt || !IsExpected)
+    {
+        return;
+    }
+
+    TEST_CHECK(SizeOfTrampoline > 0 && SizeOfTrampoline <= TEST_TRAMPOLINE_SIZE);
+
+    //
+    // The trampoline should reach the same targets and then the end of the
+    // relocated instructions
+    //
+    NumberOfOriginalTargets  = TestCollectTargets(Source, SizeOfInstructions, OriginalTargets);
+    NumberOfRelocatedTargets = TestCollectTargets(Trampoline, SizeOfTrampoline, RelocatedTargets);
+
+    TEST_CHECK(NumberOfOriginalTargets != (UINT32)-1 && NumberOfRelocatedTargets != (UINT32)-1);
+    TEST_CHECK(NumberOfRelocatedTargets == NumberOfOriginalTargets + 1);
+
+    if (NumberOfRelocatedTargets != NumberOfOriginalTargets + 1)
+    {
+        fprintf(stderr, "prologue %s (%s): %u targets, expected %u\n", Prologue->Name, IsFar ? "far" : "near", NumberOfRelocatedTargets, NumberOfOriginalTargets + 1);
+        return;
+    }
+
+    for (i = 0; i < NumberOfOriginalTargets; i++)
+    {
+        TEST_CHECK(RelocatedTargets[i] == OriginalTargets[i]);
+    }
+
+    TEST_CHECK(RelocatedTargets[NumberOfOriginalTargets] == (UINT64)Source + SizeOfInstructions);
+}
+
+/**
+ * @brief Check the shortest forms and the sizes of the conditional jumps
+ *
+ */
+static void
+TestConditionalJumps()
+{
+    UINT8  Buffer[TRAMPOLINE_MAX_RELOCATED_INSTRUCTION_SIZE];
+    UINT64 Address = 0x10000000;
+    SIZE_T Size;
+
+    //
+    // jcc rel8
+    //
+    Size = TrampolineWriteConditionalJump(Buffer, Address, 0x4, Address + 2 + 0x7f);
+    TEST_CHECK(Size == 2 && Buffer[0] == 0x74 && Buffer[1] == 0x7f);
+
+    Size = TrampolineWriteConditionalJump(Buffer, Address, 0x4, Address + 2 - 0x80);
+    TEST_CHECK(Size == 2 && Buffer[0] == 0x74 && Buffer[1] == 0x80);
+
+    //
+    // jcc rel32
+    //
+    Size = TrampolineWriteConditionalJump(Buffer, Address, 0x5, Address + 2 + 0x80);
+    TEST_CHECK(Size == 6 && Buffer[0] == 0x0f && Buffer[1] == 0x85 && *(INT32 *)&Buffer[2] == 0x7c);
+
+    //
+    // One byte out of the range of jcc rel32 but in the range of the jmp rel32
+    // after the inverted condition, the condition should skip only 5 bytes
+    //
+    Size = TrampolineWriteConditionalJump(Buffer, Address, 0x4, Address + 6 + 0x80000000ULL);
+    TEST_CHECK(Size == 2 + TRAMPOLINE_REL32_BRANCH_SIZE && Buffer[0] == 0x75 && Buffer[1] == TRAMPOLINE_REL32_BRANCH_SIZE && Buffer[2] == 0xe9);
+
+    //
+    // Absolute jump after the inverted condition
+    //
+    Size = TrampolineWriteConditionalJump(Buffer, Address, 0x4, Address + 0x100000000ULL);
+    TEST_CHECK(Size == 2 + TRAMPOLINE_ABSOLUTE_JUMP_SIZE && Buffer[0] == 0x75 && Buffer[1] == TRAMPOLINE_ABSOLUTE_JUMP_SIZE && Buffer[2] == 0xff);
+    TEST_CHECK(*(UINT64 *)&Buffer[8] == Address + 0x100000000ULL);
+
+    //
+    // The jumps and calls use the rel32 form up to the limits of the displacement
+    //
+    TEST_CHECK(TrampolineWriteJump(Buffer, Address, Address + 5 + 0x7fffffffULL) == TRAMPOLINE_REL32_BRANCH_SIZE);
+    TEST_CHECK(TrampolineWriteJump(Buffer, Address, Address + 5 + 0x80000000ULL) == TRAMPOLINE_ABSOLUTE_JUMP_SIZE);
+    TEST_CHECK(TrampolineWriteJump(Buffer, Address, Address + 5 - 0x80000000ULL) == TRAMPOLINE_REL32_BRANCH_SIZE);
+    TEST_CHECK(TrampolineWriteCall(Buffer, Address, Address + 5 + 0x80000000ULL) == 16);
+    TEST_CHECK(TrampolineIsRel32Reachable(Address, Address - 0x80000000ULL));
+    TEST_CHECK(!TrampolineIsRel32Reachable(Address, Address - 0x80000001ULL));
+}
+
+/**
+ * @brief Check the form of the detour jumps by the distance of the hook function
+ *
+ */
+static void
+TestDetourJumps()
+{
+    UINT8  Buffer[TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE];
+    UINT8  Stub[TEST_TRAMPOLINE_SIZE];
+    UINT64 Site = (UINT64)Stub - 0x1000;
+    SIZE_T SizeOfStub;
+
+    //
+    // The hook function is reachable
+    //
+    TEST_CHECK(TrampolineWriteDetourJump(Buffer, Site, Site + 0x100000, Stub, sizeof(Stub), &SizeOfStub) == TRAMPOLINE_REL32_BRANCH_SIZE);
+    TEST_CHECK(SizeOfStub == 0 && Buffer[0] == 0xe8 && *(INT32 *)&Buffer[1] == 0x100000 - TRAMPOLINE_REL32_BRANCH_SIZE);
+
+    //
+    // Only the stub is reachable
+    //
+    TEST_CHECK(TrampolineWriteDetourJump(Buffer, Site, Site + (64ULL << 30), Stub, sizeof(Stub), &SizeOfStub) == TRAMPOLINE_REL32_BRANCH_SIZE);
+    TEST_CHECK(SizeOfStub == TRAMPOLINE_ABSOLUTE_JUMP_SIZE && Buffer[0] == 0xe8 && Site + 5 + *(INT32 *)&Buffer[1] == (UINT64)Stub);
+    TEST_CHECK(Stub[0] == 0xff && Stub[1] == 0x25 && *(UINT64 *)&Stub[6] == Site + (64ULL << 30));
+
+    //
+    // There is no room for the stub
+    //
+    TEST_CHECK(TrampolineWriteDetourJump(Buffer, Site, Site + (64ULL << 30), Stub, TRAMPOLINE_ABSOLUTE_JUMP_SIZE - 1, &SizeOfStub) == TRAMPOLINE_ABSOLUTE_DETOUR_JUMP_SIZE);
+    TEST_CHECK(SizeOfStub == 0 && Buffer[0] == 0xe8 && *(UINT32 *)&Buffer[1] == 0 && Buffer[5] == 0xff && Buffer[6] == 0x25);
+    TEST_CHECK(*(UINT64 *)&Buffer[11] == Site + (64ULL << 30));
+}
+
+/**
+ * @brief A function of the execution tests
+ *
+ */
+typedef struct _TEST_FUNCTION
+{
+    const char *  Name;
+    const UINT8 * Bytes;
+    SIZE_T        Length;
+    int (*Expected)(int);
+
+} TEST_FUNCTION;
+
+static int
+TestExpectedBranch(int Value)
+{
+    return Value == 0 ? 2 : 1;
+}
+
+static int
+TestExpectedCall(int Value)
+{
+    return Value + 7;
+}
+
+static int
+TestExpectedRipRelative(int Value)
+{
+    return Value + 0x1234;
+}
+
+/* test edi, edi ; je +6 ; mov eax, 1 ; ret ; mov eax, 2 ; ret */
+static const UINT8 g_BranchFunction[] = {0x85, 0xff, 0x74, 0x06, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3, 0xb8, 0x02, 0x00, 0x00, 0x00, 0xc3};
+
+/* call +1 ; ret ; lea eax, [rdi+7] ; ret */
+static const UINT8 g_CallFunction[] = {0xe8, 0x01, 0x00, 0x00, 0x00, 0xc3, 0x8d, 0x47, 0x07, 0xc3};
+
+/* mov eax, [rip+3] ; add eax, edi ; ret ; dd 1234h */
+static const UINT8 g_RipRelativeFunction[] = {0x8b, 0x05, 0x03, 0x00, 0x00, 0x00, 0x01, 0xf8, 0xc3, 0x34, 0x12, 0x00, 0x00};
+
+static const TEST_FUNCTION g_Functions[] = {
+    {"branch", g_BranchFunction, sizeof(g_BranchFunction), TestExpectedBranch},
+    {"call", g_CallFunction, sizeof(g_CallFunction), TestExpectedCall},
+    {"rip-relative", g_RipRelativeFunction, sizeof(g_RipRelativeFunction), TestExpectedRipRelative},
+};
+
+/**
+ * @brief Execute the functions through their trampolines
+ *
+ * @param Source Where the functions are placed (executable)
+ * @param Trampoline Where the trampolines are built (executable)
+ * @param IsFar Whether the trampoline is out of the range of a 32-bit displacement
+ */
+static void
+TestExecuteTrampolines(UINT8 * Source, UINT8 * Trampoline, BOOLEAN IsFar)
+{
+    SIZE_T SizeOfInstructions;
+    SIZE_T SizeOfTrampoline;
+    UINT32 i;
+    int    Value;
+
+    for (i = 0; i < sizeof(g_Functions) / sizeof(g_Functions[0]); i++)
+    {
+        int (*Function)(int) = (int (*)(int))Trampoline;
+
+        memcpy(Source, g_Functions[i].Bytes, g_Functions[i].Length);
+
+        SizeOfInstructions = TrampolineGetSizeOfInstructions(Source, TRAMPOLINE_REL32_BRANCH_SIZE);
+
+        if (!TrampolineBuild(Source, SizeOfInstructions, Trampoline, TEST_TRAMPOLINE_SIZE, &SizeOfTrampoline))
+        {
+            TEST_CHECK(IsFar && g_Functions[i].Expected == TestExpectedRipRelative);
+            continue;
+        }
+
+        __builtin___clear_cache((char *)Trampoline, (char *)Trampoline + SizeOfTrampoline);
+
+        for (Value = 0; Value < 3; Value++)
+        {
+            if (Function(Value) != g_Functions[i].Expected(Value))
+            {
+                fprintf(stderr, "function %s (%s): returned %d for %d\n", g_Functions[i].Name, IsFar ? "far" : "near", Function(Value), Value);
+            }
+            TEST_CHECK(Function(Value) == g_Functions[i].Expected(Value));
+        }
+    }
+}
+
+int
+main()
+{
+    UINT8 * Source;
+    UINT8 * Near;
+    UINT8 * Far;
+    UINT32  i;
+
+    TestConditionalJumps();
+    TestDetourJumps();
+
+    //
+    // The source and the near trampoline are in the same mapping, the far
+    // trampoline is mapped 64GB away
+    //
+    Source = mmap(NULL, 0x2000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_CHECK(Source != MAP_FAILED);
+
+    if (Source == MAP_FAILED)
+    {
+        return TEST_RESULT("test_trampoline");
+    }
+
+    Near = Source + 0x1000;
+    Far  = mmap(Source + (64ULL << 30), 0x1000, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (Far != MAP_FAILED && TrampolineIsRel32Reachable((UINT64)Source, (UINT64)Far))
+    {
+        munmap(Far, 0x1000);
+        Far = MAP_FAILED;
+    }
+
+    if (Far == MAP_FAILED)
+    {
+        printf("test_trampoline: no far mapping, the far trampolines are skipped\n");
+    }
+
+    for (i = 0; i < sizeof(g_Prologues) / sizeof(g_Prologues[0]); i++)
+    {
+        TestRelocatePrologue(&g_Prologues[i], Source, Near, FALSE);
+
+        if (Far != MAP_FAILED)
+        {
+            TestRelocatePrologue(&g_Prologues[i], Source, Far, TRUE);
+        }
+    }
+
+    TestExecuteTrampolines(Source, Near, FALSE);
+
+    if (Far != MAP_FAILED)
+    {
+        TestExecuteTrampolines(Source, Far, TRUE);
+        munmap(Far, 0x1000);
+    }
+
+    munmap(Source, 0x2000);
+
+    return TEST_RESULT("test_trampoline");
+}